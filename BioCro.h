@@ -103,6 +103,13 @@ namespace BioCro {
     using Module_set = mc_vector;
     using Module = std::unique_ptr<module>;
     using Module_names = string_vector;
+    /**
+     * The static member functions of a module factory may be called
+     * concurrently from any number of threads, and the Module_creator
+     * pointers they return, which point to static objects having no
+     * mutable state, may be shared freely between threads.  See
+     * thread_safety.h.
+     */
     using Standard_BioCro_library_module_factory = module_factory<standardBML::module_library>;
     using Module_creator = module_creator*;
 
@@ -111,6 +118,9 @@ namespace BioCro {
      *
      *     Simulator(State initial_state, Parameter_set parameters, System_drivers drivers, Module_set direct_modules, Module_set differential_modules)
      *
+     * A Simulator must be used by only one thread at a time, though
+     * any number of Simulators, each used by its own thread, may be
+     * made from the same Module_set.
      */
     using Simulator = biocro_simulation;
 }
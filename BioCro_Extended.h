@@ -67,47 +67,68 @@ namespace BioCro {
     using State = state_map;
     using Ordered_variable_list = string_vector;
 
-    // Gets the current state of the differential variables.
-    inline State get_current_state(Dynamical_system ds) {
+    // Sets the values in `state` to the current state of the
+    // differential variables.  Any mapping type having a string-keyed
+    // `[]` operator (e.g. State or Arena_state) may be used.  A
+    // mapping that already holds these quantities (from a previous
+    // call, say) is reused without allocating anything.
+    template<typename Mapping>
+    inline void get_current_state(Dynamical_system const& ds, Mapping& state) {
         Ordered_variable_list keys{ds->get_differential_quantity_names()};
         auto size = keys.size();
         auto differential_quantities = vector<double>(size);
         ds->get_differential_quantities(differential_quantities);
-        State current_state;
         for (auto i = 0; i < keys.size(); ++i) {
             // It matters here that the keys (as initialized by
             // ds->get_differential_quantity_names()) are in the same
             // order as the corresponding differential_quantities.
-            current_state[keys[i]] = differential_quantities[i];
+            state[keys[i]] = differential_quantities[i];
         }
+    }
+
+    // Gets the current state of the differential variables.
+    inline State get_current_state(Dynamical_system const& ds) {
+        State current_state;
+        get_current_state(ds, current_state);
         return current_state;
     }
 
     using Simulation_result = state_vector_map;
 
-    inline size_t get_result_duration(Simulation_result result) {
+    template<typename Result>
+    inline size_t get_result_duration(Result const& result) {
         auto a_column = result.begin();
         return (a_column->second).size();
     }
 
+    // Sets the values in `state` to the values of all quantities in a
+    // particular row of a result.  As with get_current_state, a
+    // mapping from a previous call is reused without allocation.
+    template<typename Result, typename Mapping>
+    inline void get_state_from_result(Result const& result, size_t row_number,
+                                      Mapping& state) {
+        for (auto const& column : result) {
+            state[column.first] = column.second.at(row_number);
+        }
+    }
+
     // Gets the state of all quantities in a particular row of a result.
-    inline State get_state_from_result(Simulation_result result, size_t row_number) {
+    template<typename Result>
+    inline State get_state_from_result(Result const& result, size_t row_number) {
         State state;
-        for (auto column : result) {
-            auto name = column.first;
-            auto values = column.second;
-            state[name] = values.at(row_number);
-        }
+        get_state_from_result(result, row_number, state);
         return state;
     }
 
     // Get the initial state of all quantities in a result.
-    inline State get_initial_result_state(Simulation_result result) {
+    template<typename Result>
+    inline State get_initial_result_state(Result const& result) {
         return get_state_from_result(result, 0);
     }
 
     // Get the final state of all quantities in a result.
-    inline State get_final_result_state(Simulation_result result) {
+    template<typename Result>
+    inline State get_final_result_state(Result const& result) {
         return get_state_from_result(result, get_result_duration(result) - 1);
     }
 
@@ -121,11 +142,11 @@ namespace BioCro {
     // Get the keys of a mapping (e.g., a State or a System_drivers
     // specification) as a set.
     template<typename Mapping>
-    inline Variable_set keys(Mapping mapping) {
+    inline Variable_set keys(Mapping const& mapping) {
         Variable_set keys;
         std::transform(mapping.begin(), mapping.end(),
                        std::inserter(keys, keys.end()),
-                       [](auto pair){ return pair.first; });
+                       [](auto const& pair){ return pair.first; });
         return keys;
     }
 }
@@ -3,23 +3,27 @@
 
 #include "Random.h"
 
+#include <ctime>
+
 using namespace std;
 
-int Rand_int::seed_offset = 0;
+atomic<int> Rand_int::seed_offset {0};
 
 Rand_int::Rand_int(int lo, int hi)
-    :r(bind( uniform_int_distribution<>(lo, hi),
-             default_random_engine(time(nullptr) + seed_offset++))) { }
+    : Rand_int(lo, hi, time(nullptr) + seed_offset++) { }
 
+Rand_int::Rand_int(int lo, int hi, unsigned seed)
+    : engine(seed), distribution(lo, hi) { }
 
-int Rand_int::operator() () const { return r(); }
+int Rand_int::operator() () const { return distribution(engine); }
 
 
-int Rand_double::seed_offset = 0;
+atomic<int> Rand_double::seed_offset {0};
 
 Rand_double::Rand_double( double low, double high)
-    :r(bind(uniform_real_distribution<>(low, high),
-            default_random_engine(time(nullptr) + seed_offset++))) { }
+    : Rand_double(low, high, time(nullptr) + seed_offset++) { }
 
-double Rand_double::operator() () const { return r(); }
+Rand_double::Rand_double( double low, double high, unsigned seed)
+    : engine(seed), distribution(low, high) { }
 
+double Rand_double::operator() () const { return distribution(engine); }
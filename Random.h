@@ -1,29 +1,39 @@
 // Adapted from: Stroustrup, The C++ Programming Language (4th
 // Edition). Pearson Education. Kindle Edition.
+//
+// Unless a seed is given, each generator is seeded from the clock
+// plus a counter shared by all generators of its class; the counter
+// is atomic, so generators may be made on several threads at once.
+// A single generator must not be used by two threads at once.  For
+// random numbers that can be reproduced regardless of threading, see
+// counter_rng.h.
 
 #ifndef TEST_UTILITY_RANDOM
 #define TEST_UTILITY_RANDOM
 
+#include <atomic>
 #include <random>
 
-using std::function;
-
 class Rand_int {
 public:
     Rand_int(int lo, int hi);
+    Rand_int(int lo, int hi, unsigned seed);
     int operator() () const;
 private:
-    function<int()> r;
-    static int seed_offset;
+    mutable std::default_random_engine engine;
+    mutable std::uniform_int_distribution<> distribution;
+    static std::atomic<int> seed_offset;
 };
 
 class Rand_double {
 public:
     Rand_double( double low, double high);
+    Rand_double( double low, double high, unsigned seed);
     double operator() () const;
 private:
-    function<double()> r;
-    static int seed_offset;
+    mutable std::default_random_engine engine;
+    mutable std::uniform_real_distribution<> distribution;
+    static std::atomic<int> seed_offset;
 };
 
 #endif
@@ -0,0 +1,220 @@
+/**
+ *  Arena allocation for results and states.
+ *
+ *  Running a simulation allocates one column per recorded quantity,
+ *  plus the map nodes holding them; for short runs repeated many
+ *  times (as in a parameter sweep), these allocations can cost more
+ *  than the integration itself.  An Arena hands out memory from a few
+ *  large chunks and frees nothing until `release()` is called, at
+ *  which point everything allocated from it is given back at once
+ *  and the chunks are kept for reuse.  A batch worker can thus use a
+ *  single Arena for all of its runs:
+ *
+ *      BioCro::Arena arena;
+ *      for (...) {
+ *          {
+ *              BioCro::Arena_result result = BioCro::integrate_selected(..., arena);
+ *              // use result
+ *          }  // result must be destroyed before the release
+ *          arena.release();
+ *      }
+ *
+ *  Arena_allocator is a standard-library allocator drawing on an
+ *  Arena, in the style of std::pmr::polymorphic_allocator (which
+ *  requires C++17).  Arena_column, Arena_result, and Arena_state are
+ *  the arena-allocated counterparts of a result column, a
+ *  Simulation_result, and a State.
+ *
+ *  An Arena is not thread-safe; each thread should use its own.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>  // for std::max
+#include <cstddef>    // for std::max_align_t
+#include <functional> // for std::hash, std::equal_to
+#include <new>        // for ::operator new, ::operator delete
+#include <string>
+#include <unordered_map>
+#include <utility>    // for std::pair
+#include <vector>
+
+namespace BioCro {
+
+    class Arena
+    {
+       public:
+        explicit Arena(size_t initial_chunk_size = 64 * 1024)
+            : next_chunk_size{std::max<size_t>(initial_chunk_size, 1024)} {}
+
+        Arena(Arena const&) = delete;
+        Arena& operator=(Arena const&) = delete;
+
+        ~Arena()
+        {
+            for (Chunk& chunk : chunks) {
+                ::operator delete(chunk.data);
+            }
+        }
+
+        void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+        {
+            // Try the current chunk, then any chunks kept from before
+            // the last release.
+            for (; current < chunks.size(); ++current, offset = 0) {
+                size_t start {align_up(offset, alignment)};
+                if (start + bytes <= chunks[current].size) {
+                    offset = start + bytes;
+                    in_use += bytes;
+                    return chunks[current].data + start;
+                }
+            }
+
+            size_t size {std::max(next_chunk_size, bytes + alignment)};
+            chunks.push_back(Chunk {static_cast<char*>(::operator new(size)), size});
+            next_chunk_size = 2 * size;
+            current = chunks.size() - 1;
+            return allocate(bytes, alignment);
+        }
+
+        // Makes all memory allocated so far available again.  Every
+        // object allocated from the arena must have been destroyed
+        // first.
+        void release()
+        {
+            current = 0;
+            offset = 0;
+            in_use = 0;
+        }
+
+        // Makes sure at least `bytes` bytes can be allocated without
+        // asking the system for more memory.  (The actual capacity
+        // available may be somewhat less if alignment padding is
+        // needed.)
+        void reserve(size_t bytes)
+        {
+            size_t available {0};
+            for (size_t i {current}; i < chunks.size(); ++i) {
+                available += chunks[i].size - (i == current ? offset : 0);
+            }
+            if (available < bytes) {
+                size_t size {std::max(next_chunk_size, bytes - available)};
+                chunks.push_back(Chunk {static_cast<char*>(::operator new(size)), size});
+                next_chunk_size = 2 * size;
+            }
+        }
+
+        // The number of bytes handed out since the last release.
+        size_t bytes_in_use() const { return in_use; }
+
+        // The total size of the chunks the arena holds.
+        size_t capacity() const
+        {
+            size_t total {0};
+            for (Chunk const& chunk : chunks) total += chunk.size;
+            return total;
+        }
+
+       private:
+        struct Chunk {
+            char* data;
+            size_t size;
+        };
+
+        static size_t align_up(size_t n, size_t alignment)
+        {
+            return (n + alignment - 1) / alignment * alignment;
+        }
+
+        std::vector<Chunk> chunks;
+        size_t current {0};
+        size_t offset {0};
+        size_t in_use {0};
+        size_t next_chunk_size;
+    };
+
+    /**
+     * A standard-library allocator that allocates from an Arena.
+     * Deallocation does nothing; memory is reclaimed only when the
+     * arena is released.
+     */
+    template <typename T>
+    class Arena_allocator
+    {
+       public:
+        using value_type = T;
+
+        Arena_allocator(Arena& arena) noexcept : arena_ptr{&arena} {}
+
+        template <typename U>
+        Arena_allocator(Arena_allocator<U> const& other) noexcept
+            : arena_ptr{other.arena()} {}
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(arena_ptr->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T*, size_t) noexcept {}
+
+        Arena* arena() const noexcept { return arena_ptr; }
+
+       private:
+        Arena* arena_ptr;
+    };
+
+    template <typename T, typename U>
+    bool operator==(Arena_allocator<T> const& a, Arena_allocator<U> const& b) noexcept
+    {
+        return a.arena() == b.arena();
+    }
+
+    template <typename T, typename U>
+    bool operator!=(Arena_allocator<T> const& a, Arena_allocator<U> const& b) noexcept
+    {
+        return !(a == b);
+    }
+
+    // The names themselves are std::strings; names of up to 15
+    // characters or so (most quantity names) fit in the string object
+    // and need no allocation of their own.
+    using Arena_column = std::vector<double, Arena_allocator<double>>;
+
+    using Arena_result = std::unordered_map<
+        std::string, Arena_column,
+        std::hash<std::string>, std::equal_to<std::string>,
+        Arena_allocator<std::pair<const std::string, Arena_column>>>;
+
+    using Arena_state = std::unordered_map<
+        std::string, double,
+        std::hash<std::string>, std::equal_to<std::string>,
+        Arena_allocator<std::pair<const std::string, double>>>;
+
+    // An upper bound on the number of bytes an Arena_result with the
+    // given number of rows and columns takes up: the columns, plus
+    // the map's nodes and bucket array.
+    inline size_t estimated_result_size(size_t number_of_rows, size_t number_of_columns)
+    {
+        constexpr size_t node_size {sizeof(Arena_result::value_type) + 2 * sizeof(void*)};
+        constexpr size_t slack {2 * alignof(std::max_align_t)};
+        return number_of_columns * (number_of_rows * sizeof(double) + node_size + 2 * sizeof(void*) + 2 * slack)
+            + slack;
+    }
+
+    // Makes an empty Arena_result or Arena_state using the given arena.
+    inline Arena_result make_arena_result(Arena& arena, size_t bucket_count = 0)
+    {
+        return Arena_result(bucket_count, std::hash<std::string>(),
+                            std::equal_to<std::string>(),
+                            Arena_result::allocator_type(arena));
+    }
+
+    inline Arena_state make_arena_state(Arena& arena, size_t bucket_count = 0)
+    {
+        return Arena_state(bucket_count, std::hash<std::string>(),
+                           std::equal_to<std::string>(),
+                           Arena_state::allocator_type(arena));
+    }
+}
+
+#endif
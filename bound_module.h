@@ -0,0 +1,117 @@
+/**
+ *  Modules that own, or can't outlive, their quantities.
+ *
+ *  A module keeps references to the values in the input map it was
+ *  made with and pointers to those in its output map, so, as
+ *  test_module_object.cpp shows, making a module from a temporary or
+ *  a literal map silently gives wrong results.  Two means of avoiding
+ *  that are given here.
+ *
+ *  BioCro::create_module has the form of `create_module` on a
+ *  Module_creator, but its overloads taking an rvalue input map are
+ *  deleted, so that
+ *
+ *      auto module = BioCro::create_module(w, { {"time", 200} }, &outputs);
+ *
+ *  doesn't compile, while passing a named map does.
+ *
+ *  A Bound_module shares ownership of its input and output maps,
+ *  which are held in Quantity_stores, so that they live at least as
+ *  long as it does.  Several modules may share a store; a value set in
+ *  a store is seen by every module bound to it:
+ *
+ *      BioCro::Quantity_store inputs {BioCro::make_quantity_store(
+ *          { {"position", 3}, {"velocity", -2}, {"mass", 5}, {"spring_constant", 7} })};
+ *      BioCro::Quantity_store outputs {BioCro::make_quantity_store()};
+ *
+ *      BioCro::Bound_module energy {w, inputs, outputs};
+ *      (*inputs)["position"] = 4;
+ *      energy.run();
+ *
+ *  Binding a module adds any of its outputs missing from the output
+ *  store, set to zero.  Quantities may be added to a store later (the
+ *  values of an unordered map stay where they are as it grows), but a
+ *  quantity a module is bound to must not be removed, nor the store's
+ *  map replaced.
+ */
+#ifndef BOUND_MODULE_H
+#define BOUND_MODULE_H
+
+#include <memory>    // for std::shared_ptr, std::make_shared
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "BioCro.h"
+
+namespace BioCro {
+
+    inline Module create_module(Module_creator creator,
+                                Variable_settings const& inputs,
+                                Variable_settings* outputs)
+    {
+        return creator->create_module(inputs, outputs);
+    }
+
+    // A module made from a temporary would refer to it after it is
+    // gone.
+    Module create_module(Module_creator, Variable_settings&&, Variable_settings*) = delete;
+    Module create_module(Module_creator, Variable_settings const&&, Variable_settings*) = delete;
+
+    using Quantity_store = std::shared_ptr<Variable_settings>;
+
+    inline Quantity_store make_quantity_store(Variable_settings quantities = {})
+    {
+        return std::make_shared<Variable_settings>(std::move(quantities));
+    }
+
+    class Bound_module
+    {
+       public:
+        // Throws std::out_of_range, naming the quantity, if an input of
+        // the module isn't in the input store.
+        Bound_module(Module_creator creator, Quantity_store input_store, Quantity_store output_store)
+            : creator{creator},
+              input_store{std::move(input_store)},
+              output_store{std::move(output_store)}
+        {
+            for (std::string const& name : creator->get_inputs()) {
+                if (!this->input_store->count(name)) {
+                    throw std::out_of_range(
+                        "\"" + name + "\" is an input of the \"" + creator->get_name() +
+                        "\" module, but it isn't in the module's input store.\n");
+                }
+            }
+            for (std::string const& name : creator->get_outputs()) {
+                output_pointers.push_back(&(*this->output_store)[name]);
+            }
+            module = creator->create_module(*this->input_store, this->output_store.get());
+        }
+
+        void run() const { module->run(); }
+
+        // Sets the module's outputs to zero, as is needed before
+        // running a differential module, which adds to them.
+        void zero_outputs() const
+        {
+            for (double* output : output_pointers) *output = 0;
+        }
+
+        Module_creator get_creator() const { return creator; }
+        Quantity_store const& inputs() const { return input_store; }
+        Quantity_store const& outputs() const { return output_store; }
+
+       private:
+        Module_creator creator;
+
+        // The stores must be declared before the module, so that it is
+        // destroyed first.
+        Quantity_store input_store;
+        Quantity_store output_store;
+        std::vector<double*> output_pointers;
+        Module module;
+    };
+}
+
+#endif
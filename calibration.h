@@ -0,0 +1,587 @@
+/**
+ *  Fitting parameters to observations.
+ *
+ *  A calibration problem has a simulation (a Sweep_specification),
+ *  the parameters to fit with bounds on each, and a Loss_function that
+ *  measures how far a Simulation_result is from what was observed.
+ *  `weighted_sum_of_squares` makes the usual loss for observed time
+ *  series; any other function of the result's columns may be used.
+ *
+ *  A Calibration_objective evaluates the loss for a whole population
+ *  of candidate parameter values at once, on a number of threads; it
+ *  records only the quantities the loss needs (see
+ *  selective_simulation.h).  `calibrate` minimizes it with a
+ *  population-based optimizer, CMA-ES (Hansen, "The CMA evolution
+ *  strategy: a tutorial", 2016) or differential evolution (Storn and
+ *  Price, 1997, DE/rand/1/bin), each of which proposes one generation
+ *  at a time.  Proposals are drawn from Random_streams determined by
+ *  the seed and the generation (see counter_rng.h), so the fit
+ *  doesn't depend on the number of threads.
+ *
+ *  The optimizers work in coordinates scaled so that each parameter's
+ *  bounds become [0, 1].
+ */
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <algorithm> // for std::min, std::max, std::stable_sort, std::minmax_element
+#include <atomic>
+#include <cmath>     // for std::log, std::sqrt, std::exp, std::abs, std::isnan
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <numeric>   // for std::iota
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "counter_rng.h"
+#include "safe_simulators.h"
+#include "sensitivity.h"
+#include "sweep_runner.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    /**
+     * A loss, together with the quantities it reads from a result.  If
+     * `quantities` is empty, every quantity is recorded.
+     */
+    struct Loss_function {
+        Variable_names quantities;
+        std::function<double(Simulation_result const&)> evaluate;
+    };
+
+    // Observations of one quantity at given times.  If `weights` is
+    // empty, each observation has a weight of 1.
+    struct Observed_series {
+        std::string quantity;
+        std::vector<double> times;
+        std::vector<double> values;
+        std::vector<double> weights;
+    };
+
+    /**
+     * Returns the weighted sum of squared differences between the
+     * observations and the simulated values, found by linear
+     * interpolation in `time_quantity` (which must increase along the
+     * result).  An observation outside the simulated times makes the
+     * loss infinite.
+     */
+    inline Loss_function weighted_sum_of_squares(std::vector<Observed_series> observations,
+                                                 std::string time_quantity)
+    {
+        Variable_names quantities {time_quantity};
+        for (auto const& o : observations) {
+            if (o.times.size() != o.values.size() ||
+                (!o.weights.empty() && o.weights.size() != o.times.size())) {
+                throw std::invalid_argument(
+                    "The observations of \"" + o.quantity + "\" must have one time "
+                    "(and one weight, if any are given) per value.\n");
+            }
+            if (!std::is_sorted(o.times.begin(), o.times.end())) {
+                throw std::invalid_argument(
+                    "The observations of \"" + o.quantity + "\" must be in order of time.\n");
+            }
+            if (std::find(quantities.begin(), quantities.end(), o.quantity) == quantities.end()) {
+                quantities.push_back(o.quantity);
+            }
+        }
+
+        auto evaluate = [observations, time_quantity](Simulation_result const& result) {
+            std::vector<double> const& t = result.at(time_quantity);
+            double loss {0};
+            for (auto const& o : observations) {
+                std::vector<double> const& y = result.at(o.quantity);
+                size_t row {0};  // a cursor, since the times are in order
+                for (size_t i {0}; i < o.times.size(); ++i) {
+                    if (t.empty() || o.times[i] < t.front() || o.times[i] > t.back()) {
+                        return std::numeric_limits<double>::infinity();
+                    }
+                    while (row + 1 < t.size() && t[row + 1] < o.times[i]) ++row;
+                    double simulated {y[row]};
+                    if (row + 1 < t.size() && t[row + 1] > t[row]) {
+                        double f {(o.times[i] - t[row]) / (t[row + 1] - t[row])};
+                        simulated += f * (y[row + 1] - y[row]);
+                    }
+                    double difference {simulated - o.values[i]};
+                    double w {o.weights.empty() ? 1.0 : o.weights[i]};
+                    loss += w * difference * difference;
+                }
+            }
+            return loss;
+        };
+
+        return Loss_function {quantities, evaluate};
+    }
+
+    struct Parameter_bounds {
+        std::string name;
+        double lower;
+        double upper;
+    };
+
+    using Calibration_parameters = std::vector<Parameter_bounds>;
+
+    /**
+     * The loss as a function of the values of the calibration
+     * parameters.  A run that throws, or whose loss is NaN, has an
+     * infinite loss.
+     *
+     * A Calibration_objective is not changed by evaluation, so it may
+     * be used by several threads at once.
+     */
+    class Calibration_objective
+    {
+       public:
+        Calibration_objective(Sweep_specification spec,
+                              Calibration_parameters parameters,
+                              Loss_function loss)
+            : spec{spec}, parameters{parameters}, loss{loss}
+        {
+            Variable_names names;
+            for (auto const& p : parameters) names.push_back(p.name);
+            check_parameter_names(this->spec, names, "a calibration parameter");
+            for (auto const& p : parameters) {
+                if (!(p.lower < p.upper)) {
+                    throw std::invalid_argument(
+                        "The bounds of \"" + p.name + "\" must have lower < upper.\n");
+                }
+            }
+            if (!loss.evaluate) {
+                throw std::invalid_argument("Calibration_objective: the loss has no function.");
+            }
+        }
+
+        size_t dimensions() const { return parameters.size(); }
+        Calibration_parameters const& bounds() const { return parameters; }
+
+        // The loss for the given parameter values, letting any
+        // exception through.
+        double checked_loss(std::vector<double> const& values) const
+        {
+            Parameter_set p {spec.parameters};
+            return loss_at(values, p);
+        }
+
+        double operator()(std::vector<double> const& values) const
+        {
+            Parameter_set p {spec.parameters};
+            return safe_loss_at(values, p);
+        }
+
+        /**
+         * Returns the loss of each member of the population, evaluated
+         * on up to `number_of_threads` threads.
+         */
+        std::vector<double> evaluate(Sweep_points const& population,
+                                     unsigned number_of_threads) const
+        {
+            std::vector<double> losses(population.size());
+            std::atomic<size_t> next {0};
+
+            auto work = [&]() {
+                Parameter_set p {spec.parameters};  // reused for each member
+                for (size_t i; (i = next++) < population.size();) {
+                    losses[i] = safe_loss_at(population[i], p);
+                }
+            };
+
+            unsigned threads_to_use {static_cast<unsigned>(
+                std::min<size_t>(std::max(number_of_threads, 1u), std::max<size_t>(population.size(), 1)))};
+            run_on_threads(threads_to_use, work);
+            return losses;
+        }
+
+       private:
+        double loss_at(std::vector<double> const& values, Parameter_set& p) const
+        {
+            if (values.size() != parameters.size()) {
+                throw std::invalid_argument(
+                    "Calibration_objective: there must be one value per calibration parameter.");
+            }
+            for (size_t i {0}; i < values.size(); ++i) p[parameters[i].name] = values[i];
+
+            double value {loss.evaluate(
+                make_run_simulator(spec, p, loss.quantities).run_simulation())};
+            return std::isnan(value) ? std::numeric_limits<double>::infinity() : value;
+        }
+
+        double safe_loss_at(std::vector<double> const& values, Parameter_set& p) const
+        {
+            try {
+                return loss_at(values, p);
+            } catch (std::exception const&) {
+                return std::numeric_limits<double>::infinity();
+            }
+        }
+
+        Sweep_specification const spec;
+        Calibration_parameters const parameters;
+        Loss_function const loss;
+    };
+
+    enum class Calibration_method { cma_es, differential_evolution };
+
+    struct Calibration_options {
+        Calibration_method method {Calibration_method::cma_es};
+        size_t population_size {0};  // 0 for the method's default
+        size_t max_generations {200};
+
+        // The fit stops when the losses of a generation (for CMA-ES)
+        // or of the population (for differential evolution) differ by
+        // no more than this.
+        double loss_tolerance {1e-12};
+
+        std::uint64_t seed {1};
+        unsigned number_of_threads {std::max(1u, std::thread::hardware_concurrency())};
+
+        // For CMA-ES: the initial step size, as a fraction of each
+        // parameter's range.
+        double initial_step_size {0.3};
+
+        // For differential evolution
+        double differential_weight {0.8};
+        double crossover_probability {0.9};
+    };
+
+    struct Calibration_result {
+        Variable_names parameter_names;
+        std::vector<double> best_values;
+        double best_loss;
+        size_t generations;
+        size_t evaluations;
+        std::vector<double> best_loss_history;  // after each generation
+        bool converged;
+
+        State best_parameters() const
+        {
+            State named;
+            for (size_t i {0}; i < best_values.size(); ++i) {
+                named[parameter_names[i]] = best_values[i];
+            }
+            return named;
+        }
+    };
+
+    namespace calibration_detail {
+        using Matrix = std::vector<std::vector<double>>;
+
+        // Finds the eigenvalues and eigenvectors (the columns of
+        // `vectors`) of a symmetric matrix by cyclic Jacobi rotations,
+        // which is simple and accurate for the small matrices here.
+        inline void symmetric_eigen(Matrix a, std::vector<double>& values, Matrix& vectors)
+        {
+            size_t const n {a.size()};
+            vectors.assign(n, std::vector<double>(n, 0));
+            for (size_t i {0}; i < n; ++i) vectors[i][i] = 1;
+
+            for (int sweep {0}; sweep < 100; ++sweep) {
+                double off_diagonal {0}, diagonal {0};
+                for (size_t p {0}; p < n; ++p) {
+                    diagonal += a[p][p] * a[p][p];
+                    for (size_t q {p + 1}; q < n; ++q) off_diagonal += a[p][q] * a[p][q];
+                }
+                if (off_diagonal <= 1e-30 * diagonal) break;
+
+                for (size_t p {0}; p < n; ++p) {
+                    for (size_t q {p + 1}; q < n; ++q) {
+                        if (a[p][q] == 0) continue;
+                        double theta {(a[q][q] - a[p][p]) / (2 * a[p][q])};
+                        double t {(theta >= 0 ? 1 : -1) /
+                                  (std::abs(theta) + std::sqrt(theta * theta + 1))};
+                        double c {1 / std::sqrt(t * t + 1)};
+                        double s {t * c};
+                        for (size_t k {0}; k < n; ++k) {
+                            double kp {a[k][p]}, kq {a[k][q]};
+                            a[k][p] = c * kp - s * kq;
+                            a[k][q] = s * kp + c * kq;
+                        }
+                        for (size_t k {0}; k < n; ++k) {
+                            double pk {a[p][k]}, qk {a[q][k]};
+                            a[p][k] = c * pk - s * qk;
+                            a[q][k] = s * pk + c * qk;
+                        }
+                        for (size_t k {0}; k < n; ++k) {
+                            double kp {vectors[k][p]}, kq {vectors[k][q]};
+                            vectors[k][p] = c * kp - s * kq;
+                            vectors[k][q] = s * kp + c * kq;
+                        }
+                    }
+                }
+            }
+            values.resize(n);
+            for (size_t i {0}; i < n; ++i) values[i] = a[i][i];
+        }
+
+        inline double spread(std::vector<double> const& losses)
+        {
+            auto range = std::minmax_element(losses.begin(), losses.end());
+            if (std::isinf(*range.second)) return std::numeric_limits<double>::infinity();
+            return *range.second - *range.first;
+        }
+
+        // Maps scaled coordinates to parameter values.
+        inline Sweep_points unscale(Sweep_points const& scaled, Calibration_parameters const& bounds)
+        {
+            Sweep_points values {scaled};
+            for (auto& v : values) {
+                for (size_t i {0}; i < v.size(); ++i) {
+                    v[i] = bounds[i].lower + v[i] * (bounds[i].upper - bounds[i].lower);
+                }
+            }
+            return values;
+        }
+
+        // Records a generation's losses in the result.
+        inline void record(Calibration_result& result, Sweep_points const& scaled,
+                           std::vector<double> const& losses, Calibration_parameters const& bounds)
+        {
+            auto best = std::min_element(losses.begin(), losses.end());
+            if (*best < result.best_loss) {
+                result.best_loss = *best;
+                result.best_values = unscale({scaled[best - losses.begin()]}, bounds).front();
+            }
+            result.evaluations += losses.size();
+            result.best_loss_history.push_back(result.best_loss);
+            ++result.generations;
+        }
+
+        inline void cma_es(Calibration_objective const& objective, std::vector<double> start,
+                           Calibration_options const& options, Calibration_result& result)
+        {
+            size_t const n {objective.dimensions()};
+            size_t const lambda {options.population_size > 0
+                                     ? std::max<size_t>(options.population_size, 2)
+                                     : 4 + static_cast<size_t>(3 * std::log(n))};
+            size_t const mu {lambda / 2};
+
+            std::vector<double> w(mu);
+            for (size_t i {0}; i < mu; ++i) w[i] = std::log(mu + 0.5) - std::log(i + 1.0);
+            double w_sum {0}, w_squares {0};
+            for (double x : w) w_sum += x;
+            for (double& x : w) x /= w_sum;
+            for (double x : w) w_squares += x * x;
+            double const mu_eff {1 / w_squares};
+
+            double const dn {static_cast<double>(n)};
+            double const c_sigma {(mu_eff + 2) / (dn + mu_eff + 5)};
+            double const d_sigma {1 + 2 * std::max(0.0, std::sqrt((mu_eff - 1) / (dn + 1)) - 1) + c_sigma};
+            double const c_c {(4 + mu_eff / dn) / (dn + 4 + 2 * mu_eff / dn)};
+            double const c_1 {2 / ((dn + 1.3) * (dn + 1.3) + mu_eff)};
+            double const c_mu {std::min(1 - c_1, 2 * (mu_eff - 2 + 1 / mu_eff) /
+                                                     ((dn + 2) * (dn + 2) + mu_eff))};
+            double const chi_n {std::sqrt(dn) * (1 - 1 / (4 * dn) + 1 / (21 * dn * dn))};
+
+            std::vector<double> mean {start};
+            double sigma {options.initial_step_size};
+            std::vector<double> p_sigma(n, 0), p_c(n, 0);
+            Matrix C(n, std::vector<double>(n, 0));
+            for (size_t i {0}; i < n; ++i) C[i][i] = 1;
+            Matrix B {C};
+            std::vector<double> D(n, 1);  // square roots of the eigenvalues of C
+
+            for (size_t generation {0}; generation < options.max_generations; ++generation) {
+                Random_stream stream {options.seed, generation};
+
+                // Sample, drawing again (up to a limit) any point
+                // outside the bounds and clipping the rest.
+                Sweep_points x(lambda, std::vector<double>(n));
+                Sweep_points y(lambda, std::vector<double>(n));
+                for (size_t k {0}; k < lambda; ++k) {
+                    for (int attempt {0};; ++attempt) {
+                        std::vector<double> z(n);
+                        for (auto& zi : z) zi = stream.normal();
+                        bool inside {true};
+                        for (size_t i {0}; i < n; ++i) {
+                            double yi {0};
+                            for (size_t j {0}; j < n; ++j) yi += B[i][j] * D[j] * z[j];
+                            x[k][i] = mean[i] + sigma * yi;
+                            inside = inside && 0 <= x[k][i] && x[k][i] <= 1;
+                        }
+                        if (inside || attempt == 100) break;
+                    }
+                    for (size_t i {0}; i < n; ++i) {
+                        x[k][i] = std::min(std::max(x[k][i], 0.0), 1.0);
+                        y[k][i] = (x[k][i] - mean[i]) / sigma;
+                    }
+                }
+
+                std::vector<double> losses {
+                    objective.evaluate(unscale(x, objective.bounds()), options.number_of_threads)};
+                record(result, x, losses, objective.bounds());
+                if (spread(losses) <= options.loss_tolerance) {
+                    result.converged = true;
+                    return;
+                }
+
+                std::vector<size_t> order(lambda);
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(),
+                                 [&](size_t a, size_t b) { return losses[a] < losses[b]; });
+
+                // The weighted mean step of the best mu points
+                std::vector<double> step(n, 0);
+                for (size_t r {0}; r < mu; ++r) {
+                    for (size_t i {0}; i < n; ++i) step[i] += w[r] * y[order[r]][i];
+                }
+                for (size_t i {0}; i < n; ++i) mean[i] += sigma * step[i];
+
+                // C^(-1/2) step = B D^(-1) B^T step
+                std::vector<double> bt_step(n, 0), whitened(n, 0);
+                for (size_t j {0}; j < n; ++j) {
+                    for (size_t i {0}; i < n; ++i) bt_step[j] += B[i][j] * step[i];
+                    bt_step[j] /= D[j];
+                }
+                for (size_t i {0}; i < n; ++i) {
+                    for (size_t j {0}; j < n; ++j) whitened[i] += B[i][j] * bt_step[j];
+                }
+
+                double p_sigma_norm {0};
+                for (size_t i {0}; i < n; ++i) {
+                    p_sigma[i] = (1 - c_sigma) * p_sigma[i] +
+                                 std::sqrt(c_sigma * (2 - c_sigma) * mu_eff) * whitened[i];
+                    p_sigma_norm += p_sigma[i] * p_sigma[i];
+                }
+                p_sigma_norm = std::sqrt(p_sigma_norm);
+
+                bool const h_sigma {
+                    p_sigma_norm / std::sqrt(1 - std::pow(1 - c_sigma, 2.0 * (generation + 1))) / chi_n <
+                    1.4 + 2 / (dn + 1)};
+                for (size_t i {0}; i < n; ++i) {
+                    p_c[i] = (1 - c_c) * p_c[i] +
+                             (h_sigma ? std::sqrt(c_c * (2 - c_c) * mu_eff) : 0) * step[i];
+                }
+
+                double const old_weight {1 - c_1 - c_mu + (h_sigma ? 0 : c_1 * c_c * (2 - c_c))};
+                for (size_t i {0}; i < n; ++i) {
+                    for (size_t j {0}; j <= i; ++j) {
+                        double rank_mu {0};
+                        for (size_t r {0}; r < mu; ++r) {
+                            rank_mu += w[r] * y[order[r]][i] * y[order[r]][j];
+                        }
+                        C[i][j] = old_weight * C[i][j] + c_1 * p_c[i] * p_c[j] + c_mu * rank_mu;
+                        C[j][i] = C[i][j];
+                    }
+                }
+
+                sigma *= std::exp((c_sigma / d_sigma) * (p_sigma_norm / chi_n - 1));
+
+                std::vector<double> eigenvalues;
+                symmetric_eigen(C, eigenvalues, B);
+                for (size_t i {0}; i < n; ++i) D[i] = std::sqrt(std::max(eigenvalues[i], 1e-20));
+
+                if (sigma * *std::max_element(D.begin(), D.end()) < 1e-14) {
+                    result.converged = true;
+                    return;
+                }
+            }
+        }
+
+        inline void differential_evolution(Calibration_objective const& objective,
+                                           std::vector<double> start,
+                                           Calibration_options const& options,
+                                           Calibration_result& result)
+        {
+            size_t const n {objective.dimensions()};
+            size_t const size {options.population_size > 0
+                                   ? std::max<size_t>(options.population_size, 4)
+                                   : std::max<size_t>(10 * n, 8)};
+
+            // A Latin hypercube for the first generation, with the
+            // starting point in place of its first member.
+            Sweep_points population {latin_hypercube(n, size, options.seed)};
+            population[0] = start;
+            std::vector<double> losses {
+                objective.evaluate(unscale(population, objective.bounds()), options.number_of_threads)};
+            record(result, population, losses, objective.bounds());
+
+            for (size_t generation {1}; generation < options.max_generations; ++generation) {
+                if (spread(losses) <= options.loss_tolerance) {
+                    result.converged = true;
+                    return;
+                }
+
+                Random_stream stream {options.seed, generation};
+                auto pick = [&](size_t k) {
+                    return std::min(static_cast<size_t>(stream.uniform() * k), k - 1);
+                };
+
+                Sweep_points trials(size, std::vector<double>(n));
+                for (size_t k {0}; k < size; ++k) {
+                    size_t a, b, c;
+                    do a = pick(size); while (a == k);
+                    do b = pick(size); while (b == k || b == a);
+                    do c = pick(size); while (c == k || c == a || c == b);
+
+                    size_t always {pick(n)};
+                    for (size_t i {0}; i < n; ++i) {
+                        double u {stream.uniform()};
+                        if (i != always && u >= options.crossover_probability) {
+                            trials[k][i] = population[k][i];
+                            continue;
+                        }
+                        double v {population[a][i] +
+                                  options.differential_weight * (population[b][i] - population[c][i])};
+                        // A coordinate out of bounds is replaced by one
+                        // between the parent's and the bound.
+                        if (v < 0) v = stream.uniform() * population[k][i];
+                        if (v > 1) v = population[k][i] + stream.uniform() * (1 - population[k][i]);
+                        trials[k][i] = v;
+                    }
+                }
+
+                std::vector<double> trial_losses {
+                    objective.evaluate(unscale(trials, objective.bounds()), options.number_of_threads)};
+                for (size_t k {0}; k < size; ++k) {
+                    if (trial_losses[k] <= losses[k]) {
+                        population[k] = trials[k];
+                        losses[k] = trial_losses[k];
+                    }
+                }
+                record(result, trials, trial_losses, objective.bounds());
+            }
+        }
+    }
+
+    /**
+     * Finds the values of the calibration parameters, within their
+     * bounds, that minimize the loss, starting from their values in
+     * `spec.parameters` (clipped to the bounds).  The loss at the
+     * starting values is computed first, letting any exception
+     * through, so that a mistake in the specification or the loss is
+     * reported rather than taken for a failed run.
+     */
+    inline Calibration_result calibrate(Sweep_specification const& spec,
+                                        Calibration_parameters const& parameters,
+                                        Loss_function const& loss,
+                                        Calibration_options const& options = {})
+    {
+        if (parameters.empty()) {
+            throw std::invalid_argument("calibrate: there must be at least one parameter to fit.");
+        }
+        Calibration_objective objective {spec, parameters, loss};
+
+        std::vector<double> start, scaled_start;
+        for (auto const& p : parameters) {
+            double value {std::min(std::max(spec.parameters.at(p.name), p.lower), p.upper)};
+            start.push_back(value);
+            scaled_start.push_back((value - p.lower) / (p.upper - p.lower));
+        }
+
+        Calibration_result result {{}, start, objective.checked_loss(start), 0, 1, {}, false};
+        for (auto const& p : parameters) result.parameter_names.push_back(p.name);
+
+        if (options.method == Calibration_method::cma_es) {
+            calibration_detail::cma_es(objective, scaled_start, options, result);
+        } else {
+            calibration_detail::differential_evolution(objective, scaled_start, options, result);
+        }
+        return result;
+    }
+}
+
+#endif
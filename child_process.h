@@ -0,0 +1,102 @@
+// Runs some of this test program's own tests in a new process, as the
+// startup and load-time tests of test_module_loading.cpp and
+// test_module_plugins.cpp do to time what happens only once in a
+// process.
+//
+// The child is this program, found with _NSGetExecutablePath on macOS,
+// which has no /proc, and through /proc/self/exe elsewhere.  It is given
+// the arguments passed here and the environment of this process, with
+// the variables passed here added (replacing any of the same name).
+
+#ifndef TEST_UTILITY_CHILD_PROCESS
+#define TEST_UTILITY_CHILD_PROCESS
+
+#include <climits>   // for PATH_MAX
+#include <cstdint>   // for uint32_t
+#include <cstring>   // for strncmp
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>     // for open
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for fork, execve, readlink
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>  // for _NSGetExecutablePath
+#endif
+
+extern char** environ;
+
+namespace child_process {
+
+    inline std::string this_executable()
+    {
+#ifdef __APPLE__
+        uint32_t size {PATH_MAX};
+        std::vector<char> path(size);
+        if (_NSGetExecutablePath(path.data(), &size) != 0) {
+            path.resize(size);
+            if (_NSGetExecutablePath(path.data(), &size) != 0) {
+                throw std::runtime_error("can't find the path of this program");
+            }
+        }
+        return path.data();
+#else
+        std::vector<char> path(PATH_MAX);
+        ssize_t length {readlink("/proc/self/exe", path.data(), path.size() - 1)};
+        if (length < 0) throw std::runtime_error("can't find the path of this program");
+        return std::string(path.data(), length);
+#endif
+    }
+
+    // Starts this program with `arguments` and the variables of
+    // `environment` (each "NAME=value").  Its standard output goes to
+    // /dev/null if `quiet`.  Returns the child's process id.
+    inline pid_t start(std::vector<std::string> arguments,
+                       std::vector<std::string> environment,
+                       bool quiet)
+    {
+        arguments.insert(arguments.begin(), this_executable());
+
+        size_t const added {environment.size()};
+        for (char** e {environ}; *e; ++e) {
+            bool replaced {false};
+            for (size_t i {0}; i < added && !replaced; ++i) {
+                size_t const name_length {environment[i].find('=') + 1};
+                replaced = std::strncmp(*e, environment[i].c_str(), name_length) == 0;
+            }
+            if (!replaced) environment.push_back(*e);
+        }
+
+        auto to_pointers = [](std::vector<std::string>& strings) {
+            std::vector<char*> pointers;
+            for (auto& s : strings) pointers.push_back(&s[0]);
+            pointers.push_back(nullptr);
+            return pointers;
+        };
+        auto argv = to_pointers(arguments);
+        auto envp = to_pointers(environment);
+
+        pid_t pid {fork()};
+        if (pid == 0) {
+            int null_output {open("/dev/null", O_WRONLY)};
+            if (quiet && null_output >= 0) dup2(null_output, STDOUT_FILENO);
+            execve(argv[0], argv.data(), envp.data());
+            _exit(127);
+        }
+        if (pid < 0) throw std::runtime_error("can't start a new process");
+        return pid;
+    }
+
+    // Waits for the child `pid` and tells whether it exited with status 0.
+    inline bool succeeded(pid_t pid)
+    {
+        int status {0};
+        if (waitpid(pid, &status, 0) != pid) return false;
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+}
+
+#endif
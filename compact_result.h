@@ -0,0 +1,282 @@
+/**
+ *  A result type that stores time-invariant quantities only once.
+ *
+ *  In a Simulation_result, every parameter (e.g. "mass" or "tbase")
+ *  occupies a full column with the same value repeated at every time
+ *  point.  A Compact_result keeps such quantities as scalars and
+ *  keeps full columns only for the quantities that actually vary, so
+ *  its size scales with the number of time-varying quantities.  The
+ *  column interface is the same as that of a Simulation_result:
+ *
+ *      result.at("TTc")[i]       result["tbase"][i]
+ *      result.at("TTc").size()   for (auto& item : result) { ... }
+ *
+ *  work in either case.
+ */
+#ifndef COMPACT_RESULT_H
+#define COMPACT_RESULT_H
+
+#include <algorithm> // for std::all_of
+#include <cstring>   // for std::memcmp
+#include <iterator>  // for std::forward_iterator_tag
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>   // for std::pair, std::move
+#include <vector>
+
+#include "BioCro.h"
+
+namespace BioCro {
+
+    /**
+     * A read-only view of one column of a Compact_result.  A
+     * Column supports the operations normally used on a column of a
+     * Simulation_result: `size()`, `operator[]`, `at()`, and
+     * iteration.  It also converts implicitly to a
+     * `std::vector<double>`, so that
+     *
+     *     std::vector<double> TTc_values = result["TTc"];
+     *
+     * still works.  A Column refers to storage owned by the
+     * Compact_result it came from and must not outlive it.
+     */
+    class Column
+    {
+       public:
+        class const_iterator
+        {
+           public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = double;
+            using difference_type = std::ptrdiff_t;
+            using pointer = double const*;
+            using reference = double;
+
+            const_iterator(Column const* column, size_t index)
+                : column{column}, index{index} {}
+
+            double operator*() const { return (*column)[index]; }
+            const_iterator& operator++() { ++index; return *this; }
+            const_iterator operator++(int) { const_iterator old {*this}; ++index; return old; }
+            bool operator==(const_iterator const& other) const { return index == other.index; }
+            bool operator!=(const_iterator const& other) const { return index != other.index; }
+
+           private:
+            Column const* column;
+            size_t index;
+        };
+
+        Column(double const* values, size_t length, bool constant)
+            : values{values}, length{length}, constant{constant} {}
+
+        size_t size() const { return length; }
+
+        double operator[](size_t i) const { return constant ? *values : values[i]; }
+
+        double at(size_t i) const
+        {
+            if (i >= length) {
+                throw std::out_of_range("Column::at: index out of range.");
+            }
+            return (*this)[i];
+        }
+
+        // True if the column is stored as a single value.
+        bool is_constant() const { return constant; }
+
+        const_iterator begin() const { return const_iterator {this, 0}; }
+        const_iterator end() const { return const_iterator {this, length}; }
+
+        operator std::vector<double>() const { return std::vector<double>(begin(), end()); }
+
+       private:
+        double const* values;
+        size_t length;
+        bool constant;
+    };
+
+    /**
+     * A Compact_result is made from a Simulation_result:
+     *
+     *     BioCro::Compact_result compact {sim.run_simulation()};
+     *
+     * Any quantity whose value is the same at every time point is
+     * stored as a single number.  When made from an rvalue, the
+     * columns of the time-varying quantities are moved rather than
+     * copied.
+     *
+     * `expand()` gives back an ordinary Simulation_result.
+     */
+    class Compact_result
+    {
+       public:
+        using value_type = std::pair<std::string, Column>;
+
+        class const_iterator
+        {
+           public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Compact_result::value_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type const*;
+            using reference = value_type const&;
+
+            const_iterator(Compact_result const* result,
+                           std::unordered_map<std::string, double>::const_iterator constant_it,
+                           Simulation_result::const_iterator varying_it)
+                : result{result}, constant_it{constant_it}, varying_it{varying_it},
+                  current{"", Column {nullptr, 0, true}}
+            {
+                load();
+            }
+
+            // The referenced pair belongs to the iterator, so it is
+            // valid only until the iterator is advanced.
+            reference operator*() const { return current; }
+            pointer operator->() const { return &current; }
+
+            const_iterator& operator++()
+            {
+                if (constant_it != result->constants.end()) {
+                    ++constant_it;
+                } else {
+                    ++varying_it;
+                }
+                load();
+                return *this;
+            }
+
+            bool operator==(const_iterator const& other) const
+            {
+                return constant_it == other.constant_it && varying_it == other.varying_it;
+            }
+            bool operator!=(const_iterator const& other) const { return !(*this == other); }
+
+           private:
+            Compact_result const* result;
+            std::unordered_map<std::string, double>::const_iterator constant_it;
+            Simulation_result::const_iterator varying_it;
+            value_type current;
+
+            void load()
+            {
+                if (constant_it != result->constants.end()) {
+                    current = {constant_it->first,
+                               Column {&constant_it->second, result->rows, true}};
+                } else if (varying_it != result->varying.end()) {
+                    current = {varying_it->first,
+                               Column {varying_it->second.data(), result->rows, false}};
+                }
+            }
+        };
+
+        Compact_result() = default;
+
+        explicit Compact_result(Simulation_result const& result)
+            : Compact_result(Simulation_result {result}) {}
+
+        explicit Compact_result(Simulation_result&& result)
+        {
+            bool first {true};
+            for (auto& item : result) {
+                std::vector<double>& values = item.second;
+                if (first) {
+                    rows = values.size();
+                    first = false;
+                } else if (values.size() != rows) {
+                    throw std::invalid_argument(
+                        "Compact_result: the columns of a result must all have "
+                        "the same length, but \"" + item.first + "\" does not.");
+                }
+                // Values are compared bit for bit, so that a column
+                // holding both 0.0 and -0.0 is kept as it is, and one
+                // holding a single NaN throughout is still constant.
+                bool is_constant {!values.empty() &&
+                                  std::all_of(values.begin(), values.end(),
+                                              [&](double v) {
+                                                  return std::memcmp(&v, &values.front(), sizeof v) == 0;
+                                              })};
+                if (is_constant) {
+                    constants[item.first] = values.front();
+                } else {
+                    varying[item.first] = std::move(values);
+                }
+            }
+        }
+
+        // The number of time points.
+        size_t number_of_rows() const { return rows; }
+
+        // The number of quantities, constant or not.
+        size_t size() const { return constants.size() + varying.size(); }
+
+        size_t count(std::string const& quantity_name) const
+        {
+            return constants.count(quantity_name) + varying.count(quantity_name);
+        }
+
+        Column at(std::string const& quantity_name) const
+        {
+            auto c = constants.find(quantity_name);
+            if (c != constants.end()) {
+                return Column {&c->second, rows, true};
+            }
+            auto v = varying.find(quantity_name);
+            if (v != varying.end()) {
+                return Column {v->second.data(), rows, false};
+            }
+            throw std::out_of_range("Compact_result: no quantity named \"" +
+                                    quantity_name + "\".");
+        }
+
+        // Unlike Simulation_result::operator[], this never inserts a
+        // new column; an unknown name throws std::out_of_range.
+        Column operator[](std::string const& quantity_name) const { return at(quantity_name); }
+
+        bool is_time_invariant(std::string const& quantity_name) const
+        {
+            return constants.count(quantity_name) > 0;
+        }
+
+        // The time-invariant quantities and their values.
+        std::unordered_map<std::string, double> const& time_invariant_quantities() const
+        {
+            return constants;
+        }
+
+        // The full columns of the quantities that vary.
+        Simulation_result const& time_varying_quantities() const { return varying; }
+
+        // The number of bytes used to hold values (not counting names).
+        size_t value_storage_size() const
+        {
+            return (constants.size() + varying.size() * rows) * sizeof(double);
+        }
+
+        Simulation_result expand() const
+        {
+            Simulation_result result {varying};
+            for (auto const& item : constants) {
+                result[item.first] = std::vector<double>(rows, item.second);
+            }
+            return result;
+        }
+
+        const_iterator begin() const
+        {
+            return const_iterator {this, constants.begin(), varying.begin()};
+        }
+        const_iterator end() const
+        {
+            return const_iterator {this, constants.end(), varying.end()};
+        }
+
+       private:
+        size_t rows {0};
+        std::unordered_map<std::string, double> constants;
+        Simulation_result varying;
+    };
+}
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ *  Counter-based random number streams.
+ *
+ *  A counter-based generator (Salmon et al., "Parallel random numbers:
+ *  as easy as 1, 2, 3", SC11) computes each block of random bits as a
+ *  fixed function of a key and a counter, so that no state need be
+ *  carried from one number to the next.  Here the key is the seed and
+ *  the counter combines a stream number with a position within the
+ *  stream; a Random_stream for (seed, stream) therefore produces the
+ *  same numbers no matter which thread makes it, in what order streams
+ *  are made, or how many other streams exist.  Giving each Monte Carlo
+ *  sample its own stream (numbered by the sample's index) makes any
+ *  sample reproducible from the seed and its index alone.
+ *
+ *  The generator is Philox4x32-10, which passes the TestU01 BigCrush
+ *  battery.  The conversions to uniform and normal deviates are done
+ *  here rather than with the <random> distributions, whose algorithms
+ *  vary between standard libraries, so that the values are the same
+ *  on every platform.
+ */
+#ifndef COUNTER_RNG_H
+#define COUNTER_RNG_H
+
+#include <array>
+#include <cmath>   // for std::log, std::sqrt, std::cos
+#include <cstdint>
+
+namespace BioCro {
+
+    /**
+     * The Philox4x32-10 block function: maps a 128-bit counter and a
+     * 64-bit key to 128 random bits.
+     */
+    class Philox4x32
+    {
+       public:
+        using Counter = std::array<std::uint32_t, 4>;
+        using Key = std::array<std::uint32_t, 2>;
+
+        static Counter generate(Counter counter, Key key)
+        {
+            for (int round {0}; round < 10; ++round) {
+                if (round > 0) {
+                    key[0] += 0x9E3779B9;
+                    key[1] += 0xBB67AE85;
+                }
+                std::uint64_t product0 {std::uint64_t {0xD2511F53} * counter[0]};
+                std::uint64_t product1 {std::uint64_t {0xCD9E8D57} * counter[2]};
+                counter = Counter {
+                    static_cast<std::uint32_t>(product1 >> 32) ^ counter[1] ^ key[0],
+                    static_cast<std::uint32_t>(product1),
+                    static_cast<std::uint32_t>(product0 >> 32) ^ counter[3] ^ key[1],
+                    static_cast<std::uint32_t>(product0)};
+            }
+            return counter;
+        }
+    };
+
+    /**
+     * The random numbers of stream number `stream` for the given seed.
+     * A Random_stream meets the requirements of a standard uniform
+     * random bit generator, so it may also be used with <random>
+     * distributions (at the cost of platform-independence).
+     *
+     * A Random_stream is cheap to make and to copy; each thread should
+     * use streams of its own.
+     */
+    class Random_stream
+    {
+       public:
+        using result_type = std::uint32_t;
+
+        Random_stream(std::uint64_t seed, std::uint64_t stream)
+            : key{{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32)}},
+              stream_low{static_cast<std::uint32_t>(stream)},
+              stream_high{static_cast<std::uint32_t>(stream >> 32)} {}
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return 0xFFFFFFFF; }
+
+        result_type operator()()
+        {
+            if (used == 4) {
+                block = Philox4x32::generate(
+                    {{static_cast<std::uint32_t>(position),
+                      static_cast<std::uint32_t>(position >> 32),
+                      stream_low, stream_high}},
+                    key);
+                ++position;
+                used = 0;
+            }
+            return block[used++];
+        }
+
+        // A uniform deviate in [0, 1) with 53 random bits.
+        double uniform()
+        {
+            std::uint64_t high {(*this)() >> 5};  // 27 bits
+            std::uint64_t low {(*this)() >> 6};   // 26 bits
+            return (high * 67108864.0 + low) * (1.0 / 9007199254740992.0);
+        }
+
+        double uniform(double low, double high) { return low + (high - low) * uniform(); }
+
+        // A normal deviate, by the Box-Muller transform.  (Only one of
+        // the pair is used so that each deviate depends only on the
+        // position in the stream.)
+        double normal(double mean = 0, double standard_deviation = 1)
+        {
+            double u1 {1 - uniform()};  // in (0, 1], so the log is finite
+            double u2 {uniform()};
+            constexpr double two_pi {6.283185307179586476925286766559};
+            return mean + standard_deviation * std::sqrt(-2 * std::log(u1)) * std::cos(two_pi * u2);
+        }
+
+       private:
+        Philox4x32::Key key;
+        std::uint32_t stream_low;
+        std::uint32_t stream_high;
+        std::uint64_t position {0};
+        Philox4x32::Counter block {};
+        int used {4};
+    };
+}
+
+#endif
@@ -0,0 +1,302 @@
+/**
+ *  Looking up driver values at arbitrary times.
+ *
+ *  A solver with adaptive steps asks for the drivers at times between
+ *  the rows of the driver table.  Finding the row interval containing
+ *  a time by searching the time column, once per driver, costs a
+ *  binary search per column on every derivative calculation.  A
+ *  Driver_table instead finds the interval once for all of its
+ *  columns:
+ *
+ *  - if the times are evenly spaced (as hourly weather data is), by
+ *    dividing by the spacing; and otherwise
+ *
+ *  - by starting from the interval found last, held in a Cursor, and
+ *    moving forward (or back) from there.  Since a solver's times
+ *    mostly increase in small steps, this usually takes a comparison
+ *    or two, falling back to a binary search for long jumps.
+ *
+ *  All driver values at that time are then computed together, from
+ *  rows stored contiguously, by step (the value at the start of the
+ *  interval), linear, or cubic (Hermite, with slopes from the
+ *  neighboring rows, computed when the table is made, that reproduce
+ *  quadratics) interpolation.  Outside the range of the time column,
+ *  the values at its ends are used.
+ *
+ *  Times are given in the units of the driver named when the table is
+ *  made, usually "time"; if no name is given, a row's index is its
+ *  time, as for the fractional row numbers that dynamical systems use.
+ *
+ *  A Driver_table is not changed by lookups, so it may be shared
+ *  between threads, each with its own Cursor.
+ *
+ *  The systems that take one step per row (Static_system,
+ *  Fused_system, and the multirate system) need only the simplest
+ *  case, linear interpolation at fractional row numbers, and write the
+ *  values straight into their quantities.  For them, a Driver_rows
+ *  refers to the columns of drivers held elsewhere and writes a row,
+ *  or a point between rows, through a list of pointers.
+ */
+#ifndef DRIVER_INTERPOLATION_H
+#define DRIVER_INTERPOLATION_H
+
+#include <algorithm> // for std::sort, std::upper_bound, std::min
+#include <cmath>     // for std::abs, std::floor
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BioCro.h"
+
+namespace BioCro {
+
+    enum class Interpolation {step, linear, cubic};
+
+    class Driver_table
+    {
+       public:
+        // The interval last found, for lookups at nearby times
+        struct Cursor {
+            size_t interval {0};
+        };
+
+        Driver_table(System_drivers const& drivers,
+                     std::string const& time_name = "time",
+                     Interpolation method = Interpolation::linear)
+            : method{method}
+        {
+            if (drivers.empty()) {
+                throw std::invalid_argument("A Driver_table needs at least one driver.\n");
+            }
+            for (auto const& item : drivers) driver_names.push_back(item.first);
+            std::sort(driver_names.begin(), driver_names.end());
+
+            nrows = drivers.at(driver_names[0]).size();
+            for (auto const& name : driver_names) {
+                if (drivers.at(name).size() != nrows) {
+                    throw std::invalid_argument(
+                        "The driver \"" + name + "\" has " + std::to_string(drivers.at(name).size()) +
+                        " values, but \"" + driver_names[0] + "\" has " + std::to_string(nrows) + ".\n");
+                }
+            }
+            if (nrows < 2) {
+                throw std::invalid_argument("A Driver_table needs at least two rows.\n");
+            }
+
+            if (time_name.empty()) {
+                for (size_t i {0}; i < nrows; ++i) times.push_back(i);
+            }
+            else {
+                auto time = drivers.find(time_name);
+                if (time == drivers.end()) {
+                    throw std::invalid_argument(
+                        "\"" + time_name + "\" was given as the time driver, but there is no "
+                        "driver with that name.\n");
+                }
+                times = time->second;
+            }
+            for (size_t i {1}; i < nrows; ++i) {
+                if (!(times[i] > times[i - 1])) {
+                    throw std::invalid_argument(
+                        "The times of a Driver_table must increase, but row " + std::to_string(i) +
+                        " has time " + std::to_string(times[i]) + ", after " +
+                        std::to_string(times[i - 1]) + ".\n");
+                }
+            }
+
+            spacing = (times.back() - times.front()) / (nrows - 1);
+            uniform = true;
+            for (size_t i {0}; i < nrows && uniform; ++i) {
+                uniform = std::abs(times[i] - (times.front() + i * spacing)) <= 1e-9 * spacing;
+            }
+
+            size_t const n {driver_names.size()};
+            values.resize(nrows * n);
+            for (size_t c {0}; c < n; ++c) {
+                auto const& column = drivers.at(driver_names[c]);
+                for (size_t i {0}; i < nrows; ++i) values[i * n + c] = column[i];
+            }
+            if (method == Interpolation::cubic) {
+                // Slopes at each row: inside, the slope at the row of
+                // the parabola through it and its neighbors (for even
+                // spacing, the centered difference); at the ends, that
+                // of the end interval
+                slopes.resize(nrows * n);
+                for (size_t i {0}; i < nrows; ++i) {
+                    double const h0 {i == 0 ? 0 : times[i] - times[i - 1]};
+                    double const h1 {i + 1 == nrows ? 0 : times[i + 1] - times[i]};
+                    for (size_t c {0}; c < n; ++c) {
+                        double const d0 {i == 0 ? 0 : (values[i * n + c] - values[(i - 1) * n + c]) / h0};
+                        double const d1 {i + 1 == nrows ? 0 : (values[(i + 1) * n + c] - values[i * n + c]) / h1};
+                        slopes[i * n + c] = i == 0 ? d1 : i + 1 == nrows ? d0 : (h1 * d0 + h0 * d1) / (h0 + h1);
+                    }
+                }
+            }
+        }
+
+        Variable_names const& names() const { return driver_names; }
+        size_t rows() const { return nrows; }
+        bool is_uniform() const { return uniform; }
+        Interpolation interpolation() const { return method; }
+
+        // The index i of the interval [times[i], times[i + 1]]
+        // containing `t`, clamped to the first and last intervals
+        size_t interval(double t, Cursor& cursor) const
+        {
+            size_t const last {nrows - 2};
+            size_t i;
+            if (uniform) {
+                double const position {std::floor((t - times.front()) / spacing)};
+                i = position <= 0 ? 0 : position >= last ? last : static_cast<size_t>(position);
+            }
+            else {
+                i = std::min(cursor.interval, last);
+                if (t >= times[i + 1] && i < last) {
+                    ++i;
+                    if (t >= times[i + 1] && i < last) {
+                        i = std::upper_bound(times.begin() + i + 1, times.end() - 1, t) - times.begin() - 1;
+                    }
+                }
+                else if (t < times[i] && i > 0) {
+                    i = std::upper_bound(times.begin() + 1, times.begin() + i, t) - times.begin() - 1;
+                }
+            }
+            // Rounding in the division can put a time on a row in the
+            // interval before it.
+            if (i < last && t >= times[i + 1]) ++i;
+            if (i > 0 && t < times[i]) --i;
+            cursor.interval = i;
+            return i;
+        }
+
+        // Writes the value of each driver (in the order of `names()`)
+        // at `t` to `result`.
+        void values_at(double t, double* result, Cursor& cursor) const
+        {
+            size_t const n {driver_names.size()};
+            size_t const i {interval(t, cursor)};
+            double const* const y0 {&values[i * n]};
+            double const* const y1 {y0 + n};
+            double const h {times[i + 1] - times[i]};
+            double s {(t - times[i]) / h};
+            s = s < 0 ? 0 : s > 1 ? 1 : s;
+
+            switch (method) {
+                case Interpolation::step: {
+                    double const* const y {s >= 1 ? y1 : y0};
+                    for (size_t c {0}; c < n; ++c) result[c] = y[c];
+                    break;
+                }
+                case Interpolation::linear: {
+                    for (size_t c {0}; c < n; ++c) result[c] = y0[c] + s * (y1[c] - y0[c]);
+                    break;
+                }
+                case Interpolation::cubic: {
+                    double const* const m0 {&slopes[i * n]};
+                    double const* const m1 {m0 + n};
+                    double const s2 {s * s}, s3 {s2 * s};
+                    double const h00 {2 * s3 - 3 * s2 + 1}, h01 {-2 * s3 + 3 * s2};
+                    double const h10 {(s3 - 2 * s2 + s) * h}, h11 {(s3 - s2) * h};
+                    for (size_t c {0}; c < n; ++c) {
+                        result[c] = h00 * y0[c] + h10 * m0[c] + h01 * y1[c] + h11 * m1[c];
+                    }
+                    break;
+                }
+            }
+        }
+
+        // As above, without a cursor; for times in no particular order
+        void values_at(double t, double* result) const
+        {
+            Cursor cursor {uniform ? 0 : static_cast<size_t>(
+                std::upper_bound(times.begin() + 1, times.end() - 1, t) - times.begin() - 1)};
+            values_at(t, result, cursor);
+        }
+
+        std::vector<double> values_at(double t) const
+        {
+            std::vector<double> result(driver_names.size());
+            values_at(t, result.data());
+            return result;
+        }
+
+       private:
+        Interpolation method;
+        Variable_names driver_names;
+        size_t nrows;
+        std::vector<double> times;
+        double spacing;
+        bool uniform;
+
+        // Row-major: the value of driver c at row i is values[i * n + c].
+        std::vector<double> values;
+        std::vector<double> slopes;
+    };
+
+    /**
+     * Driver values at row numbers, written through pointers.  A
+     * fractional row is interpolated linearly between the rows on
+     * either side, as a Dynamical_system does, and a row before the
+     * first or after the last is taken to be that row.  The columns
+     * are not copied, so the drivers must outlive the Driver_rows.
+     */
+    class Driver_rows
+    {
+       public:
+        // The columns named, in that order.  Throws
+        // std::invalid_argument if one is missing, if they differ in
+        // length, or if they have no rows.
+        Driver_rows(System_drivers const& drivers, Variable_names const& names)
+        {
+            if (drivers.empty()) {
+                throw std::invalid_argument("Driver_rows needs at least one driver.\n");
+            }
+            nrows = drivers.begin()->second.size();
+            if (nrows == 0) {
+                throw std::invalid_argument("Driver_rows needs at least one row of drivers.\n");
+            }
+            for (auto const& name : names) {
+                auto column = drivers.find(name);
+                if (column == drivers.end()) {
+                    throw std::invalid_argument("There is no driver named \"" + name + "\".\n");
+                }
+                if (column->second.size() != nrows) {
+                    throw std::invalid_argument(
+                        "The driver \"" + name + "\" has " + std::to_string(column->second.size()) +
+                        " rows, but the others have " + std::to_string(nrows) + ".\n");
+                }
+                columns.push_back(&column->second);
+            }
+        }
+
+        size_t rows() const { return nrows; }
+
+        // Writes the value of each column at `row` to the matching
+        // element of `slots`.
+        void set(size_t row, std::vector<double*> const& slots) const
+        {
+            row = std::min(row, nrows - 1);
+            for (size_t i {0}; i < columns.size(); ++i) *slots[i] = (*columns[i])[row];
+        }
+
+        void set(double time, std::vector<double*> const& slots) const
+        {
+            double const last {static_cast<double>(nrows - 1)};
+            if (!(time > 0)) return set(size_t {0}, slots);
+            if (!(time < last)) return set(nrows - 1, slots);
+
+            size_t const row {static_cast<size_t>(time)};
+            double const fraction {time - row};
+            for (size_t i {0}; i < columns.size(); ++i) {
+                auto const& column = *columns[i];
+                *slots[i] = column[row] + fraction * (column[row + 1] - column[row]);
+            }
+        }
+
+       private:
+        size_t nrows;
+        std::vector<std::vector<double> const*> columns;
+    };
+}
+
+#endif
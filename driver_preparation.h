@@ -0,0 +1,313 @@
+/**
+ *  Preparing driver data once for many simulations.
+ *
+ *  Driver data usually need some work before a simulation can use
+ *  them: checking that every column is present, of the same length,
+ *  and finite; converting units (as test_multiple_module_libraries.cpp
+ *  shows, two thermal_time_linear modules may expect time in hours and
+ *  in days, and nothing notices if the drivers are in the wrong one);
+ *  resampling to the model's timestep; and computing drivers derived
+ *  from others.  A Driver_preparation describes these steps, and
+ *  `prepare` carries them out on a set of drivers, giving a
+ *  Prepared_drivers object:
+ *
+ *      BioCro::Driver_preparation preparation;
+ *      preparation.require({"time", "temp"})
+ *          .units("time", "hr").units("temp", "degF")
+ *          .convert("temp", "degC")
+ *          .resample(0.5)
+ *          .derive("warm", {"temp"}, [](std::vector<double> const& x) {
+ *              return x[0] > 20 ? 1.0 : 0.0;
+ *          });
+ *
+ *      BioCro::Prepared_drivers weather {preparation.prepare(raw_drivers)};
+ *
+ *  The steps are always carried out in that order (checks, unit
+ *  conversions, resampling, derived drivers), whatever the order in
+ *  which they are given; derived drivers are computed in the order
+ *  given, so each may use those before it.
+ *
+ *  A Prepared_drivers object can't be changed, and copies of it share
+ *  its data, so one may be given to any number of simulators, on any
+ *  number of threads, by passing `drivers()` where a System_drivers
+ *  object is expected.  (Simulator's own checks of its drivers are
+ *  part of the framework and still run, but they are cheap; the work
+ *  done here is not repeated.)
+ */
+#ifndef DRIVER_PREPARATION_H
+#define DRIVER_PREPARATION_H
+
+#include <cmath>     // for std::isfinite, std::floor
+#include <functional>
+#include <map>
+#include <memory>    // for std::shared_ptr, std::make_shared
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::pair, std::move
+#include <vector>
+
+#include "BioCro.h"
+#include "driver_interpolation.h"
+
+namespace BioCro {
+
+    class Prepared_drivers
+    {
+       public:
+        System_drivers const& drivers() const { return data->drivers; }
+        size_t rows() const { return data->rows; }
+
+        // The spacing of the "time" driver after resampling, or 0 if
+        // the drivers weren't resampled
+        double timestep() const { return data->timestep; }
+
+        // The unit of a driver, or "" if none was given
+        std::string unit(std::string const& name) const
+        {
+            auto found = data->units.find(name);
+            return found == data->units.end() ? "" : found->second;
+        }
+
+       private:
+        friend class Driver_preparation;
+
+        struct Data {
+            System_drivers drivers;
+            std::map<std::string, std::string> units;
+            size_t rows;
+            double timestep;
+        };
+
+        explicit Prepared_drivers(std::shared_ptr<Data const> data) : data{std::move(data)} {}
+
+        std::shared_ptr<Data const> data;
+    };
+
+    namespace preparation_detail {
+        struct Linear_conversion {
+            double factor;
+            double offset;
+        };
+
+        // Conversions as new = factor * old + offset, keyed by the
+        // units converted from and to
+        inline std::map<std::pair<std::string, std::string>, Linear_conversion> const& known_conversions()
+        {
+            static std::map<std::pair<std::string, std::string>, Linear_conversion> const conversions {
+                {{"hr", "day"}, {1.0 / 24, 0}},
+                {{"day", "hr"}, {24, 0}},
+                {{"min", "hr"}, {1.0 / 60, 0}},
+                {{"hr", "min"}, {60, 0}},
+                {{"s", "hr"}, {1.0 / 3600, 0}},
+                {{"hr", "s"}, {3600, 0}},
+                {{"degF", "degC"}, {5.0 / 9, -32 * 5.0 / 9}},
+                {{"degC", "degF"}, {9.0 / 5, 32}},
+                {{"K", "degC"}, {1, -273.15}},
+                {{"degC", "K"}, {1, 273.15}},
+                {{"fraction", "percent"}, {100, 0}},
+                {{"percent", "fraction"}, {0.01, 0}}};
+            return conversions;
+        }
+    }
+
+    class Driver_preparation
+    {
+       public:
+        using Derivation = std::function<double(std::vector<double> const& inputs)>;
+
+        // Drivers that must be present
+        Driver_preparation& require(Variable_names names)
+        {
+            required.insert(required.end(), names.begin(), names.end());
+            return *this;
+        }
+
+        // The unit of a driver as given
+        Driver_preparation& units(std::string name, std::string unit)
+        {
+            given_units[name] = unit;
+            return *this;
+        }
+
+        // Converts a driver to another unit, using a known conversion
+        // from the unit given for it
+        Driver_preparation& convert(std::string name, std::string to_unit)
+        {
+            conversions.push_back({name, to_unit, false, {1, 0}});
+            return *this;
+        }
+
+        // Converts a driver to another unit as new = factor * old + offset
+        Driver_preparation& convert(std::string name, std::string to_unit, double factor, double offset = 0)
+        {
+            conversions.push_back({name, to_unit, true, {factor, offset}});
+            return *this;
+        }
+
+        // Resamples all drivers to times (in the units of `time_name`,
+        // after conversion) spaced by `timestep`, from the first time
+        // to the last
+        Driver_preparation& resample(double timestep,
+                                     Interpolation method = Interpolation::linear,
+                                     std::string time_name = "time")
+        {
+            if (!(timestep > 0)) {
+                throw std::invalid_argument(
+                    "\"" + std::to_string(timestep) + "\" was given as a resampling timestep, "
+                    "but it must be positive.\n");
+            }
+            resample_step = timestep;
+            resample_method = method;
+            resample_time = time_name;
+            return *this;
+        }
+
+        // A driver computed at each row from the values of `inputs`
+        Driver_preparation& derive(std::string name, Variable_names inputs, Derivation function)
+        {
+            derived.push_back({name, inputs, function});
+            return *this;
+        }
+
+        // Carries out the steps, throwing std::invalid_argument if the
+        // drivers fail a check or a step can't be done.
+        Prepared_drivers prepare(System_drivers const& raw) const
+        {
+            auto data = std::make_shared<Prepared_drivers::Data>();
+            check(raw);
+            data->drivers = raw;
+            data->units = given_units;
+            data->rows = raw.empty() ? 0 : raw.begin()->second.size();
+            data->timestep = 0;
+
+            for (auto const& conversion : conversions) convert_driver(conversion, *data);
+
+            if (resample_step > 0) {
+                Driver_table table {data->drivers, resample_time, resample_method};
+                auto const& times = data->drivers.at(resample_time);
+                double const start {times.front()};
+                size_t const rows {static_cast<size_t>(
+                    std::floor((times.back() - start) / resample_step * (1 + 1e-12))) + 1};
+
+                System_drivers resampled;
+                for (auto const& name : table.names()) resampled[name].resize(rows);
+                std::vector<double> values(table.names().size());
+                Driver_table::Cursor cursor;
+                for (size_t i {0}; i < rows; ++i) {
+                    double const t {start + i * resample_step};
+                    table.values_at(t, values.data(), cursor);
+                    for (size_t c {0}; c < values.size(); ++c) resampled[table.names()[c]][i] = values[c];
+                    // The time itself, without rounding from interpolation
+                    resampled[resample_time][i] = t;
+                }
+                data->drivers = std::move(resampled);
+                data->rows = rows;
+                data->timestep = resample_step;
+            }
+
+            for (auto const& derivation : derived) derive_driver(derivation, *data);
+
+            return Prepared_drivers {std::move(data)};
+        }
+
+       private:
+        struct Conversion {
+            std::string name;
+            std::string to_unit;
+            bool given;
+            preparation_detail::Linear_conversion linear;
+        };
+
+        struct Derived_driver {
+            std::string name;
+            Variable_names inputs;
+            Derivation function;
+        };
+
+        Variable_names required;
+        std::map<std::string, std::string> given_units;
+        std::vector<Conversion> conversions;
+        double resample_step {0};
+        Interpolation resample_method {Interpolation::linear};
+        std::string resample_time {"time"};
+        std::vector<Derived_driver> derived;
+
+        void check(System_drivers const& raw) const
+        {
+            for (auto const& name : required) {
+                if (!raw.count(name)) {
+                    throw std::invalid_argument(
+                        "\"" + name + "\" is a required driver, but it wasn't given.\n");
+                }
+            }
+            if (raw.empty()) return;
+            size_t const rows {raw.begin()->second.size()};
+            for (auto const& item : raw) {
+                if (item.second.size() != rows) {
+                    throw std::invalid_argument(
+                        "The driver \"" + item.first + "\" has " + std::to_string(item.second.size()) +
+                        " values, but \"" + raw.begin()->first + "\" has " + std::to_string(rows) + ".\n");
+                }
+                for (size_t i {0}; i < rows; ++i) {
+                    if (!std::isfinite(item.second[i])) {
+                        throw std::invalid_argument(
+                            "The driver \"" + item.first + "\" has the value " +
+                            std::to_string(item.second[i]) + " at row " + std::to_string(i) + ".\n");
+                    }
+                }
+            }
+        }
+
+        void convert_driver(Conversion const& conversion, Prepared_drivers::Data& data) const
+        {
+            auto column = data.drivers.find(conversion.name);
+            if (column == data.drivers.end()) {
+                throw std::invalid_argument(
+                    "\"" + conversion.name + "\" was given as a driver to convert, but it "
+                    "wasn't given.\n");
+            }
+            preparation_detail::Linear_conversion linear {conversion.linear};
+            if (!conversion.given) {
+                std::string const from {data.units.count(conversion.name) ? data.units.at(conversion.name) : ""};
+                auto const& known = preparation_detail::known_conversions();
+                auto found = known.find({from, conversion.to_unit});
+                if (found == known.end()) {
+                    throw std::invalid_argument(
+                        "The driver \"" + conversion.name + "\" can't be converted from \"" + from +
+                        "\" to \"" + conversion.to_unit + "\"; no conversion between them is known.\n");
+                }
+                linear = found->second;
+            }
+            for (double& value : column->second) value = linear.factor * value + linear.offset;
+            data.units[conversion.name] = conversion.to_unit;
+        }
+
+        void derive_driver(Derived_driver const& derivation, Prepared_drivers::Data& data) const
+        {
+            if (data.drivers.count(derivation.name)) {
+                throw std::invalid_argument(
+                    "\"" + derivation.name + "\" was given as the name of a derived driver, but "
+                    "there is already a driver with that name.\n");
+            }
+            std::vector<std::vector<double> const*> inputs;
+            for (auto const& name : derivation.inputs) {
+                auto column = data.drivers.find(name);
+                if (column == data.drivers.end()) {
+                    throw std::invalid_argument(
+                        "The derived driver \"" + derivation.name + "\" needs \"" + name +
+                        "\", which isn't a driver.\n");
+                }
+                inputs.push_back(&column->second);
+            }
+            std::vector<double> result(data.rows);
+            std::vector<double> values(inputs.size());
+            for (size_t i {0}; i < data.rows; ++i) {
+                for (size_t c {0}; c < inputs.size(); ++c) values[c] = (*inputs[c])[i];
+                result[i] = derivation.function(values);
+            }
+            data.drivers[derivation.name] = std::move(result);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,347 @@
+/**
+ *  Fixed-step integration without odeint, including symplectic
+ *  methods for conservative systems.
+ *
+ *  The "homemade_euler", "boost_euler", and "boost_rk4" solvers all
+ *  take one step per driver row, but the boost ones go through
+ *  odeint's generic stepper and integrate functions, and all of them
+ *  keep the state at every row in a vector of vectors and then build
+ *  the Simulation_result column by column with `push_back`.  A
+ *  Fixed_step_integrator takes the same steps directly on flat state
+ *  arrays, allocated once, and writes the quantities at each row into
+ *  an Output_columns buffer, which is sized once and may be reused
+ *  for any number of runs:
+ *
+ *      BioCro::Fixed_step_integrator integrator {BioCro::Fixed_step_method::rk4};
+ *      BioCro::Output_columns output;
+ *      integrator.integrate(*system, output);      // as often as needed
+ *      double const* position {output.column("position")};
+ *
+ *  or, when a Simulation_result is wanted,
+ *
+ *      BioCro::Simulation_result result {integrator.integrate(*system)};
+ *
+ *  The system may be a Dynamical_system (dereferenced, as above) or a
+ *  Static_system; anything with the member functions a Simulator's
+ *  solver uses will do.  The methods are
+ *
+ *  - euler: Euler's method, giving the results of "homemade_euler"
+ *    and "boost_euler";
+ *
+ *  - rk2: Heun's method (the explicit trapezoid rule), of second
+ *    order;
+ *
+ *  - ssp_rk3: the strong-stability-preserving third-order method of
+ *    Shu and Osher;
+ *
+ *  - rk4: the classic fourth-order Runge-Kutta method, giving the
+ *    results of "boost_rk4" with an output step size of 1;
+ *
+ *  - stormer_verlet: the Stormer-Verlet (leapfrog) method, of second
+ *    order; and
+ *
+ *  - yoshida4: Yoshida's fourth-order composition of three
+ *    Stormer-Verlet steps.
+ *
+ *  The last two are symplectic: for a conservative system, such as the
+ *  harmonic oscillator, the energy they give oscillates near its true
+ *  value instead of drifting, however long the simulation, so much
+ *  larger steps may be used for the same energy error.  They apply to
+ *  systems whose differential quantities are split into coordinates,
+ *  whose derivatives depend only on the other quantities (such as
+ *  "position", whose derivative is the velocity), and the others, whose
+ *  derivatives depend only on the coordinates (such as "velocity",
+ *  whose derivative is the force per unit mass).  The coordinates are
+ *  named when the integrator is made:
+ *
+ *      BioCro::Fixed_step_integrator integrator {
+ *          BioCro::Fixed_step_method::stormer_verlet, {"position"}};
+ *
+ *  A method may also be chosen by name, as a Simulator's solver is:
+ *
+ *      BioCro::Fixed_step_integrator integrator {
+ *          BioCro::fixed_step_method("yoshida4"), {"position"}};
+ *
+ *  As with those solvers, a step is one driver row; the system scales
+ *  its derivatives by the "timestep" parameter, and drivers are
+ *  interpolated linearly for stages between rows.
+ */
+#ifndef FIXED_STEP_H
+#define FIXED_STEP_H
+
+#include <algorithm> // for std::find
+#include <cmath>     // for std::cbrt
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "BioCro.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    enum class Fixed_step_method {euler, rk2, ssp_rk3, rk4, stormer_verlet, yoshida4};
+
+    inline std::string to_string(Fixed_step_method method)
+    {
+        switch (method) {
+            case Fixed_step_method::euler: return "euler";
+            case Fixed_step_method::rk2: return "rk2";
+            case Fixed_step_method::ssp_rk3: return "ssp_rk3";
+            case Fixed_step_method::rk4: return "rk4";
+            case Fixed_step_method::stormer_verlet: return "stormer_verlet";
+            case Fixed_step_method::yoshida4: return "yoshida4";
+        }
+        return "";
+    }
+
+    // The method with the given name; throws std::out_of_range if
+    // there is none
+    inline Fixed_step_method fixed_step_method(std::string const& name)
+    {
+        for (auto method : {Fixed_step_method::euler, Fixed_step_method::rk2,
+                            Fixed_step_method::ssp_rk3, Fixed_step_method::rk4,
+                            Fixed_step_method::stormer_verlet, Fixed_step_method::yoshida4}) {
+            if (to_string(method) == name) return method;
+        }
+        throw std::out_of_range("\"" + name + "\" was given as a fixed-step method, but there is "
+                                "no method with that name.\n");
+    }
+
+    inline bool is_symplectic(Fixed_step_method method)
+    {
+        return method == Fixed_step_method::stormer_verlet || method == Fixed_step_method::yoshida4;
+    }
+
+    /**
+     * The values of a set of quantities at each of a number of rows,
+     * held column by column in one block of memory.  Resizing to the
+     * same (or a smaller) shape reuses the block.
+     */
+    class Output_columns
+    {
+       public:
+        void resize(Variable_names const& quantity_names, size_t rows)
+        {
+            if (quantity_names != column_names) column_names = quantity_names;
+            nrows = rows;
+            values.resize(column_names.size() * rows);
+        }
+
+        Variable_names const& names() const { return column_names; }
+        size_t rows() const { return nrows; }
+
+        double* column(size_t j) { return values.data() + j * nrows; }
+        double const* column(size_t j) const { return values.data() + j * nrows; }
+
+        // Throws std::out_of_range if there is no column for `name`
+        double const* column(std::string const& name) const
+        {
+            auto found = std::find(column_names.begin(), column_names.end(), name);
+            if (found == column_names.end()) {
+                throw std::out_of_range("\"" + name + "\" is not an output quantity.\n");
+            }
+            return column(static_cast<size_t>(found - column_names.begin()));
+        }
+
+        Simulation_result to_result() const
+        {
+            Simulation_result result;
+            for (size_t j {0}; j < column_names.size(); ++j) {
+                result[column_names[j]].assign(column(j), column(j) + nrows);
+            }
+            return result;
+        }
+
+       private:
+        Variable_names column_names;
+        size_t nrows {0};
+        std::vector<double> values;
+    };
+
+    /**
+     * Integrates systems one driver row per step.  Its state and stage
+     * arrays are kept between runs, so repeated runs of systems of the
+     * same size allocate nothing.  A Fixed_step_integrator must be used
+     * by one thread at a time; it throws std::logic_error if it is used
+     * from two at once.
+     */
+    class Fixed_step_integrator
+    {
+       public:
+        explicit Fixed_step_integrator(Fixed_step_method method = Fixed_step_method::rk4)
+            : method{method}
+        {
+            if (is_symplectic(method)) {
+                throw std::invalid_argument(
+                    "The \"" + to_string(method) + "\" method needs the names of the coordinates.\n");
+            }
+        }
+
+        // For the symplectic methods, `coordinates` names the
+        // differential quantities whose derivatives depend only on the
+        // others; for the rest, it is ignored.
+        Fixed_step_integrator(Fixed_step_method method, Variable_names coordinates)
+            : method{method}, coordinates{std::move(coordinates)}
+        {
+            if (is_symplectic(method) && this->coordinates.empty()) {
+                throw std::invalid_argument(
+                    "The \"" + to_string(method) + "\" method needs the names of the coordinates.\n");
+            }
+        }
+
+        Fixed_step_integrator(Fixed_step_integrator const&) = delete;
+        Fixed_step_integrator& operator=(Fixed_step_integrator const&) = delete;
+
+        Fixed_step_method get_method() const { return method; }
+
+        // Integrates `system` from its current state (a Dynamical_system
+        // must be reset before it is integrated again), writing every
+        // output quantity at each row to `output`
+        template<typename System>
+        void integrate(System& system, Output_columns& output)
+        {
+            Exclusive_use_flag::Guard guard {in_use, "A Fixed_step_integrator"};
+
+            size_t const n {system.get_differential_quantity_names().size()};
+            size_t const rows {system.get_ntimes()};
+            for (auto* v : {&x, &y, &k1, &k2, &k3, &k4}) v->resize(n);
+            system.get_differential_quantities(x);
+            if (is_symplectic(method)) find_coordinates(system.get_differential_quantity_names());
+
+            Variable_names names {system.get_output_quantity_names()};
+            auto pointers = system.get_quantity_access_ptrs(names);
+            output.resize(names, rows);
+
+            for (size_t row {0}; row < rows; ++row) {
+                // Calculating the derivative sets every quantity for
+                // this row, and gives the first stage of each method.
+                system.calculate_derivative(x, k1, row);
+                for (size_t j {0}; j < pointers.size(); ++j) output.column(j)[row] = *pointers[j];
+                if (row + 1 == rows) break;
+                step(system, static_cast<double>(row));
+            }
+        }
+
+        template<typename System>
+        Simulation_result integrate(System& system)
+        {
+            Output_columns output;
+            integrate(system, output);
+            return output.to_result();
+        }
+
+       private:
+        Fixed_step_method const method;
+        Variable_names const coordinates;
+        Exclusive_use_flag in_use;
+
+        // The state, a stage state, and the stage derivatives
+        std::vector<double> x, y, k1, k2, k3, k4;
+
+        // Whether each differential quantity is a coordinate
+        std::vector<char> is_coordinate;
+
+        void find_coordinates(Variable_names const& differential_names)
+        {
+            is_coordinate.assign(differential_names.size(), false);
+            for (auto const& name : coordinates) {
+                auto found = std::find(differential_names.begin(), differential_names.end(), name);
+                if (found == differential_names.end()) {
+                    throw std::invalid_argument(
+                        "\"" + name + "\" was given as a coordinate, but it is not a differential "
+                        "quantity of the system.\n");
+                }
+                is_coordinate[found - differential_names.begin()] = true;
+            }
+            if (coordinates.size() == differential_names.size()) {
+                throw std::invalid_argument(
+                    "Every differential quantity was given as a coordinate, but the \"" +
+                    to_string(method) + "\" method needs some that are not.\n");
+            }
+        }
+
+        // Alternately advances the coordinates (a drift) by c[0] of
+        // their derivatives, the others (a kick) by d[0] of theirs,
+        // the coordinates by c[1], and so on, ending with a drift.
+        // Each derivative is calculated after the last change to the
+        // other part of the state, at the time reached by the drifts;
+        // the first uses k1.
+        template<typename System>
+        void drift_and_kick(System& system, double t,
+                            std::initializer_list<double> c, std::initializer_list<double> d)
+        {
+            size_t const n {x.size()};
+            auto drift = c.begin();
+            auto kick = d.begin();
+            double time {t};
+            std::vector<double>* k {&k1};
+            while (true) {
+                for (size_t i {0}; i < n; ++i) if (is_coordinate[i]) x[i] += *drift * (*k)[i];
+                time += *drift++;
+                if (kick == d.end()) break;
+
+                system.calculate_derivative(x, k2, time);
+                for (size_t i {0}; i < n; ++i) if (!is_coordinate[i]) x[i] += *kick * k2[i];
+                ++kick;
+
+                system.calculate_derivative(x, k3, time);
+                k = &k3;
+            }
+        }
+
+        // Advances x by one row from time t, given k1 at (x, t)
+        template<typename System>
+        void step(System& system, double t)
+        {
+            size_t const n {x.size()};
+            switch (method) {
+                case Fixed_step_method::euler:
+                    for (size_t i {0}; i < n; ++i) x[i] += k1[i];
+                    break;
+
+                case Fixed_step_method::rk2:
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + k1[i];
+                    system.calculate_derivative(y, k2, t + 1);
+                    for (size_t i {0}; i < n; ++i) x[i] += 0.5 * (k1[i] + k2[i]);
+                    break;
+
+                case Fixed_step_method::ssp_rk3:
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + k1[i];
+                    system.calculate_derivative(y, k2, t + 1);
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + 0.25 * (k1[i] + k2[i]);
+                    system.calculate_derivative(y, k3, t + 0.5);
+                    for (size_t i {0}; i < n; ++i) x[i] += (k1[i] + k2[i] + 4 * k3[i]) / 6;
+                    break;
+
+                case Fixed_step_method::rk4:
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + 0.5 * k1[i];
+                    system.calculate_derivative(y, k2, t + 0.5);
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + 0.5 * k2[i];
+                    system.calculate_derivative(y, k3, t + 0.5);
+                    for (size_t i {0}; i < n; ++i) y[i] = x[i] + k3[i];
+                    system.calculate_derivative(y, k4, t + 1);
+                    for (size_t i {0}; i < n; ++i) x[i] += (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]) / 6;
+                    break;
+
+                case Fixed_step_method::stormer_verlet:
+                    drift_and_kick(system, t, {0.5, 0.5}, {1});
+                    break;
+
+                case Fixed_step_method::yoshida4: {
+                    // A Stormer-Verlet step of w1, one of w0 (backward),
+                    // and another of w1
+                    double const w1 {1 / (2 - std::cbrt(2.0))};
+                    double const w0 {1 - 2 * w1};
+                    drift_and_kick(system, t, {w1 / 2, (w0 + w1) / 2, (w0 + w1) / 2, w1 / 2},
+                                   {w1, w0, w1});
+                    break;
+                }
+            }
+        }
+    };
+}
+
+#endif
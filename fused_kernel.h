@@ -0,0 +1,564 @@
+/**
+ *  Fused evaluation of a fixed set of modules by generated code.
+ *
+ *  Each time a Dynamical_system calculates a derivative, it looks up
+ *  the drivers and differential quantities in its maps by name, then
+ *  makes a virtual `run` call for each module.  For a module set that
+ *  will be evaluated many times, a Fused_system instead writes a C++
+ *  translation unit for it, compiles it into a shared object, and
+ *  loads that as its derivative function (a "kernel").  The kernel
+ *  holds each module as a member of its own concrete class, so the
+ *  calls to `run` are not virtual and the compiler can inline the
+ *  modules' operations, taking them in dependency order.  The
+ *  quantities are passed in and out as flat arrays, copied to and from
+ *  the modules' quantities through pointers resolved when the kernel is
+ *  made, with no lookups by name.
+ *
+ *  Generating the code needs the modules' headers: the module named
+ *  "harmonic_oscillator" is taken to be the class
+ *  `standardBML::harmonic_oscillator` declared in
+ *  `module_library/harmonic_oscillator.h`, as in test_module_object.cpp.
+ *  (The namespace and directory may be changed in the Kernel_options.)
+ *  A module whose operation is defined out of line is called rather
+ *  than inlined, but still without a virtual call.
+ *
+ *  Compiling takes a second or so, so a kernel is compiled once for a
+ *  given set of modules, quantities, and compiler settings, and kept
+ *  in the options' directory as `biocro_kernel_<key>.so`; later
+ *  Fused_systems with the same structure load that file.  Parameter
+ *  values are not compiled in, so changing them doesn't require a new
+ *  kernel.  The key covers the generated source and the compiler
+ *  settings but not the module headers, so the directory should be
+ *  cleared when BioCro is rebuilt.
+ *
+ *  The calculations are those of Dynamical_system::calculate_derivative:
+ *  drivers are taken from the given row (or, for a non-integer time,
+ *  interpolated linearly between rows), direct modules are run, then
+ *  differential modules, and the derivatives are scaled by the
+ *  "timestep" parameter if there is one.
+ */
+#ifndef FUSED_KERNEL_H
+#define FUSED_KERNEL_H
+
+#include <algorithm> // for std::find, std::sort
+#include <atomic>
+#include <cctype>    // for std::isalnum, std::isdigit
+#include <cstdio>    // for std::rename, std::remove
+#include <cerrno>
+#include <cstdlib>   // for std::getenv
+#include <fstream>
+#include <functional> // for std::function
+#include <map>
+#include <memory>    // for std::shared_ptr
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::pair
+#include <vector>
+
+#include <dlfcn.h>     // for dlopen, dlsym
+#include <fcntl.h>     // for open
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for fork, execvp, getpid
+
+#include "BioCro_Extended.h"
+#include "driver_interpolation.h"
+#include "simulation_cache.h"
+
+// The include flags used to compile kernels, normally those used to
+// compile the program (see the Makefile).
+#ifndef BIOCRO_KERNEL_INCLUDES
+#define BIOCRO_KERNEL_INCLUDES "-I ../src -I ../inc"
+#endif
+
+namespace BioCro {
+
+    // The compiler is run directly, not through a shell; the flags are
+    // split into arguments at white space, and paths are passed as is.
+    struct Kernel_options {
+        std::string compiler {"clang++"};
+        std::string compiler_flags {"-std=c++14 -O2 -shared -fPIC"};
+        std::string include_flags {BIOCRO_KERNEL_INCLUDES};
+        std::string module_namespace {"standardBML"};
+        std::string module_header_directory {"module_library"};
+
+        // Where generated sources and compiled kernels are kept.  If
+        // empty, TMPDIR (or /tmp) is used.
+        std::string directory {};
+    };
+
+    namespace kernel_detail {
+
+        // Orders modules so that each comes after those producing its
+        // inputs.  Each module is given as its (inputs, outputs); the
+        // result lists the modules' positions.  Modules not depending
+        // on one another keep their given order.
+        inline std::vector<size_t> dependency_order(
+            std::vector<std::pair<Variable_names, Variable_names>> const& modules)
+        {
+            std::map<std::string, size_t> producer;
+            for (size_t i {0}; i < modules.size(); ++i) {
+                for (auto const& output : modules[i].second) producer[output] = i;
+            }
+
+            std::vector<size_t> order;
+            std::vector<int> mark(modules.size(), 0);  // 0: not seen, 1: in progress, 2: placed
+            std::function<void(size_t)> visit = [&](size_t i) {
+                if (mark[i] == 2) return;
+                if (mark[i] == 1) {
+                    throw std::logic_error(
+                        "The direct modules can't be ordered, since their inputs and "
+                        "outputs form a cycle.\n");
+                }
+                mark[i] = 1;
+                for (auto const& input : modules[i].first) {
+                    auto it = producer.find(input);
+                    if (it != producer.end() && it->second != i) visit(it->second);
+                }
+                mark[i] = 2;
+                order.push_back(i);
+            };
+            for (size_t i {0}; i < modules.size(); ++i) visit(i);
+            return order;
+        }
+
+        inline bool is_identifier(std::string const& name)
+        {
+            if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) return false;
+            for (char c : name) {
+                if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') return false;
+            }
+            return true;
+        }
+
+        inline std::string string_literal(std::string const& s)
+        {
+            std::string literal {"\""};
+            for (char c : s) {
+                if (c == '"' || c == '\\') literal += '\\';
+                literal += c;
+            }
+            return literal + "\"";
+        }
+
+        inline std::string kernel_directory(Kernel_options const& options)
+        {
+            if (!options.directory.empty()) return options.directory;
+            char const* tmpdir {std::getenv("TMPDIR")};
+            return tmpdir && *tmpdir ? tmpdir : "/tmp";
+        }
+
+        // The words of `s`, separated by white space
+        inline std::vector<std::string> split_words(std::string const& s)
+        {
+            std::istringstream in {s};
+            std::vector<std::string> words;
+            std::string word;
+            while (in >> word) words.push_back(word);
+            return words;
+        }
+
+        // Runs the program `arguments[0]` (found on the PATH) with the
+        // rest as its arguments, each passed as is, with its output and
+        // errors written to the file `log`.  Returns whether it ran and
+        // exited with status 0.
+        inline bool run_command(std::vector<std::string> arguments, std::string const& log)
+        {
+            std::vector<char*> argv;
+            for (auto& word : arguments) argv.push_back(&word[0]);
+            argv.push_back(nullptr);
+
+            pid_t pid {fork()};
+            if (pid < 0) return false;
+            if (pid == 0) {
+                int output {open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+                if (output >= 0) {
+                    dup2(output, STDOUT_FILENO);
+                    dup2(output, STDERR_FILENO);
+                }
+                execvp(argv[0], argv.data());
+                _exit(127);
+            }
+            int status {0};
+            while (waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) return false;
+            }
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+
+        using Create_function = void* (double const* parameters);
+        using Evaluate_function = void (void* kernel, double const* x, double const* drivers, double* dxdt);
+        using Destroy_function = void (void* kernel);
+    }
+
+    /**
+     * The quantities of a kernel, in the order of the arrays it is
+     * passed, and its modules, in the order it runs them.
+     */
+    struct Kernel_layout {
+        Variable_names differential_quantities;
+        Variable_names parameters;
+        Variable_names drivers;
+        Module_names direct_modules;
+        Module_names differential_modules;
+        std::vector<Variable_names> direct_outputs;  // for each direct module
+    };
+
+    inline Kernel_layout make_kernel_layout(State const& initial_state,
+                                            Parameter_set const& parameters,
+                                            System_drivers const& drivers,
+                                            Module_set const& direct_modules,
+                                            Module_set const& differential_modules)
+    {
+        Kernel_layout layout;
+        for (auto const& item : initial_state) layout.differential_quantities.push_back(item.first);
+        for (auto const& item : parameters) layout.parameters.push_back(item.first);
+        for (auto const& item : drivers) layout.drivers.push_back(item.first);
+
+        // Sorting makes the layout, and so the kernel, independent of
+        // the arrangement of the maps.
+        std::sort(layout.differential_quantities.begin(), layout.differential_quantities.end());
+        std::sort(layout.parameters.begin(), layout.parameters.end());
+        std::sort(layout.drivers.begin(), layout.drivers.end());
+
+        std::vector<std::pair<Variable_names, Variable_names>> io;
+        for (auto const& m : direct_modules) io.emplace_back(m->get_inputs(), m->get_outputs());
+        for (size_t i : kernel_detail::dependency_order(io)) {
+            layout.direct_modules.push_back(direct_modules[i]->get_name());
+            layout.direct_outputs.push_back(io[i].second);
+        }
+        for (auto const& m : differential_modules) layout.differential_modules.push_back(m->get_name());
+        return layout;
+    }
+
+    // The source of the kernel for a layout.  The kernel exports the C
+    // functions biocro_kernel_create, biocro_kernel_evaluate, and
+    // biocro_kernel_destroy.
+    inline std::string generate_kernel_source(Kernel_layout const& layout,
+                                              Kernel_options const& options)
+    {
+        using kernel_detail::string_literal;
+
+        for (auto const* names : {&layout.direct_modules, &layout.differential_modules}) {
+            for (auto const& name : *names) {
+                if (!kernel_detail::is_identifier(name)) {
+                    throw std::invalid_argument(
+                        "\"" + name + "\" was given as a module name, but it can't be used "
+                        "as the name of a class.\n");
+                }
+            }
+        }
+
+        // Every quantity, in slot order: differential quantities,
+        // parameters, drivers, then direct-module outputs.
+        Variable_names quantities;
+        for (auto const* names : {&layout.differential_quantities, &layout.parameters, &layout.drivers}) {
+            quantities.insert(quantities.end(), names->begin(), names->end());
+        }
+        for (auto const& outputs : layout.direct_outputs) {
+            quantities.insert(quantities.end(), outputs.begin(), outputs.end());
+        }
+        auto slot = [&](std::string const& name) {
+            return std::to_string(std::find(quantities.begin(), quantities.end(), name) - quantities.begin());
+        };
+
+        std::ostringstream s;
+        s << "// Generated by fused_kernel.h; do not edit.\n\n";
+
+        std::set<std::string> headers;
+        for (auto const* names : {&layout.direct_modules, &layout.differential_modules}) {
+            for (auto const& name : *names) headers.insert(name);
+        }
+        for (auto const& name : headers) {
+            s << "#include <" << options.module_header_directory << "/" << name << ".h>\n";
+        }
+
+        s << "\nnamespace {\n"
+          << "struct Kernel {\n"
+          << "    state_map quantities;\n"
+          << "    state_map derivatives;\n";
+        for (size_t i {0}; i < layout.direct_modules.size(); ++i) {
+            s << "    " << options.module_namespace << "::" << layout.direct_modules[i]
+              << " direct_" << i << ";\n";
+        }
+        for (size_t i {0}; i < layout.differential_modules.size(); ++i) {
+            s << "    " << options.module_namespace << "::" << layout.differential_modules[i]
+              << " differential_" << i << ";\n";
+        }
+        for (size_t i {0}; i < quantities.size(); ++i) {
+            s << "    double* const q_" << i << ";\n";
+        }
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << "    double* const d_" << i << ";\n";
+        }
+
+        // The constructor
+        s << "\n    explicit Kernel(double const* parameters)\n"
+          << "        : quantities{";
+        for (size_t i {0}; i < quantities.size(); ++i) {
+            s << (i ? ", " : "") << "{" << string_literal(quantities[i]) << ", 0}";
+        }
+        s << "},\n          derivatives{";
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << (i ? ", " : "") << "{" << string_literal(layout.differential_quantities[i]) << ", 0}";
+        }
+        s << "}";
+        for (size_t i {0}; i < layout.direct_modules.size(); ++i) {
+            s << ",\n          direct_" << i << "{quantities, &quantities}";
+        }
+        for (size_t i {0}; i < layout.differential_modules.size(); ++i) {
+            s << ",\n          differential_" << i << "{quantities, &derivatives}";
+        }
+        for (size_t i {0}; i < quantities.size(); ++i) {
+            s << ",\n          q_" << i << "{&quantities.at(" << string_literal(quantities[i]) << ")}";
+        }
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << ",\n          d_" << i << "{&derivatives.at("
+              << string_literal(layout.differential_quantities[i]) << ")}";
+        }
+        s << "\n    {\n";
+        for (size_t i {0}; i < layout.parameters.size(); ++i) {
+            s << "        *q_" << slot(layout.parameters[i]) << " = parameters[" << i << "];\n";
+        }
+        s << "    }\n";
+
+        // The derivative
+        s << "\n    void evaluate(double const* x, double const* drivers, double* dxdt)\n"
+          << "    {\n";
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << "        *q_" << slot(layout.differential_quantities[i]) << " = x[" << i << "];\n";
+        }
+        for (size_t i {0}; i < layout.drivers.size(); ++i) {
+            s << "        *q_" << slot(layout.drivers[i]) << " = drivers[" << i << "];\n";
+        }
+        for (size_t i {0}; i < layout.direct_modules.size(); ++i) {
+            s << "        direct_" << i << ".run();\n";
+        }
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << "        *d_" << i << " = 0;\n";
+        }
+        for (size_t i {0}; i < layout.differential_modules.size(); ++i) {
+            s << "        differential_" << i << ".run();\n";
+        }
+        bool has_timestep {std::find(quantities.begin(), quantities.end(), "timestep") != quantities.end()};
+        s << "        double const timestep {" << (has_timestep ? "*q_" + slot("timestep") : "1.0") << "};\n";
+        for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+            s << "        dxdt[" << i << "] = *d_" << i << " * timestep;\n";
+        }
+        s << "    }\n"
+          << "};\n"
+          << "}\n\n"
+          << "extern \"C\" {\n"
+          << "void* biocro_kernel_create(double const* parameters) { return new Kernel{parameters}; }\n"
+          << "void biocro_kernel_evaluate(void* kernel, double const* x, double const* drivers, double* dxdt)\n"
+          << "{\n"
+          << "    static_cast<Kernel*>(kernel)->evaluate(x, drivers, dxdt);\n"
+          << "}\n"
+          << "void biocro_kernel_destroy(void* kernel) { delete static_cast<Kernel*>(kernel); }\n"
+          << "}\n";
+        return s.str();
+    }
+
+    /**
+     * A compiled kernel, loaded from a shared object.
+     */
+    class Compiled_kernel
+    {
+       public:
+        // Compiles `source` unless a kernel compiled from it with the
+        // same settings is already in the options' directory, and
+        // loads it.  Throws std::runtime_error if it can't be compiled
+        // or loaded.
+        Compiled_kernel(std::string const& source, Kernel_options const& options)
+        {
+            std::string key {Key_builder {}
+                                 .add(source)
+                                 .add(options.compiler)
+                                 .add(options.compiler_flags)
+                                 .add(options.include_flags)
+                                 .key()
+                                 .to_string()};
+            std::string directory {kernel_detail::kernel_directory(options)};
+            library_path = directory + "/biocro_kernel_" + key + ".so";
+
+            if (!std::ifstream {library_path}) {
+                compile(source, directory + "/biocro_kernel_" + key, options);
+                compiled = true;
+            }
+
+            void* handle {dlopen(library_path.c_str(), RTLD_NOW | RTLD_LOCAL)};
+            if (!handle) {
+                throw std::runtime_error(
+                    "The kernel " + library_path + " could not be loaded: " + dlerror() + "\n");
+            }
+            create = reinterpret_cast<kernel_detail::Create_function*>(dlsym(handle, "biocro_kernel_create"));
+            evaluate = reinterpret_cast<kernel_detail::Evaluate_function*>(dlsym(handle, "biocro_kernel_evaluate"));
+            destroy = reinterpret_cast<kernel_detail::Destroy_function*>(dlsym(handle, "biocro_kernel_destroy"));
+            if (!create || !evaluate || !destroy) {
+                throw std::runtime_error(
+                    "The kernel " + library_path + " was loaded, but it lacks the kernel functions.\n");
+            }
+        }
+
+        std::string const& path() const { return library_path; }
+
+        // Whether the kernel was compiled, rather than found already
+        // compiled.
+        bool was_compiled() const { return compiled; }
+
+        kernel_detail::Create_function* create {nullptr};
+        kernel_detail::Evaluate_function* evaluate {nullptr};
+        kernel_detail::Destroy_function* destroy {nullptr};
+
+       private:
+        std::string library_path;
+        bool compiled {false};
+
+        // Writes `<base>.cpp` and compiles it to `<base>.so`, by way of
+        // a temporary file so that a partly written library is never
+        // loaded.
+        static void compile(std::string const& source, std::string const& base,
+                            Kernel_options const& options)
+        {
+            static std::atomic<unsigned> count {0};
+            std::string const tag {"." + std::to_string(getpid()) + "." + std::to_string(count++)};
+            std::string const source_path {base + tag + ".cpp"};
+            std::string const temporary {base + tag + ".so"};
+            std::string const log {base + tag + ".log"};
+            {
+                std::ofstream out {source_path};
+                out << source;
+                if (!out) throw std::runtime_error("The kernel source " + source_path + " could not be written.\n");
+            }
+
+            std::vector<std::string> arguments {options.compiler};
+            for (auto const& flags : {options.compiler_flags, options.include_flags}) {
+                for (auto const& word : kernel_detail::split_words(flags)) arguments.push_back(word);
+            }
+#ifdef __APPLE__
+            // Leave the BioCro symbols the kernel uses to be found in
+            // the program that loads it, as ELF linkers do.
+            arguments.push_back("-undefined");
+            arguments.push_back("dynamic_lookup");
+#endif
+            for (auto const& word : {std::string {"-o"}, temporary, source_path}) arguments.push_back(word);
+
+            if (!kernel_detail::run_command(arguments, log)) {
+                std::ostringstream messages;
+                messages << std::ifstream {log}.rdbuf();
+                std::remove(temporary.c_str());
+                std::string command;
+                for (auto const& word : arguments) command += (command.empty() ? "" : " ") + word;
+                throw std::runtime_error(
+                    "The kernel could not be compiled.  The command was\n    " + command +
+                    "\nand the compiler said\n" + messages.str().substr(0, 4000) + "\n");
+            }
+            std::remove(log.c_str());
+            std::rename(source_path.c_str(), (base + ".cpp").c_str());
+            if (std::rename(temporary.c_str(), (base + ".so").c_str()) != 0) {
+                throw std::runtime_error("The kernel " + base + ".so could not be written.\n");
+            }
+        }
+    };
+
+    /**
+     * A dynamical system whose derivative is calculated by a compiled
+     * kernel.  Like a Dynamical_system, it is made from an initial
+     * state, parameters, drivers, and modules, and it must be used by
+     * one thread at a time.
+     */
+    class Fused_system
+    {
+       public:
+        Fused_system(State const& initial_state,
+                     Parameter_set const& parameters,
+                     System_drivers const& drivers,
+                     Module_set const& direct_modules,
+                     Module_set const& differential_modules,
+                     Kernel_options const& options = {})
+            : initial_state{initial_state},
+              layout{make_kernel_layout(initial_state, parameters, drivers,
+                                        direct_modules, differential_modules)},
+              drivers{checked(drivers)},
+              driver_rows{this->drivers, layout.drivers},
+              ntimes{driver_rows.rows()},
+              driver_values(layout.drivers.size())
+        {
+            for (double& value : driver_values) driver_slots.push_back(&value);
+
+            kernel = std::make_shared<Compiled_kernel>(generate_kernel_source(layout, options), options);
+
+            std::vector<double> parameter_values;
+            for (auto const& name : layout.parameters) parameter_values.push_back(parameters.at(name));
+            auto destroy = kernel->destroy;
+            instance = std::shared_ptr<void>(kernel->create(parameter_values.data()), destroy);
+        }
+
+        Fused_system(Fused_system const&) = delete;
+        Fused_system& operator=(Fused_system const&) = delete;
+
+        size_t get_ntimes() const { return ntimes; }
+
+        Variable_names const& get_differential_quantity_names() const
+        {
+            return layout.differential_quantities;
+        }
+
+        template<typename vector_type>
+        void get_differential_quantities(vector_type& x) const
+        {
+            for (size_t i {0}; i < layout.differential_quantities.size(); ++i) {
+                x[i] = initial_state.at(layout.differential_quantities[i]);
+            }
+        }
+
+        template<typename vector_type, typename time_type>
+        void calculate_derivative(vector_type const& x, vector_type& dxdt, time_type const& time)
+        {
+            update_drivers(time);
+            kernel->evaluate(instance.get(), &x[0], driver_values.data(), &dxdt[0]);
+        }
+
+        Compiled_kernel const& get_kernel() const { return *kernel; }
+
+       private:
+        State const initial_state;
+        Kernel_layout const layout;
+        System_drivers const drivers;
+        Driver_rows const driver_rows;
+        size_t const ntimes;
+        std::vector<double> driver_values;
+        std::vector<double*> driver_slots;  // to the elements of driver_values
+        std::shared_ptr<Compiled_kernel> kernel;
+        std::shared_ptr<void> instance;
+
+        // `time` is a row number, or a fractional row.
+        template<typename time_type>
+        void update_drivers(time_type time)
+        {
+            driver_rows.set(time, driver_slots);
+        }
+
+        static System_drivers const& checked(System_drivers const& drivers)
+        {
+            if (drivers.empty()) {
+                throw std::logic_error("A Fused_system needs at least one driver.\n");
+            }
+            size_t const rows {drivers.begin()->second.size()};
+            if (rows == 0) {
+                throw std::logic_error("A Fused_system needs at least one row of drivers.\n");
+            }
+            for (auto const& item : drivers) {
+                if (item.second.size() != rows) {
+                    throw std::logic_error(
+                        "The driver \"" + item.first + "\" has " + std::to_string(item.second.size()) +
+                        " rows, but the others have " + std::to_string(rows) + ".\n");
+                }
+            }
+            return drivers;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ *  Evaluating a single module over many sets of inputs.
+ *
+ *  As test_module_evaluation.cpp shows, running a module outside a
+ *  simulation takes a Variable_settings map of inputs, a map of
+ *  outputs set to zero, and a module made by `create_module`.  Doing
+ *  that for each point of an input grid makes two maps and a module
+ *  each time.  A Module_evaluator makes them once: its module is bound
+ *  to maps it owns, and each evaluation only copies the inputs into
+ *  the map's values (through pointers found when the evaluator is
+ *  made), zeroes the outputs, runs the module, and copies the outputs
+ *  out.
+ *
+ *  Inputs are given as columns, one for each "varying" input named
+ *  when the evaluator is made, and the module's other inputs take the
+ *  fixed values given then:
+ *
+ *      BioCro::Module_evaluator evaluator {
+ *          Module_factory::retrieve("harmonic_oscillator"),
+ *          {"position", "velocity"},
+ *          { {"mass", 5}, {"spring_constant", 7} }};
+ *
+ *      std::vector<std::vector<double>> outputs;
+ *      evaluator.evaluate({positions, velocities}, outputs);
+ *
+ *  after which `outputs[i]` is the column of `output_names()[i]`.
+ *  Resizing the output columns keeps their storage, so if they are
+ *  reused, later batches no larger than the first need no allocation.
+ *
+ *  Output values are set to zero before each evaluation, since
+ *  differential modules add to their outputs.  A Module_evaluator must
+ *  be used by one thread at a time (see thread_safety.h); it throws
+ *  std::logic_error if it is used by two at once.
+ */
+#ifndef MODULE_EVALUATOR_H
+#define MODULE_EVALUATOR_H
+
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "BioCro.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    class Module_evaluator
+    {
+       public:
+        Module_evaluator(Module_creator creator,
+                         Variable_names varying_inputs,
+                         Variable_settings const& fixed_inputs = {})
+            : varying{std::move(varying_inputs)},
+              outputs_names{creator->get_outputs()}
+        {
+            Variable_names module_inputs {creator->get_inputs()};
+            std::set<std::string> required(module_inputs.begin(), module_inputs.end());
+
+            std::set<std::string> seen;
+            for (auto const& name : varying) {
+                if (!required.count(name)) {
+                    throw std::invalid_argument(
+                        "\"" + name + "\" was given as a varying input, but it isn't an "
+                        "input of the \"" + creator->get_name() + "\" module.\n");
+                }
+                if (!seen.insert(name).second || fixed_inputs.count(name)) {
+                    throw std::invalid_argument(
+                        "\"" + name + "\" was given as an input more than once.\n");
+                }
+                inputs[name] = 0;
+            }
+            for (auto const& name : module_inputs) {
+                if (inputs.count(name)) continue;
+                auto fixed = fixed_inputs.find(name);
+                if (fixed == fixed_inputs.end()) {
+                    throw std::invalid_argument(
+                        "The \"" + creator->get_name() + "\" module needs \"" + name +
+                        "\", but it was given neither as a varying nor as a fixed input.\n");
+                }
+                inputs[name] = fixed->second;
+            }
+            for (auto const& name : outputs_names) outputs[name] = 0;
+
+            for (auto const& name : varying) input_slots.push_back(&inputs.at(name));
+            for (auto const& name : outputs_names) output_slots.push_back(&outputs.at(name));
+
+            module = creator->create_module(inputs, &outputs);
+        }
+
+        // The module refers to the maps, so they may not be copied.
+        Module_evaluator(Module_evaluator const&) = delete;
+        Module_evaluator& operator=(Module_evaluator const&) = delete;
+
+        Variable_names const& input_names() const { return varying; }
+        Variable_names const& output_names() const { return outputs_names; }
+
+        // Evaluates the module at `rows` points.  `input_columns[i][j]`
+        // is the value of input i at point j, and the value of output
+        // i there is written to `output_columns[i][j]`.
+        void evaluate(size_t rows, double const* const* input_columns, double* const* output_columns)
+        {
+            Exclusive_use_flag::Guard guard {in_use, "A Module_evaluator"};
+            evaluate_rows(rows, input_columns, output_columns);
+        }
+
+        // As above, with the columns held in vectors, which must be of
+        // the same length.  Output columns are resized to match.
+        void evaluate(std::vector<std::vector<double>> const& input_columns,
+                      std::vector<std::vector<double>>& output_columns)
+        {
+            Exclusive_use_flag::Guard guard {in_use, "A Module_evaluator"};
+            if (input_columns.size() != varying.size()) {
+                throw std::invalid_argument(
+                    std::to_string(input_columns.size()) + " input columns were given, but " +
+                    std::to_string(varying.size()) + " inputs are varied.\n");
+            }
+            size_t const rows {input_columns.empty() ? 0 : input_columns[0].size()};
+            for (size_t i {0}; i < input_columns.size(); ++i) {
+                if (input_columns[i].size() != rows) {
+                    throw std::invalid_argument(
+                        "The column for \"" + varying[i] + "\" has " +
+                        std::to_string(input_columns[i].size()) + " values, but the first has " +
+                        std::to_string(rows) + ".\n");
+                }
+            }
+
+            output_columns.resize(outputs_names.size());
+            for (auto& column : output_columns) column.resize(rows);
+
+            input_pointers.resize(input_columns.size());
+            output_pointers.resize(output_columns.size());
+            for (size_t i {0}; i < input_columns.size(); ++i) input_pointers[i] = input_columns[i].data();
+            for (size_t i {0}; i < output_columns.size(); ++i) output_pointers[i] = output_columns[i].data();
+
+            evaluate_rows(rows, input_pointers.data(), output_pointers.data());
+        }
+
+       private:
+        Variable_names const varying;
+        Variable_names const outputs_names;
+        Variable_settings inputs;
+        Variable_settings outputs;
+        std::vector<double*> input_slots;
+        std::vector<double*> output_slots;
+        std::vector<double const*> input_pointers;
+        std::vector<double*> output_pointers;
+        Module module;
+        Exclusive_use_flag in_use;
+
+        void evaluate_rows(size_t rows, double const* const* input_columns, double* const* output_columns)
+        {
+            size_t const n_in {input_slots.size()};
+            size_t const n_out {output_slots.size()};
+            for (size_t row {0}; row < rows; ++row) {
+                for (size_t i {0}; i < n_in; ++i) *input_slots[i] = input_columns[i][row];
+                for (size_t i {0}; i < n_out; ++i) *output_slots[i] = 0;
+                module->run();
+                for (size_t i {0}; i < n_out; ++i) output_columns[i][row] = *output_slots[i];
+            }
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,302 @@
+/**
+ *  Loading module libraries when they are first used.
+ *
+ *  A program linked with BioCro.so (and, for the multiple-library
+ *  tests, testBML.so) pays at startup for loading every module library
+ *  it was linked with, whether or not its simulations use them.  A
+ *  Module_library instead names a library that is opened with `dlopen`
+ *  the first time one of its modules is asked for, so that a
+ *  short-lived worker loads only the libraries it needs.
+ *
+ *  A library is found by file name: "testBML" is looked for as
+ *  "testBML.so" in each of the search directories and then by the
+ *  dynamic linker's usual search.  If the library is a plugin (see
+ *  module_plugin.h), its modules are those of its module table.
+ *  Otherwise they are those of the
+ *  `<namespace>::module_library::library_entries` creator map that
+ *  every BioCro module library defines, the namespace being the
+ *  last part of the library name unless another is given.  A library
+ *  already linked into the program may be used through the same
+ *  interface by giving its creator map instead.
+ *
+ *  When a library is loaded, its creator map is copied into a sorted
+ *  table, which `retrieve` searches.  Its quantity table (the one
+ *  `module_factory::get_all_quantities` builds on each call) is built
+ *  once, when first asked for.  Loading and building are each done
+ *  once even when several threads ask at the same time, so a
+ *  Module_library may be shared.  Libraries are never closed, since
+ *  the Module_creator pointers handed out point into them.
+ */
+#ifndef MODULE_LOADING_H
+#define MODULE_LOADING_H
+
+#include <algorithm> // for std::lower_bound, std::binary_search
+#include <atomic>
+#include <cstring>   // for std::strcmp
+#include <mutex>     // for std::once_flag, std::call_once
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>   // for std::pair
+#include <vector>
+
+#include <dlfcn.h>   // for dlopen, dlsym, dlerror
+
+#include "BioCro.h"
+#include "module_plugin.h"
+
+namespace BioCro {
+
+    // The extension of module library files.
+    constexpr char const* module_library_file_extension {".so"};
+
+    using Quantity_table = std::unordered_map<std::string, std::vector<std::string>>;
+
+    namespace loading_detail {
+
+        // The names that `<library_namespace>::module_library::library_entries`
+        // may have in a shared object.  With the C++11 string ABI of
+        // libstdc++, its name carries an ABI tag; with the old ABI or
+        // with libc++, it doesn't.
+        inline std::vector<std::string> library_entries_symbols(std::string const& library_namespace)
+        {
+            std::string nested_name {"_ZN"};
+            size_t start {0};
+            while (true) {
+                size_t end {library_namespace.find("::", start)};
+                std::string part {library_namespace.substr(start, end - start)};
+                nested_name += std::to_string(part.size()) + part;
+                if (end == std::string::npos) break;
+                start = end + 2;
+            }
+            nested_name += "14module_library15library_entries";
+            return {nested_name + "B5cxx11E", nested_name + "E"};
+        }
+
+        inline std::string last_dl_error()
+        {
+            char const* message {dlerror()};
+            return message ? message : "unknown error";
+        }
+
+        // The creators of a plugin's module table.  Throws
+        // std::runtime_error if the table was made for another version
+        // of the plugin interface or another C++ standard library.
+        inline creator_map plugin_creators(biocro_module_table const* table,
+                                           std::string const& library_name)
+        {
+            std::string problem;
+            if (!table) {
+                problem = "its module table is missing";
+            }
+            else if (table->version != BIOCRO_MODULE_TABLE_VERSION) {
+                problem = "its module table has version " + std::to_string(table->version) +
+                          " rather than " + std::to_string(BIOCRO_MODULE_TABLE_VERSION);
+            }
+            else if (!table->cxx_library || std::strcmp(table->cxx_library, BIOCRO_CXX_LIBRARY) != 0) {
+                problem = std::string("it was built with ") +
+                          (table->cxx_library ? table->cxx_library : "an unknown library") +
+                          " rather than " BIOCRO_CXX_LIBRARY;
+            }
+            if (!problem.empty()) {
+                throw std::runtime_error(
+                    "The \"" + library_name + "\" plugin was loaded, but " + problem + ".\n");
+            }
+
+            creator_map creators;
+            for (size_t i {0}; i < table->number_of_modules; ++i) {
+                auto const& entry = table->modules[i];
+                if (!entry.name || !entry.creator) {
+                    throw std::runtime_error(
+                        "The \"" + library_name + "\" plugin was loaded, but entry " +
+                        std::to_string(i) + " of its module table is empty.\n");
+                }
+                creators[entry.name] = static_cast<Module_creator>(entry.creator);
+            }
+            return creators;
+        }
+
+        inline bool has_directory(std::string const& file_name)
+        {
+            return file_name.find('/') != std::string::npos;
+        }
+
+        inline std::string file_part(std::string const& path)
+        {
+            return path.substr(path.rfind('/') + 1);
+        }
+    }
+
+    /**
+     * A module library that is loaded the first time one of its
+     * modules, its module names, or its quantity table is asked for.
+     */
+    class Module_library
+    {
+       public:
+        Module_library(std::string library_name,
+                       std::vector<std::string> search_directories = {"."},
+                       std::string library_namespace = "")
+            : library_name{std::move(library_name)},
+              library_namespace{library_namespace.empty()
+                                    ? loading_detail::file_part(this->library_name)
+                                    : std::move(library_namespace)},
+              search_directories{std::move(search_directories)}
+        {
+        }
+
+        // A library linked into the program, given its creator map
+        // (standardBML::module_library::library_entries, say).
+        // Nothing is opened; the table is built when first used.
+        Module_library(std::string library_name, creator_map const& entries)
+            : library_name{std::move(library_name)},
+              library_namespace{},
+              search_directories{},
+              entries{&entries}
+        {
+        }
+
+        Module_library(Module_library const&) = delete;
+        Module_library& operator=(Module_library const&) = delete;
+
+        std::string const& name() const { return library_name; }
+
+        // Whether the table of modules has been built (and, for a
+        // library that isn't linked, the library opened).
+        bool is_loaded() const { return loaded.load(std::memory_order_acquire); }
+
+        // Opens the library, if that hasn't been done, and builds its
+        // table of modules.  Throws std::runtime_error if the library
+        // can't be opened or has no creator map; a later call tries
+        // again.
+        void load()
+        {
+            std::call_once(load_flag, [this]() { load_table(); });
+        }
+
+        Module_creator retrieve(std::string const& module_name)
+        {
+            load();
+            auto it = std::lower_bound(
+                table.begin(), table.end(), module_name,
+                [](std::pair<std::string, Module_creator> const& entry, std::string const& name) {
+                    return entry.first < name;
+                });
+            if (it == table.end() || it->first != module_name) {
+                throw std::out_of_range(
+                    "\"" + module_name + "\" was given as a module name, but no module "
+                    "with that name could be found in the \"" + library_name + "\" library.\n");
+            }
+            return it->second;
+        }
+
+        bool contains(std::string const& module_name)
+        {
+            load();
+            return std::binary_search(
+                module_names.begin(), module_names.end(), module_name);
+        }
+
+        // The names of the modules, in sorted order.
+        Module_names const& get_all_modules()
+        {
+            load();
+            return module_names;
+        }
+
+        // The same table as module_factory::get_all_quantities.
+        Quantity_table const& get_all_quantities()
+        {
+            load();
+            std::call_once(quantities_flag, [this]() {
+                Quantity_table q {{"module_name", {}}, {"quantity_type", {}}, {"quantity_name", {}}};
+                for (auto const& entry : table) {
+                    for (auto const& name : entry.second->get_inputs()) {
+                        q["module_name"].push_back(entry.first);
+                        q["quantity_type"].push_back("input");
+                        q["quantity_name"].push_back(name);
+                    }
+                    for (auto const& name : entry.second->get_outputs()) {
+                        q["module_name"].push_back(entry.first);
+                        q["quantity_type"].push_back("output");
+                        q["quantity_name"].push_back(name);
+                    }
+                }
+                quantities = std::move(q);
+            });
+            return quantities;
+        }
+
+       private:
+        std::string const library_name;
+        std::string const library_namespace;
+        std::vector<std::string> const search_directories;
+
+        creator_map const* entries {nullptr};
+        creator_map plugin_entries;
+        std::vector<std::pair<std::string, Module_creator>> table;
+        Module_names module_names;
+        Quantity_table quantities;
+
+        std::once_flag load_flag;
+        std::once_flag quantities_flag;
+        std::atomic<bool> loaded {false};
+
+        void load_table()
+        {
+            if (!entries) entries = open_library();
+            table.assign(entries->begin(), entries->end());
+            for (auto const& entry : table) module_names.push_back(entry.first);
+            loaded.store(true, std::memory_order_release);
+        }
+
+        creator_map const* open_library()
+        {
+            std::string file_name {library_name + module_library_file_extension};
+
+            std::vector<std::string> candidates;
+            if (!loading_detail::has_directory(library_name)) {
+                for (auto const& directory : search_directories) {
+                    candidates.push_back(directory + "/" + file_name);
+                }
+            }
+            candidates.push_back(file_name);
+
+            void* handle {nullptr};
+            std::string errors;
+            for (auto const& candidate : candidates) {
+                handle = dlopen(candidate.c_str(), RTLD_NOW | RTLD_LOCAL);
+                if (handle) break;
+                errors += "\n    " + loading_detail::last_dl_error();
+            }
+            if (!handle) {
+                throw std::runtime_error(
+                    "\"" + library_name + "\" was given as a module library name, "
+                    "but it could not be loaded:" + errors + "\n");
+            }
+
+            void* get_table {dlsym(handle, BIOCRO_MODULE_TABLE_FUNCTION)};
+            if (get_table) {
+                plugin_entries = loading_detail::plugin_creators(
+                    reinterpret_cast<biocro_module_table_function*>(get_table)(), library_name);
+                return &plugin_entries;
+            }
+
+            // If the program is also linked with the library, the
+            // creator map the library uses may be a copy in the
+            // program (made by a copy relocation), leaving the one in
+            // the library unfilled.  The definition found first in the
+            // global scope is the one in use.
+            for (auto const& symbol : loading_detail::library_entries_symbols(library_namespace)) {
+                void* address {dlsym(RTLD_DEFAULT, symbol.c_str())};
+                if (!address) address = dlsym(handle, symbol.c_str());
+                if (address) return static_cast<creator_map const*>(address);
+            }
+            throw std::runtime_error(
+                "The \"" + library_name + "\" library was loaded, but it has no " +
+                library_namespace + "::module_library::library_entries.\n");
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ *  The interface through which a module library built as a plugin
+ *  tells a program what modules it has.
+ *
+ *  A plugin is a shared object defining the C function
+ *
+ *      biocro_module_table const* biocro_get_module_table(void);
+ *
+ *  which returns a table of the library's module names and creators.
+ *  Because the function has C linkage, its name doesn't depend on the
+ *  library's namespace or on the compiler's name mangling, so a
+ *  program can load a library it knows nothing about (see
+ *  Module_library in module_loading.h and Module_registry in
+ *  module_registry.h).  The table is defined with
+ *  BIOCRO_DEFINE_MODULE_TABLE; for a library whose modules are in the
+ *  usual creator map, the plugin's source need only be
+ *
+ *      #include "module_plugin.h"
+ *      #include "module_library/module_library.h"
+ *
+ *      BIOCRO_DEFINE_MODULE_TABLE(mylibrary::module_library::library_entries)
+ *
+ *  (plugins/testBML_plugin.cpp is such a source).
+ *
+ *  The creators in the table are still C++ objects, so a plugin must
+ *  be built against the same framework headers, and the same C++
+ *  standard library, as the program loading it.  The table records
+ *  both a version number for this interface and the standard library
+ *  it was built with, and a plugin whose table doesn't match is
+ *  refused.
+ */
+#ifndef MODULE_PLUGIN_H
+#define MODULE_PLUGIN_H
+
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint32_t
+#include <vector>
+
+// Changed whenever these structures or the framework's module_creator
+// class change in a way that a plugin built earlier would not match.
+#define BIOCRO_MODULE_TABLE_VERSION 1
+
+// The C++ standard library (and, for libstdc++, the string ABI) in
+// use, since module creators pass std::strings across.
+#if defined(_LIBCPP_VERSION)
+#define BIOCRO_CXX_LIBRARY "libc++"
+#elif defined(_GLIBCXX_USE_CXX11_ABI) && _GLIBCXX_USE_CXX11_ABI
+#define BIOCRO_CXX_LIBRARY "libstdc++/cxx11"
+#else
+#define BIOCRO_CXX_LIBRARY "libstdc++"
+#endif
+
+#define BIOCRO_MODULE_TABLE_FUNCTION "biocro_get_module_table"
+
+extern "C" {
+    struct biocro_module_entry {
+        char const* name;
+        void* creator;  // a module_creator*
+    };
+
+    struct biocro_module_table {
+        uint32_t version;            // BIOCRO_MODULE_TABLE_VERSION
+        char const* cxx_library;     // BIOCRO_CXX_LIBRARY
+        size_t number_of_modules;
+        biocro_module_entry const* modules;
+    };
+
+    typedef biocro_module_table const* biocro_module_table_function(void);
+}
+
+namespace BioCro {
+
+    /**
+     * Holds a biocro_module_table describing the entries of a creator
+     * map.  The names in the table point into the map, which must not
+     * change afterward.
+     */
+    class Module_table_builder
+    {
+       public:
+        template<typename Creator_map>
+        explicit Module_table_builder(Creator_map const& creators)
+        {
+            for (auto const& entry : creators) {
+                entries.push_back({entry.first.c_str(), static_cast<void*>(entry.second)});
+            }
+            table = {BIOCRO_MODULE_TABLE_VERSION, BIOCRO_CXX_LIBRARY,
+                     entries.size(), entries.data()};
+        }
+
+        Module_table_builder(Module_table_builder const&) = delete;
+        Module_table_builder& operator=(Module_table_builder const&) = delete;
+
+        biocro_module_table const* get() const { return &table; }
+
+       private:
+        std::vector<biocro_module_entry> entries;
+        biocro_module_table table;
+    };
+}
+
+// Defines biocro_get_module_table for a plugin whose modules are those
+// of `creator_map`.  The table is made the first time it is asked for.
+#define BIOCRO_DEFINE_MODULE_TABLE(creator_map)                          \
+    extern "C" biocro_module_table const* biocro_get_module_table(void)  \
+    {                                                                    \
+        static BioCro::Module_table_builder const builder {creator_map}; \
+        return builder.get();                                            \
+    }
+
+#endif
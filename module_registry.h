@@ -0,0 +1,149 @@
+/**
+ *  A registry of module libraries chosen at run time.
+ *
+ *  Test_BioCro_library_module_factory (BioCro_Extended.h) can only
+ *  name a library whose header the program was compiled with.  A
+ *  Module_registry instead holds module libraries added while the
+ *  program runs: libraries linked into the program, given by their
+ *  creator maps, and libraries or plugins (module_plugin.h) loaded by
+ *  file name, which are opened when first needed (module_loading.h).
+ *  A module library can then be shipped on its own and used without
+ *  rebuilding the program.
+ *
+ *  A module is retrieved either from a named library or, if no
+ *  library is named, from the first library, in the order they were
+ *  added, that has a module of that name.  (As the
+ *  MultipleModuleLibrariesTest tests show, libraries may have modules
+ *  of the same name.)  Libraries are opened one at a time in that
+ *  order only as far as needed to find the module.
+ *
+ *  A registry may be shared between threads; libraries may be added
+ *  while others are being used.
+ */
+#ifndef MODULE_REGISTRY_H
+#define MODULE_REGISTRY_H
+
+#include <memory>    // for std::unique_ptr
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::pair
+#include <vector>
+
+#include "BioCro.h"
+#include "module_loading.h"
+
+namespace BioCro {
+
+    class Module_registry
+    {
+       public:
+        // Adds a library (or plugin) to be loaded when first needed.
+        Module_library& add(std::string const& library_name,
+                            std::vector<std::string> search_directories = {"."})
+        {
+            return insert(std::unique_ptr<Module_library>{
+                new Module_library{library_name, std::move(search_directories)}});
+        }
+
+        // Adds a library linked into the program, given its creator
+        // map.
+        Module_library& add(std::string const& library_name, creator_map const& entries)
+        {
+            return insert(std::unique_ptr<Module_library>{
+                new Module_library{library_name, entries}});
+        }
+
+        // Adds a library (or plugin) and loads it now, so that any
+        // problem with it is found here rather than at first use.  A
+        // library that can't be loaded isn't added.
+        Module_library& load(std::string const& library_name,
+                             std::vector<std::string> search_directories = {"."})
+        {
+            std::unique_ptr<Module_library> library {
+                new Module_library{library_name, std::move(search_directories)}};
+            library->load();
+            return insert(std::move(library));
+        }
+
+        Module_library& library(std::string const& library_name)
+        {
+            std::lock_guard<std::mutex> lock {libraries_mutex};
+            for (auto const& library : libraries) {
+                if (library->name() == library_name) return *library;
+            }
+            throw std::out_of_range(
+                "\"" + library_name + "\" was given as a module library name, but no "
+                "library with that name has been added to the registry.\n");
+        }
+
+        std::vector<std::string> library_names()
+        {
+            std::vector<std::string> names;
+            for (auto library : snapshot()) names.push_back(library->name());
+            return names;
+        }
+
+        Module_creator retrieve(std::string const& library_name, std::string const& module_name)
+        {
+            return library(library_name).retrieve(module_name);
+        }
+
+        // The module of that name in the first library having one.
+        // Throws std::runtime_error if a library that must be opened
+        // to look for it can't be loaded.
+        Module_creator retrieve(std::string const& module_name)
+        {
+            for (auto library : snapshot()) {
+                if (library->contains(module_name)) return library->retrieve(module_name);
+            }
+            throw std::out_of_range(
+                "\"" + module_name + "\" was given as a module name, but no module "
+                "with that name could be found in any registered library.\n");
+        }
+
+        // The modules of every library, as (library name, module name)
+        // pairs.  This loads every library.
+        std::vector<std::pair<std::string, std::string>> get_all_modules()
+        {
+            std::vector<std::pair<std::string, std::string>> modules;
+            for (auto library : snapshot()) {
+                for (auto const& name : library->get_all_modules()) {
+                    modules.emplace_back(library->name(), name);
+                }
+            }
+            return modules;
+        }
+
+       private:
+        std::vector<std::unique_ptr<Module_library>> libraries;
+        std::mutex libraries_mutex;
+
+        Module_library& insert(std::unique_ptr<Module_library> library)
+        {
+            std::lock_guard<std::mutex> lock {libraries_mutex};
+            for (auto const& existing : libraries) {
+                if (existing->name() == library->name()) {
+                    throw std::invalid_argument(
+                        "\"" + library->name() + "\" was given as a module library name, "
+                        "but a library with that name is already in the registry.\n");
+                }
+            }
+            libraries.push_back(std::move(library));
+            return *libraries.back();
+        }
+
+        // The libraries, in the order they were added.  Each lives as
+        // long as the registry, so the pointers may be used without
+        // holding the lock.
+        std::vector<Module_library*> snapshot()
+        {
+            std::lock_guard<std::mutex> lock {libraries_mutex};
+            std::vector<Module_library*> result;
+            for (auto const& library : libraries) result.push_back(library.get());
+            return result;
+        }
+    };
+}
+
+#endif
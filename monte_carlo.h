@@ -0,0 +1,373 @@
+/**
+ *  A parallel Monte Carlo driver for uncertainty analysis.
+ *
+ *  `run_monte_carlo` draws values for a set of uncertain parameters
+ *  from given distributions, runs one simulation per sample on a
+ *  number of threads, and reduces each run to a Run_summary (see
+ *  reduction.h).  Sample i is drawn from Random_stream(seed, i) (see
+ *  counter_rng.h), so it, and the run made with it, depend only on the
+ *  seed and i: the results are the same for any number of threads or
+ *  batch size, and any single run can be reproduced with
+ *  `draw_sample`.
+ *
+ *  Samples are drawn in batches; a thread claims the next batch with a
+ *  single atomic increment, draws all of its samples, and then runs
+ *  them.
+ */
+#ifndef MONTE_CARLO_H
+#define MONTE_CARLO_H
+
+#include <algorithm> // for std::min, std::max
+#include <atomic>
+#include <cmath>     // for std::exp, std::sqrt, std::erfc, std::log
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>   // for std::pair
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "counter_rng.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+#include "sweep_runner.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    /**
+     * A distribution from which a parameter value can be drawn.
+     */
+    class Distribution
+    {
+       public:
+        static Distribution uniform(double low, double high)
+        {
+            if (!(low <= high)) {
+                throw std::invalid_argument("Distribution::uniform: low must not exceed high.");
+            }
+            return Distribution {Kind::uniform, low, high};
+        }
+
+        static Distribution normal(double mean, double standard_deviation)
+        {
+            check_spread(standard_deviation);
+            return Distribution {Kind::normal, mean, standard_deviation};
+        }
+
+        // The distribution of exp(X), where X is normal with the given
+        // mean and standard deviation.
+        static Distribution lognormal(double log_mean, double log_standard_deviation)
+        {
+            check_spread(log_standard_deviation);
+            return Distribution {Kind::lognormal, log_mean, log_standard_deviation};
+        }
+
+        // A normal distribution restricted to [low, high], drawn by
+        // inverting its distribution function, so that even a window
+        // far out in a tail costs no more than any other.
+        static Distribution truncated_normal(double mean, double standard_deviation,
+                                             double low, double high)
+        {
+            if (!(standard_deviation > 0)) {
+                throw std::invalid_argument(
+                    "Distribution::truncated_normal: the standard deviation must be positive.");
+            }
+            if (!(low < high)) {
+                throw std::invalid_argument(
+                    "Distribution::truncated_normal: low must be less than high.");
+            }
+            Distribution d {Kind::truncated_normal, mean, standard_deviation};
+            d.low = low;
+            d.high = high;
+            return d;
+        }
+
+        static Distribution constant(double value)
+        {
+            return Distribution {Kind::constant, value, 0};
+        }
+
+        double sample(Random_stream& stream) const
+        {
+            switch (kind) {
+                case Kind::uniform: return stream.uniform(a, b);
+                case Kind::normal: return stream.normal(a, b);
+                case Kind::lognormal: return std::exp(stream.normal(a, b));
+                case Kind::truncated_normal: return quantile(stream.uniform());
+                case Kind::constant: return a;
+            }
+            return a;
+        }
+
+        // The value below which a fraction p of the distribution lies,
+        // for 0 < p < 1.  This maps a point of the unit interval (from a
+        // Latin hypercube or Sobol design; see sensitivity.h) to a
+        // parameter value.
+        double quantile(double p) const
+        {
+            switch (kind) {
+                case Kind::uniform: return a + (b - a) * p;
+                case Kind::normal: return a + b * standard_normal_quantile(p);
+                case Kind::lognormal: return std::exp(a + b * standard_normal_quantile(p));
+                case Kind::truncated_normal: {
+                    // Phi^-1(Phi(alpha) + p (Phi(beta) - Phi(alpha))).  A
+                    // window above the mean is reflected into the lower
+                    // tail, where Phi is small and so keeps its
+                    // precision.
+                    double alpha {(low - a) / b};
+                    double beta {(high - a) / b};
+                    if (alpha > 0) {
+                        double lower {standard_normal_cdf(-beta)};
+                        double upper {standard_normal_cdf(-alpha)};
+                        double z {standard_normal_quantile(upper - p * (upper - lower))};
+                        return std::min(std::max(a - b * z, low), high);
+                    }
+                    double lower {standard_normal_cdf(alpha)};
+                    double upper {standard_normal_cdf(beta)};
+                    double x {a + b * standard_normal_quantile(lower + p * (upper - lower))};
+                    return std::min(std::max(x, low), high);
+                }
+                case Kind::constant: return a;
+            }
+            return a;
+        }
+
+        static double standard_normal_cdf(double x)
+        {
+            return 0.5 * std::erfc(-x / std::sqrt(2.0));
+        }
+
+        // Acklam's rational approximation, refined by one step of
+        // Halley's method; accurate to about 1e-15.
+        static double standard_normal_quantile(double p)
+        {
+            if (p <= 0) return -std::numeric_limits<double>::infinity();
+            if (p >= 1) return std::numeric_limits<double>::infinity();
+
+            constexpr double a[] {-3.969683028665376e+01, 2.209460984245205e+02,
+                                  -2.759285104469687e+02, 1.383577518672690e+02,
+                                  -3.066479806614716e+01, 2.506628277459239e+00};
+            constexpr double b[] {-5.447609879822406e+01, 1.615858368580409e+02,
+                                  -1.556989798598866e+02, 6.680131188771972e+01,
+                                  -1.328068155288572e+01};
+            constexpr double c[] {-7.784894002430293e-03, -3.223964580411365e-01,
+                                  -2.400758277161838e+00, -2.549732539343734e+00,
+                                  4.374664141464968e+00, 2.938163982698783e+00};
+            constexpr double d[] {7.784695709041462e-03, 3.224671290700398e-01,
+                                  2.445134137142996e+00, 3.754408661907416e+00};
+            constexpr double p_low {0.02425};
+
+            double x;
+            if (p < p_low || p > 1 - p_low) {
+                double q {std::sqrt(-2 * std::log(p < p_low ? p : 1 - p))};
+                x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                    ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+                if (p > 1 - p_low) x = -x;
+            } else {
+                double q {p - 0.5};
+                double r {q * q};
+                x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+                    (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+            }
+
+            constexpr double sqrt_two_pi {2.506628274631000502415765284811};
+            double e {standard_normal_cdf(x) - p};
+            double u {e * sqrt_two_pi * std::exp(x * x / 2)};
+            return x - u / (1 + x * u / 2);
+        }
+
+       private:
+        enum class Kind { uniform, normal, lognormal, truncated_normal, constant };
+
+        Distribution(Kind kind, double a, double b) : kind{kind}, a{a}, b{b} {}
+
+        static void check_spread(double s)
+        {
+            if (!(s >= 0)) {
+                throw std::invalid_argument("Distribution: a standard deviation can't be negative.");
+            }
+        }
+
+        Kind kind;
+        double a;
+        double b;
+        double low {-std::numeric_limits<double>::infinity()};
+        double high {std::numeric_limits<double>::infinity()};
+    };
+
+    // The uncertain parameters and their distributions, in the order
+    // in which values are drawn.
+    using Parameter_distributions = std::vector<std::pair<std::string, Distribution>>;
+
+    inline Variable_names parameter_names(Parameter_distributions const& distributions)
+    {
+        Variable_names names;
+        for (auto const& d : distributions) names.push_back(d.first);
+        return names;
+    }
+
+    /**
+     * Returns the values of sample `index` for the given seed, one per
+     * parameter in the order given.
+     */
+    inline std::vector<double> draw_sample(Parameter_distributions const& distributions,
+                                           std::uint64_t seed, std::uint64_t index)
+    {
+        Random_stream stream {seed, index};
+        std::vector<double> values;
+        values.reserve(distributions.size());
+        for (auto const& d : distributions) {
+            values.push_back(d.second.sample(stream));
+        }
+        return values;
+    }
+
+    // Draws samples first_index, ..., first_index + count - 1.
+    inline Sweep_points draw_samples(Parameter_distributions const& distributions,
+                                     std::uint64_t seed, std::uint64_t first_index, size_t count)
+    {
+        Sweep_points samples;
+        samples.reserve(count);
+        for (size_t i {0}; i < count; ++i) {
+            samples.push_back(draw_sample(distributions, seed, first_index + i));
+        }
+        return samples;
+    }
+
+    struct Monte_carlo_options {
+        std::uint64_t seed {1};
+        unsigned number_of_threads {std::max(1u, std::thread::hardware_concurrency())};
+        size_t batch_size {64};
+    };
+
+    // Sample statistics of one reduction over the successful runs.
+    struct Summary_statistics {
+        double mean;
+        double standard_deviation;
+        double minimum;
+        double maximum;
+    };
+
+    struct Monte_carlo_result {
+        Sweep_points samples;               // one per run
+        std::vector<Run_summary> summaries; // empty for a failed run
+        std::vector<Run_status> statuses;
+        std::vector<Summary_statistics> statistics;  // one per reduction
+
+        std::vector<size_t> failed_runs() const
+        {
+            std::vector<size_t> failed;
+            for (size_t run {0}; run < statuses.size(); ++run) {
+                if (statuses[run] != Run_status::done) failed.push_back(run);
+            }
+            return failed;
+        }
+    };
+
+    namespace monte_carlo_detail {
+        // Computed in run order so that the result doesn't depend on
+        // how the runs were divided among threads.
+        inline std::vector<Summary_statistics> statistics(Monte_carlo_result const& r,
+                                                          size_t number_of_reductions)
+        {
+            std::vector<Summary_statistics> stats;
+            for (size_t j {0}; j < number_of_reductions; ++j) {
+                // Welford's algorithm
+                double n {0}, mean {0}, m2 {0};
+                double lo {std::numeric_limits<double>::infinity()};
+                double hi {-lo};
+                for (size_t run {0}; run < r.summaries.size(); ++run) {
+                    if (r.statuses[run] != Run_status::done) continue;
+                    double x {r.summaries[run][j]};
+                    n += 1;
+                    double delta {x - mean};
+                    mean += delta / n;
+                    m2 += delta * (x - mean);
+                    lo = std::min(lo, x);
+                    hi = std::max(hi, x);
+                }
+                double nan {std::numeric_limits<double>::quiet_NaN()};
+                stats.push_back(Summary_statistics {
+                    n > 0 ? mean : nan,
+                    n > 1 ? std::sqrt(m2 / (n - 1)) : nan,
+                    n > 0 ? lo : nan,
+                    n > 0 ? hi : nan});
+            }
+            return stats;
+        }
+    }
+
+    /**
+     * Runs `number_of_samples` simulations, each using `spec` with the
+     * uncertain parameters set to values drawn from their
+     * distributions, and returns the reductions of each run along
+     * with summary statistics.  The names of the uncertain parameters
+     * replace `spec.varied_parameters`; like those, each must be one
+     * of `spec.parameters`.  A run that throws is marked failed and
+     * left out of the statistics.
+     */
+    inline Monte_carlo_result run_monte_carlo(
+        Sweep_specification const& spec,
+        Parameter_distributions const& distributions,
+        Reduction_set const& reductions,
+        size_t number_of_samples,
+        Monte_carlo_options const& options = {})
+    {
+        check_parameter_names(spec, parameter_names(distributions), "an uncertain parameter");
+        if (options.number_of_threads == 0 || options.batch_size == 0) {
+            throw std::invalid_argument(
+                "run_monte_carlo: number_of_threads and batch_size must be positive.");
+        }
+
+        Monte_carlo_result result;
+        result.samples.resize(number_of_samples);
+        result.summaries.resize(number_of_samples);
+        result.statuses.assign(number_of_samples, Run_status::pending);
+
+        size_t const number_of_batches {
+            (number_of_samples + options.batch_size - 1) / options.batch_size};
+        std::atomic<size_t> next_batch {0};
+
+        // Each thread writes only to the elements of the runs it
+        // claimed, so no further synchronization is needed.
+        auto work = [&]() {
+            Parameter_set parameters {spec.parameters};
+            for (;;) {
+                size_t batch {next_batch++};
+                if (batch >= number_of_batches) return;
+
+                size_t first {batch * options.batch_size};
+                size_t count {std::min(options.batch_size, number_of_samples - first)};
+                Sweep_points samples {draw_samples(distributions, options.seed, first, count)};
+
+                for (size_t i {0}; i < count; ++i) {
+                    size_t run {first + i};
+                    for (size_t p {0}; p < distributions.size(); ++p) {
+                        parameters[distributions[p].first] = samples[i][p];
+                    }
+                    try {
+                        result.summaries[run] =
+                            make_run_simulator(spec, parameters).run_summary(reductions);
+                        result.statuses[run] = Run_status::done;
+                    } catch (std::exception const&) {
+                        result.statuses[run] = Run_status::failed;
+                    }
+                    result.samples[run] = std::move(samples[i]);
+                }
+            }
+        };
+
+        unsigned number_of_threads {static_cast<unsigned>(
+            std::min<size_t>(options.number_of_threads, std::max<size_t>(number_of_batches, 1)))};
+        run_on_threads(number_of_threads, work);
+
+        result.statistics = monte_carlo_detail::statistics(result, reductions.size());
+        return result;
+    }
+}
+
+#endif
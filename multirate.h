@@ -0,0 +1,381 @@
+/**
+ *  Multirate integration of fast and slow differential modules.
+ *
+ *  In a crop model, some differential quantities (a canopy's energy
+ *  balance, say) change over minutes and others (root biomass, say)
+ *  over days.  A solver taking steps short enough for the first runs
+ *  every module at every one of those steps, though most of them need
+ *  far fewer.  A Multirate_simulator instead splits the differential
+ *  modules into a fast group and a slow group, and at each driver row
+ *
+ *  - runs the slow modules once, giving the change the slow group
+ *    would make over the row; and
+ *
+ *  - takes `substeps` Euler steps of a fraction of the row, at each
+ *    running the fast modules (and only the direct modules they
+ *    depend on, with the drivers interpolated to that time), and
+ *    adding their change together with an equal share of the slow
+ *    group's change.
+ *
+ *  The fast modules so see the slow quantities move steadily across
+ *  the row, and the slow modules see the fast quantities as they are
+ *  at each row.  With one substep, this is Euler's method, and gives
+ *  the results of the "homemade_euler" solver.  Quantities are
+ *  recorded at each row, as a Simulator records them.
+ *
+ *  The groups are either given,
+ *
+ *      BioCro::Multirate_simulator simulator {
+ *          initial_state, parameters, drivers, direct_modules,
+ *          {fast_modules, slow_modules}, 60};
+ *
+ *  or found by partition_by_timescale, which estimates how quickly
+ *  each differential module can change the state: from the change in
+ *  its outputs when each differential quantity is changed slightly,
+ *  the largest sum, over the quantities the module changes, of the
+ *  absolute values of these rates (a bound on the magnitudes of the
+ *  eigenvalues of its part of the Jacobian).  Modules whose timescale
+ *  (the reciprocal of that bound, in rows) is shorter than
+ *  `fast_timescale` rows are put in the fast group:
+ *
+ *      BioCro::Module_partition groups {BioCro::partition_by_timescale(
+ *          initial_state, parameters, drivers, direct_modules, differential_modules)};
+ *
+ *  As with a Static_system, the direct modules must be given in an
+ *  order that puts each after any module producing one of its inputs.
+ */
+#ifndef MULTIRATE_H
+#define MULTIRATE_H
+
+#include <algorithm> // for std::fill, std::max_element
+#include <cmath>     // for std::abs
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "BioCro.h"
+#include "bound_module.h"
+#include "driver_interpolation.h"
+#include "fixed_step.h"     // for Output_columns
+#include "system_check.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    struct Module_partition {
+        Module_set fast;
+        Module_set slow;
+    };
+
+    namespace multirate_detail {
+
+        /**
+         * The quantities and modules of a system whose differential
+         * modules are split into groups, each adding to its own store
+         * of derivatives.
+         */
+        class System
+        {
+           public:
+            System(State const& initial_state,
+                   Parameter_set const& parameters,
+                   System_drivers const& drivers,
+                   Module_set const& direct_modules,
+                   std::vector<Module_set> const& groups)
+                : initial_state{initial_state},
+                  drivers{checked(drivers, initial_state, parameters, direct_modules, groups)},
+                  driver_rows{this->drivers, system_detail::driver_names(drivers)},
+                  quantities{make_quantity_store()}
+            {
+                ntimes = driver_rows.rows();
+
+                for (auto const& item : initial_state) (*quantities)[item.first] = item.second;
+                for (auto const& item : parameters) (*quantities)[item.first] = item.second;
+                for (auto const& item : drivers) (*quantities)[item.first] = item.second[0];
+                for (auto creator : direct_modules) direct.emplace_back(creator, quantities, quantities);
+
+                for (auto const& item : initial_state) {
+                    differential_names.push_back(item.first);
+                    x_slots.push_back(&quantities->at(item.first));
+                }
+                for (auto const& name : system_detail::driver_names(drivers)) {
+                    driver_slots.push_back(&quantities->at(name));
+                }
+                auto timestep = quantities->find("timestep");
+                timestep_slot = timestep == quantities->end() ? &one : &timestep->second;
+
+                for (auto const& group : groups) {
+                    Quantity_store derivatives {make_quantity_store()};
+                    for (auto const& name : differential_names) (*derivatives)[name] = 0;
+                    std::vector<Bound_module> modules;
+                    for (auto creator : group) modules.emplace_back(creator, quantities, derivatives);
+
+                    std::vector<double*> slots;
+                    for (auto const& name : differential_names) slots.push_back(&derivatives->at(name));
+
+                    derivative_stores.push_back(derivatives);
+                    differential.push_back(std::move(modules));
+                    derivative_slots.push_back(slots);
+                    group_direct.push_back(needed_direct_modules(group));
+                }
+
+                for (auto const& item : *quantities) output_names.push_back(item.first);
+                for (auto const& name : output_names) output_slots.push_back(&quantities->at(name));
+            }
+
+            System(System const&) = delete;
+            System& operator=(System const&) = delete;
+
+            size_t get_ntimes() const { return ntimes; }
+            size_t size() const { return x_slots.size(); }
+            Variable_names const& get_differential_quantity_names() const { return differential_names; }
+            Variable_names const& get_output_quantity_names() const { return output_names; }
+            std::vector<double const*> const& get_output_slots() const { return output_slots; }
+
+            double& x(size_t i) { return *x_slots[i]; }
+
+            void reset()
+            {
+                for (size_t i {0}; i < differential_names.size(); ++i) {
+                    *x_slots[i] = initial_state.at(differential_names[i]);
+                }
+            }
+
+            void set_drivers(size_t row) { driver_rows.set(row, driver_slots); }
+
+            // Drivers at a fractional row, interpolated linearly
+            void set_drivers(double time) { driver_rows.set(time, driver_slots); }
+
+            void run_direct()
+            {
+                for (auto const& module : direct) module.run();
+            }
+
+            // Runs the direct modules that the modules of a group depend
+            // on
+            void run_direct(size_t group)
+            {
+                for (size_t i : group_direct[group]) direct[i].run();
+            }
+
+            // The change a group's modules make to each differential
+            // quantity over one row
+            void rates(size_t group, double* r)
+            {
+                auto const& slots = derivative_slots[group];
+                for (double* d : slots) *d = 0;
+                for (auto const& module : differential[group]) module.run();
+                double const timestep {*timestep_slot};
+                for (size_t i {0}; i < slots.size(); ++i) r[i] = *slots[i] * timestep;
+            }
+
+           private:
+            State const initial_state;
+            System_drivers const drivers;
+            Driver_rows const driver_rows;
+            Quantity_store quantities;
+            std::vector<Bound_module> direct;
+            // Kept here as well as in the modules, since a group may
+            // have none
+            std::vector<Quantity_store> derivative_stores;
+            std::vector<std::vector<Bound_module>> differential;
+
+            size_t ntimes;
+            Variable_names differential_names;
+            std::vector<double*> x_slots;
+            std::vector<double*> driver_slots;
+            double const one {1.0};
+            double const* timestep_slot;
+            std::vector<std::vector<double*>> derivative_slots;
+            std::vector<std::vector<size_t>> group_direct;
+            Variable_names output_names;
+            std::vector<double const*> output_slots;
+
+            // The drivers, once the system has been checked
+            static System_drivers const& checked(System_drivers const& drivers,
+                                                 State const& initial_state,
+                                                 Parameter_set const& parameters,
+                                                 Module_set const& direct_modules,
+                                                 std::vector<Module_set> const& groups)
+            {
+                check(initial_state, parameters, drivers, direct_modules, groups);
+                return drivers;
+            }
+
+            // The indices of the direct modules producing, directly or
+            // through others, an input of a module of `group`, in order
+            std::vector<size_t> needed_direct_modules(Module_set const& group) const
+            {
+                std::set<std::string> needed;
+                for (auto creator : group) {
+                    for (auto const& name : creator->get_inputs()) needed.insert(name);
+                }
+                std::vector<bool> used(direct.size(), false);
+                for (size_t i {direct.size()}; i-- > 0;) {
+                    for (auto const& name : direct[i].get_creator()->get_outputs()) {
+                        if (needed.count(name)) used[i] = true;
+                    }
+                    if (used[i]) {
+                        for (auto const& name : direct[i].get_creator()->get_inputs()) needed.insert(name);
+                    }
+                }
+                std::vector<size_t> indices;
+                for (size_t i {0}; i < direct.size(); ++i) {
+                    if (used[i]) indices.push_back(i);
+                }
+                return indices;
+            }
+
+            // Checks the system as a Static_system is checked, taking
+            // the modules of every group together.
+            static void check(State const& initial_state,
+                              Parameter_set const& parameters,
+                              System_drivers const& drivers,
+                              Module_set const& direct_modules,
+                              std::vector<Module_set> const& groups)
+            {
+                auto io = [](Module_creator creator) {
+                    return system_detail::Module_io {
+                        creator->get_name(), creator->get_inputs(), creator->get_outputs()};
+                };
+                std::vector<system_detail::Module_io> direct, differential;
+                for (auto creator : direct_modules) direct.push_back(io(creator));
+                for (auto const& group : groups) {
+                    for (auto creator : group) differential.push_back(io(creator));
+                }
+                system_detail::defined_quantities("A multirate system", initial_state, parameters,
+                                                  drivers, direct, differential);
+            }
+        };
+    }
+
+    /**
+     * Runs a system whose differential modules are split into a fast
+     * and a slow group, taking `substeps` steps of the fast group for
+     * each driver row.  A Multirate_simulator must be used by one thread
+     * at a time; it throws std::logic_error if it is run from two at
+     * once.
+     */
+    class Multirate_simulator
+    {
+       public:
+        Multirate_simulator(State const& initial_state,
+                            Parameter_set const& parameters,
+                            System_drivers const& drivers,
+                            Module_set const& direct_modules,
+                            Module_partition const& differential_modules,
+                            size_t substeps)
+            : system{initial_state, parameters, drivers, direct_modules,
+                     {differential_modules.fast, differential_modules.slow}},
+              substeps{substeps},
+              fast(system.size()),
+              slow(system.size())
+        {
+            if (substeps == 0) {
+                throw std::invalid_argument("A Multirate_simulator needs at least one substep.\n");
+            }
+        }
+
+        size_t get_substeps() const { return substeps; }
+
+        // Runs the simulation, writing every quantity at each row to
+        // `output`
+        void run_simulation(Output_columns& output)
+        {
+            Exclusive_use_flag::Guard guard {in_use, "A Multirate_simulator"};
+
+            size_t const n {system.size()};
+            size_t const rows {system.get_ntimes()};
+            auto const& slots = system.get_output_slots();
+            output.resize(system.get_output_quantity_names(), rows);
+            system.reset();
+
+            for (size_t row {0}; row < rows; ++row) {
+                system.set_drivers(row);
+                system.run_direct();
+                for (size_t j {0}; j < slots.size(); ++j) output.column(j)[row] = *slots[j];
+                if (row + 1 == rows) break;
+
+                system.rates(slow_group, slow.data());
+                for (size_t k {0}; k < substeps; ++k) {
+                    if (k > 0) {
+                        system.set_drivers(row + static_cast<double>(k) / substeps);
+                        system.run_direct(fast_group);
+                    }
+                    system.rates(fast_group, fast.data());
+                    for (size_t i {0}; i < n; ++i) system.x(i) += (fast[i] + slow[i]) / substeps;
+                }
+            }
+        }
+
+        Simulation_result run_simulation()
+        {
+            Output_columns output;
+            run_simulation(output);
+            return output.to_result();
+        }
+
+       private:
+        static size_t const fast_group {0};
+        static size_t const slow_group {1};
+
+        multirate_detail::System system;
+        size_t const substeps;
+        std::vector<double> fast;
+        std::vector<double> slow;
+        Exclusive_use_flag in_use;
+    };
+
+    /**
+     * Splits differential modules into those whose timescale, estimated
+     * at the initial state and first row of drivers, is shorter than
+     * `fast_timescale` rows, and the rest.
+     */
+    inline Module_partition partition_by_timescale(State const& initial_state,
+                                                   Parameter_set const& parameters,
+                                                   System_drivers const& drivers,
+                                                   Module_set const& direct_modules,
+                                                   Module_set const& differential_modules,
+                                                   double fast_timescale = 10)
+    {
+        // Each module in a group of its own
+        std::vector<Module_set> groups;
+        for (auto creator : differential_modules) groups.push_back({creator});
+        multirate_detail::System system {initial_state, parameters, drivers, direct_modules, groups};
+
+        size_t const n {system.size()};
+        std::vector<double> base(n), changed(n), row_sums(n);
+        system.reset();
+        system.set_drivers(size_t {0});
+        system.run_direct();
+
+        Module_partition partition;
+        for (size_t g {0}; g < groups.size(); ++g) {
+            system.rates(g, base.data());
+            std::fill(row_sums.begin(), row_sums.end(), 0);
+            for (size_t j {0}; j < n; ++j) {
+                double const original {system.x(j)};
+                double const delta {1e-6 * (1 + std::abs(original))};
+                system.x(j) = original + delta;
+                system.run_direct(g);
+                system.rates(g, changed.data());
+                for (size_t i {0}; i < n; ++i) row_sums[i] += std::abs(changed[i] - base[i]) / delta;
+                system.x(j) = original;
+            }
+            system.run_direct(g);
+
+            double const rate {*std::max_element(row_sums.begin(), row_sums.end())};
+            if (rate * fast_timescale > 1) {
+                partition.fast.push_back(differential_modules[g]);
+            }
+            else {
+                partition.slow.push_back(differential_modules[g]);
+            }
+        }
+        return partition;
+    }
+}
+
+#endif
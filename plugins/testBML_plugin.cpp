@@ -0,0 +1,8 @@
+// Builds testBML.so's modules into a plugin that a program can load at
+// run time (see module_plugin.h).  The Makefile builds it as
+// testBML_plugin.so, linked with testBML.so.
+
+#include "module_plugin.h"
+#include "testBML/src/module_library/module_library.h" // for testBML::module_library
+
+BIOCRO_DEFINE_MODULE_TABLE(testBML::module_library::library_entries)
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <algorithm> // for std::max
 #include "BioCro.h"
+#include "compact_result.h"
 
 using std::cout;
 using std::endl;
@@ -41,3 +42,16 @@ inline void print_result(const BioCro::Simulation_result &result) {
         cout << endl;
     }
 }
+
+// Prints the time-invariant quantities of a Compact_result once, as
+// name-value pairs, followed by the table of time-varying quantities.
+inline void print_result(const BioCro::Compact_result &result) {
+    for (auto item : result.time_invariant_quantities()) {
+        cout << item.first << ": " << item.second << endl;
+    }
+    cout << endl;
+
+    if (!result.time_varying_quantities().empty()) {
+        print_result(result.time_varying_quantities());
+    }
+}
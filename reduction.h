@@ -0,0 +1,454 @@
+/**
+ *  Per-run summaries computed during integration.
+ *
+ *  Often only a few numbers are wanted from each run (a final
+ *  biomass, a peak leaf area index, the time at which some quantity
+ *  peaks) rather than the full Simulation_result.  A Reduction_set
+ *  declares those numbers:
+ *
+ *      BioCro::Reduction_set reductions {
+ *          { BioCro::Reduction::final_value("Leaf"),
+ *            BioCro::Reduction::maximum("lai"),
+ *            BioCro::Reduction::argmax("lai"),
+ *            BioCro::Reduction::integral("canopy_assimilation_rate") },
+ *          "time"};
+ *
+ *  and `integrate_reduced` computes them as the system is integrated,
+ *  updating each reduction at each time point and keeping nothing
+ *  else, so that the memory used doesn't grow with the length of the
+ *  run.  The result is a Run_summary: one value per reduction, in the
+ *  order given.  Idempotent_simulator::run_summary and an overload of
+ *  serve_sweep (sweep_coordinator.h) do the same for a simulator and a
+ *  batch worker.
+ *
+ *  Times (for argmax, argmin, integral, and value_at) are the values
+ *  of the Reduction_set's time quantity, or, if none is named, the
+ *  integration variable, which counts rows of the drivers.
+ *
+ *  As with integrate_selected, the solvers listed by
+ *  supports_selective_recording are stepped here; for others, the
+ *  full result is computed first and then reduced.
+ */
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <functional>
+#include <limits>    // for std::numeric_limits
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "selective_simulation.h"
+
+namespace BioCro {
+
+    // The values of a Reduction_set for one run.
+    using Run_summary = std::vector<double>;
+
+    /**
+     * One number to be computed from a run.  Reductions are made
+     * with the static member functions; `named` gives one a name
+     * other than its default (for example "maximum(lai)").
+     */
+    class Reduction
+    {
+       public:
+        // The step function of a custom reduction: given the
+        // accumulated value, the time, and the values of the
+        // reduction's quantities at that time (in the order given),
+        // returns the new accumulated value.
+        using Step = std::function<double(double accumulated, double time,
+                                          std::vector<double> const& values)>;
+
+        enum class Kind { final_value, minimum, maximum, argmin, argmax,
+                          integral, value_at, custom };
+
+        static Reduction final_value(std::string quantity)
+        {
+            return Reduction {Kind::final_value, "final_value", {quantity}};
+        }
+
+        static Reduction minimum(std::string quantity)
+        {
+            return Reduction {Kind::minimum, "minimum", {quantity}};
+        }
+
+        static Reduction maximum(std::string quantity)
+        {
+            return Reduction {Kind::maximum, "maximum", {quantity}};
+        }
+
+        // The time at which the quantity first takes its least (or
+        // greatest) value.
+        static Reduction argmin(std::string quantity)
+        {
+            return Reduction {Kind::argmin, "argmin", {quantity}};
+        }
+
+        static Reduction argmax(std::string quantity)
+        {
+            return Reduction {Kind::argmax, "argmax", {quantity}};
+        }
+
+        // The integral of the quantity over time, by the trapezoidal
+        // rule.
+        static Reduction integral(std::string quantity)
+        {
+            return Reduction {Kind::integral, "integral", {quantity}};
+        }
+
+        // The value of the quantity at the given time, interpolated
+        // linearly between time points; NaN if the run doesn't reach
+        // that time.
+        static Reduction value_at(std::string quantity, double time)
+        {
+            Reduction r {Kind::value_at, "value_at", {quantity}};
+            r.at_time = time;
+            r.reduction_name += "@" + std::to_string(time);
+            return r;
+        }
+
+        // A user-defined reduction: starting from `initial_value`,
+        // `step` is applied at each time point.
+        static Reduction custom(std::string name, Variable_names quantities,
+                                double initial_value, Step step)
+        {
+            Reduction r {Kind::custom, "custom", quantities};
+            r.reduction_name = name;
+            r.initial = initial_value;
+            r.step_function = step;
+            return r;
+        }
+
+        Reduction& named(std::string name)
+        {
+            reduction_name = name;
+            return *this;
+        }
+
+        // The step function of a custom reduction can't be compared
+        // with another, so a cache (simulation_cache.h) identifies a
+        // custom reduction by a version string given here, which must
+        // change whenever the function does.  A custom reduction
+        // without one is never cached.
+        Reduction& versioned(std::string version)
+        {
+            version_key = version;
+            return *this;
+        }
+
+        Kind kind() const { return reduction_kind; }
+        std::string const& name() const { return reduction_name; }
+        Variable_names const& quantities() const { return quantity_names; }
+        double time() const { return at_time; }
+        double initial_value() const { return initial; }
+        Step const& step() const { return step_function; }
+        std::string const& version() const { return version_key; }
+
+       private:
+        Reduction(Kind kind, std::string const& kind_name, Variable_names quantities)
+            : reduction_kind{kind}, quantity_names{quantities}
+        {
+            if (quantities.empty()) {
+                throw std::invalid_argument("A " + kind_name + " reduction must name a quantity.");
+            }
+            reduction_name = kind_name + "(" + quantities.front() + ")";
+        }
+
+        Kind reduction_kind;
+        std::string reduction_name;
+        Variable_names quantity_names;
+        double at_time {0};
+        double initial {0};
+        Step step_function;
+        std::string version_key;
+    };
+
+    /**
+     * An ordered collection of reductions and the name of the
+     * quantity giving the time (empty for the integration variable).
+     * `names` gives the names of the values of a Run_summary.
+     */
+    class Reduction_set
+    {
+       public:
+        Reduction_set(std::vector<Reduction> reductions, std::string time_quantity = "")
+            : reductions{reductions}, time_quantity{time_quantity} {}
+
+        size_t size() const { return reductions.size(); }
+
+        Variable_names names() const
+        {
+            Variable_names n;
+            for (Reduction const& r : reductions) n.push_back(r.name());
+            return n;
+        }
+
+        // Pairs the values of a summary with their names.
+        State label(Run_summary const& summary) const
+        {
+            State labeled;
+            for (size_t i {0}; i < reductions.size(); ++i) {
+                labeled[reductions[i].name()] = summary.at(i);
+            }
+            return labeled;
+        }
+
+        std::vector<Reduction> const& items() const { return reductions; }
+        std::string const& time_name() const { return time_quantity; }
+
+       private:
+        std::vector<Reduction> reductions;
+        std::string time_quantity;
+    };
+
+    namespace reduction_detail {
+        constexpr double nan {std::numeric_limits<double>::quiet_NaN()};
+
+        // Updates every reduction of a set from successive time
+        // points.  The quantities the reductions need are gathered
+        // into `values`, one slot per distinct quantity.
+        class Accumulator
+        {
+           public:
+            explicit Accumulator(Reduction_set const& reductions)
+                : reductions{reductions.items()},
+                  time_quantity{reductions.time_name()}
+            {
+                for (Reduction const& r : this->reductions) {
+                    std::vector<size_t> slots;
+                    for (std::string const& q : r.quantities()) slots.push_back(slot(q));
+                    slots_of.push_back(slots);
+                }
+                if (!time_quantity.empty()) time_slot = slot(time_quantity);
+
+                accumulated.resize(this->reductions.size());
+                extreme.resize(this->reductions.size());
+                previous_value.resize(this->reductions.size());
+                for (size_t i {0}; i < this->reductions.size(); ++i) {
+                    Reduction const& r {this->reductions[i]};
+                    switch (r.kind()) {
+                        case Reduction::Kind::integral: accumulated[i] = 0; break;
+                        case Reduction::Kind::custom: accumulated[i] = r.initial_value(); break;
+                        default: accumulated[i] = nan;
+                    }
+                }
+            }
+
+            // The distinct quantities needed, in slot order.
+            Variable_names const& quantities() const { return needed; }
+
+            std::vector<double>& slots() { return values; }
+
+            // Updates each reduction with the values now in the
+            // slots; `t` is the integration variable.
+            void update(double t)
+            {
+                double time {time_quantity.empty() ? t : values[time_slot]};
+                for (size_t i {0}; i < reductions.size(); ++i) {
+                    Reduction const& r {reductions[i]};
+                    double v {values[slots_of[i][0]]};
+                    double& a {accumulated[i]};
+                    switch (r.kind()) {
+                        case Reduction::Kind::final_value:
+                            a = v;
+                            break;
+                        case Reduction::Kind::minimum:
+                            if (first || v < a) a = v;
+                            break;
+                        case Reduction::Kind::maximum:
+                            if (first || v > a) a = v;
+                            break;
+                        case Reduction::Kind::argmin:
+                            if (first || v < extreme[i]) { extreme[i] = v; a = time; }
+                            break;
+                        case Reduction::Kind::argmax:
+                            if (first || v > extreme[i]) { extreme[i] = v; a = time; }
+                            break;
+                        case Reduction::Kind::integral:
+                            if (!first) a += 0.5 * (v + previous_value[i]) * (time - previous_time);
+                            break;
+                        case Reduction::Kind::value_at:
+                            if (time == r.time()) {
+                                a = v;
+                            } else if (!first && previous_time < r.time() && r.time() < time) {
+                                a = previous_value[i] + (v - previous_value[i]) *
+                                    (r.time() - previous_time) / (time - previous_time);
+                            }
+                            break;
+                        case Reduction::Kind::custom: {
+                            std::vector<double>& args {custom_args};
+                            args.clear();
+                            for (size_t s : slots_of[i]) args.push_back(values[s]);
+                            a = r.step()(a, time, args);
+                            break;
+                        }
+                    }
+                    previous_value[i] = v;
+                }
+                previous_time = time;
+                first = false;
+            }
+
+            // The summary.  Reductions needing at least one time point
+            // are NaN if there were none.
+            Run_summary summary() const
+            {
+                if (!first) return accumulated;
+                Run_summary s(reductions.size(), nan);
+                for (size_t i {0}; i < reductions.size(); ++i) {
+                    if (reductions[i].kind() == Reduction::Kind::integral ||
+                        reductions[i].kind() == Reduction::Kind::custom) {
+                        s[i] = accumulated[i];
+                    }
+                }
+                return s;
+            }
+
+           private:
+            size_t slot(std::string const& quantity)
+            {
+                for (size_t i {0}; i < needed.size(); ++i) {
+                    if (needed[i] == quantity) return i;
+                }
+                needed.push_back(quantity);
+                values.push_back(0);
+                return needed.size() - 1;
+            }
+
+            std::vector<Reduction> const& reductions;
+            std::string time_quantity;
+            size_t time_slot {0};
+            Variable_names needed;
+            std::vector<std::vector<size_t>> slots_of;
+            std::vector<double> values;
+
+            Run_summary accumulated;
+            std::vector<double> extreme;
+            std::vector<double> previous_value;
+            double previous_time {0};
+            bool first {true};
+            std::vector<double> custom_args;
+        };
+
+        inline std::out_of_range unknown_quantity(std::string const& name)
+        {
+            return std::out_of_range(
+                "\"" + name + "\" was given as a quantity to reduce, "
+                "but the system has no quantity with that name.\n");
+        }
+
+        // The counterpart of selective_detail::Recorder that reduces
+        // rather than records.
+        class Reducer
+        {
+           public:
+            Reducer(Dynamical_system const& sys, Reduction_set const& reductions)
+                : sys{sys},
+                  accumulator{reductions},
+                  scratch(sys->get_differential_quantity_names().size())
+            {
+                Variable_names available {sys->get_output_quantity_names()};
+                Variable_set available_set(available.begin(), available.end());
+                for (std::string const& name : accumulator.quantities()) {
+                    if (available_set.count(name) == 0) throw unknown_quantity(name);
+                }
+                pointers = sys->get_quantity_access_ptrs(accumulator.quantities());
+            }
+
+            void record(selective_detail::State_vector const& x,
+                        selective_detail::State_vector& dxdt, double t)
+            {
+                sys->calculate_derivative(x, dxdt, t);
+                std::vector<double>& values {accumulator.slots()};
+                for (size_t i {0}; i < pointers.size(); ++i) {
+                    values[i] = *pointers[i];
+                }
+                accumulator.update(t);
+            }
+
+            void record(selective_detail::State_vector const& x, double t)
+            {
+                record(x, scratch, t);
+            }
+
+            Run_summary summary() const { return accumulator.summary(); }
+
+           private:
+            Dynamical_system const& sys;
+            Accumulator accumulator;
+            std::vector<const double*> pointers;
+            selective_detail::State_vector scratch;
+        };
+    }
+
+    /**
+     * Computes the reductions of a Simulation_result that has
+     * already been made.  If the Reduction_set names no time
+     * quantity, row i of the result is taken to be at time
+     * i * `output_step_size`, as it is for a result made by a BioCro
+     * solver (other than "homemade_euler") with that output step
+     * size.  Throws std::out_of_range if a quantity the reductions
+     * need is not in the result.
+     */
+    inline Run_summary reduce_result(Simulation_result const& result,
+                                     Reduction_set const& reductions,
+                                     double output_step_size = 1)
+    {
+        reduction_detail::Accumulator accumulator {reductions};
+        std::vector<std::vector<double> const*> columns;
+        for (std::string const& name : accumulator.quantities()) {
+            auto it = result.find(name);
+            if (it == result.end()) throw reduction_detail::unknown_quantity(name);
+            columns.push_back(&it->second);
+        }
+
+        size_t rows {columns.empty() ? 0 : columns.front()->size()};
+        std::vector<double>& values {accumulator.slots()};
+        for (size_t row {0}; row < rows; ++row) {
+            for (size_t i {0}; i < columns.size(); ++i) {
+                values[i] = columns[i]->at(row);
+            }
+            accumulator.update(row * output_step_size);
+        }
+        return accumulator.summary();
+    }
+
+    /**
+     * Integrates `sys` from its current state using the named solver
+     * and returns the values of the given reductions, computed as
+     * the integration proceeds.  The remaining arguments have the
+     * same meaning as the corresponding Simulator constructor
+     * arguments.  Throws std::out_of_range if a quantity the
+     * reductions need is not a quantity of the system.
+     *
+     * Like `Solver::integrate`, this doesn't reset the system first.
+     */
+    inline Run_summary integrate_reduced(
+        Dynamical_system const& sys,
+        Reduction_set const& reductions,
+        std::string const& ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps)
+    {
+        if (!supports_selective_recording(ode_solver_name)) {
+            return reduce_result(make_ode_solver(ode_solver_name,
+                                                 output_step_size,
+                                                 adaptive_rel_error_tol,
+                                                 adaptive_abs_error_tol,
+                                                 adaptive_max_steps)->integrate(sys),
+                                 reductions, output_step_size);
+        }
+
+        reduction_detail::Reducer reducer {sys, reductions};
+        selective_detail::step_through(sys, reducer, ode_solver_name, output_step_size,
+                                       adaptive_rel_error_tol, adaptive_abs_error_tol,
+                                       adaptive_max_steps);
+        return reducer.summary();
+    }
+}
+
+#endif
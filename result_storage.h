@@ -0,0 +1,582 @@
+/**
+ *  Output-side storage options for simulation results.
+ *
+ *  A Simulation_result holds every quantity as a full-precision
+ *  column of doubles, one value per time point, even when the
+ *  quantity is a parameter that never changes.  A Stored_result
+ *  holds the same information in encoded form: each column may be
+ *  stored at reduced precision (float32 or fixed-point), constant
+ *  columns are stored as a single value, and the remaining columns
+ *  are run-length or delta encoded, whichever is smaller.  Nothing
+ *  here touches the integration itself; a Stored_result is made from
+ *  a Simulation_result after a simulation has run.
+ */
+#ifndef RESULT_STORAGE_H
+#define RESULT_STORAGE_H
+
+#include <algorithm> // for std::all_of, std::equal, std::min
+#include <cmath>     // for std::llround, std::isfinite, std::abs
+#include <cstdint>   // for std::uint8_t, std::uint32_t, std::uint64_t
+#include <cstring>   // for std::memcpy
+#include <istream>
+#include <limits>    // for std::numeric_limits
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "BioCro.h"
+
+namespace BioCro {
+
+    /**
+     * The type used to store the values of a column.  `full_double`
+     * is lossless; `float32` keeps about seven significant digits;
+     * `fixed_point` stores each value as an integer multiple of the
+     * column's resolution.
+     */
+    enum class Value_type : std::uint8_t { full_double, float32, fixed_point };
+
+    /**
+     * How a single column is to be stored.  For example,
+     *
+     *     Column_format { Value_type::fixed_point, 1e-3 }
+     *
+     * stores values rounded to the nearest thousandth.
+     */
+    struct Column_format {
+        Value_type type {Value_type::full_double};
+        double resolution {0}; // used only with fixed_point
+    };
+
+    /**
+     * Options used in making a Stored_result.  Columns not named in
+     * `column_formats` are stored using `default_format`.  The three
+     * flags enable the space-saving layouts; with all of them off,
+     * every value of every column is stored.
+     */
+    struct Storage_options {
+        Column_format default_format {};
+        std::unordered_map<std::string, Column_format> column_formats {};
+        bool elide_constant_columns {true};
+        bool run_length_encoding {true};
+        bool delta_encoding {true};
+
+        Column_format format_for(std::string const& quantity_name) const {
+            auto it = column_formats.find(quantity_name);
+            return it == column_formats.end() ? default_format : it->second;
+        }
+    };
+
+    namespace storage_detail {
+        enum class Layout : std::uint8_t { plain, constant, run_length, delta };
+
+        using Bytes = std::vector<std::uint8_t>;
+
+        // Number of bytes in the stored form of a value of the given
+        // type.  Fixed-point values are variable-length, hence 0.
+        inline int word_width(Value_type type) {
+            return type == Value_type::full_double ? 8
+                 : type == Value_type::float32     ? 4
+                 :                                   0;
+        }
+
+        inline std::uint64_t zigzag(std::int64_t n) {
+            return (static_cast<std::uint64_t>(n) << 1) ^ static_cast<std::uint64_t>(n >> 63);
+        }
+
+        inline std::int64_t unzigzag(std::uint64_t n) {
+            return static_cast<std::int64_t>(n >> 1) ^ -static_cast<std::int64_t>(n & 1);
+        }
+
+        inline void put_varint(Bytes& out, std::uint64_t n) {
+            while (n >= 0x80) {
+                out.push_back(static_cast<std::uint8_t>(n | 0x80));
+                n >>= 7;
+            }
+            out.push_back(static_cast<std::uint8_t>(n));
+        }
+
+        inline std::uint64_t get_varint(Bytes const& in, size_t& pos) {
+            std::uint64_t n {0};
+            for (int shift {0}; shift < 64; shift += 7) {
+                if (pos >= in.size()) {
+                    throw std::runtime_error("Stored_result: truncated column data.");
+                }
+                std::uint8_t byte {in[pos++]};
+                n |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return n;
+            }
+            throw std::runtime_error("Stored_result: malformed column data.");
+        }
+
+        inline void put_fixed(Bytes& out, std::uint64_t word, int width) {
+            for (int i {0}; i < width; ++i) {
+                out.push_back(static_cast<std::uint8_t>(word >> (8 * i)));
+            }
+        }
+
+        inline std::uint64_t get_fixed(Bytes const& in, size_t& pos, int width) {
+            if (pos + width > in.size()) {
+                throw std::runtime_error("Stored_result: truncated column data.");
+            }
+            std::uint64_t word {0};
+            for (int i {0}; i < width; ++i) {
+                word |= static_cast<std::uint64_t>(in[pos++]) << (8 * i);
+            }
+            return word;
+        }
+
+        // Converts a value to the integer "word" actually stored.
+        // For the floating-point types this is the bit pattern; for
+        // fixed_point it is the zigzag-encoded multiple of the
+        // resolution.
+        inline std::uint64_t to_word(double value, Column_format const& format) {
+            switch (format.type) {
+                case Value_type::full_double: {
+                    std::uint64_t bits;
+                    std::memcpy(&bits, &value, sizeof bits);
+                    return bits;
+                }
+                case Value_type::float32: {
+                    float f {static_cast<float>(value)};
+                    std::uint32_t bits;
+                    std::memcpy(&bits, &f, sizeof bits);
+                    return bits;
+                }
+                case Value_type::fixed_point: {
+                    // llround is undefined for NaN and for values
+                    // outside the range of long long; the bound
+                    // (2^62) also keeps the differences used by delta
+                    // encoding within range.
+                    double const scaled {value / format.resolution};
+                    if (!std::isfinite(scaled) || std::abs(scaled) >= 4611686018427387904.0) {
+                        throw std::invalid_argument(
+                            "Stored_result: a fixed_point column can hold only "
+                            "finite values within range of its resolution.");
+                    }
+                    return zigzag(std::llround(scaled));
+                }
+            }
+            throw std::logic_error("Stored_result: unknown value type.");
+        }
+
+        inline double from_word(std::uint64_t word, Column_format const& format) {
+            switch (format.type) {
+                case Value_type::full_double: {
+                    double value;
+                    std::memcpy(&value, &word, sizeof value);
+                    return value;
+                }
+                case Value_type::float32: {
+                    std::uint32_t bits {static_cast<std::uint32_t>(word)};
+                    float f;
+                    std::memcpy(&f, &bits, sizeof f);
+                    return f;
+                }
+                case Value_type::fixed_point:
+                    return unzigzag(word) * format.resolution;
+            }
+            throw std::logic_error("Stored_result: unknown value type.");
+        }
+
+        inline void put_word(Bytes& out, std::uint64_t word, Value_type type) {
+            int width {word_width(type)};
+            if (width == 0) {
+                put_varint(out, word);
+            } else {
+                put_fixed(out, word, width);
+            }
+        }
+
+        inline std::uint64_t get_word(Bytes const& in, size_t& pos, Value_type type) {
+            int width {word_width(type)};
+            return width == 0 ? get_varint(in, pos) : get_fixed(in, pos, width);
+        }
+
+        // Delta step for the floating-point types: the XOR of
+        // successive bit patterns has mostly-zero high bytes (sign,
+        // exponent, and leading mantissa bits agree) and, for values
+        // with short mantissas, mostly-zero low bytes, so we store
+        // only the bytes in between, preceded by a byte giving the
+        // counts of leading and trailing zero bytes.
+        inline void put_xor(Bytes& out, std::uint64_t x, int width) {
+            if (x == 0) {
+                out.push_back(static_cast<std::uint8_t>(width << 4));
+                return;
+            }
+            int trailing {0};
+            while (((x >> (8 * trailing)) & 0xff) == 0) ++trailing;
+            int leading {0};
+            while (((x >> (8 * (width - 1 - leading))) & 0xff) == 0) ++leading;
+            out.push_back(static_cast<std::uint8_t>((leading << 4) | trailing));
+            put_fixed(out, x >> (8 * trailing), width - leading - trailing);
+        }
+
+        inline std::uint64_t get_xor(Bytes const& in, size_t& pos, int width) {
+            if (pos >= in.size()) {
+                throw std::runtime_error("Stored_result: truncated column data.");
+            }
+            std::uint8_t header {in[pos++]};
+            int leading {header >> 4};
+            int trailing {header & 0x0f};
+            if (leading == width && trailing == 0) return 0;
+            if (leading + trailing >= width) {
+                throw std::runtime_error("Stored_result: malformed column data.");
+            }
+            return get_fixed(in, pos, width - leading - trailing) << (8 * trailing);
+        }
+
+        inline Bytes encode(std::vector<std::uint64_t> const& words,
+                            Layout layout, Value_type type) {
+            Bytes out;
+            if (words.empty()) return out;
+            switch (layout) {
+                case Layout::plain:
+                    for (auto w : words) put_word(out, w, type);
+                    break;
+                case Layout::constant:
+                    put_word(out, words[0], type);
+                    break;
+                case Layout::run_length:
+                    for (size_t i {0}; i < words.size();) {
+                        size_t j {i};
+                        while (j < words.size() && words[j] == words[i]) ++j;
+                        put_word(out, words[i], type);
+                        put_varint(out, j - i);
+                        i = j;
+                    }
+                    break;
+                case Layout::delta:
+                    put_word(out, words[0], type);
+                    for (size_t i {1}; i < words.size(); ++i) {
+                        if (type == Value_type::fixed_point) {
+                            put_varint(out, zigzag(unzigzag(words[i]) - unzigzag(words[i - 1])));
+                        } else {
+                            put_xor(out, words[i] ^ words[i - 1], word_width(type));
+                        }
+                    }
+                    break;
+            }
+            return out;
+        }
+
+        inline std::vector<std::uint64_t> decode(Bytes const& in, size_t length,
+                                                 Layout layout, Value_type type) {
+            std::vector<std::uint64_t> words;
+            words.reserve(length);
+            if (length == 0) return words;
+            size_t pos {0};
+            switch (layout) {
+                case Layout::plain:
+                    while (words.size() < length) words.push_back(get_word(in, pos, type));
+                    break;
+                case Layout::constant:
+                    words.assign(length, get_word(in, pos, type));
+                    break;
+                case Layout::run_length:
+                    while (words.size() < length) {
+                        std::uint64_t w {get_word(in, pos, type)};
+                        std::uint64_t run {get_varint(in, pos)};
+                        if (run == 0 || run > length - words.size()) {
+                            throw std::runtime_error("Stored_result: malformed column data.");
+                        }
+                        words.insert(words.end(), run, w);
+                    }
+                    break;
+                case Layout::delta:
+                    words.push_back(get_word(in, pos, type));
+                    while (words.size() < length) {
+                        if (type == Value_type::fixed_point) {
+                            std::int64_t d {unzigzag(get_varint(in, pos))};
+                            words.push_back(zigzag(unzigzag(words.back()) + d));
+                        } else {
+                            words.push_back(words.back() ^ get_xor(in, pos, word_width(type)));
+                        }
+                    }
+                    break;
+            }
+            return words;
+        }
+    }
+
+    /**
+     * A Stored_result is a compact, encoded copy of a
+     * Simulation_result.  It is made with
+     *
+     *     Stored_result stored {result, options};
+     *
+     * and turned back into an ordinary Simulation_result with
+     * `stored.expand()`.  A single column may be recovered with
+     * `stored.column(name)`.  A Stored_result may be written to a
+     * binary stream with `write` and read back with `read`.
+     *
+     * With the default options, storage is lossless: expanding a
+     * Stored_result gives back exactly the values it was made from.
+     */
+    class Stored_result
+    {
+       public:
+        Stored_result() = default;
+
+        explicit Stored_result(Simulation_result const& result,
+                               Storage_options const& options = {})
+        {
+            using namespace storage_detail;
+
+            bool first {true};
+            for (auto const& item : result) {
+                if (first) {
+                    rows = item.second.size();
+                    first = false;
+                } else if (item.second.size() != rows) {
+                    throw std::invalid_argument(
+                        "Stored_result: the columns of a result must all have "
+                        "the same length, but \"" + item.first + "\" does not.");
+                }
+
+                Column_format format {options.format_for(item.first)};
+                if (format.type == Value_type::fixed_point && !(format.resolution > 0)) {
+                    throw std::invalid_argument(
+                        "Stored_result: a fixed_point column (\"" + item.first +
+                        "\") requires a positive resolution.");
+                }
+
+                std::vector<std::uint64_t> words;
+                words.reserve(rows);
+                for (double v : item.second) words.push_back(to_word(v, format));
+
+                Encoded_column column {format, Layout::plain, encode(words, Layout::plain, format.type)};
+
+                bool is_constant {std::all_of(words.begin(), words.end(),
+                                              [&](std::uint64_t w) { return w == words.front(); })};
+                if (options.elide_constant_columns && is_constant) {
+                    column.layout = Layout::constant;
+                    column.bytes = encode(words, Layout::constant, format.type);
+                } else {
+                    for (Layout candidate : {Layout::run_length, Layout::delta}) {
+                        if (candidate == Layout::run_length && !options.run_length_encoding) continue;
+                        if (candidate == Layout::delta && !options.delta_encoding) continue;
+                        Bytes bytes {encode(words, candidate, format.type)};
+                        if (bytes.size() < column.bytes.size()) {
+                            column.layout = candidate;
+                            column.bytes = std::move(bytes);
+                        }
+                    }
+                }
+                columns[item.first] = std::move(column);
+            }
+        }
+
+        // The number of time points in the stored result.
+        size_t number_of_rows() const { return rows; }
+
+        // Decodes a single column.
+        std::vector<double> column(std::string const& quantity_name) const
+        {
+            using namespace storage_detail;
+            Encoded_column const& c {columns.at(quantity_name)};
+            std::vector<std::uint64_t> words {decode(c.bytes, rows, c.layout, c.format.type)};
+            std::vector<double> values;
+            values.reserve(rows);
+            for (auto w : words) values.push_back(from_word(w, c.format));
+            return values;
+        }
+
+        // Decodes every column, giving back an ordinary Simulation_result.
+        Simulation_result expand() const
+        {
+            Simulation_result result;
+            for (auto const& item : columns) {
+                result[item.first] = column(item.first);
+            }
+            return result;
+        }
+
+        // The number of bytes `write` would produce.
+        size_t stored_size() const
+        {
+            size_t size {header_size};
+            for (auto const& item : columns) {
+                size += column_header_size + item.first.size() + item.second.bytes.size();
+            }
+            return size;
+        }
+
+        // The number of bytes needed to hold the values of `result`
+        // as doubles (not counting the column names).
+        static size_t full_size(Simulation_result const& result)
+        {
+            size_t size {0};
+            for (auto const& item : result) {
+                size += item.second.size() * sizeof(double);
+            }
+            return size;
+        }
+
+        void write(std::ostream& out) const
+        {
+            using namespace storage_detail;
+            Bytes header;
+            std::string const m {magic()};
+            header.insert(header.end(), m.begin(), m.end());
+            put_fixed(header, rows, 8);
+            put_fixed(header, columns.size(), 8);
+            write_bytes(out, header);
+
+            for (auto const& item : columns) {
+                Encoded_column const& c {item.second};
+                Bytes column_header;
+                put_fixed(column_header, item.first.size(), 4);
+                column_header.insert(column_header.end(), item.first.begin(), item.first.end());
+                column_header.push_back(static_cast<std::uint8_t>(c.format.type));
+                column_header.push_back(static_cast<std::uint8_t>(c.layout));
+                put_fixed(column_header, to_word(c.format.resolution, {}), 8);
+                put_fixed(column_header, c.bytes.size(), 8);
+                write_bytes(out, column_header);
+                write_bytes(out, c.bytes);
+            }
+            if (!out) {
+                throw std::runtime_error("Stored_result: error writing to stream.");
+            }
+        }
+
+        static Stored_result read(std::istream& in)
+        {
+            using namespace storage_detail;
+            Stored_result stored;
+
+            Bytes header {read_bytes(in, header_size)};
+            std::string const m {magic()};
+            if (!std::equal(m.begin(), m.end(), header.begin())) {
+                throw std::runtime_error("Stored_result: stream does not hold a stored result.");
+            }
+            size_t pos {m.size()};
+            stored.rows = get_fixed(header, pos, 8);
+            size_t number_of_columns {get_fixed(header, pos, 8)};
+
+            // The sizes below come from the stream, so each is checked
+            // before anything is allocated for it.
+            if (stored.rows > max_rows) {
+                throw std::runtime_error("Stored_result: implausible row count.");
+            }
+            if (number_of_columns > remaining(in) / column_header_size) {
+                throw std::runtime_error("Stored_result: unexpected end of stream.");
+            }
+
+            for (size_t i {0}; i < number_of_columns; ++i) {
+                Bytes length_bytes {read_bytes(in, 4)};
+                pos = 0;
+                size_t name_length {get_fixed(length_bytes, pos, 4)};
+                if (name_length > remaining(in)) {
+                    throw std::runtime_error("Stored_result: unexpected end of stream.");
+                }
+                Bytes name_bytes {read_bytes(in, name_length)};
+                std::string name(name_bytes.begin(), name_bytes.end());
+
+                Bytes column_header {read_bytes(in, column_header_size - 4)};
+                pos = 0;
+                std::uint8_t const type_tag {column_header[pos++]};
+                std::uint8_t const layout_tag {column_header[pos++]};
+                if (type_tag > static_cast<std::uint8_t>(Value_type::fixed_point) ||
+                    layout_tag > static_cast<std::uint8_t>(Layout::delta)) {
+                    throw std::runtime_error(
+                        "Stored_result: column \"" + name + "\" has an unknown "
+                        "value type or layout.");
+                }
+                Encoded_column c;
+                c.format.type = static_cast<Value_type>(type_tag);
+                c.layout = static_cast<Layout>(layout_tag);
+                c.format.resolution = from_word(get_fixed(column_header, pos, 8), {});
+                if (c.format.type == Value_type::fixed_point && !(c.format.resolution > 0)) {
+                    throw std::runtime_error(
+                        "Stored_result: fixed_point column \"" + name + "\" has an "
+                        "invalid resolution.");
+                }
+                size_t byte_count {get_fixed(column_header, pos, 8)};
+                if (byte_count > remaining(in)) {
+                    throw std::runtime_error("Stored_result: unexpected end of stream.");
+                }
+                // Plain and delta columns spend at least a byte on
+                // every row, so they can't describe more rows than
+                // they have bytes.
+                if ((c.layout == Layout::plain || c.layout == Layout::delta) &&
+                    stored.rows > byte_count) {
+                    throw std::runtime_error(
+                        "Stored_result: column \"" + name + "\" is too short for "
+                        "its row count.");
+                }
+                c.bytes = read_bytes(in, byte_count);
+                stored.columns[name] = std::move(c);
+            }
+            return stored;
+        }
+
+       private:
+        struct Encoded_column {
+            Column_format format;
+            storage_detail::Layout layout;
+            storage_detail::Bytes bytes;
+        };
+
+        // Identifies a stream written by Stored_result::write.
+        static std::string magic() { return "BCSR"; }
+
+        // magic, row count, column count
+        static constexpr size_t header_size {4 + 8 + 8};
+        // name length, value type, layout, resolution, byte count
+        static constexpr size_t column_header_size {4 + 1 + 1 + 8 + 8};
+
+        // The most rows `read` accepts.  Constant and run-length
+        // columns can describe any number of rows in a few bytes, so
+        // the row count of a corrupt stream is bounded here instead,
+        // far above the million or so rows of a century of hourly
+        // time points.
+        static constexpr size_t max_rows {size_t {1} << 26};
+
+        static void write_bytes(std::ostream& out, storage_detail::Bytes const& bytes)
+        {
+            out.write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+        }
+
+        // The number of bytes left in `in`, or the largest size_t
+        // if it can't tell (as for a pipe).
+        static size_t remaining(std::istream& in)
+        {
+            size_t const unknown {std::numeric_limits<size_t>::max()};
+            std::istream::pos_type const here {in.tellg()};
+            if (here == std::istream::pos_type(-1)) return unknown;
+            in.seekg(0, std::ios::end);
+            std::istream::pos_type const end {in.tellg()};
+            in.clear();
+            in.seekg(here);
+            if (end == std::istream::pos_type(-1) || end < here) return unknown;
+            return static_cast<size_t>(end - here);
+        }
+
+        // Reads `count` bytes a piece at a time, so that a stream
+        // whose length is unknown and which holds fewer bytes than a
+        // corrupt header claims fails before much is allocated.
+        static storage_detail::Bytes read_bytes(std::istream& in, size_t count)
+        {
+            size_t const piece {size_t {1} << 16};
+            storage_detail::Bytes bytes;
+            while (bytes.size() < count) {
+                size_t const start {bytes.size()};
+                size_t const n {std::min(piece, count - start)};
+                bytes.resize(start + n);
+                in.read(reinterpret_cast<char*>(bytes.data() + start), n);
+                if (static_cast<size_t>(in.gcount()) != n) {
+                    throw std::runtime_error("Stored_result: unexpected end of stream.");
+                }
+            }
+            return bytes;
+        }
+
+        size_t rows {0};
+        std::unordered_map<std::string, Encoded_column> columns;
+    };
+}
+
+#endif
@@ -1,13 +1,28 @@
 #ifndef SAFE_SIMULATORS_H
 #define SAFE_SIMULATORS_H
 
+#include <atomic>
+
 #include "BioCro_Extended.h"
+#include "reduction.h"
+#include "selective_simulation.h"
+#include "thread_safety.h"
 
 namespace BioCro {
 
 // Here, we define a version of Simulator that automatically resets
 // the dynamical system member object before running.  Note that we
 // don't bother including the generate_report() member function.
+//
+// If a list of quantities to record is given as the last constructor
+// argument, run_simulation returns only those quantities, and (for
+// the solvers listed by supports_selective_recording) the others are
+// never copied into the result at all.  Simulator, being merely an
+// alias for biocro_simulation, can't offer this option.
+//
+// An Idempotent_simulator owns its dynamical system, so it must not be
+// run by two threads at once; run_simulation throws std::logic_error
+// if it is (see thread_safety.h).
 class Idempotent_simulator
 {
    public:
@@ -23,7 +38,16 @@ class Idempotent_simulator
         double output_step_size,
         double adaptive_rel_error_tol,
         double adaptive_abs_error_tol,
-        int adaptive_max_steps)
+        int adaptive_max_steps,
+        // the quantities to record (all of them, if empty)
+        BioCro::Variable_names recorded_quantities = {})
+        :
+        ode_solver_name{ode_solver_name},
+        output_step_size{output_step_size},
+        adaptive_rel_error_tol{adaptive_rel_error_tol},
+        adaptive_abs_error_tol{adaptive_abs_error_tol},
+        adaptive_max_steps{adaptive_max_steps},
+        recorded_quantities{recorded_quantities}
     {
         // Create the system
         sys = make_dynamical_system(initial_state, parameters,
@@ -42,13 +66,47 @@ class Idempotent_simulator
 
     BioCro::Simulation_result run_simulation()
     {
+        Exclusive_use_flag::Guard guard {in_use, "An Idempotent_simulator"};
         sys->reset();
-        return system_solver->integrate(sys);
+        if (recorded_quantities.empty()) {
+            return system_solver->integrate(sys);
+        }
+        return integrate_selected(sys,
+                                  recorded_quantities,
+                                  ode_solver_name,
+                                  output_step_size,
+                                  adaptive_rel_error_tol,
+                                  adaptive_abs_error_tol,
+                                  adaptive_max_steps);
+    }
+
+    // Runs the simulation but returns only the values of the given
+    // reductions, computed as the simulation runs (see reduction.h).
+    BioCro::Run_summary run_summary(BioCro::Reduction_set const& reductions)
+    {
+        Exclusive_use_flag::Guard guard {in_use, "An Idempotent_simulator"};
+        sys->reset();
+        return integrate_reduced(sys,
+                                 reductions,
+                                 ode_solver_name,
+                                 output_step_size,
+                                 adaptive_rel_error_tol,
+                                 adaptive_abs_error_tol,
+                                 adaptive_max_steps);
     }
 
    private:
     BioCro::Dynamical_system sys;
     BioCro::Solver system_solver;
+
+    std::string ode_solver_name;
+    double output_step_size;
+    double adaptive_rel_error_tol;
+    double adaptive_abs_error_tol;
+    int adaptive_max_steps;
+    BioCro::Variable_names recorded_quantities;
+
+    Exclusive_use_flag in_use;
 };
 
 // An alternative to mimicking Simulator and having to deal with the
@@ -56,6 +114,11 @@ class Idempotent_simulator
 // access the dynamical system's reset function is to store the
 // paramter values used in making a Simulator object and simply
 // remaking the simulator each time we want to run it.
+//
+// Since each run uses a simulator of its own, an
+// Alternate_idempotent_simulator may be run by several threads at
+// once, provided the objects passed to its constructor (which it
+// holds by reference) are left unchanged meanwhile.
 class Alternate_idempotent_simulator
 {
    public:
@@ -127,15 +190,16 @@ class Single_use_simulator : public Simulator
    public:
     BioCro::Simulation_result run_simulation()
     {
-        if (has_been_run) {
+        // The exchange makes the check-and-set atomic, so that of two
+        // threads racing to run the simulator, only one succeeds.
+        if (has_been_run.exchange(true)) {
             throw std::runtime_error("A Single_use_simulator can only be run once.");
         }
-        has_been_run = true;
         return Simulator::run_simulation();
     }
 
    private:
-    bool has_been_run {false};
+    std::atomic<bool> has_been_run {false};
 };
 
 }
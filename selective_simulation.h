@@ -0,0 +1,357 @@
+/**
+ *  Integration that records only selected quantities.
+ *
+ *  An ode_solver records every quantity of the system (parameters,
+ *  drivers, and every module output) at every time point, and there
+ *  is no way to tell it to do otherwise.  When only a handful of the
+ *  quantities are wanted, most of that work is wasted.  The function
+ *  `integrate_selected` defined here steps the dynamical system
+ *  itself and copies only the requested quantities into its output,
+ *  allocating each output column once, at its final length.
+ *
+ *  The stepping is done here for the solvers listed by
+ *  `supports_selective_recording`, reproducing the corresponding
+ *  BioCro solvers.  Other solvers (for example "boost_rosenbrock")
+ *  are run as usual and the unwanted columns discarded afterward, so
+ *  the result is the same but nothing is saved.
+ */
+#ifndef SELECTIVE_SIMULATION_H
+#define SELECTIVE_SIMULATION_H
+
+#include <cmath>     // for std::llround
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/numeric/odeint.hpp>
+
+#include "BioCro_Extended.h"
+#include "arena.h"
+
+namespace BioCro {
+
+    /**
+     * Returns true if `integrate_selected` does its own stepping (and
+     * so saves time and memory) for the named solver.
+     */
+    inline bool supports_selective_recording(std::string const& ode_solver_name)
+    {
+        return ode_solver_name == "homemade_euler" ||
+               ode_solver_name == "boost_euler" ||
+               ode_solver_name == "boost_rk4" ||
+               ode_solver_name == "boost_rkck54";
+    }
+
+    namespace selective_detail {
+        using State_vector = std::vector<double>;
+
+        // Moves (or, between allocators, copies) a column of a full
+        // result into a column of the result being returned.
+        inline void store_column(std::vector<double>& from, std::vector<double>& to)
+        {
+            to = std::move(from);
+        }
+
+        inline void store_column(std::vector<double>& from, Arena_column& to)
+        {
+            to.assign(from.begin(), from.end());
+        }
+
+        // Holds pointers to the recorded quantities inside the system
+        // and the columns they are copied into.  Result is either
+        // Simulation_result or Arena_result; the columns are allocated
+        // using the given allocator, with room for `ntimes` rows.
+        template <typename Result>
+        class Recorder
+        {
+           public:
+            using Column = typename Result::mapped_type;
+            using Allocator = typename Result::allocator_type;
+
+            Recorder(Dynamical_system const& sys, Variable_names const& names,
+                     size_t ntimes, Allocator const& allocator)
+                : sys{sys},
+                  names{names},
+                  ntimes{ntimes},
+                  allocator{allocator},
+                  scratch(sys->get_differential_quantity_names().size())
+            {
+                Variable_names available {sys->get_output_quantity_names()};
+                Variable_set available_set(available.begin(), available.end());
+                for (std::string const& name : names) {
+                    if (available_set.count(name) == 0) {
+                        throw std::out_of_range(
+                            "\"" + name + "\" was given as a quantity to record, "
+                            "but the system has no quantity with that name.\n");
+                    }
+                }
+                pointers = sys->get_quantity_access_ptrs(names);
+
+                columns.reserve(names.size());
+                for (size_t i {0}; i < names.size(); ++i) {
+                    columns.emplace_back(ntimes, 0.0, typename Column::allocator_type(allocator));
+                }
+            }
+
+            // Brings every quantity in the system up to date for
+            // state x at time t, records the selected ones, and
+            // leaves the derivative at (x, t) in dxdt.
+            void record(State_vector const& x, State_vector& dxdt, double t)
+            {
+                if (row >= ntimes) {
+                    throw std::logic_error("Recorder: more rows recorded than time points.");
+                }
+                sys->calculate_derivative(x, dxdt, t);
+                for (size_t i {0}; i < pointers.size(); ++i) {
+                    columns[i][row] = *pointers[i];
+                }
+                ++row;
+            }
+
+            void record(State_vector const& x, double t) { record(x, scratch, t); }
+
+            Result result()
+            {
+                Result result {empty_result()};
+                for (size_t i {0}; i < names.size(); ++i) {
+                    columns[i].resize(row);
+                    result.emplace(names[i], std::move(columns[i]));
+                }
+                return result;
+            }
+
+            Result empty_result() const
+            {
+                return Result(names.size(), typename Result::hasher(),
+                              typename Result::key_equal(), allocator);
+            }
+
+           private:
+            Dynamical_system const& sys;
+            Variable_names const& names;
+            size_t ntimes;
+            Allocator allocator;
+            std::vector<Column> columns;
+            std::vector<const double*> pointers;
+            State_vector scratch;
+            size_t row {0};
+        };
+
+        // The number of rows recorded per unit of time (that is, per
+        // row of the drivers) for an output step size below 1.
+        inline size_t steps_per_time_point(double step_size)
+        {
+            double n {1 / step_size};
+            if (!(step_size > 0) || std::abs(n - std::llround(n)) > 1e-9 * n) {
+                throw std::invalid_argument(
+                    "integrate_selected: an output step size smaller than 1 "
+                    "must divide 1 evenly.");
+            }
+            return std::llround(n);
+        }
+
+        // The times at which rows are recorded: every `stride`th
+        // time point, or, for an output step size below 1, every
+        // 1 / `per_time_point` of a time point.  (One of the two is
+        // always 1.)
+        struct Output_spacing {
+            size_t stride;
+            size_t per_time_point;
+
+            // The number of rows recorded for a system with `ntimes`
+            // time points.
+            size_t rows(size_t ntimes) const
+            {
+                return ntimes == 0 ? 0 : (ntimes - 1) * per_time_point / stride + 1;
+            }
+
+            // The time of the given row.
+            double time(size_t row) const
+            {
+                return static_cast<double>(row * stride) / per_time_point;
+            }
+        };
+
+        // As with the BioCro solvers, an output step size larger than
+        // 1 skips time points, and one smaller than 1 records rows
+        // between them; it must be a whole number in the first case
+        // and divide 1 evenly in the second.  homemade_euler ignores
+        // the output step size and records every time point.
+        inline Output_spacing output_spacing(std::string const& ode_solver_name,
+                                             double output_step_size)
+        {
+            if (ode_solver_name == "homemade_euler" || output_step_size == 1) return {1, 1};
+            if (!(output_step_size >= 1)) return {1, steps_per_time_point(output_step_size)};
+            if (std::abs(output_step_size - std::llround(output_step_size)) > 1e-9 * output_step_size) {
+                throw std::invalid_argument(
+                    "integrate_selected: an output step size larger than 1 "
+                    "must be a whole number.");
+            }
+            return {static_cast<size_t>(std::llround(output_step_size)), 1};
+        }
+
+        // Steps `sys` through its time points using one of the
+        // solvers listed by supports_selective_recording, calling
+        // `recorder.record(x, dxdt, t)` (or `recorder.record(x, t)`)
+        // once per row given by output_spacing.  Either form of `record` must bring
+        // the system's quantities up to date for (x, t), as
+        // Recorder::record does; the first form must also leave the
+        // derivative in dxdt.
+        template <typename Recorder>
+        void step_through(
+            Dynamical_system const& sys,
+            Recorder& recorder,
+            std::string const& ode_solver_name,
+            double output_step_size,
+            double adaptive_rel_error_tol,
+            double adaptive_abs_error_tol,
+            int adaptive_max_steps)
+        {
+            namespace odeint = boost::numeric::odeint;
+
+            bool is_euler {ode_solver_name == "homemade_euler" || ode_solver_name == "boost_euler"};
+            if (sys->requires_euler_ode_solver() && !is_euler) {
+                throw std::runtime_error(
+                    "integrate_selected: the system requires an Euler solver, but \"" +
+                    ode_solver_name + "\" was specified.");
+            }
+
+            Output_spacing const spacing {output_spacing(ode_solver_name, output_step_size)};
+            size_t const rows {spacing.rows(sys->get_ntimes())};
+            State_vector x(sys->get_differential_quantity_names().size());
+            sys->get_differential_quantities(x);
+
+            auto derivative = [&sys](State_vector const& x, State_vector& dxdt, double t) {
+                sys->calculate_derivative(x, dxdt, t);
+            };
+
+            if (ode_solver_name == "boost_rkck54") {
+                std::vector<double> times(rows);
+                for (size_t r {0}; r < rows; ++r) times[r] = spacing.time(r);
+                odeint::integrate_times(
+                    odeint::make_controlled(adaptive_abs_error_tol,
+                                            adaptive_rel_error_tol,
+                                            odeint::runge_kutta_cash_karp54<State_vector>()),
+                    derivative, x, times.begin(), times.end(), output_step_size,
+                    [&recorder](State_vector const& x, double t) { recorder.record(x, t); },
+                    odeint::max_step_checker(adaptive_max_steps));
+                return;
+            }
+
+            // The remaining solvers are fixed-step, taking one step
+            // per recorded row.
+            double const h {spacing.time(1)};
+
+            // The stepper's overload of do_step taking a precomputed
+            // derivative lets us reuse the evaluation made in recording.
+            odeint::runge_kutta4<State_vector> rk4;
+            State_vector dxdt(x.size());
+            for (size_t r {0}; r < rows; ++r) {
+                double const time {spacing.time(r)};
+                recorder.record(x, dxdt, time);
+                if (r + 1 == rows) break;
+
+                if (is_euler) {
+                    for (size_t i {0}; i < x.size(); ++i) x[i] += h * dxdt[i];
+                } else {
+                    rk4.do_step(derivative, x, dxdt, time, h);
+                }
+            }
+        }
+
+        template <typename Result>
+        Result integrate(
+            Dynamical_system const& sys,
+            Variable_names const& recorded_quantities,
+            std::string const& ode_solver_name,
+            double output_step_size,
+            double adaptive_rel_error_tol,
+            double adaptive_abs_error_tol,
+            int adaptive_max_steps,
+            typename Result::allocator_type const& allocator)
+        {
+            if (!supports_selective_recording(ode_solver_name)) {
+                Simulation_result full {make_ode_solver(ode_solver_name,
+                                                        output_step_size,
+                                                        adaptive_rel_error_tol,
+                                                        adaptive_abs_error_tol,
+                                                        adaptive_max_steps)->integrate(sys)};
+                Result selected(recorded_quantities.size(), typename Result::hasher(),
+                                typename Result::key_equal(), allocator);
+                for (std::string const& name : recorded_quantities) {
+                    auto it = full.find(name);
+                    if (it == full.end()) {
+                        throw std::out_of_range(
+                            "\"" + name + "\" was given as a quantity to record, "
+                            "but the system has no quantity with that name.\n");
+                    }
+                    auto& column = selected.emplace(
+                        name, typename Result::mapped_type(allocator)).first->second;
+                    store_column(it->second, column);
+                }
+                return selected;
+            }
+
+            size_t rows {output_spacing(ode_solver_name, output_step_size)
+                             .rows(sys->get_ntimes())};
+            Recorder<Result> recorder {sys, recorded_quantities, rows, allocator};
+            step_through(sys, recorder, ode_solver_name, output_step_size,
+                         adaptive_rel_error_tol, adaptive_abs_error_tol, adaptive_max_steps);
+            return recorder.result();
+        }
+    }
+
+    /**
+     * Integrates `sys` from its current state using the named solver
+     * and returns a Simulation_result containing only the quantities
+     * named in `recorded_quantities`.  The remaining arguments have
+     * the same meaning as the corresponding Simulator constructor
+     * arguments.  Throws std::out_of_range if a requested quantity is
+     * not a quantity of the system.
+     *
+     * Like `Solver::integrate`, this doesn't reset the system first.
+     */
+    inline Simulation_result integrate_selected(
+        Dynamical_system const& sys,
+        Variable_names const& recorded_quantities,
+        std::string const& ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps)
+    {
+        return selective_detail::integrate<Simulation_result>(
+            sys, recorded_quantities, ode_solver_name, output_step_size,
+            adaptive_rel_error_tol, adaptive_abs_error_tol, adaptive_max_steps,
+            Simulation_result::allocator_type());
+    }
+
+    /**
+     * The same, but the result is allocated from `arena`, which is
+     * first made large enough to hold it, so that a run made with a
+     * previously-used (and released) arena normally allocates no new
+     * memory for its result.
+     */
+    inline Arena_result integrate_selected(
+        Dynamical_system const& sys,
+        Variable_names const& recorded_quantities,
+        std::string const& ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps,
+        Arena& arena)
+    {
+        size_t rows {supports_selective_recording(ode_solver_name)
+                         ? selective_detail::output_spacing(ode_solver_name, output_step_size)
+                               .rows(sys->get_ntimes())
+                         : sys->get_ntimes()};
+        arena.reserve(estimated_result_size(rows, recorded_quantities.size()));
+        return selective_detail::integrate<Arena_result>(
+            sys, recorded_quantities, ode_solver_name, output_step_size,
+            adaptive_rel_error_tol, adaptive_abs_error_tol, adaptive_max_steps,
+            Arena_result::allocator_type(arena));
+    }
+}
+
+#endif
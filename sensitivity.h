@@ -0,0 +1,529 @@
+/**
+ *  Space-filling designs and variance-based (Sobol) sensitivity
+ *  analysis.
+ *
+ *  The samplers produce points of the unit cube: `latin_hypercube`
+ *  gives a Latin hypercube design, and `Sobol_sequence` gives points of
+ *  a Sobol low-discrepancy sequence.  `to_parameter_values` maps such
+ *  points to parameter values through the quantile functions of a set
+ *  of Parameter_distributions (see monte_carlo.h), giving Sweep_points
+ *  that can be passed to `run_sweep` or `run_distributed_sweep` with
+ *  the distributions' names as the varied parameters.
+ *
+ *  A Saltelli design for d parameters has N groups of d + 2 points:
+ *  a point of a matrix A, the same point with parameter i taken from a
+ *  matrix B (for each i), and the point of B.  From the Run_summary of
+ *  each point (see reduction.h), a Sobol_index_estimator computes the
+ *  first-order index S_i (the fraction of the variance of an output
+ *  due to parameter i alone) and the total-order index ST_i (the
+ *  fraction due to parameter i including its interactions), using the
+ *  estimators of Saltelli et al. (2010) and Jansen (1999).  The
+ *  estimator takes one group at a time, so the summaries need not be
+ *  kept.
+ *
+ *  `run_sensitivity_analysis` does all of this in memory: it makes the
+ *  design, runs the simulations on a number of threads, and streams
+ *  the summaries to the estimator.  Groups are added to the estimator
+ *  in order, so the indices don't depend on the number of threads.
+ */
+#ifndef SENSITIVITY_H
+#define SENSITIVITY_H
+
+#include <algorithm> // for std::min, std::max, std::swap, std::none_of
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "counter_rng.h"
+#include "monte_carlo.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+#include "sweep_runner.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    /**
+     * Returns a Latin hypercube design of `number_of_points` points in
+     * the unit cube of the given dimension: along each dimension, each
+     * of the intervals [k / n, (k + 1) / n) holds exactly one point.
+     * The design depends only on the seed.
+     */
+    inline Sweep_points latin_hypercube(size_t dimensions, size_t number_of_points,
+                                        std::uint64_t seed)
+    {
+        Sweep_points points(number_of_points, std::vector<double>(dimensions));
+        std::vector<size_t> strata(number_of_points);
+        for (size_t j {0}; j < dimensions; ++j) {
+            Random_stream stream {seed, j};
+            for (size_t k {0}; k < number_of_points; ++k) strata[k] = k;
+
+            // Fisher-Yates shuffle
+            for (size_t k {number_of_points}; k > 1; --k) {
+                size_t other {static_cast<size_t>(stream.uniform() * k)};
+                std::swap(strata[k - 1], strata[std::min(other, k - 1)]);
+            }
+            for (size_t k {0}; k < number_of_points; ++k) {
+                points[k][j] = (strata[k] + stream.uniform()) / number_of_points;
+            }
+        }
+        return points;
+    }
+
+    namespace sensitivity_detail {
+        // Primitive polynomials and initial direction numbers for
+        // dimensions 2 through 21, from Joe and Kuo (2008),
+        // new-joe-kuo-6.21201.
+        struct Direction_numbers {
+            unsigned degree;
+            unsigned coefficients;
+            std::uint32_t initial[7];
+        };
+
+        constexpr Direction_numbers direction_numbers[] {
+            {1, 0, {1}},
+            {2, 1, {1, 3}},
+            {3, 1, {1, 3, 1}},
+            {3, 2, {1, 1, 1}},
+            {4, 1, {1, 1, 3, 3}},
+            {4, 4, {1, 3, 5, 13}},
+            {5, 2, {1, 1, 5, 5, 17}},
+            {5, 4, {1, 1, 5, 5, 5}},
+            {5, 7, {1, 1, 7, 11, 19}},
+            {5, 11, {1, 1, 5, 1, 1}},
+            {5, 13, {1, 1, 1, 3, 11}},
+            {5, 14, {1, 3, 5, 5, 31}},
+            {6, 1, {1, 3, 3, 9, 7, 49}},
+            {6, 13, {1, 1, 1, 15, 21, 21}},
+            {6, 16, {1, 3, 1, 13, 27, 49}},
+            {6, 19, {1, 1, 1, 15, 7, 5}},
+            {6, 22, {1, 3, 1, 15, 13, 25}},
+            {6, 25, {1, 1, 5, 5, 19, 61}},
+            {7, 1, {1, 3, 7, 11, 23, 15, 103}},
+            {7, 4, {1, 3, 7, 13, 13, 15, 69}}};
+    }
+
+    /**
+     * The points of a Sobol sequence.  For m >= 0, any 2^m consecutive
+     * points starting at a multiple of 2^m put exactly one point in
+     * each interval [k / 2^m, (k + 1) / 2^m) along each dimension.
+     * Point 0 is the origin, which has no image under an unbounded
+     * distribution, so designs here start from point 1.
+     */
+    class Sobol_sequence
+    {
+       public:
+        static constexpr size_t max_dimensions {21};
+
+        explicit Sobol_sequence(size_t dimensions) : directions(dimensions)
+        {
+            if (dimensions < 1 || dimensions > max_dimensions) {
+                throw std::out_of_range(
+                    "\"dimensions\" was given as " + std::to_string(dimensions) +
+                    ", but a Sobol_sequence has from 1 to " +
+                    std::to_string(max_dimensions) + " dimensions.\n");
+            }
+
+            for (unsigned k {0}; k < bits; ++k) directions[0][k] = std::uint32_t {1} << (31 - k);
+
+            for (size_t j {1}; j < dimensions; ++j) {
+                auto const& n = sensitivity_detail::direction_numbers[j - 1];
+                auto& v = directions[j];
+                for (unsigned k {0}; k < bits; ++k) {
+                    if (k < n.degree) {
+                        v[k] = n.initial[k] << (31 - k);
+                    } else {
+                        v[k] = v[k - n.degree] ^ (v[k - n.degree] >> n.degree);
+                        for (unsigned l {1}; l < n.degree; ++l) {
+                            if ((n.coefficients >> (n.degree - 1 - l)) & 1) v[k] ^= v[k - l];
+                        }
+                    }
+                }
+            }
+        }
+
+        size_t dimensions() const { return directions.size(); }
+
+        // Point `index`, computed directly from the Gray code of the
+        // index, so that points can be made in any order.
+        std::vector<double> point(std::uint64_t index) const
+        {
+            if (index >> bits) {
+                throw std::out_of_range("Sobol_sequence: the index must be less than 2^32.");
+            }
+            std::uint64_t gray {index ^ (index >> 1)};
+            std::vector<double> x(directions.size());
+            for (size_t j {0}; j < directions.size(); ++j) {
+                std::uint32_t bits_of_x {0};
+                for (unsigned k {0}; k < bits; ++k) {
+                    if ((gray >> k) & 1) bits_of_x ^= directions[j][k];
+                }
+                x[j] = bits_of_x * (1.0 / 4294967296.0);
+            }
+            return x;
+        }
+
+       private:
+        static constexpr unsigned bits {32};
+        std::vector<std::array<std::uint32_t, bits>> directions;
+    };
+
+    // Points first_index, ..., first_index + count - 1 of the Sobol
+    // sequence of the given dimension.
+    inline Sweep_points sobol_points(size_t dimensions, size_t count,
+                                     std::uint64_t first_index = 1)
+    {
+        Sobol_sequence sequence {dimensions};
+        Sweep_points points;
+        points.reserve(count);
+        for (size_t i {0}; i < count; ++i) points.push_back(sequence.point(first_index + i));
+        return points;
+    }
+
+    /**
+     * Maps points of the unit cube to parameter values, taking
+     * coordinate j of each point through the quantile function of
+     * distribution j.
+     */
+    inline Sweep_points to_parameter_values(Sweep_points const& unit_points,
+                                            Parameter_distributions const& distributions)
+    {
+        Sweep_points values;
+        values.reserve(unit_points.size());
+        for (auto const& u : unit_points) {
+            if (u.size() != distributions.size()) {
+                throw std::invalid_argument(
+                    "to_parameter_values: each point must have one coordinate per distribution.");
+            }
+            std::vector<double> v(u.size());
+            for (size_t j {0}; j < u.size(); ++j) v[j] = distributions[j].second.quantile(u[j]);
+            values.push_back(std::move(v));
+        }
+        return values;
+    }
+
+    enum class Sampling_method { sobol, latin_hypercube };
+
+    /**
+     * A Saltelli design: `number_of_groups` groups of
+     * `number_of_parameters` + 2 points, stored group by group.  In
+     * each group, point 0 is from matrix A, point i + 1 is that point
+     * with parameter i taken from matrix B, and the last is from B.
+     */
+    struct Saltelli_design {
+        Variable_names parameter_names;
+        size_t number_of_parameters;
+        size_t number_of_groups;
+        Sweep_points points;
+
+        size_t group_size() const { return number_of_parameters + 2; }
+    };
+
+    /**
+     * Makes a Saltelli design with `number_of_groups` groups.  With
+     * Sampling_method::sobol, the rows of A and B are the first and
+     * second halves of the points of a Sobol sequence of twice the
+     * dimension (so there may be at most Sobol_sequence::max_dimensions
+     * / 2 parameters), and powers of two are the best choices for the
+     * number of groups.  With Sampling_method::latin_hypercube, A and B
+     * are independent Latin hypercube designs made with the seed.
+     */
+    inline Saltelli_design saltelli_design(Parameter_distributions const& distributions,
+                                           size_t number_of_groups,
+                                           Sampling_method method = Sampling_method::sobol,
+                                           std::uint64_t seed = 1)
+    {
+        size_t const d {distributions.size()};
+        if (d == 0) {
+            throw std::invalid_argument("saltelli_design: there must be at least one parameter.");
+        }
+
+        Sweep_points a, b;
+        if (method == Sampling_method::sobol) {
+            if (2 * d > Sobol_sequence::max_dimensions) {
+                throw std::out_of_range(
+                    "A Sobol Saltelli design was requested for " + std::to_string(d) +
+                    " parameters, but at most " +
+                    std::to_string(Sobol_sequence::max_dimensions / 2) +
+                    " are allowed; use Sampling_method::latin_hypercube instead.\n");
+            }
+            Sobol_sequence sequence {2 * d};
+            for (size_t g {0}; g < number_of_groups; ++g) {
+                std::vector<double> x {sequence.point(g + 1)};
+                a.emplace_back(x.begin(), x.begin() + d);
+                b.emplace_back(x.begin() + d, x.end());
+            }
+        } else {
+            Sweep_points both {latin_hypercube(2 * d, number_of_groups, seed)};
+            for (auto const& x : both) {
+                a.emplace_back(x.begin(), x.begin() + d);
+                b.emplace_back(x.begin() + d, x.end());
+            }
+        }
+        a = to_parameter_values(a, distributions);
+        b = to_parameter_values(b, distributions);
+
+        Saltelli_design design {{}, d, number_of_groups, {}};
+        for (auto const& item : distributions) design.parameter_names.push_back(item.first);
+        design.points.reserve(number_of_groups * design.group_size());
+        for (size_t g {0}; g < number_of_groups; ++g) {
+            design.points.push_back(a[g]);
+            for (size_t i {0}; i < d; ++i) {
+                std::vector<double> mixed {a[g]};
+                mixed[i] = b[g][i];
+                design.points.push_back(std::move(mixed));
+            }
+            design.points.push_back(b[g]);
+        }
+        return design;
+    }
+
+    /**
+     * Sobol indices of each output (reduction) with respect to each
+     * parameter; `first_order[k][i]` is the first-order index of
+     * output k with respect to parameter i.
+     */
+    struct Sobol_indices {
+        Variable_names parameter_names;
+        Variable_names output_names;
+        std::vector<std::vector<double>> first_order;
+        std::vector<std::vector<double>> total_order;
+        std::vector<double> variance;  // of each output
+        size_t number_of_groups;       // that contributed
+    };
+
+    /**
+     * Accumulates the sums needed for Sobol indices one group of a
+     * Saltelli design at a time.  The indices depend on the order in
+     * which groups are added only through rounding.
+     */
+    class Sobol_index_estimator
+    {
+       public:
+        Sobol_index_estimator(Variable_names parameter_names, Variable_names output_names)
+            : parameters{parameter_names},
+              outputs{output_names},
+              shift(outputs.size()),
+              sum(outputs.size()),
+              sum_of_squares(outputs.size()),
+              first_order_sum(outputs.size(), std::vector<double>(parameters.size())),
+              total_order_sum(outputs.size(), std::vector<double>(parameters.size()))
+        {
+        }
+
+        // `group` holds the summaries of the points of one group, in
+        // design order.
+        void add_group(std::vector<Run_summary> const& group)
+        {
+            size_t const d {parameters.size()};
+            if (group.size() != d + 2) {
+                throw std::invalid_argument(
+                    "Sobol_index_estimator: a group must have one summary per parameter plus two.");
+            }
+            for (auto const& summary : group) {
+                if (summary.size() != outputs.size()) {
+                    throw std::invalid_argument(
+                        "Sobol_index_estimator: each summary must have one value per output.");
+                }
+            }
+
+            for (size_t k {0}; k < outputs.size(); ++k) {
+                double f_a {group[0][k]};
+                double f_b {group[d + 1][k]};
+
+                // Sums of values shifted by the first one seen, to
+                // reduce rounding error in the variance.
+                if (groups == 0) shift[k] = f_a;
+                for (double f : {f_a, f_b}) {
+                    sum[k] += f - shift[k];
+                    sum_of_squares[k] += (f - shift[k]) * (f - shift[k]);
+                }
+
+                for (size_t i {0}; i < d; ++i) {
+                    double f_ab {group[i + 1][k]};
+                    first_order_sum[k][i] += f_b * (f_ab - f_a);           // Saltelli et al. (2010)
+                    total_order_sum[k][i] += 0.5 * (f_a - f_ab) * (f_a - f_ab);  // Jansen (1999)
+                }
+            }
+            ++groups;
+        }
+
+        size_t number_of_groups() const { return groups; }
+
+        // Throws std::logic_error if no group has been added.  The
+        // indices of an output with no variance are 0.
+        Sobol_indices indices() const
+        {
+            if (groups == 0) {
+                throw std::logic_error("Sobol_index_estimator: no groups have been added.");
+            }
+            Sobol_indices result {parameters, outputs, {}, {}, {}, groups};
+            double const n {static_cast<double>(groups)};
+            for (size_t k {0}; k < outputs.size(); ++k) {
+                double mean {sum[k] / (2 * n)};
+                double variance {sum_of_squares[k] / (2 * n) - mean * mean};
+                result.variance.push_back(variance);
+
+                std::vector<double> first, total;
+                for (size_t i {0}; i < parameters.size(); ++i) {
+                    first.push_back(variance > 0 ? first_order_sum[k][i] / n / variance : 0);
+                    total.push_back(variance > 0 ? total_order_sum[k][i] / n / variance : 0);
+                }
+                result.first_order.push_back(first);
+                result.total_order.push_back(total);
+            }
+            return result;
+        }
+
+       private:
+        Variable_names parameters;
+        Variable_names outputs;
+        size_t groups {0};
+        std::vector<double> shift;
+        std::vector<double> sum;
+        std::vector<double> sum_of_squares;
+        std::vector<std::vector<double>> first_order_sum;
+        std::vector<std::vector<double>> total_order_sum;
+    };
+
+    /**
+     * Computes Sobol indices from the summaries of all of the points of
+     * a design (for example, the values of a Distributed_sweep_result
+     * whose worker returned reductions).  Groups with an empty summary,
+     * such as those of failed runs, are skipped; std::logic_error is
+     * thrown if that leaves none.
+     */
+    inline Sobol_indices sobol_indices(Saltelli_design const& design,
+                                       std::vector<Run_summary> const& summaries,
+                                       Variable_names const& output_names)
+    {
+        if (summaries.size() != design.points.size()) {
+            throw std::invalid_argument("sobol_indices: there must be one summary per design point.");
+        }
+        Sobol_index_estimator estimator {design.parameter_names, output_names};
+        for (size_t g {0}; g < design.number_of_groups; ++g) {
+            auto first = summaries.begin() + g * design.group_size();
+            std::vector<Run_summary> group {first, first + design.group_size()};
+            bool complete {std::none_of(group.begin(), group.end(),
+                                        [](Run_summary const& s) { return s.empty(); })};
+            if (complete) estimator.add_group(group);
+        }
+        return estimator.indices();
+    }
+
+    struct Sensitivity_options {
+        Sampling_method sampling {Sampling_method::sobol};
+        std::uint64_t seed {1};  // for Latin hypercube designs
+        unsigned number_of_threads {std::max(1u, std::thread::hardware_concurrency())};
+        size_t batch_size {4};   // in groups
+    };
+
+    struct Sensitivity_result {
+        Sobol_indices indices;
+        std::vector<size_t> failed_groups;  // left out of the indices
+    };
+
+    /**
+     * Makes a Saltelli design with `number_of_groups` groups for the
+     * given parameters, runs a simulation at each point on a number of
+     * threads, and returns the Sobol indices of each reduction.  As in
+     * `run_monte_carlo`, each parameter must be one of
+     * `spec.parameters`.  A group any of whose runs throws is left out;
+     * if every group is left out, the indices are empty.
+     *
+     * Threads claim batches of groups.  A finished group is added to
+     * the estimator as soon as all groups before it have been, so only
+     * the summaries of groups finished out of order are held.
+     */
+    inline Sensitivity_result run_sensitivity_analysis(
+        Sweep_specification const& spec,
+        Parameter_distributions const& distributions,
+        Reduction_set const& reductions,
+        size_t number_of_groups,
+        Sensitivity_options const& options = {})
+    {
+        check_parameter_names(spec, parameter_names(distributions), "an uncertain parameter");
+        if (options.number_of_threads == 0 || options.batch_size == 0) {
+            throw std::invalid_argument(
+                "run_sensitivity_analysis: number_of_threads and batch_size must be positive.");
+        }
+
+        Saltelli_design const design {
+            saltelli_design(distributions, number_of_groups, options.sampling, options.seed)};
+        size_t const group_size {design.group_size()};
+
+        Sobol_index_estimator estimator {design.parameter_names, reductions.names()};
+        Sensitivity_result result;
+
+        std::mutex mutex;  // guards everything below
+        std::map<size_t, std::vector<Run_summary>> finished;  // out of order
+        size_t next_to_add {0};
+
+        auto add = [&](size_t group, std::vector<Run_summary> summaries) {
+            std::lock_guard<std::mutex> lock {mutex};
+            finished.emplace(group, std::move(summaries));
+            for (auto it = finished.begin();
+                 it != finished.end() && it->first == next_to_add;
+                 it = finished.erase(it), ++next_to_add) {
+                if (it->second.empty()) {
+                    result.failed_groups.push_back(it->first);
+                } else {
+                    estimator.add_group(it->second);
+                }
+            }
+        };
+
+        size_t const number_of_batches {
+            (number_of_groups + options.batch_size - 1) / options.batch_size};
+        std::atomic<size_t> next_batch {0};
+
+        auto work = [&]() {
+            Parameter_set parameters {spec.parameters};
+            for (;;) {
+                size_t batch {next_batch++};
+                if (batch >= number_of_batches) return;
+
+                size_t first {batch * options.batch_size};
+                size_t last {std::min(first + options.batch_size, number_of_groups)};
+                for (size_t group {first}; group < last; ++group) {
+                    std::vector<Run_summary> summaries;
+                    try {
+                        for (size_t p {0}; p < group_size; ++p) {
+                            auto const& point = design.points[group * group_size + p];
+                            for (size_t i {0}; i < point.size(); ++i) {
+                                parameters[design.parameter_names[i]] = point[i];
+                            }
+                            summaries.push_back(
+                                make_run_simulator(spec, parameters).run_summary(reductions));
+                        }
+                    } catch (std::exception const&) {
+                        summaries.clear();  // marks the group failed
+                    }
+                    add(group, std::move(summaries));
+                }
+            }
+        };
+
+        unsigned number_of_threads {static_cast<unsigned>(
+            std::min<size_t>(options.number_of_threads, std::max<size_t>(number_of_batches, 1)))};
+        run_on_threads(number_of_threads, work);
+
+        if (estimator.number_of_groups() > 0) {
+            result.indices = estimator.indices();
+        } else {
+            result.indices = Sobol_indices {design.parameter_names, reductions.names(),
+                                            {}, {}, {}, 0};
+        }
+        return result;
+    }
+}
+
+#endif
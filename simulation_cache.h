@@ -0,0 +1,596 @@
+/**
+ *  A content-addressed cache of simulation results.
+ *
+ *  Optimizers and sensitivity designs often run the same simulation
+ *  more than once.  A Simulation_cache holds results keyed by a
+ *  Cache_key, a 128-bit digest of everything that determines a result:
+ *  the initial state, parameters, drivers, modules, solver settings,
+ *  and the quantities recorded (or the reductions computed).  The
+ *  digest is canonical: maps are hashed in order of their keys, so two
+ *  maps with the same contents have the same digest however their
+ *  elements happen to be arranged, and -0.0 and 0.0 (like any two
+ *  NaNs) are treated as equal.  Modules are identified by name, inputs,
+ *  and outputs, and reductions by kind, quantities, and time, so that
+ *  keys are the same in every process.  Since a module's code isn't
+ *  part of the key, a cache may be given a model version (any string
+ *  naming the build of the module libraries, such as a release number
+ *  or a digest of BioCro.so), which is hashed into every key it makes;
+ *  results written to a directory by another version are then never
+ *  found.  Without one, the directory must be cleared whenever the
+ *  module libraries are rebuilt.  A custom reduction's step
+ *  function can't be hashed, so it is identified by the version string
+ *  given with Reduction::versioned; summaries involving a custom
+ *  reduction without one are not cached.
+ *
+ *  Results are held in memory up to a given number of bytes, the least
+ *  recently used being dropped first.  If a directory is given, every
+ *  result is also written there (losslessly, as a Stored_result; see
+ *  result_storage.h), and a result not found in memory is looked for
+ *  on disk, so that results are shared between processes and kept
+ *  from one session to the next.  The statistics report hits, misses,
+ *  and memory use.
+ *
+ *  A Memoized_simulator puts a cache in front of `run_simulation` and
+ *  `run_summary`.  A Simulation_cache may be used by several threads
+ *  at once; two threads that miss on the same key at the same time
+ *  both run the simulation.
+ */
+#ifndef SIMULATION_CACHE_H
+#define SIMULATION_CACHE_H
+
+#include <algorithm> // for std::sort, std::min
+#include <atomic>
+#include <cstdint>
+#include <cstdio>    // for std::rename, std::remove
+#include <cstring>   // for std::memcpy
+#include <fstream>
+#include <list>
+#include <memory>    // for std::unique_ptr
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>   // for std::pair, std::move
+#include <vector>
+
+#include <unistd.h>  // for getpid
+
+#include "BioCro_Extended.h"
+#include "reduction.h"
+#include "result_storage.h"
+#include "safe_simulators.h"
+
+namespace BioCro {
+
+    struct Cache_key {
+        std::uint64_t high;
+        std::uint64_t low;
+
+        bool operator==(Cache_key const& other) const
+        {
+            return high == other.high && low == other.low;
+        }
+        bool operator!=(Cache_key const& other) const { return !(*this == other); }
+
+        // 32 hexadecimal digits
+        std::string to_string() const
+        {
+            static char const digits[] {"0123456789abcdef"};
+            std::string s(32, '0');
+            for (int i {0}; i < 16; ++i) {
+                s[15 - i] = digits[(high >> (4 * i)) & 0xf];
+                s[31 - i] = digits[(low >> (4 * i)) & 0xf];
+            }
+            return s;
+        }
+    };
+
+    struct Cache_key_hash {
+        size_t operator()(Cache_key const& key) const { return static_cast<size_t>(key.low); }
+    };
+
+    /**
+     * Builds a Cache_key from a sequence of values.  Each value is
+     * mixed into two independent 64-bit lanes; strings and containers
+     * are prefixed by their lengths so that different sequences can't
+     * run together into the same one.
+     */
+    class Key_builder
+    {
+       public:
+        Key_builder& add(std::uint64_t word)
+        {
+            a = (rotate(a ^ mix(word ^ 0x9E3779B97F4A7C15), 29) + length) * 0xBF58476D1CE4E5B9;
+            b = (rotate(b ^ mix(word + 0xD1B54A32D192ED03), 31) ^ length) * 0x94D049BB133111EB;
+            ++length;
+            return *this;
+        }
+
+        Key_builder& add(double value)
+        {
+            if (value == 0) value = 0;  // -0.0 becomes 0.0
+            std::uint64_t word;
+            if (value != value) {
+                word = 0x7FF8000000000000;  // one NaN for all
+            } else {
+                std::memcpy(&word, &value, sizeof word);
+            }
+            return add(word);
+        }
+
+        Key_builder& add(std::string const& s)
+        {
+            add(std::uint64_t {s.size()});
+            for (size_t i {0}; i < s.size(); i += 8) {
+                std::uint64_t word {0};
+                std::memcpy(&word, s.data() + i, std::min<size_t>(8, s.size() - i));
+                add(word);
+            }
+            return *this;
+        }
+
+        Key_builder& add(Cache_key const& key) { return add(key.high).add(key.low); }
+
+        Key_builder& add(Variable_names const& names)
+        {
+            add(std::uint64_t {names.size()});
+            for (auto const& n : names) add(n);
+            return *this;
+        }
+
+        // In order of the names, whatever the order of the map.
+        Key_builder& add(State const& values)
+        {
+            add(std::uint64_t {values.size()});
+            for (auto const* item : sorted(values)) add(item->first).add(item->second);
+            return *this;
+        }
+
+        Key_builder& add(System_drivers const& drivers)
+        {
+            add(std::uint64_t {drivers.size()});
+            for (auto const* item : sorted(drivers)) {
+                add(item->first).add(std::uint64_t {item->second.size()});
+                for (double v : item->second) add(v);
+            }
+            return *this;
+        }
+
+        Key_builder& add(Module_set const& modules)
+        {
+            add(std::uint64_t {modules.size()});
+            for (Module_creator m : modules) {
+                add(m->get_name()).add(m->get_inputs()).add(m->get_outputs());
+            }
+            return *this;
+        }
+
+        // The names of the reductions are only labels and are left
+        // out.  Throws std::invalid_argument if a custom reduction has
+        // no version (see can_cache).
+        Key_builder& add(Reduction_set const& reductions)
+        {
+            add(std::uint64_t {reductions.size()});
+            for (Reduction const& r : reductions.items()) {
+                add(static_cast<std::uint64_t>(r.kind())).add(r.quantities()).add(r.time());
+                if (r.kind() == Reduction::Kind::custom) {
+                    if (r.version().empty()) {
+                        throw std::invalid_argument(
+                            "The custom reduction \"" + r.name() + "\" has no version, "
+                            "so it can't be part of a cache key.");
+                    }
+                    add(r.initial_value()).add(r.version());
+                }
+            }
+            return add(reductions.time_name());
+        }
+
+        Cache_key key() const { return Cache_key {mix(a ^ length), mix(b + length)}; }
+
+       private:
+        // The finalizer of splitmix64
+        static std::uint64_t mix(std::uint64_t z)
+        {
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            return z ^ (z >> 31);
+        }
+
+        static std::uint64_t rotate(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+        template <typename Map>
+        static std::vector<typename Map::value_type const*> sorted(Map const& m)
+        {
+            std::vector<typename Map::value_type const*> items;
+            for (auto const& item : m) items.push_back(&item);
+            std::sort(items.begin(), items.end(),
+                      [](typename Map::value_type const* x, typename Map::value_type const* y) {
+                          return x->first < y->first;
+                      });
+            return items;
+        }
+
+        std::uint64_t a {0x6A09E667F3BCC908};
+        std::uint64_t b {0xBB67AE8584CAA73B};
+        std::uint64_t length {0};
+    };
+
+    // Whether the summaries of `reductions` may be cached: every
+    // custom reduction must have a version.
+    inline bool can_cache(Reduction_set const& reductions)
+    {
+        for (Reduction const& r : reductions.items()) {
+            if (r.kind() == Reduction::Kind::custom && r.version().empty()) return false;
+        }
+        return true;
+    }
+
+    // A digest of a set of drivers, which may be computed once and
+    // given to any number of Memoized_simulators using them.
+    inline Cache_key fingerprint(System_drivers const& drivers)
+    {
+        return Key_builder{}.add(drivers).key();
+    }
+
+    /**
+     * The key of a simulation's full result (or of only the recorded
+     * quantities, if any are named), as made by the given version of
+     * the module libraries.
+     */
+    inline Cache_key simulation_key(
+        State const& initial_state,
+        Parameter_set const& parameters,
+        Cache_key const& drivers_fingerprint,
+        Module_set const& direct_mcs,
+        Module_set const& differential_mcs,
+        std::string const& ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps,
+        Variable_names recorded_quantities = {},
+        std::string const& model_version = "")
+    {
+        std::sort(recorded_quantities.begin(), recorded_quantities.end());
+        return Key_builder{}
+            .add(model_version)
+            .add(initial_state)
+            .add(parameters)
+            .add(drivers_fingerprint)
+            .add(direct_mcs)
+            .add(differential_mcs)
+            .add(ode_solver_name)
+            .add(output_step_size)
+            .add(adaptive_rel_error_tol)
+            .add(adaptive_abs_error_tol)
+            .add(static_cast<std::uint64_t>(adaptive_max_steps))
+            .add(recorded_quantities)
+            .key();
+    }
+
+    struct Cache_statistics {
+        size_t memory_hits;
+        size_t disk_hits;
+        size_t misses;
+        size_t insertions;
+        size_t evictions;   // from memory
+        size_t entries;     // in memory
+        size_t bytes;       // estimated memory held by the entries
+        size_t byte_limit;
+
+        size_t lookups() const { return memory_hits + disk_hits + misses; }
+
+        double hit_rate() const
+        {
+            return lookups() == 0 ? 0 : double(memory_hits + disk_hits) / lookups();
+        }
+    };
+
+    class Simulation_cache
+    {
+       public:
+        /**
+         * Makes a cache holding up to `byte_limit` bytes of results in
+         * memory and, if `directory` isn't empty, writing every result
+         * to a file there.  The directory must already exist.  The
+         * Memoized_simulators using the cache make their keys with
+         * `model_version`.
+         */
+        explicit Simulation_cache(size_t byte_limit, std::string directory = "",
+                                  std::string model_version = "")
+            : byte_limit{byte_limit}, directory{directory}, version{model_version}
+        {
+            if (!this->directory.empty() && this->directory.back() != '/') this->directory += '/';
+        }
+
+        Simulation_cache(Simulation_cache const&) = delete;
+        Simulation_cache& operator=(Simulation_cache const&) = delete;
+
+        std::string const& model_version() const { return version; }
+
+        // If the result for `key` is held, copies it to `result` and
+        // returns true.
+        bool find(Cache_key const& key, Simulation_result& result)
+        {
+            {
+                std::lock_guard<std::mutex> lock {mutex};
+                auto it = index.find(key);
+                if (it != index.end()) {
+                    entries.splice(entries.begin(), entries, it->second);  // most recently used
+                    result = it->second->result;
+                    ++counts.memory_hits;
+                    return true;
+                }
+            }
+
+            if (!directory.empty() && read_file(key, result)) {
+                std::lock_guard<std::mutex> lock {mutex};
+                ++counts.disk_hits;
+                keep(key, result);
+                return true;
+            }
+
+            std::lock_guard<std::mutex> lock {mutex};
+            ++counts.misses;
+            return false;
+        }
+
+        void insert(Cache_key const& key, Simulation_result const& result)
+        {
+            if (!directory.empty()) write_file(key, result);
+            std::lock_guard<std::mutex> lock {mutex};
+            ++counts.insertions;
+            keep(key, result);
+        }
+
+        Cache_statistics statistics() const
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            Cache_statistics s {counts};
+            s.entries = entries.size();
+            s.bytes = bytes;
+            s.byte_limit = byte_limit;
+            return s;
+        }
+
+        // Empties the memory tier, leaving any files in place.
+        void clear_memory()
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            entries.clear();
+            index.clear();
+            bytes = 0;
+        }
+
+        // An estimate of the memory used to hold a result.
+        static size_t size_of(Simulation_result const& result)
+        {
+            size_t size {sizeof(Entry) + 4 * sizeof(void*)};
+            for (auto const& item : result) {
+                size += sizeof(item) + 2 * sizeof(void*) + item.first.capacity() +
+                        item.second.capacity() * sizeof(double);
+            }
+            return size;
+        }
+
+       private:
+        struct Entry {
+            Cache_key key;
+            Simulation_result result;
+            size_t size;
+        };
+
+        // Called with the mutex held.
+        void keep(Cache_key const& key, Simulation_result const& result)
+        {
+            size_t size {size_of(result)};
+            auto it = index.find(key);
+            if (it != index.end()) {
+                bytes -= it->second->size;
+                entries.erase(it->second);
+                index.erase(it);
+            }
+            if (size > byte_limit) return;  // too big to hold in memory
+
+            while (bytes + size > byte_limit) {
+                bytes -= entries.back().size;
+                index.erase(entries.back().key);
+                entries.pop_back();
+                ++counts.evictions;
+            }
+            entries.push_front(Entry {key, result, size});
+            index[key] = entries.begin();
+            bytes += size;
+        }
+
+        std::string path(Cache_key const& key) const { return directory + key.to_string() + ".bcc"; }
+
+        static std::string magic() { return "BCCACHE1"; }
+
+        bool read_file(Cache_key const& key, Simulation_result& result) const
+        {
+            std::ifstream in {path(key), std::ios::binary};
+            if (!in) return false;
+            std::string const m {magic()};
+            std::string file_magic(m.size(), '\0');
+            std::uint64_t file_key[2];
+            in.read(&file_magic[0], m.size());
+            in.read(reinterpret_cast<char*>(file_key), sizeof file_key);
+            if (!in || file_magic != m || file_key[0] != key.high || file_key[1] != key.low) {
+                return false;
+            }
+            try {
+                result = Stored_result::read(in).expand();
+            } catch (std::exception const&) {
+                return false;  // a damaged file is a miss
+            }
+            return true;
+        }
+
+        // Writes to a temporary file first and then renames it, so a
+        // reader (perhaps in another process) never sees a partial file.
+        void write_file(Cache_key const& key, Simulation_result const& result)
+        {
+            static std::atomic<unsigned> serial {0};
+            std::string const final_path {path(key)};
+            std::string const temporary_path {
+                final_path + "." + std::to_string(::getpid()) + "." + std::to_string(serial++)};
+            {
+                std::ofstream out {temporary_path, std::ios::binary};
+                if (!out) {
+                    throw std::runtime_error(
+                        "Simulation_cache: can't write to \"" + temporary_path + "\".");
+                }
+                std::string const m {magic()};
+                std::uint64_t file_key[2] {key.high, key.low};
+                out.write(m.data(), m.size());
+                out.write(reinterpret_cast<char const*>(file_key), sizeof file_key);
+                Stored_result {result}.write(out);
+            }
+            if (std::rename(temporary_path.c_str(), final_path.c_str()) != 0) {
+                std::remove(temporary_path.c_str());
+                throw std::runtime_error(
+                    "Simulation_cache: can't rename \"" + temporary_path + "\".");
+            }
+        }
+
+        size_t const byte_limit;
+        std::string directory;
+        std::string const version;
+
+        mutable std::mutex mutex;  // guards everything below
+        std::list<Entry> entries;  // most recently used first
+        std::unordered_map<Cache_key, std::list<Entry>::iterator, Cache_key_hash> index;
+        size_t bytes {0};
+        Cache_statistics counts {};
+    };
+
+    /**
+     * A simulator that looks in a cache before running, and stores what
+     * it runs.  The constructor arguments are as for
+     * Idempotent_simulator, after the cache; the simulation itself is
+     * made only if it needs to be run.
+     *
+     * Like an Alternate_idempotent_simulator, a Memoized_simulator
+     * holds its inputs by reference, and they must not be changed while
+     * it is in use: the key is computed when it is made.  Giving the
+     * drivers' fingerprint, when many simulators share the drivers,
+     * saves hashing the drivers for each one.
+     */
+    class Memoized_simulator
+    {
+       public:
+        Memoized_simulator(
+            Simulation_cache& cache,
+            State const& initial_state,
+            Parameter_set const& parameters,
+            System_drivers const& drivers,
+            Module_set const& direct_mcs,
+            Module_set const& differential_mcs,
+            std::string ode_solver_name,
+            double output_step_size,
+            double adaptive_rel_error_tol,
+            double adaptive_abs_error_tol,
+            int adaptive_max_steps,
+            Variable_names recorded_quantities = {})
+            : Memoized_simulator(cache, initial_state, parameters, drivers,
+                                 fingerprint(drivers), direct_mcs, differential_mcs,
+                                 ode_solver_name, output_step_size,
+                                 adaptive_rel_error_tol, adaptive_abs_error_tol,
+                                 adaptive_max_steps, recorded_quantities)
+        {
+        }
+
+        Memoized_simulator(
+            Simulation_cache& cache,
+            State const& initial_state,
+            Parameter_set const& parameters,
+            System_drivers const& drivers,
+            Cache_key const& drivers_fingerprint,
+            Module_set const& direct_mcs,
+            Module_set const& differential_mcs,
+            std::string ode_solver_name,
+            double output_step_size,
+            double adaptive_rel_error_tol,
+            double adaptive_abs_error_tol,
+            int adaptive_max_steps,
+            Variable_names recorded_quantities = {})
+            : cache{cache},
+              initial_state{initial_state},
+              parameters{parameters},
+              drivers{drivers},
+              direct_mcs{direct_mcs},
+              differential_mcs{differential_mcs},
+              ode_solver_name{ode_solver_name},
+              output_step_size{output_step_size},
+              adaptive_rel_error_tol{adaptive_rel_error_tol},
+              adaptive_abs_error_tol{adaptive_abs_error_tol},
+              adaptive_max_steps{adaptive_max_steps},
+              recorded_quantities{recorded_quantities},
+              result_key{simulation_key(initial_state, parameters, drivers_fingerprint,
+                                        direct_mcs, differential_mcs, ode_solver_name,
+                                        output_step_size, adaptive_rel_error_tol,
+                                        adaptive_abs_error_tol, adaptive_max_steps,
+                                        recorded_quantities, cache.model_version())}
+        {
+        }
+
+        Cache_key const& key() const { return result_key; }
+
+        Simulation_result run_simulation()
+        {
+            Simulation_result result;
+            if (!cache.find(result_key, result)) {
+                result = simulator().run_simulation();
+                cache.insert(result_key, result);
+            }
+            return result;
+        }
+
+        // Summaries are cached under a key that also covers the
+        // reductions, as a one-column result.  Those of a set with an
+        // unversioned custom reduction are computed every time.
+        Run_summary run_summary(Reduction_set const& reductions)
+        {
+            if (!can_cache(reductions)) return simulator().run_summary(reductions);
+            Cache_key const key {Key_builder{}.add(result_key).add(reductions).key()};
+            Simulation_result stored;
+            if (cache.find(key, stored)) return stored.at(summary_column());
+
+            Run_summary summary {simulator().run_summary(reductions)};
+            cache.insert(key, Simulation_result {{summary_column(), summary}});
+            return summary;
+        }
+
+       private:
+        Idempotent_simulator& simulator()
+        {
+            if (!sim) {
+                sim.reset(new Idempotent_simulator {
+                    initial_state, parameters, drivers, direct_mcs, differential_mcs,
+                    ode_solver_name, output_step_size, adaptive_rel_error_tol,
+                    adaptive_abs_error_tol, adaptive_max_steps, recorded_quantities});
+            }
+            return *sim;
+        }
+
+        static std::string summary_column() { return "run_summary"; }
+
+        Simulation_cache& cache;
+        State const& initial_state;
+        Parameter_set const& parameters;
+        System_drivers const& drivers;
+        Module_set const& direct_mcs;
+        Module_set const& differential_mcs;
+        std::string ode_solver_name;
+        double output_step_size;
+        double adaptive_rel_error_tol;
+        double adaptive_abs_error_tol;
+        int adaptive_max_steps;
+        Variable_names recorded_quantities;
+        Cache_key const result_key;
+        std::unique_ptr<Idempotent_simulator> sim;
+    };
+}
+
+#endif
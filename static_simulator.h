@@ -0,0 +1,272 @@
+/**
+ *  Simulators for module sets known at compile time.
+ *
+ *  A Simulator takes its modules as Module_creator pointers, so each
+ *  module is created through a virtual function and run through a
+ *  virtual `run`, and each derivative calculation looks up drivers and
+ *  differential quantities by name.  When the modules are known when
+ *  the program is written, they can instead be given as template
+ *  arguments, using the module classes themselves (as
+ *  test_module_object.cpp does with standardBML::thermal_time_linear):
+ *
+ *      using Oscillator = BioCro::Static_simulator<
+ *          BioCro::Direct_modules<standardBML::harmonic_energy>,
+ *          BioCro::Differential_modules<standardBML::harmonic_oscillator>>;
+ *
+ *      Oscillator simulator {initial_state, parameters, drivers,
+ *                            BioCro::Static_method::rk4};
+ *      BioCro::Simulation_result result {simulator.run_simulation()};
+ *
+ *  The modules are held as members of their own types, so each call
+ *  to `run` is made on an object whose type the compiler knows,
+ *  and the derivative calculation, which runs them in turn, is a single
+ *  function the compiler can inline throughout; no virtual dispatch is
+ *  needed.  Module quantities are found by name once, when the system
+ *  is made, and are afterward reached through a table of pointers.
+ *  (Module input and output names come from static functions
+ *  returning vectors of strings, so they can't be resolved at compile
+ *  time.)
+ *
+ *  Direct modules are run in the order given, which must put each
+ *  after any module producing one of its inputs.  Module headers must
+ *  be included before BioCro.h, which hides some of the names they use.
+ *
+ *  A Static_simulator integrates one row of the drivers per step with
+ *  Euler's method or the classic fourth-order Runge-Kutta method,
+ *  giving the results of the "homemade_euler" and "boost_rk4"
+ *  (with an output step size of 1) solvers.  The steps are taken by a
+ *  Fixed_step_integrator (see fixed_step.h), which may also be used
+ *  directly with a Static_system for its other methods.
+ */
+#ifndef STATIC_SIMULATOR_H
+#define STATIC_SIMULATOR_H
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "driver_interpolation.h"
+#include "fixed_step.h"
+#include "system_check.h"
+#include "thread_safety.h"
+
+namespace BioCro {
+
+    template<typename... Modules> struct Direct_modules {};
+    template<typename... Modules> struct Differential_modules {};
+
+    enum class Static_method {euler, rk4};
+
+    namespace static_detail {
+
+        // Modules of the given types, each made in place from the same
+        // inputs and outputs, and run in the order given.  Each module
+        // is a member of its own (known) type, so its calls to `run`
+        // can be resolved when compiled.
+        template<typename... Modules>
+        struct Module_chain {
+            Module_chain(State const&, State*) {}
+            void run() const {}
+        };
+
+        template<typename First, typename... Rest>
+        struct Module_chain<First, Rest...> {
+            Module_chain(State const& inputs, State* outputs)
+                : first{inputs, outputs}, rest{inputs, outputs} {}
+
+            void run() const
+            {
+                first.run();
+                rest.run();
+            }
+
+            First first;
+            Module_chain<Rest...> rest;
+        };
+
+        template<typename... Modules>
+        inline std::vector<system_detail::Module_io> module_io()
+        {
+            return {{Modules::get_name(), Modules::get_inputs(), Modules::get_outputs()}...};
+        }
+    }
+
+    template<typename Direct, typename Differential>
+    class Static_system;
+
+    /**
+     * A dynamical system whose modules are given by type.  Like a
+     * Dynamical_system, it must be used by one thread at a time.
+     */
+    template<typename... Direct, typename... Differential>
+    class Static_system<Direct_modules<Direct...>, Differential_modules<Differential...>>
+    {
+       public:
+        Static_system(State const& initial_state,
+                      Parameter_set const& parameters,
+                      System_drivers const& drivers)
+            : initial_state{initial_state},
+              drivers{drivers},
+              quantities{defined_quantities(initial_state, parameters, drivers)},
+              driver_rows{this->drivers, system_detail::driver_names(drivers)},
+              derivatives{zeroed(initial_state)},
+              direct_modules{quantities, &quantities},
+              differential_modules{quantities, &derivatives}
+        {
+            ntimes = driver_rows.rows();
+
+            for (auto const& item : parameters) quantities[item.first] = item.second;
+            for (auto const& item : initial_state) {
+                differential_names.push_back(item.first);
+                x_slots.push_back(&quantities.at(item.first));
+                derivative_slots.push_back(&derivatives.at(item.first));
+            }
+            for (auto const& name : system_detail::driver_names(drivers)) {
+                driver_slots.push_back(&quantities.at(name));
+            }
+            auto timestep = quantities.find("timestep");
+            timestep_slot = timestep == quantities.end() ? &one : &timestep->second;
+
+            std::vector<double> x(differential_names.size());
+            get_differential_quantities(x);
+            set_state(x.data(), size_t {0});
+            direct_modules.run();
+        }
+
+        Static_system(Static_system const&) = delete;
+        Static_system& operator=(Static_system const&) = delete;
+
+        size_t get_ntimes() const { return ntimes; }
+
+        Variable_names const& get_differential_quantity_names() const { return differential_names; }
+
+        Variable_names get_output_quantity_names() const { return keys_of(quantities); }
+
+        std::vector<double const*> get_quantity_access_ptrs(Variable_names const& names) const
+        {
+            std::vector<double const*> pointers;
+            for (auto const& name : names) pointers.push_back(&quantities.at(name));
+            return pointers;
+        }
+
+        template<typename vector_type>
+        void get_differential_quantities(vector_type& x) const
+        {
+            for (size_t i {0}; i < differential_names.size(); ++i) {
+                x[i] = initial_state.at(differential_names[i]);
+            }
+        }
+
+        template<typename vector_type, typename time_type>
+        void calculate_derivative(vector_type const& x, vector_type& dxdt, time_type const& time)
+        {
+            derivative(&x[0], time, &dxdt[0]);
+        }
+
+        // The derivative at `x` and `time` (a row number, or a
+        // fractional row), as flat arrays in the order of
+        // get_differential_quantity_names.
+        template<typename time_type>
+        void derivative(double const* x, time_type time, double* dxdt)
+        {
+            set_state(x, time);
+            direct_modules.run();
+            for (double* d : derivative_slots) *d = 0;
+            differential_modules.run();
+            double const timestep {*timestep_slot};
+            for (size_t i {0}; i < derivative_slots.size(); ++i) dxdt[i] = *derivative_slots[i] * timestep;
+        }
+
+       private:
+        State const initial_state;
+        System_drivers const drivers;
+        State quantities;
+        Driver_rows const driver_rows;
+        State derivatives;
+
+        // These must follow the maps, whose elements they refer to.
+        static_detail::Module_chain<Direct...> direct_modules;
+        static_detail::Module_chain<Differential...> differential_modules;
+
+        size_t ntimes;
+        Variable_names differential_names;
+        std::vector<double*> x_slots;
+        std::vector<double*> derivative_slots;
+        std::vector<double*> driver_slots;
+        double const one {1.0};
+        double const* timestep_slot;
+
+        // `time` is a row number, or a fractional row.
+        template<typename time_type>
+        void set_state(double const* x, time_type time)
+        {
+            for (size_t i {0}; i < x_slots.size(); ++i) *x_slots[i] = x[i];
+            driver_rows.set(time, driver_slots);
+        }
+
+        static Variable_names keys_of(State const& state)
+        {
+            Variable_names names;
+            for (auto const& item : state) names.push_back(item.first);
+            return names;
+        }
+
+        static State zeroed(State const& state)
+        {
+            State result;
+            for (auto const& item : state) result[item.first] = 0;
+            return result;
+        }
+
+        // Every quantity of the system, set to zero, after checking
+        // the system (see system_check.h)
+        static State defined_quantities(State const& initial_state,
+                                        Parameter_set const& parameters,
+                                        System_drivers const& drivers)
+        {
+            State zero;
+            for (auto const& name : system_detail::defined_quantities(
+                     "A Static_system", initial_state, parameters, drivers,
+                     static_detail::module_io<Direct...>(),
+                     static_detail::module_io<Differential...>())) {
+                zero[name] = 0;
+            }
+            return zero;
+        }
+    };
+
+    /**
+     * Runs a Static_system, one driver row per step, recording every
+     * quantity at each row.  A Static_simulator must be used by one
+     * thread at a time; it throws std::logic_error if it is run from
+     * two at once.
+     */
+    template<typename Direct, typename Differential>
+    class Static_simulator
+    {
+       public:
+        Static_simulator(State const& initial_state,
+                         Parameter_set const& parameters,
+                         System_drivers const& drivers,
+                         Static_method method = Static_method::rk4)
+            : system{initial_state, parameters, drivers},
+              integrator{method == Static_method::euler ? Fixed_step_method::euler
+                                                        : Fixed_step_method::rk4}
+        {
+        }
+
+        Simulation_result run_simulation()
+        {
+            Exclusive_use_flag::Guard guard {in_use, "A Static_simulator"};
+            return integrator.integrate(system);
+        }
+
+       private:
+        Static_system<Direct, Differential> system;
+        Fixed_step_integrator integrator;
+        Exclusive_use_flag in_use;
+    };
+}
+
+#endif
@@ -0,0 +1,815 @@
+/**
+ *  A coordinator/worker mode for parameter sweeps.
+ *
+ *  `run_distributed_sweep` hands out batches of sweep points (values
+ *  of the varied parameters) to workers and collects, for each run, a
+ *  short vector of reduced values (for example, a final yield) rather
+ *  than the full result.  It knows nothing of modules or simulators:
+ *  each worker is given the Sweep_specification and a Sweep_reducer
+ *  when it is started and runs `serve_sweep`, which turns each batch
+ *  into simulations.
+ *
+ *  Coordinator and workers communicate only through a Sweep_transport,
+ *  which carries opaque messages.  Two transports are provided:
+ *
+ *  - Loopback_transport runs each worker on a thread of the calling
+ *    process and passes messages through in-memory queues.
+ *
+ *  - Unix_socket_transport forks each worker as a process and passes
+ *    length-prefixed messages over a Unix-domain socket pair, just as
+ *    a network transport to other nodes would (with only the
+ *    connection set-up differing).
+ *
+ *  The coordinator copes with unreliable workers.  A batch whose
+ *  worker is lost (or sends a reply that can't be parsed), or a run
+ *  that fails, is retried (on any worker) until it has been attempted
+ *  `max_attempts` times.  When no work is left to hand out, an idle
+ *  worker is given a copy of the oldest batch still outstanding after
+ *  `straggler_timeout`; whichever copy finishes first is used, so a
+ *  slow worker can't hold up the sweep.
+ */
+#ifndef SWEEP_COORDINATOR_H
+#define SWEEP_COORDINATOR_H
+
+#include <algorithm> // for std::all_of, std::find, std::min
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>   // for std::memcpy
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>    // for std::unique_ptr
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>       // for poll
+#include <signal.h>     // for SIGKILL
+#include <sys/socket.h> // for socketpair, send, recv
+#include <sys/wait.h>   // for waitpid
+#include <unistd.h>     // for fork, close, _exit
+
+#include "BioCro_Extended.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+#include "sweep_runner.h"
+
+namespace BioCro {
+
+    // Computes the values kept from each run of a sweep.
+    using Sweep_reducer = std::function<std::vector<double>(Simulation_result const&)>;
+
+    /**
+     * The worker's end of a transport.  `receive` blocks until a
+     * message arrives and returns false once the coordinator has gone
+     * away.
+     */
+    class Sweep_worker_endpoint
+    {
+       public:
+        virtual ~Sweep_worker_endpoint() = default;
+        virtual bool receive(std::string& message) = 0;
+        virtual void send(std::string const& message) = 0;
+    };
+
+    // The code a worker runs; the second argument is the worker's
+    // index.  Normally this just calls serve_sweep.
+    using Sweep_worker_function = std::function<void(Sweep_worker_endpoint&, size_t)>;
+
+    // Something that happened on a transport, as seen by the
+    // coordinator.
+    struct Transport_event {
+        enum Kind { message, worker_lost, timeout };
+        Kind kind;
+        size_t worker;
+        std::string contents;
+    };
+
+    /**
+     * The coordinator's end of a transport.  `send` returns false if
+     * the worker is known to be gone.  `receive` waits for up to
+     * `timeout` for a message from any worker or the loss of one.
+     */
+    class Sweep_transport
+    {
+       public:
+        virtual ~Sweep_transport() = default;
+        virtual size_t number_of_workers() const = 0;
+        virtual bool send(size_t worker, std::string const& message) = 0;
+        virtual Transport_event receive(std::chrono::milliseconds timeout) = 0;
+    };
+
+    namespace coordinator_detail {
+        enum Tag : std::uint64_t { batch_tag = 1, result_tag = 2, stop_tag = 3 };
+
+        class Writer
+        {
+           public:
+            void put(std::uint64_t n) { append(&n, sizeof n); }
+            void put(double x) { append(&x, sizeof x); }
+            std::string const& bytes() const { return data; }
+
+           private:
+            void append(void const* p, size_t n)
+            {
+                data.append(static_cast<char const*>(p), n);
+            }
+            std::string data;
+        };
+
+        class Reader
+        {
+           public:
+            explicit Reader(std::string const& data) : data{data} {}
+
+            std::uint64_t get_uint() { std::uint64_t n; extract(&n, sizeof n); return n; }
+            double get_double() { double x; extract(&x, sizeof x); return x; }
+            size_t remaining() const { return data.size() - position; }
+
+           private:
+            void extract(void* p, size_t n)
+            {
+                if (position + n > data.size()) {
+                    throw std::runtime_error("Sweep message is truncated.");
+                }
+                std::memcpy(p, data.data() + position, n);
+                position += n;
+            }
+            std::string const& data;
+            size_t position {0};
+        };
+
+        inline std::string stop_message()
+        {
+            Writer w;
+            w.put(std::uint64_t {stop_tag});
+            return w.bytes();
+        }
+
+        // What a worker reported for one run.
+        struct Run_outcome {
+            size_t run;
+            bool succeeded;
+            std::vector<double> values;
+        };
+
+        // Parses a worker's reply to batch `batch_id`, made up of
+        // the runs `batch_runs`.  Returns false, rather than throwing,
+        // if the message is malformed, names a run outside the batch,
+        // or answers some other batch.
+        inline bool parse_results(std::string const& message, std::uint64_t batch_id,
+                                  std::vector<size_t> const& batch_runs,
+                                  std::vector<Run_outcome>& outcomes)
+        {
+            try {
+                Reader in {message};
+                if (in.get_uint() != result_tag || in.get_uint() != batch_id) return false;
+                std::uint64_t n {in.get_uint()};
+                // Each run takes at least three words.
+                if (n > in.remaining() / (3 * sizeof(std::uint64_t))) return false;
+                for (std::uint64_t i {0}; i < n; ++i) {
+                    Run_outcome outcome;
+                    std::uint64_t run {in.get_uint()};
+                    if (std::find(batch_runs.begin(), batch_runs.end(), run) ==
+                        batch_runs.end()) {
+                        return false;
+                    }
+                    outcome.run = run;
+                    outcome.succeeded = in.get_uint() != 0;
+                    std::uint64_t count {in.get_uint()};
+                    if (count > in.remaining() / sizeof(double)) return false;
+                    outcome.values.resize(count);
+                    for (double& v : outcome.values) v = in.get_double();
+                    outcomes.push_back(std::move(outcome));
+                }
+                return true;
+            } catch (std::runtime_error const&) {
+                return false;
+            }
+        }
+    }
+
+    namespace coordinator_detail {
+        // Runs batches received from the coordinator until told to
+        // stop, using `run(sim)` to get the values of each run from a
+        // simulator set up for it.
+        template <typename Run>
+        void serve(Sweep_worker_endpoint& endpoint,
+                   Sweep_specification const& spec,
+                   Run run)
+        {
+            Parameter_set parameters {spec.parameters};
+            std::string message;
+            while (endpoint.receive(message)) {
+                Reader in {message};
+                if (in.get_uint() != batch_tag) return;
+
+                std::uint64_t batch_id {in.get_uint()};
+                std::uint64_t number_of_runs {in.get_uint()};
+
+                Writer out;
+                out.put(std::uint64_t {result_tag});
+                out.put(batch_id);
+                out.put(number_of_runs);
+                for (std::uint64_t i {0}; i < number_of_runs; ++i) {
+                    std::uint64_t run_index {in.get_uint()};
+                    for (std::string const& name : spec.varied_parameters) {
+                        parameters[name] = in.get_double();
+                    }
+
+                    std::vector<double> values;
+                    bool succeeded {true};
+                    try {
+                        Idempotent_simulator sim {
+                            make_run_simulator(spec, parameters, spec.recorded_quantities)};
+                        values = run(sim);
+                    } catch (...) {
+                        succeeded = false;
+                        values.clear();
+                    }
+
+                    out.put(run_index);
+                    out.put(std::uint64_t {succeeded});
+                    out.put(std::uint64_t {values.size()});
+                    for (double v : values) out.put(v);
+                }
+                endpoint.send(out.bytes());
+            }
+        }
+    }
+
+    /**
+     * Runs batches received from the coordinator until told to stop
+     * (or until the coordinator goes away).  Each run is made with an
+     * Idempotent_simulator using `spec`, with the varied parameters
+     * set from the sweep point; `reduce` is applied to its result.
+     */
+    inline void serve_sweep(Sweep_worker_endpoint& endpoint,
+                            Sweep_specification const& spec,
+                            Sweep_reducer const& reduce)
+    {
+        coordinator_detail::serve(endpoint, spec, [&reduce](Idempotent_simulator& sim) {
+            return reduce(sim.run_simulation());
+        });
+    }
+
+    /**
+     * The same, but each run's values are those of the given
+     * reductions (see reduction.h), computed as the run proceeds
+     * without keeping its full result.
+     */
+    inline void serve_sweep(Sweep_worker_endpoint& endpoint,
+                            Sweep_specification const& spec,
+                            Reduction_set const& reductions)
+    {
+        coordinator_detail::serve(endpoint, spec, [&reductions](Idempotent_simulator& sim) {
+            return sim.run_summary(reductions);
+        });
+    }
+
+    /**
+     * Transport whose workers are threads of this process.  The
+     * workers are started by the constructor and stopped (and joined)
+     * by the destructor.  A worker whose function returns or throws
+     * before being told to stop is reported as lost.
+     */
+    class Loopback_transport : public Sweep_transport
+    {
+       public:
+        Loopback_transport(size_t number_of_workers, Sweep_worker_function worker)
+        {
+            for (size_t i {0}; i < number_of_workers; ++i) {
+                mailboxes.emplace_back(new Mailbox);
+            }
+            for (size_t i {0}; i < number_of_workers; ++i) {
+                threads.emplace_back([this, worker, i]() {
+                    Endpoint endpoint {*this, i};
+                    try {
+                        worker(endpoint, i);
+                    } catch (...) {
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock {mailboxes[i]->mutex};
+                        mailboxes[i]->closed = true;
+                    }
+                    post(Transport_event {Transport_event::worker_lost, i, {}});
+                });
+            }
+        }
+
+        ~Loopback_transport()
+        {
+            for (auto& box : mailboxes) {
+                std::lock_guard<std::mutex> lock {box->mutex};
+                box->closed = true;
+                box->ready.notify_all();
+            }
+            for (auto& thread : threads) thread.join();
+        }
+
+        size_t number_of_workers() const override { return mailboxes.size(); }
+
+        bool send(size_t worker, std::string const& message) override
+        {
+            Mailbox& box {*mailboxes.at(worker)};
+            std::lock_guard<std::mutex> lock {box.mutex};
+            if (box.closed) return false;
+            box.messages.push_back(message);
+            box.ready.notify_one();
+            return true;
+        }
+
+        Transport_event receive(std::chrono::milliseconds timeout) override
+        {
+            std::unique_lock<std::mutex> lock {inbox_mutex};
+            if (!inbox_ready.wait_for(lock, timeout, [this]() { return !inbox.empty(); })) {
+                return Transport_event {Transport_event::timeout, 0, {}};
+            }
+            Transport_event event {std::move(inbox.front())};
+            inbox.pop_front();
+            return event;
+        }
+
+       private:
+        struct Mailbox {
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::deque<std::string> messages;
+            bool closed {false};
+        };
+
+        class Endpoint : public Sweep_worker_endpoint
+        {
+           public:
+            Endpoint(Loopback_transport& transport, size_t worker)
+                : transport{transport}, worker{worker} {}
+
+            bool receive(std::string& message) override
+            {
+                Mailbox& box {*transport.mailboxes[worker]};
+                std::unique_lock<std::mutex> lock {box.mutex};
+                box.ready.wait(lock, [&box]() { return box.closed || !box.messages.empty(); });
+                if (box.messages.empty()) return false;
+                message = std::move(box.messages.front());
+                box.messages.pop_front();
+                return true;
+            }
+
+            void send(std::string const& message) override
+            {
+                transport.post(Transport_event {Transport_event::message, worker, message});
+            }
+
+           private:
+            Loopback_transport& transport;
+            size_t worker;
+        };
+
+        void post(Transport_event event)
+        {
+            std::lock_guard<std::mutex> lock {inbox_mutex};
+            inbox.push_back(std::move(event));
+            inbox_ready.notify_one();
+        }
+
+        std::vector<std::unique_ptr<Mailbox>> mailboxes;
+        std::mutex inbox_mutex;
+        std::condition_variable inbox_ready;
+        std::deque<Transport_event> inbox;
+        std::vector<std::thread> threads;
+    };
+
+    namespace coordinator_detail {
+        inline bool write_all(int fd, char const* data, size_t n)
+        {
+#ifdef MSG_NOSIGNAL
+            constexpr int flags {MSG_NOSIGNAL}; // a dead peer gives EPIPE, not SIGPIPE
+#else
+            constexpr int flags {0};
+#endif
+            while (n > 0) {
+                ssize_t written {::send(fd, data, n, flags)};
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                data += written;
+                n -= written;
+            }
+            return true;
+        }
+
+        // Reads `n` bytes, waiting at most `timeout` milliseconds for
+        // each piece to arrive, or, if `timeout` is negative, as long
+        // as it takes.
+        inline bool read_all(int fd, char* data, size_t n, int timeout = -1)
+        {
+            while (n > 0) {
+                if (timeout >= 0) {
+                    pollfd p {fd, POLLIN, 0};
+                    int ready {::poll(&p, 1, timeout)};
+                    if (ready < 0 && errno == EINTR) continue;
+                    if (ready <= 0) return false;
+                }
+                ssize_t got {::recv(fd, data, n, 0)};
+                if (got < 0 && errno == EINTR) continue;
+                if (got <= 0) return false;
+                data += got;
+                n -= got;
+            }
+            return true;
+        }
+
+        // Messages are sent as an 8-byte length followed by the bytes.
+        // A length beyond this limit can only come from a broken peer.
+        constexpr std::uint64_t max_frame_length {std::uint64_t {1} << 28};
+
+        inline bool write_frame(int fd, std::string const& message)
+        {
+            std::uint64_t length {message.size()};
+            return write_all(fd, reinterpret_cast<char const*>(&length), sizeof length) &&
+                   write_all(fd, message.data(), message.size());
+        }
+
+        // Returns false if the connection is closed, the length is
+        // over the limit, or (with a nonnegative `timeout`, as for
+        // read_all) the frame stops arriving part way through.
+        inline bool read_frame(int fd, std::string& message, int timeout = -1)
+        {
+            std::uint64_t length;
+            if (!read_all(fd, reinterpret_cast<char*>(&length), sizeof length, timeout) ||
+                length > max_frame_length) {
+                return false;
+            }
+            message.resize(length);
+            return length == 0 || read_all(fd, &message[0], length, timeout);
+        }
+
+        class Socket_endpoint : public Sweep_worker_endpoint
+        {
+           public:
+            explicit Socket_endpoint(int fd) : fd{fd} {}
+            bool receive(std::string& message) override { return read_frame(fd, message); }
+            void send(std::string const& message) override { write_frame(fd, message); }
+
+           private:
+            int fd;
+        };
+    }
+
+    /**
+     * Transport whose workers are forked processes, each connected to
+     * the coordinator by a Unix-domain socket pair.  The destructor
+     * closes the sockets (so that idle workers exit) and waits for
+     * the workers.  A worker that dies, or whose function returns
+     * before being told to stop, is reported as lost, as is one that
+     * sends a message longer than max_frame_length or stops sending
+     * part way through a message for longer than `frame_timeout`.
+     */
+    class Unix_socket_transport : public Sweep_transport
+    {
+       public:
+        Unix_socket_transport(size_t number_of_workers, Sweep_worker_function worker,
+                              std::chrono::milliseconds frame_timeout = std::chrono::seconds {10})
+            : frame_timeout{frame_timeout}
+        {
+            for (size_t i {0}; i < number_of_workers; ++i) {
+                int fds[2];
+                if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+                    shut_down();
+                    throw sweep_detail::system_error("Unix_socket_transport: can't make a socket pair");
+                }
+#ifdef SO_NOSIGPIPE
+                int on {1};
+                ::setsockopt(fds[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
+                pid_t pid {::fork()};
+                if (pid == 0) {
+                    // Close the coordinator's ends so that each worker
+                    // sees end-of-file when the coordinator closes its
+                    // end of that worker's socket.
+                    for (int fd : sockets) {
+                        if (fd >= 0) ::close(fd);
+                    }
+                    ::close(fds[0]);
+                    coordinator_detail::Socket_endpoint endpoint {fds[1]};
+                    try {
+                        worker(endpoint, i);
+                    } catch (...) {
+                        ::_exit(1);
+                    }
+                    ::_exit(0);
+                }
+                ::close(fds[1]);
+                if (pid < 0) {
+                    ::close(fds[0]);
+                    shut_down();
+                    throw sweep_detail::system_error("Unix_socket_transport: can't start a worker");
+                }
+                sockets.push_back(fds[0]);
+                workers.push_back(pid);
+            }
+        }
+
+        ~Unix_socket_transport() { shut_down(); }
+
+        size_t number_of_workers() const override { return workers.size(); }
+
+        bool send(size_t worker, std::string const& message) override
+        {
+            int fd {sockets.at(worker)};
+            if (fd < 0) return false;
+            if (!coordinator_detail::write_frame(fd, message)) {
+                lose(worker);
+                return false;
+            }
+            return true;
+        }
+
+        Transport_event receive(std::chrono::milliseconds timeout) override
+        {
+            std::vector<pollfd> fds;
+            std::vector<size_t> which;
+            for (size_t i {0}; i < sockets.size(); ++i) {
+                if (sockets[i] >= 0) {
+                    fds.push_back(pollfd {sockets[i], POLLIN, 0});
+                    which.push_back(i);
+                }
+            }
+            int ready {::poll(fds.data(), fds.size(), static_cast<int>(timeout.count()))};
+            if (ready <= 0) return Transport_event {Transport_event::timeout, 0, {}};
+
+            // Start the search at a rotating position so that no
+            // worker's messages are favored over another's.
+            for (size_t k {0}; k < fds.size(); ++k) {
+                size_t j {(next_to_check + k) % fds.size()};
+                if (fds[j].revents == 0) continue;
+                next_to_check = j + 1;
+
+                size_t worker {which[j]};
+                std::string message;
+                if (coordinator_detail::read_frame(fds[j].fd, message,
+                                                   static_cast<int>(frame_timeout.count()))) {
+                    return Transport_event {Transport_event::message, worker, std::move(message)};
+                }
+                lose(worker);
+                return Transport_event {Transport_event::worker_lost, worker, {}};
+            }
+            return Transport_event {Transport_event::timeout, 0, {}};
+        }
+
+        // Kills a worker outright, as if its node had failed.  (Used
+        // in testing.)
+        void kill_worker(size_t worker) { ::kill(workers.at(worker), SIGKILL); }
+
+       private:
+        void lose(size_t worker)
+        {
+            if (sockets[worker] >= 0) ::close(sockets[worker]);
+            sockets[worker] = -1;
+        }
+
+        void shut_down()
+        {
+            for (size_t i {0}; i < sockets.size(); ++i) lose(i);
+            for (pid_t pid : workers) {
+                int status;
+                while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            }
+            workers.clear();
+        }
+
+        std::chrono::milliseconds frame_timeout;
+        std::vector<int> sockets;
+        std::vector<pid_t> workers;
+        size_t next_to_check {0};
+    };
+
+    struct Coordinator_options {
+        size_t batch_size {8};
+        int max_attempts {3};
+        std::chrono::milliseconds straggler_timeout {500};
+    };
+
+    /**
+     * The reduced values of each run of a distributed sweep, plus some
+     * statistics on how the work was done.
+     */
+    struct Distributed_sweep_result {
+        std::vector<std::vector<double>> values;
+        std::vector<Run_status> statuses;
+
+        std::vector<size_t> runs_per_worker;  // runs whose values were used
+        size_t batches_sent {0};
+        size_t retried_runs {0};
+        size_t speculative_batches {0};
+        size_t workers_lost {0};
+
+        std::vector<size_t> failed_runs() const
+        {
+            std::vector<size_t> failed;
+            for (size_t run {0}; run < statuses.size(); ++run) {
+                if (statuses[run] != Run_status::done) failed.push_back(run);
+            }
+            return failed;
+        }
+    };
+
+    /**
+     * Runs one simulation per sweep point on the workers of
+     * `transport` and collects their reduced values.  Returns once
+     * every run has either succeeded or failed `max_attempts` times,
+     * or every worker has been lost; the workers are then told to
+     * stop.
+     */
+    inline Distributed_sweep_result run_distributed_sweep(
+        Sweep_points const& points,
+        Sweep_transport& transport,
+        Coordinator_options const& options = {})
+    {
+        using namespace coordinator_detail;
+        using clock = std::chrono::steady_clock;
+
+        if (options.batch_size == 0 || options.max_attempts < 1) {
+            throw std::invalid_argument(
+                "run_distributed_sweep: batch_size and max_attempts must be positive.");
+        }
+
+        size_t const number_of_workers {transport.number_of_workers()};
+        Distributed_sweep_result result;
+        result.values.resize(points.size());
+        result.statuses.assign(points.size(), Run_status::pending);
+        result.runs_per_worker.assign(number_of_workers, 0);
+
+        struct Batch {
+            std::vector<size_t> runs;
+            clock::time_point started;
+            int copies;
+        };
+        std::map<std::uint64_t, Batch> outstanding;
+        std::uint64_t next_batch_id {0};
+
+        std::deque<size_t> pending;
+        for (size_t run {0}; run < points.size(); ++run) pending.push_back(run);
+        std::vector<int> attempts(points.size(), 0);
+        size_t unfinished {points.size()};
+
+        // The batch each worker is running, if any.
+        constexpr std::uint64_t idle {~std::uint64_t {0}};
+        std::vector<std::uint64_t> assignment(number_of_workers, idle);
+        // The runs of that batch, kept even once the batch is
+        // forgotten, so that a late reply can still be checked.
+        std::vector<std::vector<size_t>> assigned_runs(number_of_workers);
+        std::vector<bool> alive(number_of_workers, true);
+        size_t workers_alive {number_of_workers};
+
+        auto send_batch = [&](size_t worker, std::uint64_t id, Batch& batch) {
+            Writer out;
+            out.put(std::uint64_t {batch_tag});
+            out.put(id);
+            out.put(std::uint64_t {batch.runs.size()});
+            for (size_t run : batch.runs) {
+                out.put(std::uint64_t {run});
+                for (double v : points[run]) out.put(v);
+            }
+            if (!transport.send(worker, out.bytes())) return false;
+            assignment[worker] = id;
+            assigned_runs[worker] = batch.runs;
+            ++batch.copies;
+            ++result.batches_sent;
+            return true;
+        };
+
+        // Puts a run back in the queue, or gives up on it.
+        auto retry = [&](size_t run) {
+            if (result.statuses[run] != Run_status::pending) return;
+            if (attempts[run] < options.max_attempts) {
+                pending.push_front(run);
+                ++result.retried_runs;
+            } else {
+                result.statuses[run] = Run_status::failed;
+                --unfinished;
+            }
+        };
+
+        // Called when a worker is done with (or has lost) a batch.  A
+        // batch is forgotten once all of its runs are finished; if
+        // nobody is still working on it, its unfinished runs are
+        // retried.
+        auto release = [&](size_t worker) {
+            std::uint64_t id {assignment[worker]};
+            assignment[worker] = idle;
+            auto it = outstanding.find(id);
+            if (it == outstanding.end()) return;
+
+            Batch& batch {it->second};
+            --batch.copies;
+            bool finished {std::all_of(batch.runs.begin(), batch.runs.end(), [&](size_t run) {
+                return result.statuses[run] != Run_status::pending;
+            })};
+            if (!finished && batch.copies == 0) {
+                for (size_t run : batch.runs) retry(run);
+            }
+            if (finished || batch.copies == 0) outstanding.erase(it);
+        };
+
+        auto lose = [&](size_t worker) {
+            if (!alive[worker]) return;
+            alive[worker] = false;
+            --workers_alive;
+            ++result.workers_lost;
+            release(worker);
+        };
+
+        while (unfinished > 0 && workers_alive > 0) {
+            // Give every idle worker something to do: new work if
+            // there is any, or else a copy of a straggling batch.
+            for (size_t worker {0}; worker < number_of_workers; ++worker) {
+                if (!alive[worker] || assignment[worker] != idle) continue;
+
+                if (!pending.empty()) {
+                    Batch batch {{}, clock::now(), 0};
+                    while (!pending.empty() && batch.runs.size() < options.batch_size) {
+                        size_t run {pending.front()};
+                        pending.pop_front();
+                        ++attempts[run];
+                        batch.runs.push_back(run);
+                    }
+                    std::uint64_t id {next_batch_id++};
+                    Batch& b {outstanding.emplace(id, batch).first->second};
+                    if (!send_batch(worker, id, b)) {
+                        outstanding.erase(id);
+                        for (size_t run : batch.runs) {
+                            --attempts[run];
+                            pending.push_front(run);
+                        }
+                        lose(worker);
+                    }
+                    continue;
+                }
+
+                auto oldest = outstanding.end();
+                for (auto it = outstanding.begin(); it != outstanding.end(); ++it) {
+                    if (it->second.copies == 1 &&
+                        clock::now() - it->second.started > options.straggler_timeout &&
+                        (oldest == outstanding.end() || it->second.started < oldest->second.started)) {
+                        oldest = it;
+                    }
+                }
+                if (oldest != outstanding.end()) {
+                    if (send_batch(worker, oldest->first, oldest->second)) {
+                        ++result.speculative_batches;
+                    } else {
+                        lose(worker);
+                    }
+                }
+            }
+
+            Transport_event event {transport.receive(
+                std::min(options.straggler_timeout, std::chrono::milliseconds {50}))};
+            if (event.kind == Transport_event::timeout) continue;
+            if (event.kind == Transport_event::worker_lost) {
+                lose(event.worker);
+                continue;
+            }
+
+            // A worker whose reply can't be parsed, or doesn't answer
+            // the batch it was given (or names runs not in it), can't
+            // be trusted with more work; it is treated as lost, and
+            // its batch retried.
+            std::vector<Run_outcome> outcomes;
+            if (event.worker >= number_of_workers || !alive[event.worker] ||
+                !parse_results(event.contents, assignment[event.worker],
+                               assigned_runs[event.worker], outcomes)) {
+                if (event.worker < number_of_workers) lose(event.worker);
+                continue;
+            }
+            for (Run_outcome& outcome : outcomes) {
+                // The first successful copy of a run is the one used.
+                if (outcome.succeeded && result.statuses[outcome.run] == Run_status::pending) {
+                    result.values[outcome.run] = std::move(outcome.values);
+                    result.statuses[outcome.run] = Run_status::done;
+                    ++result.runs_per_worker[event.worker];
+                    --unfinished;
+                }
+            }
+            release(event.worker);
+        }
+
+        for (size_t run {0}; run < points.size(); ++run) {
+            if (result.statuses[run] == Run_status::pending) {
+                result.statuses[run] = Run_status::failed;
+            }
+        }
+        for (size_t worker {0}; worker < number_of_workers; ++worker) {
+            if (alive[worker]) transport.send(worker, stop_message());
+        }
+        return result;
+    }
+}
+
+#endif
@@ -0,0 +1,605 @@
+/**
+ *  A multi-process parameter sweep runner.
+ *
+ *  `run_sweep` runs one simulation for each of a list of sweep points
+ *  (values for a chosen set of parameters, with the remaining inputs
+ *  held fixed) using a number of forked worker processes.  Everything
+ *  the workers share lives in a single memory mapping, laid out as
+ *  follows:
+ *
+ *      header          sizes, offsets, and the work-queue counter
+ *      names           varied parameters, recorded quantities, and
+ *                      drivers, as NUL-terminated strings
+ *      points          number_of_runs x number_of_varied doubles
+ *      drivers         number_of_driver_columns x number_of_driver_rows
+ *                      doubles
+ *      statuses        one Run_status per run
+ *      results         number_of_runs x number_of_recorded x number_of_rows
+ *                      doubles
+ *
+ *  The drivers are thus written once, into memory every worker reads
+ *  from: each worker builds the drivers for its runs from the shared
+ *  copy, once, rather than from the caller's specification.  (A
+ *  BioCro dynamical system keeps a private copy of its drivers, so
+ *  each run still copies them into its own system.)  The workers,
+ *  being forked, also reuse the parent's already-loaded module
+ *  libraries.
+ *
+ *  Work is handed out through an atomic counter in the header: a
+ *  worker claims the next run with a single fetch_add, which, since
+ *  the runs are all known in advance, serves as a lock-free
+ *  multi-consumer queue.  Each worker writes the recorded columns of
+ *  its runs directly into the results area.
+ *
+ *  If a file name is given, the mapping is that file, so the results
+ *  (along with the sweep points and drivers that produced them) are
+ *  left on disk and may be reopened later with `Sweep_result::open`.
+ *  Otherwise an anonymous shared mapping is used.
+ *
+ *  This requires a POSIX system (fork, mmap, waitpid).  As with
+ *  threads (see thread_safety.h), nothing needs to be done to make the
+ *  modules safe to use in the workers.
+ */
+#ifndef SWEEP_RUNNER_H
+#define SWEEP_RUNNER_H
+
+#include <algorithm> // for std::copy
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>   // for std::memcmp, std::memcpy, std::strerror
+#include <new>       // for placement new
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move, std::swap
+#include <vector>
+
+#include <fcntl.h>     // for open
+#include <sys/mman.h>  // for mmap, munmap
+#include <sys/stat.h>  // for fstat
+#include <sys/wait.h>  // for waitpid
+#include <unistd.h>    // for fork, ftruncate, close, _exit
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "selective_simulation.h"
+
+namespace BioCro {
+
+    /**
+     * The fixed inputs of a sweep, plus the names of the parameters
+     * that are varied and of the quantities to record.  Each varied
+     * parameter must be one of `parameters`; its value there is
+     * replaced by the value given by the sweep point.  If
+     * `recorded_quantities` is empty, every quantity is recorded.
+     */
+    struct Sweep_specification {
+        State initial_state;
+        Parameter_set parameters;
+        System_drivers drivers;
+        Module_set direct_modules;
+        Module_set differential_modules;
+
+        std::string ode_solver_name;
+        double output_step_size;
+        double adaptive_rel_error_tol;
+        double adaptive_abs_error_tol;
+        int adaptive_max_steps;
+
+        Variable_names varied_parameters;
+        Variable_names recorded_quantities;
+    };
+
+    // One vector of values (in the order of the varied parameters) per
+    // run.
+    using Sweep_points = std::vector<std::vector<double>>;
+
+    /**
+     * Throws std::invalid_argument unless each of `names` is one of
+     * `spec.parameters`.  `role` describes the names in the message,
+     * for example "a varied parameter".
+     */
+    inline void check_parameter_names(Sweep_specification const& spec,
+                                      Variable_names const& names,
+                                      std::string const& role)
+    {
+        for (std::string const& name : names) {
+            if (spec.parameters.count(name) == 0) {
+                throw std::invalid_argument(
+                    "\"" + name + "\" was given as " + role + ", "
+                    "but it is not one of the simulation's parameters.\n");
+            }
+        }
+    }
+
+    /**
+     * Makes the simulator for one run of `spec`: `parameters` is
+     * `spec.parameters` with the run's values put in, and the run
+     * records `recorded_quantities` (every quantity, if empty).  The
+     * second form uses `drivers` in place of `spec.drivers`.
+     */
+    inline Idempotent_simulator make_run_simulator(
+        Sweep_specification const& spec,
+        Parameter_set const& parameters,
+        System_drivers const& drivers,
+        Variable_names const& recorded_quantities)
+    {
+        return Idempotent_simulator {
+            spec.initial_state, parameters, drivers,
+            spec.direct_modules, spec.differential_modules,
+            spec.ode_solver_name, spec.output_step_size,
+            spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+            spec.adaptive_max_steps, recorded_quantities};
+    }
+
+    inline Idempotent_simulator make_run_simulator(
+        Sweep_specification const& spec,
+        Parameter_set const& parameters,
+        Variable_names const& recorded_quantities = {})
+    {
+        return make_run_simulator(spec, parameters, spec.drivers, recorded_quantities);
+    }
+
+    enum class Run_status : std::uint32_t { pending, running, done, failed };
+
+    namespace sweep_detail {
+        // The first eight bytes of a sweep result file.
+        inline char const* magic() { return "BCSWEEP2"; }
+
+        struct Header {
+            char magic[8];
+            std::uint64_t number_of_runs;
+            std::uint64_t number_of_rows;         // recorded in each run
+            std::uint64_t number_of_driver_rows;
+            std::uint64_t number_of_varied;
+            std::uint64_t number_of_recorded;
+            std::uint64_t number_of_driver_columns;
+            std::uint64_t names_offset;
+            std::uint64_t points_offset;
+            std::uint64_t drivers_offset;
+            std::uint64_t statuses_offset;
+            std::uint64_t results_offset;
+            std::uint64_t total_size;
+            std::atomic<std::uint64_t> next_run;
+        };
+
+        using Status = std::atomic<std::uint32_t>;
+
+        static_assert(sizeof(Status) == sizeof(std::uint32_t),
+                      "Run statuses must be plain 32-bit words in shared memory.");
+
+        inline std::uint64_t align8(std::uint64_t n) { return (n + 7) / 8 * 8; }
+
+        inline std::runtime_error system_error(std::string const& what)
+        {
+            return std::runtime_error(what + ": " + std::strerror(errno));
+        }
+
+        // Owns a shared memory mapping, either of a file or anonymous.
+        class Mapping
+        {
+           public:
+            Mapping() = default;
+
+            // Makes a new, zero-filled, writable mapping of `size`
+            // bytes, backed by the file at `path` (which is created
+            // or truncated) if `path` is nonempty.
+            static Mapping create(std::string const& path, std::uint64_t size)
+            {
+                Mapping m;
+                m.size = size;
+                int fd {-1};
+                if (!path.empty()) {
+                    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                    if (fd < 0) throw system_error("Can't create \"" + path + "\"");
+                    if (::ftruncate(fd, size) != 0) {
+                        ::close(fd);
+                        throw system_error("Can't resize \"" + path + "\"");
+                    }
+                }
+                int flags {path.empty() ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED};
+                m.data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+                if (fd >= 0) ::close(fd);
+                if (m.data == MAP_FAILED) {
+                    m.data = nullptr;
+                    throw system_error("Can't map sweep memory");
+                }
+                return m;
+            }
+
+            // Maps an existing file for reading.
+            static Mapping open(std::string const& path)
+            {
+                Mapping m;
+                int fd {::open(path.c_str(), O_RDONLY)};
+                if (fd < 0) throw system_error("Can't open \"" + path + "\"");
+                struct stat info;
+                if (::fstat(fd, &info) != 0) {
+                    ::close(fd);
+                    throw system_error("Can't read \"" + path + "\"");
+                }
+                m.size = info.st_size;
+                m.data = ::mmap(nullptr, m.size, PROT_READ, MAP_SHARED, fd, 0);
+                ::close(fd);
+                if (m.data == MAP_FAILED) {
+                    m.data = nullptr;
+                    throw system_error("Can't map \"" + path + "\"");
+                }
+                return m;
+            }
+
+            Mapping(Mapping&& other) noexcept : data{other.data}, size{other.size}
+            {
+                other.data = nullptr;
+            }
+
+            Mapping& operator=(Mapping&& other) noexcept
+            {
+                std::swap(data, other.data);
+                std::swap(size, other.size);
+                return *this;
+            }
+
+            ~Mapping()
+            {
+                if (data) ::munmap(data, size);
+            }
+
+            char* bytes() const { return static_cast<char*>(data); }
+            std::uint64_t length() const { return size; }
+
+           private:
+            void* data {nullptr};
+            std::uint64_t size {0};
+        };
+
+        // Copies the drivers out of the mapping at `base`; their
+        // names, in the order they are stored, are `driver_names`.
+        inline System_drivers read_drivers(char const* base,
+                                           Variable_names const& driver_names)
+        {
+            Header const& h {*reinterpret_cast<Header const*>(base)};
+            double const* d {reinterpret_cast<double const*>(base + h.drivers_offset)};
+            size_t const rows {h.number_of_driver_rows};
+            System_drivers drivers;
+            for (size_t i {0}; i < driver_names.size(); ++i) {
+                double const* column {d + i * rows};
+                drivers[driver_names[i]] = std::vector<double>(column, column + rows);
+            }
+            return drivers;
+        }
+    }
+
+    /**
+     * The results of a sweep, held in the sweep's shared mapping.
+     * Columns of individual runs may be read directly from the
+     * mapping with `column_data`, or copied out with `column` or
+     * `result`.
+     */
+    class Sweep_result
+    {
+       public:
+        // Reopens a result file written by run_sweep.
+        static Sweep_result open(std::string const& path)
+        {
+            return Sweep_result {sweep_detail::Mapping::open(path)};
+        }
+
+        size_t number_of_runs() const { return header().number_of_runs; }
+        size_t number_of_rows() const { return header().number_of_rows; }
+
+        Variable_names const& varied_parameters() const { return varied; }
+        Variable_names const& recorded_quantities() const { return recorded; }
+
+        std::vector<double> point(size_t run) const
+        {
+            double const* p {points() + check_run(run) * varied.size()};
+            return std::vector<double>(p, p + varied.size());
+        }
+
+        System_drivers drivers() const
+        {
+            return sweep_detail::read_drivers(mapping.bytes(), driver_names);
+        }
+
+        Run_status status(size_t run) const
+        {
+            return static_cast<Run_status>(statuses()[check_run(run)].load());
+        }
+
+        // The runs that raised an exception or whose worker died.
+        std::vector<size_t> failed_runs() const
+        {
+            std::vector<size_t> failed;
+            for (size_t run {0}; run < number_of_runs(); ++run) {
+                if (status(run) != Run_status::done) failed.push_back(run);
+            }
+            return failed;
+        }
+
+        // A pointer to the number_of_rows() values of the given
+        // quantity for the given run.
+        double const* column_data(size_t run, std::string const& quantity_name) const
+        {
+            return results() +
+                   (check_run(run) * recorded.size() + quantity_index(quantity_name)) *
+                       number_of_rows();
+        }
+
+        std::vector<double> column(size_t run, std::string const& quantity_name) const
+        {
+            double const* c {column_data(run, quantity_name)};
+            return std::vector<double>(c, c + number_of_rows());
+        }
+
+        Simulation_result result(size_t run) const
+        {
+            Simulation_result r;
+            for (std::string const& name : recorded) {
+                r[name] = column(run, name);
+            }
+            return r;
+        }
+
+        // Takes over a mapping filled in by run_sweep.
+        explicit Sweep_result(sweep_detail::Mapping&& m) : mapping{std::move(m)}
+        {
+            if (mapping.length() < sizeof(sweep_detail::Header) ||
+                std::memcmp(header().magic, sweep_detail::magic(), sizeof header().magic) != 0 ||
+                header().total_size != mapping.length()) {
+                throw std::runtime_error("Sweep_result: not a sweep result file.");
+            }
+            char const* name {as<char>(header().names_offset)};
+            auto read_names = [&name](Variable_names& names, size_t n) {
+                for (size_t i {0}; i < n; ++i) {
+                    names.emplace_back(name);
+                    name += names.back().size() + 1;
+                }
+            };
+            read_names(varied, header().number_of_varied);
+            read_names(recorded, header().number_of_recorded);
+            read_names(driver_names, header().number_of_driver_columns);
+        }
+
+       private:
+        sweep_detail::Header const& header() const
+        {
+            return *reinterpret_cast<sweep_detail::Header const*>(mapping.bytes());
+        }
+
+        template <typename T>
+        T const* as(std::uint64_t offset) const
+        {
+            return reinterpret_cast<T const*>(mapping.bytes() + offset);
+        }
+
+        double const* points() const { return as<double>(header().points_offset); }
+        double const* results() const { return as<double>(header().results_offset); }
+
+        sweep_detail::Status const* statuses() const
+        {
+            return as<sweep_detail::Status>(header().statuses_offset);
+        }
+
+        size_t check_run(size_t run) const
+        {
+            if (run >= number_of_runs()) {
+                throw std::out_of_range(
+                    "Sweep_result: there is no run " + std::to_string(run) + ".");
+            }
+            return run;
+        }
+
+        size_t quantity_index(std::string const& quantity_name) const
+        {
+            for (size_t i {0}; i < recorded.size(); ++i) {
+                if (recorded[i] == quantity_name) return i;
+            }
+            throw std::out_of_range(
+                "\"" + quantity_name + "\" was given as a quantity name, "
+                "but it is not one of the sweep's recorded quantities.\n");
+        }
+
+        sweep_detail::Mapping mapping;
+        Variable_names varied;
+        Variable_names recorded;
+        Variable_names driver_names;
+    };
+
+    namespace sweep_detail {
+        // Runs sweep points, taken from the queue in the mapping at
+        // `base`, until none are left.  The drivers are those in the
+        // mapping; `spec.drivers` is not used.
+        inline void work(Sweep_specification const& spec, Variable_names const& recorded,
+                         Variable_names const& driver_names, char* base)
+        {
+            Header& h {*reinterpret_cast<Header*>(base)};
+            double const* points {reinterpret_cast<double const*>(base + h.points_offset)};
+            Status* statuses {reinterpret_cast<Status*>(base + h.statuses_offset)};
+            double* results {reinterpret_cast<double*>(base + h.results_offset)};
+            size_t const rows {h.number_of_rows};
+            size_t const n_varied {spec.varied_parameters.size()};
+
+            System_drivers const drivers {read_drivers(base, driver_names)};
+            Parameter_set parameters {spec.parameters};
+            for (;;) {
+                std::uint64_t run {h.next_run.fetch_add(1)};
+                if (run >= h.number_of_runs) return;
+
+                statuses[run].store(static_cast<std::uint32_t>(Run_status::running));
+                Run_status outcome {Run_status::done};
+                try {
+                    for (size_t i {0}; i < n_varied; ++i) {
+                        parameters[spec.varied_parameters[i]] = points[run * n_varied + i];
+                    }
+                    Simulation_result result {
+                        make_run_simulator(spec, parameters, drivers, recorded).run_simulation()};
+
+                    double* out {results + run * recorded.size() * rows};
+                    for (std::string const& name : recorded) {
+                        std::vector<double> const& column {result.at(name)};
+                        if (column.size() != rows) {
+                            throw std::runtime_error(
+                                "run_sweep: a run returned the wrong number of rows.");
+                        }
+                        std::memcpy(out, column.data(), rows * sizeof(double));
+                        out += rows;
+                    }
+                } catch (...) {
+                    outcome = Run_status::failed;
+                }
+                statuses[run].store(static_cast<std::uint32_t>(outcome));
+            }
+        }
+    }
+
+    /**
+     * Runs one simulation per sweep point using `number_of_workers`
+     * forked worker processes and returns the results.  If
+     * `result_path` is nonempty, the results are also left in that
+     * file.
+     *
+     * A run that throws, or whose worker dies, is given the status
+     * Run_status::failed; the others are unaffected.  Throws
+     * std::invalid_argument if the specification or points are
+     * inconsistent and std::runtime_error if the workers or shared
+     * memory can't be set up.
+     */
+    inline Sweep_result run_sweep(
+        Sweep_specification const& spec,
+        Sweep_points const& points,
+        unsigned number_of_workers,
+        std::string const& result_path = "")
+    {
+        using namespace sweep_detail;
+
+        if (number_of_workers == 0) {
+            throw std::invalid_argument("run_sweep: at least one worker is needed.");
+        }
+        check_parameter_names(spec, spec.varied_parameters, "a varied parameter");
+        for (auto const& point : points) {
+            if (point.size() != spec.varied_parameters.size()) {
+                throw std::invalid_argument(
+                    "run_sweep: each sweep point must give one value per varied parameter.");
+            }
+        }
+        size_t driver_rows {spec.drivers.empty() ? 0 : spec.drivers.begin()->second.size()};
+        for (auto const& driver : spec.drivers) {
+            if (driver.second.size() != driver_rows) {
+                throw std::invalid_argument(
+                    "run_sweep: the drivers must all have the same length.");
+            }
+        }
+        // The rows each run records, which differ from the rows of
+        // the drivers for an output step size other than 1.
+        size_t const rows {selective_detail::output_spacing(spec.ode_solver_name,
+                                                            spec.output_step_size)
+                               .rows(driver_rows)};
+
+        // Making a system here checks the modules and inputs and
+        // settles the list of quantities to record.
+        Variable_names recorded {spec.recorded_quantities};
+        {
+            Dynamical_system sys {make_dynamical_system(
+                spec.initial_state, spec.parameters, spec.drivers,
+                spec.direct_modules, spec.differential_modules)};
+            if (recorded.empty()) recorded = sys->get_output_quantity_names();
+        }
+
+        Variable_names driver_names;
+        for (auto const& driver : spec.drivers) driver_names.push_back(driver.first);
+
+        std::string names;
+        std::vector<Variable_names const*> name_lists {
+            &spec.varied_parameters, &recorded, &driver_names};
+        for (Variable_names const* list : name_lists) {
+            for (std::string const& name : *list) {
+                names += name;
+                names += '\0';
+            }
+        }
+
+        // Lay out the mapping.
+        std::uint64_t const n_varied {spec.varied_parameters.size()};
+        std::uint64_t const names_offset {align8(sizeof(Header))};
+        std::uint64_t const points_offset {align8(names_offset + names.size())};
+        std::uint64_t const drivers_offset {
+            points_offset + points.size() * n_varied * sizeof(double)};
+        std::uint64_t const statuses_offset {
+            drivers_offset + driver_names.size() * driver_rows * sizeof(double)};
+        std::uint64_t const results_offset {
+            align8(statuses_offset + points.size() * sizeof(Status))};
+        std::uint64_t const total_size {
+            results_offset + points.size() * recorded.size() * rows * sizeof(double)};
+
+        Mapping m {Mapping::create(result_path, total_size)};
+        char* base {m.bytes()};
+        Header& h {*new (base) Header {}};
+        std::memcpy(h.magic, magic(), sizeof h.magic);
+        h.number_of_runs = points.size();
+        h.number_of_rows = rows;
+        h.number_of_driver_rows = driver_rows;
+        h.number_of_varied = n_varied;
+        h.number_of_recorded = recorded.size();
+        h.number_of_driver_columns = driver_names.size();
+        h.names_offset = names_offset;
+        h.points_offset = points_offset;
+        h.drivers_offset = drivers_offset;
+        h.statuses_offset = statuses_offset;
+        h.results_offset = results_offset;
+        h.total_size = total_size;
+        h.next_run.store(0);
+
+        std::memcpy(base + h.names_offset, names.data(), names.size());
+        double* p {reinterpret_cast<double*>(base + h.points_offset)};
+        for (auto const& point : points) {
+            p = std::copy(point.begin(), point.end(), p);
+        }
+        double* d {reinterpret_cast<double*>(base + h.drivers_offset)};
+        for (std::string const& name : driver_names) {
+            d = std::copy(spec.drivers.at(name).begin(), spec.drivers.at(name).end(), d);
+        }
+        for (size_t run {0}; run < points.size(); ++run) {
+            new (base + h.statuses_offset + run * sizeof(Status))
+                Status {static_cast<std::uint32_t>(Run_status::pending)};
+        }
+
+        std::vector<pid_t> workers;
+        for (unsigned w {0}; w < number_of_workers; ++w) {
+            pid_t pid {::fork()};
+            if (pid == 0) {
+                // In the worker: never return to the caller's code,
+                // and exit without running the parent's exit handlers.
+                try {
+                    work(spec, recorded, driver_names, base);
+                } catch (...) {
+                    ::_exit(1);
+                }
+                ::_exit(0);
+            }
+            if (pid < 0) {
+                // Let the workers already started finish the job.
+                if (workers.empty()) throw system_error("run_sweep: can't start a worker");
+                break;
+            }
+            workers.push_back(pid);
+        }
+
+        for (pid_t pid : workers) {
+            int wait_status;
+            while (::waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {}
+        }
+
+        // Any run left unfinished belonged to a worker that died.
+        Status* statuses {reinterpret_cast<Status*>(base + h.statuses_offset)};
+        for (size_t run {0}; run < points.size(); ++run) {
+            if (statuses[run].load() != static_cast<std::uint32_t>(Run_status::done)) {
+                statuses[run].store(static_cast<std::uint32_t>(Run_status::failed));
+            }
+        }
+
+        return Sweep_result {std::move(m)};
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ *  The checks made when a system of modules is wired together once,
+ *  with each quantity reached afterward through a pointer: by a
+ *  Static_system (static_simulator.h) and by the system behind a
+ *  Multirate_simulator (multirate.h), much as a Dynamical_system
+ *  checks its inputs when it is made.
+ */
+#ifndef SYSTEM_CHECK_H
+#define SYSTEM_CHECK_H
+
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "BioCro.h"
+
+namespace BioCro {
+
+    namespace system_detail {
+
+        // A module's name and the quantities it reads and writes
+        struct Module_io {
+            std::string name;
+            Variable_names inputs;
+            Variable_names outputs;
+        };
+
+        // Every quantity of a system, after checking that the drivers
+        // have at least one row, all of the same length, that each
+        // quantity is defined once, that every module input is
+        // defined, and that the direct modules are in order.  Throws
+        // std::logic_error, naming `system` (such as "A Static_system"),
+        // if a check fails.
+        inline Variable_names defined_quantities(std::string const& system,
+                                                 State const& initial_state,
+                                                 Parameter_set const& parameters,
+                                                 System_drivers const& drivers,
+                                                 std::vector<Module_io> const& direct,
+                                                 std::vector<Module_io> const& differential)
+        {
+            if (drivers.empty()) {
+                throw std::logic_error(system + " needs at least one driver.\n");
+            }
+            size_t const rows {drivers.begin()->second.size()};
+            if (rows == 0) {
+                throw std::logic_error(system + " needs at least one row of drivers.\n");
+            }
+
+            Variable_names defined;
+            for (auto const& item : initial_state) defined.push_back(item.first);
+            for (auto const& item : parameters) defined.push_back(item.first);
+            for (auto const& item : drivers) {
+                defined.push_back(item.first);
+                if (item.second.size() != rows) {
+                    throw std::logic_error(
+                        "The driver \"" + item.first + "\" has " + std::to_string(item.second.size()) +
+                        " rows, but the others have " + std::to_string(rows) + ".\n");
+                }
+            }
+
+            std::set<std::string> available(defined.begin(), defined.end());
+            for (auto const& module : direct) {
+                for (auto const& input : module.inputs) {
+                    if (!available.count(input)) {
+                        throw std::logic_error(
+                            "The direct module \"" + module.name + "\" needs \"" + input +
+                            "\", which is neither given nor produced by an earlier direct module.\n");
+                    }
+                }
+                for (auto const& output : module.outputs) {
+                    defined.push_back(output);
+                    available.insert(output);
+                }
+            }
+
+            std::set<std::string> seen;
+            std::string duplicates;
+            for (auto const& name : defined) {
+                if (!seen.insert(name).second) duplicates += " " + name;
+            }
+            if (!duplicates.empty()) {
+                throw std::logic_error(
+                    "The following quantities were defined more than once:" + duplicates + "\n");
+            }
+
+            for (auto const& module : differential) {
+                for (auto const& input : module.inputs) {
+                    if (!available.count(input)) {
+                        throw std::logic_error(
+                            "The differential module \"" + module.name + "\" needs \"" + input +
+                            "\", which is not defined.\n");
+                    }
+                }
+                for (auto const& output : module.outputs) {
+                    if (!initial_state.count(output)) {
+                        throw std::logic_error(
+                            "The differential module \"" + module.name + "\" has \"" + output +
+                            "\" as an output, but it has no initial value.\n");
+                    }
+                }
+            }
+            return defined;
+        }
+
+        inline Variable_names driver_names(System_drivers const& drivers)
+        {
+            Variable_names names;
+            for (auto const& item : drivers) names.push_back(item.first);
+            return names;
+        }
+    }
+}
+
+#endif
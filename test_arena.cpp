@@ -0,0 +1,195 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate the Arena class of arena.h and its use in
+// running many short simulations without allocating new memory for
+// each result.  The last test compares the time taken by a batch of
+// short runs with and without an arena.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint> // for std::uintptr_t
+#include <iostream>
+
+#include "arena.h"
+#include "selective_simulation.h"
+#include "BioCro_Extended.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(ArenaTest, AllocationsAreAlignedAndReleased) {
+    BioCro::Arena arena {1024};
+
+    for (size_t alignment : {1, 2, 8, 16}) {
+        void* p {arena.allocate(3, alignment)};
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % alignment, 0);
+    }
+    EXPECT_EQ(arena.bytes_in_use(), 12);
+
+    // A request larger than the initial chunk gets a chunk of its own.
+    arena.allocate(4096);
+    size_t capacity {arena.capacity()};
+    EXPECT_GE(capacity, 1024 + 4096);
+
+    // After a release, the same requests are met from the chunks
+    // already held.
+    arena.release();
+    EXPECT_EQ(arena.bytes_in_use(), 0);
+    arena.allocate(3);
+    arena.allocate(4096);
+    EXPECT_EQ(arena.capacity(), capacity);
+}
+
+TEST(ArenaTest, ContainersUseTheArena) {
+    BioCro::Arena arena;
+
+    BioCro::Arena_state state {BioCro::make_arena_state(arena)};
+    state["position"] = 1;
+    state["velocity"] = 2;
+    EXPECT_GT(arena.bytes_in_use(), 0);
+
+    BioCro::Arena_column column {BioCro::Arena_column::allocator_type(arena)};
+    size_t before {arena.bytes_in_use()};
+    column.reserve(100);
+    EXPECT_EQ(arena.bytes_in_use(), before + 100 * sizeof(double));
+}
+
+class ArenaSimulationTest : public ::testing::Test {
+   protected:
+    BioCro::Dynamical_system get_system() {
+        return BioCro::make_dynamical_system(
+            initial_state,
+            parameters,
+            drivers,
+            direct_modules,
+            differential_modules);
+    }
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+    BioCro::System_drivers drivers
+        { {"elapsed_time", { 0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9 }} };
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+
+    BioCro::Variable_names recorded
+        { "elapsed_time", "position", "velocity", "total_energy" };
+};
+
+// A result allocated from an arena holds the same values as an
+// ordinary one.
+TEST_F(ArenaSimulationTest, ArenaResultMatchesSimulationResult) {
+    BioCro::Arena arena;
+
+    auto sys = get_system();
+    BioCro::Simulation_result expected {
+        BioCro::integrate_selected(sys, recorded, "boost_rk4", 1, 1e-4, 1e-4, 200)};
+    sys->reset();
+    BioCro::Arena_result result {
+        BioCro::integrate_selected(sys, recorded, "boost_rk4", 1, 1e-4, 1e-4, 200, arena)};
+
+    ASSERT_EQ(result.size(), expected.size());
+    for (auto& item : expected) {
+        auto& column = result.at(item.first);
+        EXPECT_TRUE(std::equal(item.second.begin(), item.second.end(),
+                               column.begin(), column.end()))
+            << item.first;
+    }
+
+    // The state helpers accept arena-allocated results and states.
+    BioCro::Arena_state state {BioCro::make_arena_state(arena)};
+    BioCro::get_state_from_result(result, 9, state);
+    EXPECT_EQ(state.at("position"), expected.at("position")[9]);
+    EXPECT_EQ(BioCro::get_final_result_state(result),
+              BioCro::get_final_result_state(expected));
+}
+
+// Once an arena has been used for one run, later runs, each followed
+// by a release, need no new memory.
+TEST_F(ArenaSimulationTest, ReusedArenaDoesNotGrow) {
+    BioCro::Arena arena {1024};
+    auto sys = get_system();
+
+    size_t capacity_after_first_run {0};
+    for (int run {0}; run < 100; ++run) {
+        sys->reset();
+        {
+            BioCro::Arena_result result {
+                BioCro::integrate_selected(sys, recorded, "homemade_euler",
+                                           1, 1e-4, 1e-4, 200, arena)};
+            EXPECT_EQ(result.at("position").size(), drivers.at("elapsed_time").size());
+        }
+        if (run == 0) capacity_after_first_run = arena.capacity();
+        arena.release();
+    }
+    EXPECT_EQ(arena.capacity(), capacity_after_first_run);
+}
+
+// The State helpers in BioCro_Extended.h can fill in an existing
+// State rather than making a new one each time.
+TEST_F(ArenaSimulationTest, StateHelpersReuseState) {
+    auto sys = get_system();
+    BioCro::Simulation_result result {
+        BioCro::integrate_selected(sys, recorded, "homemade_euler", 1, 1e-4, 1e-4, 200)};
+
+    BioCro::State state;
+    for (size_t row {0}; row < BioCro::get_result_duration(result); ++row) {
+        BioCro::get_state_from_result(result, row, state);
+        EXPECT_EQ(state, BioCro::get_state_from_result(result, row));
+    }
+
+    BioCro::get_current_state(sys, state);
+    EXPECT_EQ(state.at("position"), result.at("position").back());
+}
+
+// Times a batch of short runs made with and without an arena.
+TEST_F(ArenaSimulationTest, BatchOfShortRuns) {
+    using clock = std::chrono::steady_clock;
+    constexpr int number_of_runs {5000};
+
+    auto sys = get_system();
+    recorded = sys->get_output_quantity_names();
+
+    auto start = clock::now();
+    for (int run {0}; run < number_of_runs; ++run) {
+        sys->reset();
+        BioCro::Simulation_result result {
+            BioCro::integrate_selected(sys, recorded, "homemade_euler", 1, 1e-4, 1e-4, 200)};
+    }
+    auto heap_time = clock::now() - start;
+
+    BioCro::Arena arena;
+    start = clock::now();
+    for (int run {0}; run < number_of_runs; ++run) {
+        sys->reset();
+        {
+            BioCro::Arena_result result {
+                BioCro::integrate_selected(sys, recorded, "homemade_euler",
+                                           1, 1e-4, 1e-4, 200, arena)};
+        }
+        arena.release();
+    }
+    auto arena_time = clock::now() - start;
+
+    if (VERBOSE) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+        cout << number_of_runs << " runs with heap-allocated results: "
+             << duration_cast<microseconds>(heap_time).count() << " us" << endl;
+        cout << number_of_runs << " runs with arena-allocated results: "
+             << duration_cast<microseconds>(arena_time).count() << " us" << endl;
+        cout << "arena capacity: " << arena.capacity() << " bytes" << endl;
+    }
+
+    SUCCEED();
+}
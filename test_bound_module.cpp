@@ -0,0 +1,128 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover bound_module.h, whose interfaces keep a module from
+// outliving the quantities it refers to.  They show that
+// BioCro::create_module won't take a temporary input map (the mistake
+// of RvalueInputNotOK and LiteralInputNotOK in test_module_object.cpp),
+// that a Bound_module made from a literal gives the expected results
+// even after the code that made it has returned, that modules bound to
+// the same store see the same values, and that missing inputs are
+// reported.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <type_traits> // for std::true_type, std::false_type
+#include <utility>     // for std::declval
+
+#include "BioCro.h"
+#include "bound_module.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+namespace {
+    // Whether BioCro::create_module may be called with an input map of
+    // type T
+    template<typename T, typename = void>
+    struct Accepts_inputs : std::false_type {};
+
+    template<typename T>
+    struct Accepts_inputs<T, decltype((void)BioCro::create_module(
+        std::declval<BioCro::Module_creator>(), std::declval<T>(),
+        std::declval<BioCro::Variable_settings*>()))> : std::true_type {};
+
+    // A module made in a function from a literal, which is used after
+    // the function has returned
+    BioCro::Bound_module thermal_time_module()
+    {
+        return BioCro::Bound_module {
+            Module_factory::retrieve("thermal_time_linear"),
+            BioCro::make_quantity_store({ {"time", 200},
+                                          {"sowing_time", 100},
+                                          {"temp", 25},
+                                          {"tbase", 1} }),
+            BioCro::make_quantity_store()};
+    }
+}
+
+TEST(BoundModuleTest, TemporaryInputsAreRefused) {
+    static_assert(Accepts_inputs<BioCro::Variable_settings&>::value, "");
+    static_assert(Accepts_inputs<BioCro::Variable_settings const&>::value, "");
+    static_assert(!Accepts_inputs<BioCro::Variable_settings>::value, "");
+    static_assert(!Accepts_inputs<BioCro::Variable_settings const>::value, "");
+
+    BioCro::Module_creator w {Module_factory::retrieve("harmonic_energy")};
+    BioCro::Variable_settings inputs { {"position", 3}, {"velocity", -2},
+                                       {"mass", 5}, {"spring_constant", 7} };
+    BioCro::Variable_settings outputs;
+    for (std::string const& name : w->get_outputs()) outputs[name] = 0;
+    BioCro::Module module {BioCro::create_module(w, inputs, &outputs)};
+    module->run();
+    EXPECT_DOUBLE_EQ(outputs.at("total_energy"), 0.5 * 5 * 4 + 0.5 * 7 * 9);
+}
+
+TEST(BoundModuleTest, LiteralInputOK) {
+    BioCro::Bound_module ttl {thermal_time_module()};
+
+    // Something else is allocated where a temporary map would have
+    // been.
+    BioCro::Variable_settings other { {"time", -1}, {"sowing_time", -1},
+                                      {"temp", -1}, {"tbase", -1} };
+
+    ttl.zero_outputs();
+    ttl.run();
+    // (temp - tbase) / 24, as in test_module_object.cpp
+    double const expected_output_value {(25.0 - 1) / 24};
+    EXPECT_DOUBLE_EQ(ttl.outputs()->at("TTc"), expected_output_value);
+    if (VERBOSE) cout << "TTc rate: " << ttl.outputs()->at("TTc") << endl;
+
+    ttl.zero_outputs();
+    EXPECT_DOUBLE_EQ(ttl.outputs()->at("TTc"), 0);
+}
+
+TEST(BoundModuleTest, ModulesShareStores) {
+    BioCro::Quantity_store inputs {BioCro::make_quantity_store(
+        { {"position", 3}, {"velocity", -2}, {"mass", 5}, {"spring_constant", 7} })};
+    BioCro::Quantity_store energies {BioCro::make_quantity_store()};
+    BioCro::Quantity_store derivatives {BioCro::make_quantity_store()};
+
+    BioCro::Bound_module energy {Module_factory::retrieve("harmonic_energy"), inputs, energies};
+    BioCro::Bound_module oscillator {Module_factory::retrieve("harmonic_oscillator"), inputs, derivatives};
+
+    // Quantities added to a store after modules are bound to it don't
+    // disturb them.
+    for (int i {0}; i < 100; ++i) (*inputs)["unused_" + std::to_string(i)] = i;
+
+    (*inputs)["position"] = 4;
+    energy.run();
+    oscillator.zero_outputs();
+    oscillator.run();
+    EXPECT_DOUBLE_EQ(energies->at("spring_energy"), 0.5 * 7 * 16);
+    EXPECT_DOUBLE_EQ(derivatives->at("velocity"), -7.0 * 4 / 5);
+    EXPECT_EQ(oscillator.inputs(), energy.inputs());
+
+    // Moving a bound module keeps its bindings.
+    BioCro::Bound_module moved {std::move(energy)};
+    (*inputs)["velocity"] = 1;
+    moved.run();
+    EXPECT_DOUBLE_EQ(energies->at("kinetic_energy"), 0.5 * 5 * 1);
+}
+
+TEST(BoundModuleTest, MissingInputsAreReported) {
+    try {
+        BioCro::Bound_module energy {Module_factory::retrieve("harmonic_energy"),
+                                     BioCro::make_quantity_store({ {"position", 3} }),
+                                     BioCro::make_quantity_store()};
+        ADD_FAILURE() << "Expected std::out_of_range";
+    }
+    catch (std::out_of_range const& e) {
+        EXPECT_NE(std::string(e.what()).find("of the \"harmonic_energy\" module"), std::string::npos);
+    }
+}
@@ -0,0 +1,192 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the calibration engine of calibration.h.  Using
+// observations made by simulating the harmonic oscillator with known
+// parameter values, they check that both CMA-ES and differential
+// evolution recover those values from distant starting points, that
+// the fit doesn't depend on the number of threads, and that the loss
+// interpolates between time points.  The last test times the
+// evaluation of a generation with increasing numbers of threads.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max, std::min
+#include <chrono>
+#include <cmath>     // for std::isinf
+#include <iostream>
+#include <thread>
+
+#include "BioCro_Extended.h"
+#include "calibration.h"
+#include "safe_simulators.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class CalibrationTest : public ::testing::Test {
+   protected:
+    CalibrationTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) {
+            times.push_back(i * 0.1);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+
+        // Observe the position and kinetic energy at a few times; the
+        // position alone depends only on the ratio of the spring
+        // constant to the mass.
+        BioCro::Idempotent_simulator sim {
+            spec.initial_state, true_parameters, spec.drivers,
+            spec.direct_modules, spec.differential_modules,
+            spec.ode_solver_name, spec.output_step_size,
+            spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+            spec.adaptive_max_steps};
+        BioCro::Simulation_result truth {sim.run_simulation()};
+
+        for (std::string q : {"position", "kinetic_energy"}) {
+            BioCro::Observed_series series {q, {}, {}, {}};
+            for (size_t row {5}; row < times.size(); row += 10) {
+                series.times.push_back(truth.at("elapsed_time")[row]);
+                series.values.push_back(truth.at(q)[row]);
+            }
+            observations.push_back(series);
+        }
+    }
+
+    BioCro::Parameter_set true_parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 15}, {"spring_constant", 2}, {"timestep", 0.1} },  // the starting point
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        {},
+        {}
+    };
+
+    BioCro::Calibration_parameters bounds {
+        {"mass", 1, 20},
+        {"spring_constant", 1, 20}};
+
+    std::vector<BioCro::Observed_series> observations;
+};
+
+TEST_F(CalibrationTest, BothMethodsRecoverTheParameters) {
+    auto loss = BioCro::weighted_sum_of_squares(observations, "elapsed_time");
+
+    for (auto method : {BioCro::Calibration_method::cma_es,
+                        BioCro::Calibration_method::differential_evolution}) {
+        BioCro::Calibration_options options;
+        options.method = method;
+        auto result = BioCro::calibrate(spec, bounds, loss, options);
+        BioCro::State fit {result.best_parameters()};
+
+        if (VERBOSE) {
+            cout << (method == BioCro::Calibration_method::cma_es ? "CMA-ES" : "DE")
+                 << ": mass = " << fit.at("mass") << ", spring_constant = "
+                 << fit.at("spring_constant") << ", loss = " << result.best_loss
+                 << " after " << result.generations << " generations ("
+                 << result.evaluations << " runs)" << endl;
+        }
+
+        EXPECT_TRUE(result.converged);
+        EXPECT_NEAR(fit.at("mass"), 5, 1e-3);
+        EXPECT_NEAR(fit.at("spring_constant"), 7, 1e-3);
+        EXPECT_TRUE(std::is_sorted(result.best_loss_history.rbegin(),
+                                   result.best_loss_history.rend()));
+        EXPECT_EQ(result.best_loss_history.size(), result.generations);
+    }
+}
+
+TEST_F(CalibrationTest, FitDoesNotDependOnThreading) {
+    auto loss = BioCro::weighted_sum_of_squares(observations, "elapsed_time");
+
+    for (auto method : {BioCro::Calibration_method::cma_es,
+                        BioCro::Calibration_method::differential_evolution}) {
+        BioCro::Calibration_options options;
+        options.method = method;
+        options.max_generations = 15;
+        options.number_of_threads = 1;
+        auto reference = BioCro::calibrate(spec, bounds, loss, options);
+
+        options.number_of_threads = 4;
+        auto result = BioCro::calibrate(spec, bounds, loss, options);
+        EXPECT_EQ(result.best_values, reference.best_values);
+        EXPECT_EQ(result.best_loss_history, reference.best_loss_history);
+    }
+}
+
+// The loss interpolates between time points, weights each
+// observation, and is infinite for times that weren't simulated.
+TEST_F(CalibrationTest, WeightedSumOfSquares) {
+    BioCro::Simulation_result result {
+        {"elapsed_time", {0, 1, 2}},
+        {"position", {0, 10, 30}}};
+
+    auto loss = BioCro::weighted_sum_of_squares(
+        { {"position", {0.5, 1.5}, {4, 21}, {2, 3}} }, "elapsed_time");
+    EXPECT_EQ(loss.quantities, (BioCro::Variable_names {"elapsed_time", "position"}));
+    EXPECT_DOUBLE_EQ(loss.evaluate(result), 2 * 1 * 1 + 3 * 1 * 1);
+
+    auto outside = BioCro::weighted_sum_of_squares({ {"position", {2.5}, {0}, {}} }, "elapsed_time");
+    EXPECT_TRUE(std::isinf(outside.evaluate(result)));
+
+    EXPECT_THROW(BioCro::weighted_sum_of_squares({ {"position", {1, 0}, {0, 0}, {}} }, "elapsed_time"),
+                 std::invalid_argument);
+}
+
+TEST_F(CalibrationTest, BadInputsAreRejected) {
+    auto loss = BioCro::weighted_sum_of_squares(observations, "elapsed_time");
+
+    BioCro::Calibration_parameters unknown {{"bogus", 0, 1}};
+    EXPECT_THROW(BioCro::calibrate(spec, unknown, loss), std::invalid_argument);
+
+    BioCro::Calibration_parameters empty_range {{"mass", 2, 2}};
+    EXPECT_THROW(BioCro::calibrate(spec, empty_range, loss), std::invalid_argument);
+
+    // A quantity that isn't simulated is reported, not taken for a
+    // failed run.
+    auto bad_loss = BioCro::weighted_sum_of_squares({ {"bogus", {1}, {0}, {}} }, "elapsed_time");
+    EXPECT_THROW(BioCro::calibrate(spec, bounds, bad_loss), std::out_of_range);
+}
+
+// Times the evaluation of one generation on 1, 2, 4, ... threads, up
+// to one per core.
+TEST_F(CalibrationTest, GenerationTimeWithNumberOfThreads) {
+    using clock = std::chrono::steady_clock;
+    BioCro::Calibration_objective objective {
+        spec, bounds, BioCro::weighted_sum_of_squares(observations, "elapsed_time")};
+    BioCro::Sweep_points population {BioCro::latin_hypercube(2, 256, 3)};
+    for (auto& p : population) {
+        for (auto& x : p) x = 1 + 19 * x;
+    }
+    unsigned cores {std::max(2u, std::thread::hardware_concurrency())};
+
+    std::vector<double> reference;
+    for (unsigned threads {1};; threads = std::min(2 * threads, cores)) {
+        auto start = clock::now();
+        std::vector<double> losses {objective.evaluate(population, threads)};
+        std::chrono::duration<double> elapsed {clock::now() - start};
+
+        if (reference.empty()) reference = losses;
+        EXPECT_EQ(losses, reference);
+        if (VERBOSE) {
+            cout << threads << " thread(s): " << population.size() / elapsed.count()
+                 << " evaluations/s" << endl;
+        }
+        if (threads == cores) break;
+    }
+}
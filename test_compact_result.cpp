@@ -0,0 +1,126 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests show that a Compact_result stores parameters and other
+// time-invariant quantities only once while presenting the same
+// column interface as the Simulation_result it was made from.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath> // for std::signbit
+
+#include "BioCro.h"
+#include "compact_result.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class CompactResultTest : public ::testing::Test {
+   protected:
+    CompactResultTest() {
+        BioCro::Simulator sim {
+            initial_state,
+            parameters,
+            drivers,
+            steady_state_modules,
+            derivative_modules,
+            "homemade_euler",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        result = sim.run_simulation();
+    }
+
+    BioCro::State initial_state { {"TTc", 0} };
+    BioCro::Parameter_set parameters { {"sowing_time", 0},
+                                       {"tbase", 5},
+                                       {"temp", 11},
+                                       {"timestep", 1} };
+    BioCro::System_drivers drivers { {"time",  { 0, 1, 2, 3, 4, 5 }} };
+    BioCro::Module_set steady_state_modules;
+    BioCro::Module_set derivative_modules
+        { Module_factory::retrieve("thermal_time_linear") };
+
+    BioCro::Simulation_result result;
+};
+
+// Every parameter is stored as a scalar; the driver and the
+// differential quantity are stored as full columns.
+TEST_F(CompactResultTest, ParametersAreStoredOnce) {
+    BioCro::Compact_result compact {result};
+
+    if (VERBOSE) print_result(compact);
+
+    EXPECT_EQ(compact.size(), result.size());
+    EXPECT_EQ(compact.number_of_rows(), drivers.at("time").size());
+
+    for (auto& item : parameters) {
+        EXPECT_TRUE(compact.is_time_invariant(item.first)) << item.first;
+        EXPECT_DOUBLE_EQ(compact.time_invariant_quantities().at(item.first), item.second);
+    }
+    EXPECT_FALSE(compact.is_time_invariant("time"));
+    EXPECT_FALSE(compact.is_time_invariant("TTc"));
+
+    EXPECT_EQ(compact.time_varying_quantities().size(), 2);
+    EXPECT_EQ(compact.value_storage_size(),
+              (parameters.size() + 2 * compact.number_of_rows()) * sizeof(double));
+}
+
+// The column interface gives the same values as the original result,
+// whether or not the column is stored as a scalar.
+TEST_F(CompactResultTest, ColumnInterfaceMatchesSimulationResult) {
+    BioCro::Compact_result compact {result};
+
+    for (auto& item : result) {
+        std::string quantity_name {item.first};
+        size_t duration {item.second.size()};
+        ASSERT_EQ(compact.at(quantity_name).size(), duration);
+        for (size_t i {0}; i < duration; ++i) {
+            EXPECT_DOUBLE_EQ(compact.at(quantity_name)[i], result.at(quantity_name)[i]);
+            EXPECT_DOUBLE_EQ(compact[quantity_name].at(i), result[quantity_name][i]);
+        }
+    }
+
+    // Iterating over the Compact_result visits every quantity once.
+    size_t visited {0};
+    for (auto& item : compact) {
+        ASSERT_EQ(result.count(item.first), 1) << item.first;
+        std::vector<double> column = item.second;
+        EXPECT_EQ(column, result.at(item.first));
+        ++visited;
+    }
+    EXPECT_EQ(visited, result.size());
+
+    EXPECT_THROW(compact.at("bogus"), std::out_of_range);
+    EXPECT_THROW(compact.at("TTc").at(drivers.at("time").size()), std::out_of_range);
+}
+
+// Expanding a Compact_result gives back the original result.
+TEST_F(CompactResultTest, ExpandRestoresResult) {
+    BioCro::Compact_result compact {BioCro::Simulation_result {result}};
+    BioCro::Simulation_result expanded {compact.expand()};
+
+    EXPECT_EQ(expanded, result);
+}
+
+TEST_F(CompactResultTest, RaggedResultIsRejected) {
+    BioCro::Simulation_result ragged { {"a", {1, 2, 3}}, {"b", {1, 2}} };
+    EXPECT_THROW(BioCro::Compact_result{ragged}, std::invalid_argument);
+}
+
+// Constancy is decided bit for bit: a column holding both 0.0 and
+// -0.0 varies, and expanding it keeps the sign of each zero.
+TEST_F(CompactResultTest, SignedZerosAreKept) {
+    BioCro::Simulation_result signed_zeros { {"a", {0.0, -0.0, 0.0}} };
+    BioCro::Compact_result compact {signed_zeros};
+
+    EXPECT_FALSE(compact.at("a").is_constant());
+    BioCro::Simulation_result expanded {compact.expand()};
+    EXPECT_FALSE(std::signbit(expanded.at("a")[0]));
+    EXPECT_TRUE(std::signbit(expanded.at("a")[1]));
+}
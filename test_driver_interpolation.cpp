@@ -0,0 +1,249 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the Driver_table of driver_interpolation.h, which
+// finds driver values at times between rows.  They check step, linear,
+// and cubic values for the drivers of
+// test_multiple_module_libraries.cpp and for a quadratic, which cubic
+// interpolation reproduces away from the ends; that lookups through a
+// cursor, in any order of times, agree with lookups without one for
+// unevenly spaced times; and that bad driver tables are refused.  They
+// also check the values a Driver_rows writes at rows, between rows, and
+// outside the table, including one of a single row.  The last test
+// compares the time needed to look up many drivers at the
+// times an adaptive solver might use, with a binary search of each
+// column and with Driver_tables.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::find, std::upper_bound
+#include <chrono>
+#include <cmath>     // for std::sin
+#include <iostream>
+
+#include "BioCro.h"
+#include "driver_interpolation.h"
+
+#include "Random.h"
+
+using std::cout;
+using std::endl;
+
+class DriverInterpolationTest : public ::testing::Test {
+   protected:
+    BioCro::System_drivers drivers
+        { {"time", { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 } },
+          {"temp", { 5, 8, 10, 15, 20, 20, 25, 30, 32, 40} } };
+
+    // The value of driver `name` at `t`
+    double value(BioCro::Driver_table const& table, std::string const& name, double t) {
+        auto const& names = table.names();
+        return table.values_at(t)[std::find(names.begin(), names.end(), name) - names.begin()];
+    }
+};
+
+TEST_F(DriverInterpolationTest, InterpolatedValues) {
+    BioCro::Driver_table step {drivers, "time", BioCro::Interpolation::step};
+    BioCro::Driver_table linear {drivers, "time", BioCro::Interpolation::linear};
+    BioCro::Driver_table cubic {drivers, "time", BioCro::Interpolation::cubic};
+    EXPECT_TRUE(linear.is_uniform());
+    EXPECT_EQ(linear.names(), (BioCro::Variable_names {"temp", "time"}));
+
+    for (size_t i {0}; i < 10; ++i) {
+        for (auto const* table : {&step, &linear, &cubic}) {
+            EXPECT_DOUBLE_EQ(value(*table, "temp", i), drivers["temp"][i]);
+            EXPECT_DOUBLE_EQ(value(*table, "time", i), i);
+        }
+    }
+    EXPECT_DOUBLE_EQ(value(step, "temp", 2.5), 10);
+    EXPECT_DOUBLE_EQ(value(step, "temp", 2.999), 10);
+    EXPECT_DOUBLE_EQ(value(linear, "temp", 2.5), 12.5);
+
+    // Hermite interpolation with centered slopes ((15 - 8)/2 at row 2
+    // and (20 - 10)/2 at row 3)
+    double const s {0.5}, h00 {2 * s * s * s - 3 * s * s + 1}, h10 {s * s * s - 2 * s * s + s};
+    EXPECT_DOUBLE_EQ(value(cubic, "temp", 2.5),
+                     h00 * 10 + h10 * 3.5 + (1 - h00) * 15 - h10 * 5);
+
+    // Times beyond the ends take the values there.
+    EXPECT_DOUBLE_EQ(value(linear, "temp", -3), 5);
+    EXPECT_DOUBLE_EQ(value(cubic, "temp", 12), 40);
+
+    // Rows as times
+    BioCro::Driver_table by_row {{ {"temp", drivers["temp"]} }, ""};
+    EXPECT_DOUBLE_EQ(value(by_row, "temp", 6.5), 27.5);
+}
+
+// Cubic interpolation is exact for a quadratic except in the first and
+// last intervals, even with uneven spacing.
+TEST_F(DriverInterpolationTest, CubicReproducesQuadratics) {
+    std::vector<double> times {0, 0.5, 1.5, 2, 3.25, 4, 5.5, 6};
+    std::vector<double> squares;
+    for (double t : times) squares.push_back(3 * t * t - t + 2);
+    BioCro::Driver_table cubic {{ {"time", times}, {"y", squares} }, "time",
+                                BioCro::Interpolation::cubic};
+    EXPECT_FALSE(cubic.is_uniform());
+
+    for (double t {0.5}; t <= 5.5; t += 0.125) {
+        EXPECT_NEAR(value(cubic, "y", t), 3 * t * t - t + 2, 1e-12) << "t = " << t;
+    }
+}
+
+TEST_F(DriverInterpolationTest, CursorsAgreeWithSearches) {
+    Rand_double gap {0.01, 2};
+    Rand_double query {-1, 110};
+    std::vector<double> times {0};
+    for (int i {0}; i < 99; ++i) times.push_back(times.back() + gap());
+    std::vector<double> ys(times.size()), zs(times.size());
+    for (size_t i {0}; i < times.size(); ++i) {
+        ys[i] = gap();
+        zs[i] = -gap();
+    }
+
+    for (auto method : {BioCro::Interpolation::step, BioCro::Interpolation::linear,
+                        BioCro::Interpolation::cubic}) {
+        BioCro::Driver_table table {{ {"time", times}, {"y", ys}, {"z", zs} }, "time", method};
+        ASSERT_FALSE(table.is_uniform());
+        BioCro::Driver_table::Cursor cursor;
+        std::vector<double> with_cursor(3);
+
+        // Mostly increasing times, with some jumps back and ahead
+        double t {-0.5};
+        for (int i {0}; i < 2000; ++i) {
+            t = i % 100 == 99 ? query() : t + 0.03;
+            table.values_at(t, with_cursor.data(), cursor);
+            EXPECT_EQ(with_cursor, table.values_at(t)) << "t = " << t;
+            EXPECT_LE(cursor.interval, times.size() - 2);
+        }
+        for (size_t i {0}; i < times.size(); ++i) {
+            table.values_at(times[i], with_cursor.data(), cursor);
+            EXPECT_DOUBLE_EQ(with_cursor[1], ys[i]);
+        }
+    }
+}
+
+TEST_F(DriverInterpolationTest, BadTablesAreRefused) {
+    EXPECT_THROW((BioCro::Driver_table {BioCro::System_drivers {}}), std::invalid_argument);
+    EXPECT_THROW((BioCro::Driver_table {{ {"time", {0, 1, 2}}, {"temp", {5, 8}} }}),
+                 std::invalid_argument);
+    EXPECT_THROW((BioCro::Driver_table {{ {"time", {0}}, {"temp", {5}} }}), std::invalid_argument);
+    EXPECT_THROW((BioCro::Driver_table {{ {"time", {0, 2, 1}}, {"temp", {5, 8, 9}} }}),
+                 std::invalid_argument);
+    EXPECT_THROW((BioCro::Driver_table {{ {"doy", {0, 1}}, {"temp", {5, 8}} }}),
+                 std::invalid_argument);
+}
+
+TEST_F(DriverInterpolationTest, DriverRows) {
+    BioCro::System_drivers drivers { {"time", {0, 1, 2, 3}}, {"temp", {5, 8, 6, 10}} };
+    BioCro::Driver_rows rows {drivers, {"temp", "time"}};
+    EXPECT_EQ(rows.rows(), 4u);
+
+    double temp {0}, time {0};
+    std::vector<double*> slots {&temp, &time};
+    rows.set(size_t {2}, slots);
+    EXPECT_EQ(temp, 6);
+    EXPECT_EQ(time, 2);
+    rows.set(1.25, slots);
+    EXPECT_DOUBLE_EQ(temp, 7.5);
+    EXPECT_DOUBLE_EQ(time, 1.25);
+
+    // Rows outside the table are taken to be its first or last.
+    rows.set(-0.5, slots);
+    EXPECT_EQ(temp, 5);
+    rows.set(-1e30, slots);
+    EXPECT_EQ(temp, 5);
+    rows.set(3.5, slots);
+    EXPECT_EQ(temp, 10);
+    rows.set(size_t {7}, slots);
+    EXPECT_EQ(temp, 10);
+
+    BioCro::System_drivers one_row { {"temp", {12}} };
+    BioCro::Driver_rows single {one_row, {"temp"}};
+    single.set(0.5, slots);
+    EXPECT_EQ(temp, 12);
+
+    EXPECT_THROW((BioCro::Driver_rows {drivers, {"rh"}}), std::invalid_argument);
+    BioCro::System_drivers empty { {"temp", {}} };
+    EXPECT_THROW((BioCro::Driver_rows {empty, {"temp"}}), std::invalid_argument);
+    BioCro::System_drivers uneven { {"time", {0, 1, 2}}, {"temp", {5, 8}} };
+    EXPECT_THROW((BioCro::Driver_rows {uneven, {"time", "temp"}}), std::invalid_argument);
+}
+
+// Looks up 40 drivers of a year of hourly data at 500,000 times
+// increasing in small, uneven steps: with a binary search of each
+// column, and with Driver_tables for evenly and unevenly spaced times.
+TEST_F(DriverInterpolationTest, LookupTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    size_t const rows {8760}, columns {40};
+    int const lookups {500000};
+    double const last_time {rows - 1.0};
+
+    drivers.clear();
+    std::vector<double> times, uneven_times;
+    for (size_t i {0}; i < rows; ++i) {
+        times.push_back(i);
+        uneven_times.push_back(i + (i % 7 == 3 ? 0.5 : 0));
+    }
+    for (size_t c {0}; c < columns; ++c) {
+        std::vector<double> column;
+        for (size_t i {0}; i < rows; ++i) column.push_back(std::sin(0.01 * i + c));
+        drivers["driver_" + std::to_string(c)] = column;
+    }
+
+    std::vector<double> result(columns + 1);
+    double sum {0};
+    auto next_time = [&](int i) { return (i * 0.7 + (i % 3) * 0.2) * last_time / (0.7 * lookups); };
+
+    // A binary search and linear interpolation for each column
+    drivers["time"] = times;
+    std::vector<std::vector<double> const*> column_pointers;
+    for (auto const& item : drivers) column_pointers.push_back(&item.second);
+    auto start = clock::now();
+    for (int i {0}; i < lookups; ++i) {
+        double const t {next_time(i)};
+        for (size_t c {0}; c < column_pointers.size(); ++c) {
+            size_t j = std::upper_bound(times.begin() + 1, times.end() - 1, t) - times.begin() - 1;
+            auto const& column = *column_pointers[c];
+            result[c] = column[j] + (t - times[j]) / (times[j + 1] - times[j]) * (column[j + 1] - column[j]);
+        }
+        sum += result[0];
+    }
+    auto search_time = clock::now() - start;
+
+    BioCro::Driver_table uniform {drivers};
+    BioCro::Driver_table::Cursor cursor;
+    start = clock::now();
+    for (int i {0}; i < lookups; ++i) {
+        uniform.values_at(next_time(i), result.data(), cursor);
+        sum += result[0];
+    }
+    auto uniform_time = clock::now() - start;
+
+    drivers["time"] = uneven_times;
+    BioCro::Driver_table uneven {drivers};
+    cursor = {};
+    start = clock::now();
+    for (int i {0}; i < lookups; ++i) {
+        uneven.values_at(next_time(i), result.data(), cursor);
+    }
+    auto cursor_time = clock::now() - start;
+
+    EXPECT_TRUE(uniform.is_uniform());
+    EXPECT_FALSE(uneven.is_uniform());
+    if (VERBOSE) {
+        cout << "search per column: " << duration_cast<microseconds>(search_time).count() << " us" << endl;
+        cout << "uniform index: " << duration_cast<microseconds>(uniform_time).count() << " us ("
+             << static_cast<double>(search_time.count()) / uniform_time.count()
+             << " times as fast)" << endl;
+        cout << "cursor: " << duration_cast<microseconds>(cursor_time).count() << " us ("
+             << static_cast<double>(search_time.count()) / cursor_time.count()
+             << " times as fast)" << endl;
+        cout << "(checksum " << sum << ")" << endl;
+    }
+}
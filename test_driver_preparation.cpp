@@ -0,0 +1,168 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover driver_preparation.h, which checks, converts,
+// resamples, and adds to driver data once, giving a Prepared_drivers
+// object that many simulations may share.  They check each step on the
+// drivers of test_multiple_module_libraries.cpp, including converting
+// time to the days testBML's thermal_time_linear expects, and that bad
+// drivers and impossible steps are refused.  The last test compares the
+// time needed to start many simulations, preparing the drivers for each
+// and preparing them once.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>     // for std::nan, std::sin
+#include <iostream>
+
+#include "BioCro_Extended.h"
+#include "driver_preparation.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+using Module_factory_2 = BioCro::Test_BioCro_library_module_factory;
+
+class DriverPreparationTest : public ::testing::Test {
+   protected:
+    BioCro::System_drivers drivers
+        { {"time", { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 } },
+          {"temp", { 5, 8, 10, 15, 20, 20, 25, 30, 32, 40} } };
+};
+
+TEST_F(DriverPreparationTest, StepsAreCarriedOut) {
+    BioCro::Driver_preparation preparation;
+    preparation.require({"time", "temp"})
+        .units("time", "hr").units("temp", "degC")
+        .derive("warm", {"temp"}, [](std::vector<double> const& x) { return x[0] > 20 ? 1.0 : 0.0; })
+        .resample(0.5)
+        .convert("temp", "degF");
+
+    BioCro::Prepared_drivers prepared {preparation.prepare(drivers)};
+    auto const& result = prepared.drivers();
+    EXPECT_EQ(prepared.rows(), 19u);
+    EXPECT_EQ(prepared.timestep(), 0.5);
+    EXPECT_EQ(prepared.unit("temp"), "degF");
+    EXPECT_EQ(prepared.unit("time"), "hr");
+    EXPECT_EQ(prepared.unit("warm"), "");
+    ASSERT_EQ(result.size(), 3u);
+
+    for (size_t i {0}; i < prepared.rows(); ++i) {
+        EXPECT_DOUBLE_EQ(result.at("time")[i], 0.5 * i);
+        double const celsius {i % 2 == 0 ? drivers["temp"][i / 2]
+                                         : (drivers["temp"][i / 2] + drivers["temp"][i / 2 + 1]) / 2};
+        EXPECT_NEAR(result.at("temp")[i], celsius * 9 / 5 + 32, 1e-12);
+        // Derived after conversion and resampling
+        EXPECT_EQ(result.at("warm")[i], result.at("temp")[i] > 20 ? 1 : 0);
+    }
+
+    // Copies share the data.
+    BioCro::Prepared_drivers copy {prepared};
+    EXPECT_EQ(&copy.drivers(), &prepared.drivers());
+}
+
+// testBML's thermal_time_linear works in days where standardBML's
+// works in hours.  With the hourly drivers converted to days, and the
+// timestep given in days, it gives the thermal time standardBML's
+// module gives for the drivers as they were.
+TEST_F(DriverPreparationTest, UnitsMatchTheModule) {
+    auto run = [](BioCro::Module_creator module, BioCro::System_drivers const& d, double timestep) {
+        return BioCro::Simulator {{ {"TTc", 0} },
+                                  { {"timestep", timestep}, {"sowing_time", 0}, {"tbase", 10} },
+                                  d, {}, {module},
+                                  "homemade_euler", 1, 0.0001, 0.0001, 200}.run_simulation();
+    };
+
+    BioCro::Prepared_drivers in_days {BioCro::Driver_preparation {}
+        .units("time", "hr").convert("time", "day").prepare(drivers)};
+    EXPECT_EQ(in_days.unit("time"), "day");
+    EXPECT_DOUBLE_EQ(in_days.drivers().at("time")[6], 0.25);
+
+    auto standard = run(Module_factory::retrieve("thermal_time_linear"), drivers, 1);
+    auto test = run(Module_factory_2::retrieve("thermal_time_linear"), in_days.drivers(), 1.0 / 24);
+    if (VERBOSE) cout << "TTc: " << standard["TTc"].back() << " and " << test["TTc"].back() << endl;
+    EXPECT_DOUBLE_EQ(test["TTc"].back(), standard["TTc"].back());
+}
+
+TEST_F(DriverPreparationTest, BadDriversAreRefused) {
+    BioCro::Driver_preparation requires_rh;
+    requires_rh.require({"time", "rh"});
+    EXPECT_THROW(requires_rh.prepare(drivers), std::invalid_argument);
+
+    BioCro::Driver_preparation any;
+    auto uneven = drivers;
+    uneven["temp"].pop_back();
+    EXPECT_THROW(any.prepare(uneven), std::invalid_argument);
+
+    auto missing_value = drivers;
+    missing_value["temp"][3] = std::nan("");
+    EXPECT_THROW(any.prepare(missing_value), std::invalid_argument);
+
+    // No unit was given for temp, so no conversion is known.
+    EXPECT_THROW(BioCro::Driver_preparation {}.convert("temp", "degF").prepare(drivers),
+                 std::invalid_argument);
+    EXPECT_NO_THROW(BioCro::Driver_preparation {}.convert("temp", "degF", 1.8, 32).prepare(drivers));
+
+    auto backward = drivers;
+    backward["time"][4] = 2;
+    EXPECT_THROW(BioCro::Driver_preparation {}.resample(0.5).prepare(backward), std::invalid_argument);
+    EXPECT_THROW(BioCro::Driver_preparation {}.resample(0), std::invalid_argument);
+
+    auto sum = [](std::vector<double> const& x) { return x[0] + x[1]; };
+    EXPECT_THROW(BioCro::Driver_preparation {}.derive("temp", {"time"}, sum).prepare(drivers),
+                 std::invalid_argument);
+    EXPECT_THROW(BioCro::Driver_preparation {}.derive("x", {"time", "rh"}, sum).prepare(drivers),
+                 std::invalid_argument);
+}
+
+// Starts 200 simulations on a year of hourly drivers resampled to half
+// hours, preparing the drivers for each and preparing them once.
+TEST_F(DriverPreparationTest, PreparationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    drivers.clear();
+    for (int i {0}; i < 8760; ++i) {
+        drivers["time"].push_back(i);
+        drivers["temp"].push_back(60 + 20 * std::sin(i * 0.26));
+    }
+    BioCro::Driver_preparation preparation;
+    preparation.require({"time", "temp"}).units("temp", "degF").convert("temp", "degC").resample(0.5);
+
+    BioCro::Module_set modules {Module_factory::retrieve("thermal_time_linear")};
+    BioCro::Parameter_set parameters { {"timestep", 0.5}, {"sowing_time", 0}, {"tbase", 10} };
+    int const simulations {200};
+    size_t total_rows {0};
+
+    auto start = clock::now();
+    for (int i {0}; i < simulations; ++i) {
+        BioCro::Prepared_drivers prepared {preparation.prepare(drivers)};
+        BioCro::Simulator simulator {{ {"TTc", 0} }, parameters, prepared.drivers(), {}, modules,
+                                     "homemade_euler", 1, 0.0001, 0.0001, 200};
+        total_rows += prepared.rows();
+    }
+    auto each_time = clock::now() - start;
+
+    start = clock::now();
+    BioCro::Prepared_drivers prepared {preparation.prepare(drivers)};
+    for (int i {0}; i < simulations; ++i) {
+        BioCro::Simulator simulator {{ {"TTc", 0} }, parameters, prepared.drivers(), {}, modules,
+                                     "homemade_euler", 1, 0.0001, 0.0001, 200};
+        total_rows -= prepared.rows();
+    }
+    auto once_time = clock::now() - start;
+
+    EXPECT_EQ(total_rows, 0u);
+    if (VERBOSE) {
+        cout << "preparing for each simulation: " << duration_cast<microseconds>(each_time).count() << " us" << endl;
+        cout << "preparing once: " << duration_cast<microseconds>(once_time).count() << " us ("
+             << static_cast<double>(each_time.count()) / once_time.count()
+             << " times as fast)" << endl;
+    }
+}
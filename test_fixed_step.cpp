@@ -0,0 +1,361 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the Fixed_step_integrator of fixed_step.h, which
+// takes one step per driver row on flat state arrays and writes its
+// results into an Output_columns buffer.  They check, for the harmonic
+// oscillator of test_harmonic_oscillator.cpp, that its Euler and RK4
+// methods give the results of a Simulator using the "homemade_euler"
+// and "boost_rk4" solvers, for a Dynamical_system and for a
+// Static_system; that each method converges at its order to the exact
+// solution; that the symplectic methods keep the total energy near its
+// initial value where RK4 lets it drift; that methods may be chosen by
+// name and bad coordinates are refused; and that a buffer is reused
+// from run to run.  The last two tests compare the time needed to run
+// a simulation with the existing fixed-step solvers and with each
+// method, and the time each method needs to keep the energy error
+// within the bound of test_harmonic_oscillator.cpp.
+//
+// As in test_static_simulator.cpp, the module headers are included
+// directly, and must come before BioCro.h.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max
+#include <chrono>
+#include <cmath>     // for std::abs, std::cos, std::isfinite, std::log2, std::sin, std::sqrt
+#include <iostream>
+
+#include <module_library/harmonic_energy.h>     // for standardBML::harmonic_energy
+#include <module_library/harmonic_oscillator.h> // for standardBML::harmonic_oscillator
+
+#include "BioCro_Extended.h"
+#include "fixed_step.h"
+#include "static_simulator.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+using Oscillator_system = BioCro::Static_system<
+    BioCro::Direct_modules<standardBML::harmonic_energy>,
+    BioCro::Differential_modules<standardBML::harmonic_oscillator>>;
+
+class FixedStepTest : public ::testing::Test {
+   protected:
+    FixedStepTest() { set_rows(101); }
+
+    void set_rows(size_t rows) {
+        std::vector<double> times;
+        for (size_t i {0}; i < rows; ++i) times.push_back(i * parameters["timestep"]);
+        drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Dynamical_system system() {
+        return BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                             direct_modules, differential_modules);
+    }
+
+    BioCro::Simulation_result interpreted_result(std::string const& solver) {
+        return BioCro::Simulator {initial_state, parameters, drivers,
+                                  direct_modules, differential_modules,
+                                  solver, 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+
+    void expect_same_results(BioCro::Simulation_result const& expected,
+                             BioCro::Simulation_result const& result) {
+        ASSERT_EQ(result.size(), expected.size());
+        for (auto const& column : expected) {
+            ASSERT_EQ(result.count(column.first), 1u) << column.first;
+            auto const& values = result.at(column.first);
+            ASSERT_EQ(values.size(), column.second.size()) << column.first;
+            for (size_t i {0}; i < values.size(); ++i) {
+                EXPECT_NEAR(values[i], column.second[i], 1e-12 * (1 + std::abs(column.second[i])))
+                    << column.first << " at row " << i;
+            }
+        }
+    }
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+};
+
+TEST_F(FixedStepTest, MatchesExistingSolvers) {
+    BioCro::Fixed_step_integrator euler {BioCro::Fixed_step_method::euler};
+    BioCro::Fixed_step_integrator rk4 {BioCro::Fixed_step_method::rk4};
+
+    BioCro::Simulation_result expected_euler {interpreted_result("homemade_euler")};
+    expect_same_results(expected_euler, euler.integrate(*system()));
+    expect_same_results(interpreted_result("boost_euler"), euler.integrate(*system()));
+
+    BioCro::Simulation_result expected_rk4 {interpreted_result("boost_rk4")};
+    expect_same_results(expected_rk4, rk4.integrate(*system()));
+
+    // The same for a Static_system, which is integrated from its
+    // initial state each time
+    Oscillator_system static_system {initial_state, parameters, drivers};
+    expect_same_results(expected_euler, euler.integrate(static_system));
+    expect_same_results(expected_rk4, rk4.integrate(static_system));
+    expect_same_results(expected_rk4, rk4.integrate(static_system));
+}
+
+// The position error after two time units, with timesteps of 0.1 and
+// 0.05, against the exact solution x0 cos(wt) + (v0 / w) sin(wt)
+TEST_F(FixedStepTest, MethodsConvergeAtTheirOrders) {
+    double const w {std::sqrt(7.0 / 5)};
+    double const exact {3 * std::cos(w * 2) - 2 / w * std::sin(w * 2)};
+
+    auto error = [&](BioCro::Fixed_step_method method, double timestep) {
+        parameters["timestep"] = timestep;
+        set_rows(static_cast<size_t>(2 / timestep + 0.5) + 1);
+        BioCro::Fixed_step_integrator integrator {method, {"position"}};
+        BioCro::Output_columns output;
+        integrator.integrate(*system(), output);
+        return std::abs(output.column("position")[output.rows() - 1] - exact);
+    };
+
+    std::vector<std::pair<BioCro::Fixed_step_method, double>> orders {
+        {BioCro::Fixed_step_method::euler, 1},
+        {BioCro::Fixed_step_method::rk2, 2},
+        {BioCro::Fixed_step_method::ssp_rk3, 3},
+        {BioCro::Fixed_step_method::rk4, 4},
+        {BioCro::Fixed_step_method::stormer_verlet, 2},
+        {BioCro::Fixed_step_method::yoshida4, 4}};
+    for (auto const& item : orders) {
+        double const order {std::log2(error(item.first, 0.1) / error(item.first, 0.05))};
+        if (VERBOSE) cout << BioCro::to_string(item.first) << " order: " << order << endl;
+        EXPECT_NEAR(order, item.second, 0.25) << BioCro::to_string(item.first);
+    }
+}
+
+// Over 10,000 steps (about 190 periods), the energy error of the
+// symplectic methods is no larger late in the simulation than early,
+// while that of RK4 grows.
+TEST_F(FixedStepTest, SymplecticMethodsConserveEnergy) {
+    set_rows(10000);
+    double const initial_energy {0.5 * 5 * 4 + 0.5 * 7 * 9};
+
+    // The largest relative energy errors in the first and last tenths
+    // of the simulation
+    auto energy_errors = [&](BioCro::Fixed_step_method method) {
+        BioCro::Fixed_step_integrator integrator {method, {"position"}};
+        BioCro::Output_columns output;
+        integrator.integrate(*system(), output);
+        double const* energy {output.column("total_energy")};
+        std::pair<double, double> errors {0, 0};
+        for (size_t i {0}; i < 1000; ++i) {
+            errors.first = std::max(errors.first, std::abs(energy[i] / initial_energy - 1));
+            errors.second = std::max(errors.second, std::abs(energy[9000 + i] / initial_energy - 1));
+        }
+        if (VERBOSE) {
+            cout << BioCro::to_string(method) << " energy error: " << errors.first
+                 << " early, " << errors.second << " late" << endl;
+        }
+        return errors;
+    };
+
+    auto verlet = energy_errors(BioCro::Fixed_step_method::stormer_verlet);
+    EXPECT_LT(verlet.first, 0.01);
+    EXPECT_LT(verlet.second, 1.01 * verlet.first);
+
+    auto yoshida = energy_errors(BioCro::Fixed_step_method::yoshida4);
+    EXPECT_LT(yoshida.first, 1e-4);
+    EXPECT_LT(yoshida.second, 1.01 * yoshida.first);
+
+    auto rk4 = energy_errors(BioCro::Fixed_step_method::rk4);
+    EXPECT_GT(rk4.second, 5 * rk4.first);
+}
+
+TEST_F(FixedStepTest, MethodsAreChosenByName) {
+    for (std::string name : {"euler", "rk2", "ssp_rk3", "rk4", "stormer_verlet", "yoshida4"}) {
+        EXPECT_EQ(BioCro::to_string(BioCro::fixed_step_method(name)), name);
+    }
+    EXPECT_THROW(BioCro::fixed_step_method("boost_rk4"), std::out_of_range);
+    EXPECT_TRUE(BioCro::is_symplectic(BioCro::fixed_step_method("yoshida4")));
+    EXPECT_FALSE(BioCro::is_symplectic(BioCro::fixed_step_method("rk4")));
+}
+
+TEST_F(FixedStepTest, BadCoordinatesAreRefused) {
+    EXPECT_THROW(BioCro::Fixed_step_integrator {BioCro::Fixed_step_method::stormer_verlet},
+                 std::invalid_argument);
+    EXPECT_THROW((BioCro::Fixed_step_integrator {BioCro::Fixed_step_method::yoshida4, {}}),
+                 std::invalid_argument);
+
+    BioCro::Fixed_step_integrator not_differential {BioCro::Fixed_step_method::yoshida4, {"mass"}};
+    EXPECT_THROW(not_differential.integrate(*system()), std::invalid_argument);
+
+    BioCro::Fixed_step_integrator all_coordinates {BioCro::Fixed_step_method::stormer_verlet,
+                                                   {"position", "velocity"}};
+    EXPECT_THROW(all_coordinates.integrate(*system()), std::invalid_argument);
+
+    // Coordinates are ignored by the other methods.
+    BioCro::Fixed_step_integrator rk4 {BioCro::Fixed_step_method::rk4, {"mass"}};
+    EXPECT_NO_THROW(rk4.integrate(*system()));
+}
+
+TEST_F(FixedStepTest, OutputIsReused) {
+    BioCro::Fixed_step_integrator integrator {BioCro::Fixed_step_method::ssp_rk3};
+    BioCro::Output_columns output;
+    integrator.integrate(*system(), output);
+    EXPECT_EQ(output.rows(), 101u);
+    EXPECT_EQ(output.names(), system()->get_output_quantity_names());
+    double const* position {output.column("position")};
+    double const last {position[100]};
+    EXPECT_DOUBLE_EQ(position[0], 3);
+
+    integrator.integrate(*system(), output);
+    EXPECT_EQ(output.column("position"), position);
+    EXPECT_EQ(position[100], last);
+
+    BioCro::Simulation_result result {output.to_result()};
+    EXPECT_EQ(result["position"].size(), 101u);
+    EXPECT_EQ(result["position"].back(), last);
+    EXPECT_THROW(output.column("temp"), std::out_of_range);
+}
+
+// Times 200 runs of a 1000-row simulation with each of the existing
+// fixed-step solvers, and with each method on a Dynamical_system and a
+// Static_system, reusing one integrator and buffer.
+TEST_F(FixedStepTest, SimulationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    set_rows(1000);
+    int const runs {200};
+    double sum {0};
+
+    std::vector<std::pair<std::string, clock::duration>> solver_times;
+    for (std::string solver : {"homemade_euler", "boost_euler", "boost_rk4"}) {
+        auto start = clock::now();
+        for (int i {0}; i < runs; ++i) sum += interpreted_result(solver)["position"].back();
+        solver_times.push_back({solver, clock::now() - start});
+    }
+
+    BioCro::Output_columns output;
+    auto time_method = [&](BioCro::Fixed_step_method method, bool static_system) {
+        BioCro::Fixed_step_integrator integrator {method};
+        auto start = clock::now();
+        for (int i {0}; i < runs; ++i) {
+            if (static_system) {
+                Oscillator_system system {initial_state, parameters, drivers};
+                integrator.integrate(system, output);
+            }
+            else {
+                integrator.integrate(*system(), output);
+            }
+            sum += output.column("position")[output.rows() - 1];
+        }
+        return clock::now() - start;
+    };
+
+    auto report = [&](std::string const& name, clock::duration time, clock::duration baseline) {
+        if (!VERBOSE) return;
+        cout << name << ": " << duration_cast<microseconds>(time).count() << " us";
+        if (time != baseline) {
+            cout << " (" << static_cast<double>(baseline.count()) / time.count() << " times as fast)";
+        }
+        cout << endl;
+    };
+    for (auto const& item : solver_times) report(item.first, item.second, item.second);
+
+    auto euler_baseline = solver_times[1].second;
+    auto rk4_baseline = solver_times[2].second;
+    for (auto method : {BioCro::Fixed_step_method::euler, BioCro::Fixed_step_method::rk2,
+                        BioCro::Fixed_step_method::ssp_rk3, BioCro::Fixed_step_method::rk4}) {
+        auto baseline = method == BioCro::Fixed_step_method::rk4 ? rk4_baseline : euler_baseline;
+        std::string const compared {method == BioCro::Fixed_step_method::rk4 ? " (vs boost_rk4)"
+                                                                              : " (vs boost_euler)"};
+        report(BioCro::to_string(method) + compared, time_method(method, false), baseline);
+        report(BioCro::to_string(method) + ", static" + compared, time_method(method, true), baseline);
+    }
+    EXPECT_TRUE(std::isfinite(sum));
+}
+
+// For each of RK4, Stormer-Verlet, and Yoshida's method, finds the
+// largest timestep (from 0.8 down by factors of the square root of two)
+// that keeps the total energy within 9e-4 of its initial value over
+// 1000 time units, and times 10 runs with it; boost_rk4 is timed with
+// the timestep RK4 needs.
+TEST_F(FixedStepTest, CostAtFixedEnergyError) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    double const duration {1000};
+    double const tolerance {9e-4};
+    double const initial_energy {0.5 * 5 * 4 + 0.5 * 7 * 9};
+    int const runs {10};
+    BioCro::Output_columns output;
+
+    auto use_timestep = [&](double timestep) {
+        parameters["timestep"] = timestep;
+        set_rows(static_cast<size_t>(duration / timestep) + 1);
+    };
+
+    auto energy_error = [&]() {
+        double const* energy {output.column("total_energy")};
+        double error {0};
+        for (size_t i {0}; i < output.rows(); ++i) {
+            error = std::max(error, std::abs(energy[i] / initial_energy - 1));
+        }
+        return error;
+    };
+
+    struct Timing {
+        std::string method;
+        double timestep;
+        size_t rows;
+        clock::duration time;
+    };
+    std::vector<Timing> timings;
+    double rk4_timestep {0};
+    for (auto method : {BioCro::Fixed_step_method::rk4, BioCro::Fixed_step_method::stormer_verlet,
+                        BioCro::Fixed_step_method::yoshida4}) {
+        BioCro::Fixed_step_integrator integrator {method, {"position"}};
+        double timestep {0.8};
+        for (; timestep > 1e-3; timestep /= std::sqrt(2.0)) {
+            use_timestep(timestep);
+            integrator.integrate(*system(), output);
+            if (energy_error() <= tolerance) break;
+        }
+        ASSERT_GT(timestep, 1e-3) << BioCro::to_string(method);
+        if (method == BioCro::Fixed_step_method::rk4) rk4_timestep = timestep;
+
+        auto start = clock::now();
+        for (int i {0}; i < runs; ++i) integrator.integrate(*system(), output);
+        timings.push_back({BioCro::to_string(method), timestep, output.rows(), clock::now() - start});
+        EXPECT_LE(energy_error(), tolerance);
+    }
+
+    use_timestep(rk4_timestep);
+    auto start = clock::now();
+    for (int i {0}; i < runs; ++i) interpreted_result("boost_rk4");
+    auto boost_time = clock::now() - start;
+
+    // Yoshida's method takes larger steps than RK4 for the same energy
+    // error, and Stormer-Verlet takes smaller ones.
+    EXPECT_GT(timings[2].timestep, timings[0].timestep);
+    EXPECT_LT(timings[1].timestep, timings[0].timestep);
+
+    if (VERBOSE) {
+        cout << "boost_rk4 (timestep " << rk4_timestep << "): "
+             << duration_cast<microseconds>(boost_time).count() << " us" << endl;
+        for (auto const& item : timings) {
+            cout << item.method << " (timestep " << item.timestep << ", " << item.rows << " rows): "
+                 << duration_cast<microseconds>(item.time).count() << " us ("
+                 << static_cast<double>(boost_time.count()) / item.time.count()
+                 << " times as fast)" << endl;
+        }
+    }
+}
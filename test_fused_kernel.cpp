@@ -0,0 +1,226 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the generated kernels of fused_kernel.h.  They
+// check that direct modules are put in dependency order, that a
+// Fused_system calculates the same derivatives as a Dynamical_system
+// for the harmonic oscillator and for the thermal-time model of
+// test_repeat_runs.cpp, that a compiled kernel is reused for a system
+// of the same structure, that the compiler's arguments are passed
+// without a shell, and that compiler errors are reported.  The last
+// test compares the time needed to calculate derivatives with the two.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::find
+#include <chrono>
+#include <cmath>     // for std::abs
+#include <cstdio>    // for std::remove
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "BioCro_Extended.h"
+#include "fused_kernel.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class FusedKernelTest : public ::testing::Test {
+   protected:
+    FusedKernelTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) times.push_back(i * 0.1);
+        drivers = { {"elapsed_time", times} };
+        options.directory = ::testing::TempDir();
+    }
+
+    // Checks that the two systems give the same derivatives at several
+    // states and times, matching quantities by name.
+    void expect_same_derivatives(BioCro::Dynamical_system const& interpreted,
+                                 BioCro::Fused_system& fused) {
+        auto interpreted_names = interpreted->get_differential_quantity_names();
+        auto fused_names = fused.get_differential_quantity_names();
+        ASSERT_EQ(BioCro::Variable_set(interpreted_names.begin(), interpreted_names.end()),
+                  BioCro::Variable_set(fused_names.begin(), fused_names.end()));
+        size_t n {fused_names.size()};
+
+        std::vector<double> x(n), fused_x(n), dxdt(n), fused_dxdt(n);
+        for (int trial {0}; trial < 20; ++trial) {
+            for (size_t i {0}; i < n; ++i) x[i] = 0.37 * trial - 1.3 * i + 0.5;
+            for (size_t i {0}; i < n; ++i) {
+                auto position = std::find(interpreted_names.begin(), interpreted_names.end(), fused_names[i]);
+                fused_x[i] = x[position - interpreted_names.begin()];
+            }
+
+            size_t row {static_cast<size_t>(trial * 3) % fused.get_ntimes()};
+            interpreted->calculate_derivative(x, dxdt, row);
+            fused.calculate_derivative(fused_x, fused_dxdt, row);
+            expect_matching(interpreted_names, dxdt, fused_names, fused_dxdt);
+
+            double time {row + 0.25};
+            if (time < fused.get_ntimes() - 1) {
+                interpreted->calculate_derivative(x, dxdt, time);
+                fused.calculate_derivative(fused_x, fused_dxdt, time);
+                expect_matching(interpreted_names, dxdt, fused_names, fused_dxdt);
+            }
+        }
+    }
+
+    void expect_matching(BioCro::Variable_names const& names, std::vector<double> const& values,
+                         BioCro::Variable_names const& fused_names, std::vector<double> const& fused_values) {
+        for (size_t i {0}; i < fused_names.size(); ++i) {
+            auto position = std::find(names.begin(), names.end(), fused_names[i]) - names.begin();
+            EXPECT_NEAR(fused_values[i], values[position], 1e-12 * (1 + std::abs(values[position])))
+                << fused_names[i];
+        }
+    }
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+
+    BioCro::Kernel_options options;
+};
+
+TEST_F(FusedKernelTest, DirectModulesAreOrderedByDependency) {
+    // c needs b's output, which needs a's.
+    std::vector<std::pair<BioCro::Variable_names, BioCro::Variable_names>> modules {
+        { {"y"}, {"z"} },   // c
+        { {"w"}, {"v"} },   // independent
+        { {"x"}, {"y"} },   // b
+        { {"u"}, {"x"} }};  // a
+    EXPECT_EQ(BioCro::kernel_detail::dependency_order(modules),
+              (std::vector<size_t> {3, 2, 0, 1}));
+
+    modules.push_back({ {"z"}, {"u"} });
+    EXPECT_THROW(BioCro::kernel_detail::dependency_order(modules), std::logic_error);
+
+    // The generated source runs them in that order.
+    auto layout = BioCro::make_kernel_layout(initial_state, parameters, drivers,
+                                             direct_modules, differential_modules);
+    std::string source {BioCro::generate_kernel_source(layout, options)};
+    EXPECT_NE(source.find("#include <module_library/harmonic_oscillator.h>"), std::string::npos);
+    EXPECT_NE(source.find("standardBML::harmonic_energy direct_0;"), std::string::npos);
+    EXPECT_LT(source.find("direct_0.run();"), source.find("differential_0.run();"));
+    if (VERBOSE) cout << source << endl;
+}
+
+TEST_F(FusedKernelTest, MatchesInterpretedDerivatives) {
+    BioCro::Dynamical_system interpreted {BioCro::make_dynamical_system(
+        initial_state, parameters, drivers, direct_modules, differential_modules)};
+    BioCro::Fused_system fused {initial_state, parameters, drivers,
+                                direct_modules, differential_modules, options};
+    expect_same_derivatives(interpreted, fused);
+
+    // The thermal-time model of test_repeat_runs.cpp
+    BioCro::State tt_state { {"TTc", 0} };
+    BioCro::Parameter_set tt_parameters { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} };
+    BioCro::System_drivers tt_drivers { {"time", {0, 1, 2, 3, 4, 5}},
+                                        {"temp", {3, 8, 11, 15, 4, 20}} };
+    BioCro::Module_set tt_modules { Module_factory::retrieve("thermal_time_linear") };
+    BioCro::Dynamical_system tt_interpreted {BioCro::make_dynamical_system(
+        tt_state, tt_parameters, tt_drivers, {}, tt_modules)};
+    BioCro::Fused_system tt_fused {tt_state, tt_parameters, tt_drivers, {}, tt_modules, options};
+    expect_same_derivatives(tt_interpreted, tt_fused);
+}
+
+// A second system of the same structure, even with other parameter
+// values, uses the kernel already compiled.
+TEST_F(FusedKernelTest, CompiledKernelIsReused) {
+    BioCro::Fused_system first {initial_state, parameters, drivers,
+                                direct_modules, differential_modules, options};
+
+    parameters["mass"] = 11;
+    BioCro::Parameter_set rearranged;
+    rearranged.reserve(64);
+    for (auto const& item : parameters) rearranged.insert(item);
+    BioCro::Fused_system second {initial_state, rearranged, drivers,
+                                 direct_modules, differential_modules, options};
+    EXPECT_FALSE(second.get_kernel().was_compiled());
+    EXPECT_EQ(second.get_kernel().path(), first.get_kernel().path());
+
+    BioCro::Dynamical_system interpreted {BioCro::make_dynamical_system(
+        initial_state, parameters, drivers, direct_modules, differential_modules)};
+    expect_same_derivatives(interpreted, second);
+}
+
+// Arguments reach the program as given, however many spaces or shell
+// characters they hold.
+TEST_F(FusedKernelTest, CommandsAreRunWithoutAShell) {
+    std::string const log {::testing::TempDir() + "test_fused_kernel command.log"};
+    ASSERT_TRUE(BioCro::kernel_detail::run_command({"printf", "%s|%s", "a b; exit 1", "$HOME"}, log));
+    std::ostringstream output;
+    output << std::ifstream {log}.rdbuf();
+    EXPECT_EQ(output.str(), "a b; exit 1|$HOME");
+    std::remove(log.c_str());
+
+    EXPECT_FALSE(BioCro::kernel_detail::run_command({"false"}, log));
+    EXPECT_FALSE(BioCro::kernel_detail::run_command({"no_such_program_for_biocro"}, log));
+    std::remove(log.c_str());
+}
+
+TEST_F(FusedKernelTest, CompilerErrorsAreReported) {
+    options.module_namespace = "noSuchBML";
+    try {
+        BioCro::Fused_system fused {initial_state, parameters, drivers,
+                                    direct_modules, differential_modules, options};
+        ADD_FAILURE() << "Expected std::runtime_error";
+    }
+    catch (std::runtime_error const& e) {
+        EXPECT_NE(std::string(e.what()).find("The kernel could not be compiled."), std::string::npos);
+        EXPECT_NE(std::string(e.what()).find("noSuchBML"), std::string::npos);
+    }
+}
+
+// Times 200,000 derivative calculations each way.
+TEST_F(FusedKernelTest, DerivativeTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    BioCro::Dynamical_system interpreted {BioCro::make_dynamical_system(
+        initial_state, parameters, drivers, direct_modules, differential_modules)};
+    BioCro::Fused_system fused {initial_state, parameters, drivers,
+                                direct_modules, differential_modules, options};
+
+    int const evaluations {200000};
+    // Both quantities are given the same value, so that the sum of
+    // the derivatives doesn't depend on their order.
+    std::vector<double> x(2), dxdt(2);
+    double sum {0};
+
+    auto start = clock::now();
+    for (int i {0}; i < evaluations; ++i) {
+        x[0] = x[1] = i * 1e-6;
+        interpreted->calculate_derivative(x, dxdt, static_cast<size_t>(i % 100));
+        sum += dxdt[0] + dxdt[1];
+    }
+    auto interpreted_time = clock::now() - start;
+
+    start = clock::now();
+    for (int i {0}; i < evaluations; ++i) {
+        x[0] = x[1] = i * 1e-6;
+        fused.calculate_derivative(x, dxdt, static_cast<size_t>(i % 100));
+        sum -= dxdt[0] + dxdt[1];
+    }
+    auto fused_time = clock::now() - start;
+
+    EXPECT_NEAR(sum, 0, 1e-6);
+    if (VERBOSE) {
+        cout << "interpreted: " << duration_cast<microseconds>(interpreted_time).count() << " us" << endl;
+        cout << "fused kernel: " << duration_cast<microseconds>(fused_time).count() << " us ("
+             << static_cast<double>(interpreted_time.count()) / fused_time.count()
+             << " times as fast)" << endl;
+    }
+}
@@ -0,0 +1,175 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the Module_evaluator of module_evaluator.h, which
+// runs one module over columns of inputs.  They check that it gives
+// the results of the module-evaluation pattern of
+// test_module_evaluation.cpp for a differential and a direct module,
+// that reusing its output columns gives the same results, and that
+// badly specified inputs are refused.  The last test compares the time
+// needed to evaluate a module over a grid of inputs with the two.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "BioCro.h"
+#include "module_evaluator.h"
+
+#include "Random.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class ModuleEvaluatorTest : public ::testing::Test {
+   protected:
+    Rand_double double_gen { -100, 100 };
+    Rand_double pos_double_gen { 1e-5, 100 };
+
+    // The outputs of one evaluation made as in
+    // test_module_evaluation.cpp.
+    BioCro::Variable_settings evaluate_once(BioCro::Module_creator w,
+                                            BioCro::Variable_settings const& inputs) {
+        BioCro::Variable_settings outputs;
+        for (std::string& param : w->get_outputs()) {
+            outputs[param] = 0.0;
+        }
+        BioCro::Module module = w->create_module(inputs, &outputs);
+        module->run();
+        return outputs;
+    }
+};
+
+TEST_F(ModuleEvaluatorTest, DifferentialModule) {
+    BioCro::Module_creator w = Module_factory::retrieve("harmonic_oscillator");
+    BioCro::Module_evaluator evaluator {w, {"position", "velocity", "mass"},
+                                        { {"spring_constant", 7} }};
+    ASSERT_EQ(evaluator.output_names(), w->get_outputs());
+
+    size_t const rows {50};
+    std::vector<std::vector<double>> inputs(3), outputs;
+    for (size_t j {0}; j < rows; ++j) {
+        inputs[0].push_back(double_gen());
+        inputs[1].push_back(double_gen());
+        inputs[2].push_back(pos_double_gen());
+    }
+    evaluator.evaluate(inputs, outputs);
+    ASSERT_EQ(outputs.size(), 2u);
+
+    for (size_t j {0}; j < rows; ++j) {
+        BioCro::Variable_settings expected {evaluate_once(w, {
+            {"position", inputs[0][j]},
+            {"velocity", inputs[1][j]},
+            {"mass", inputs[2][j]},
+            {"spring_constant", 7}})};
+        for (size_t i {0}; i < outputs.size(); ++i) {
+            EXPECT_DOUBLE_EQ(outputs[i][j], expected.at(evaluator.output_names()[i]));
+        }
+    }
+
+    // Outputs are set to zero before each evaluation, so evaluating
+    // again into the same columns gives the same values.
+    auto first_outputs = outputs;
+    double const* storage {outputs[0].data()};
+    evaluator.evaluate(inputs, outputs);
+    EXPECT_EQ(outputs, first_outputs);
+    EXPECT_EQ(outputs[0].data(), storage);
+}
+
+TEST_F(ModuleEvaluatorTest, DirectModule) {
+    BioCro::Module_creator w = Module_factory::retrieve("solar_position_michalsky");
+
+    // Urbana, Illinois, through July 19, 2023
+    BioCro::Variable_settings fixed {
+        {"lat", 40.0932},
+        {"longitude", -88.20175},
+        {"time_zone_offset", -5},
+        {"year", 2023}};
+    BioCro::Module_evaluator evaluator {w, {"time"}, fixed};
+
+    std::vector<double> times;
+    for (int hour {0}; hour < 24; ++hour) times.push_back(200 + hour / 24.0);
+    std::vector<std::vector<double>> outputs(evaluator.output_names().size(),
+                                             std::vector<double>(times.size()));
+    std::vector<double*> output_columns;
+    for (auto& column : outputs) output_columns.push_back(column.data());
+    double const* input_columns[] {times.data()};
+    evaluator.evaluate(times.size(), input_columns, output_columns.data());
+
+    for (size_t j {0}; j < times.size(); ++j) {
+        BioCro::Variable_settings inputs {fixed};
+        inputs["time"] = times[j];
+        BioCro::Variable_settings expected {evaluate_once(w, inputs)};
+        for (size_t i {0}; i < outputs.size(); ++i) {
+            EXPECT_DOUBLE_EQ(outputs[i][j], expected.at(evaluator.output_names()[i]));
+        }
+    }
+}
+
+TEST_F(ModuleEvaluatorTest, BadInputsAreRefused) {
+    BioCro::Module_creator w = Module_factory::retrieve("harmonic_oscillator");
+    BioCro::Variable_settings fixed { {"mass", 5}, {"spring_constant", 7} };
+
+    // Not an input of the module
+    EXPECT_THROW((BioCro::Module_evaluator {w, {"position", "velocity", "time"}, fixed}),
+                 std::invalid_argument);
+    // Given twice
+    EXPECT_THROW((BioCro::Module_evaluator {w, {"position", "velocity", "mass"}, fixed}),
+                 std::invalid_argument);
+    // Not given
+    EXPECT_THROW((BioCro::Module_evaluator {w, {"position"}, fixed}), std::invalid_argument);
+
+    BioCro::Module_evaluator evaluator {w, {"position", "velocity"}, fixed};
+    std::vector<std::vector<double>> outputs;
+    EXPECT_THROW(evaluator.evaluate({ {1, 2} }, outputs), std::invalid_argument);
+    EXPECT_THROW(evaluator.evaluate({ {1, 2}, {3} }, outputs), std::invalid_argument);
+}
+
+// Times the evaluation of harmonic_oscillator at 200,000 points each
+// way.
+TEST_F(ModuleEvaluatorTest, EvaluationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    BioCro::Module_creator w = Module_factory::retrieve("harmonic_oscillator");
+    size_t const rows {200000};
+    std::vector<std::vector<double>> inputs(2, std::vector<double>(rows)), outputs;
+    for (size_t j {0}; j < rows; ++j) {
+        inputs[0][j] = j * 1e-3;
+        inputs[1][j] = 1 - j * 1e-3;
+    }
+    double sum {0};
+
+    auto start = clock::now();
+    for (size_t j {0}; j < rows; ++j) {
+        BioCro::Variable_settings row_outputs {evaluate_once(w, {
+            {"position", inputs[0][j]},
+            {"velocity", inputs[1][j]},
+            {"mass", 5},
+            {"spring_constant", 7}})};
+        sum += row_outputs["position"] + row_outputs["velocity"];
+    }
+    auto single_time = clock::now() - start;
+
+    start = clock::now();
+    BioCro::Module_evaluator evaluator {w, {"position", "velocity"},
+                                        { {"mass", 5}, {"spring_constant", 7} }};
+    evaluator.evaluate(inputs, outputs);
+    for (size_t j {0}; j < rows; ++j) sum -= outputs[0][j] + outputs[1][j];
+    auto batch_time = clock::now() - start;
+
+    EXPECT_NEAR(sum, 0, 1e-6);
+    if (VERBOSE) {
+        cout << "one module per point: " << duration_cast<microseconds>(single_time).count() << " us" << endl;
+        cout << "module evaluator: " << duration_cast<microseconds>(batch_time).count() << " us ("
+             << static_cast<double>(single_time.count()) / batch_time.count()
+             << " times as fast)" << endl;
+    }
+}
@@ -0,0 +1,224 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the on-demand module libraries of
+// module_loading.h.  This program is not linked with testBML.so; the
+// tests check that the library is opened only when one of its modules
+// is first asked for, that its modules then work in a simulation, that
+// a linked library gives the same creators and quantities as its
+// module factory, that errors name what went wrong, and that threads
+// asking for an unloaded library at once all get the same creators.
+// The last test times a new process's first simulation, with every
+// library loaded and indexed up front and with libraries loaded only
+// as needed.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::min
+#include <atomic>
+#include <chrono>
+#include <cstdlib>   // for std::getenv
+#include <iostream>
+#include <thread>
+
+#include <dlfcn.h>     // for dlopen
+
+#include "BioCro.h"
+#include "child_process.h"
+#include "module_loading.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+namespace {
+    // Whether a file of that name has been loaded into this process,
+    // by a Module_library or otherwise.
+    bool in_process(std::string const& file_name)
+    {
+        void* handle {dlopen(file_name.c_str(), RTLD_NOW | RTLD_NOLOAD)};
+        if (handle) dlclose(handle);
+        return handle != nullptr;
+    }
+
+    BioCro::Simulation_result thermal_time_simulation(BioCro::Module_creator thermal_time)
+    {
+        return BioCro::Simulator {
+            { {"TTc", 0} },
+            { {"timestep", 1}, {"sowing_time", 0}, {"tbase", 5} },
+            { {"time", {0, 1, 2, 3, 4}}, {"temp", {5, 10, 15, 20, 25}} },
+            {},
+            { thermal_time },
+            "homemade_euler", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+
+    BioCro::Simulation_result oscillator_simulation()
+    {
+        return BioCro::Simulator {
+            { {"position", 3}, {"velocity", -2} },
+            { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} },
+            { {"elapsed_time", {0, 0.1, 0.2, 0.3, 0.4}} },
+            { Module_factory::retrieve("harmonic_energy") },
+            { Module_factory::retrieve("harmonic_oscillator") },
+            "boost_rk4", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+}
+
+TEST(ModuleLoadingTest, LibraryIsLoadedOnFirstUse) {
+    // test_all is linked with testBML.so; this test is only meaningful
+    // when the library isn't already present.
+    bool linked {in_process("./testBML.so")};
+
+    BioCro::Module_library test_library {"testBML"};
+    EXPECT_FALSE(test_library.is_loaded());
+    if (!linked) {
+        EXPECT_FALSE(in_process("./testBML.so"));
+    }
+
+    BioCro::Module_creator thermal_time {test_library.retrieve("thermal_time_linear")};
+    EXPECT_TRUE(test_library.is_loaded());
+    EXPECT_TRUE(in_process("./testBML.so"));
+
+    EXPECT_EQ(thermal_time->get_name(), "thermal_time_linear");
+    EXPECT_EQ(test_library.retrieve("thermal_time_linear"), thermal_time);
+    EXPECT_EQ(test_library.get_all_modules(),
+              (BioCro::Module_names {"solar_position_michalsky", "thermal_time_linear"}));
+    EXPECT_TRUE(test_library.contains("solar_position_michalsky"));
+    EXPECT_FALSE(test_library.contains("harmonic_oscillator"));
+
+    // testBML's thermal_time_linear accumulates temp - tbase per unit
+    // of time.
+    auto result = thermal_time_simulation(thermal_time);
+    EXPECT_DOUBLE_EQ(result["TTc"][4], 0 + 5 + 10 + 15);
+}
+
+// A linked library behaves as its module factory does.
+TEST(ModuleLoadingTest, LinkedLibraryMatchesFactory) {
+    BioCro::Module_library standard {"standardBML", standardBML::module_library::library_entries};
+    EXPECT_FALSE(standard.is_loaded());
+
+    auto modules = Module_factory::get_all_modules();
+    EXPECT_EQ(standard.get_all_modules(), modules);
+    for (auto const& name : modules) {
+        EXPECT_EQ(standard.retrieve(name), Module_factory::retrieve(name)) << name;
+    }
+    EXPECT_EQ(standard.get_all_quantities(), Module_factory::get_all_quantities());
+
+    // The quantity table is built once.
+    EXPECT_EQ(&standard.get_all_quantities(), &standard.get_all_quantities());
+}
+
+TEST(ModuleLoadingTest, ErrorsNameTheProblem) {
+    BioCro::Module_library missing {"no_such_library"};
+    try {
+        missing.retrieve("thermal_time_linear");
+        ADD_FAILURE() << "Expected std::runtime_error";
+    }
+    catch (std::runtime_error const& e) {
+        EXPECT_NE(std::string(e.what()).find("\"no_such_library\" was given as a module library name"),
+                  std::string::npos) << e.what();
+    }
+    EXPECT_FALSE(missing.is_loaded());
+    EXPECT_THROW(missing.get_all_modules(), std::runtime_error);
+
+    // The file is found, but the namespace is wrong.
+    BioCro::Module_library misnamed {"testBML", {"."}, "otherBML"};
+    EXPECT_THROW(misnamed.load(), std::runtime_error);
+
+    BioCro::Module_library test_library {"testBML"};
+    try {
+        test_library.retrieve("harmonic_oscillator");
+        ADD_FAILURE() << "Expected std::out_of_range";
+    }
+    catch (std::out_of_range const& e) {
+        EXPECT_STREQ(e.what(),
+                     "\"harmonic_oscillator\" was given as a module name, but no module "
+                     "with that name could be found in the \"testBML\" library.\n");
+    }
+}
+
+// Threads asking for modules of an unloaded library at once all get
+// the same creators.
+TEST(ModuleLoadingTest, ConcurrentFirstUse) {
+    for (int trial {0}; trial < 20; ++trial) {
+        BioCro::Module_library test_library {"testBML"};
+        std::vector<BioCro::Module_creator> found(8);
+        std::atomic<int> ready {0};
+        std::vector<std::thread> threads;
+        for (size_t t {0}; t < found.size(); ++t) {
+            threads.emplace_back([&, t]() {
+                ++ready;
+                while (ready < static_cast<int>(found.size())) {}
+                found[t] = test_library.retrieve("thermal_time_linear");
+                test_library.get_all_quantities();
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        for (auto creator : found) EXPECT_EQ(creator, found[0]);
+        EXPECT_EQ(test_library.get_all_quantities().at("quantity_name").size(), 11u);
+    }
+}
+
+// Run in a new process by StartupTime, in the way that
+// BIOCRO_STARTUP_MODE names.
+TEST(ModuleLoadingTest, DISABLED_FirstSimulation) {
+    char const* mode {std::getenv("BIOCRO_STARTUP_MODE")};
+    ASSERT_NE(mode, nullptr);
+
+    BioCro::Module_library standard {"standardBML", standardBML::module_library::library_entries};
+    BioCro::Module_library test_library {"testBML"};
+
+    if (std::string(mode) == "eager") {
+        // Register everything up front, as a worker linked with every
+        // module library does.
+        standard.get_all_quantities();
+        test_library.get_all_quantities();
+    }
+
+    BioCro::Module_creator oscillator {standard.retrieve("harmonic_oscillator")};
+    EXPECT_EQ(oscillator, Module_factory::retrieve("harmonic_oscillator"));
+    EXPECT_EQ(oscillator_simulation()["position"].size(), 5u);
+
+    EXPECT_EQ(test_library.is_loaded(), std::string(mode) == "eager");
+}
+
+// Times a new process from its start to the end of its first
+// simulation.
+TEST(ModuleLoadingTest, StartupTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto time_process = [](std::string const& mode) {
+        auto start = clock::now();
+        pid_t pid {child_process::start(
+            {"--gtest_filter=ModuleLoadingTest.DISABLED_FirstSimulation",
+             "--gtest_also_run_disabled_tests"},
+            {"BIOCRO_STARTUP_MODE=" + mode},
+            !VERBOSE)};
+        bool const succeeded {child_process::succeeded(pid)};
+        auto elapsed = clock::now() - start;
+
+        EXPECT_TRUE(succeeded) << mode << " run failed";
+        return elapsed;
+    };
+
+    clock::duration eager {clock::duration::max()};
+    clock::duration lazy {clock::duration::max()};
+    for (int i {0}; i < 5; ++i) {
+        eager = std::min(eager, time_process("eager"));
+        lazy = std::min(lazy, time_process("lazy"));
+    }
+
+    if (VERBOSE) {
+        cout << "time to first simulation, all libraries loaded and indexed: "
+             << duration_cast<microseconds>(eager).count() << " us" << endl;
+        cout << "time to first simulation, libraries loaded as needed: "
+             << duration_cast<microseconds>(lazy).count() << " us" << endl;
+    }
+}
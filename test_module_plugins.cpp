@@ -0,0 +1,204 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover module plugins (module_plugin.h) and the registry
+// of module_registry.h.  testBML's modules are loaded at run time from
+// testBML_plugin.so, which the Makefile builds from
+// plugins/testBML_plugin.cpp; this program is compiled without
+// testBML's header.  The tests check that the plugin's modules are
+// found through its module table and work in a simulation, that the
+// registry looks modules up in the order libraries were added, opening
+// them only as needed, and that tables made for another interface
+// version or C++ library are refused.  The last test times loading a
+// plugin in a new process and in one that has already loaded it.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdlib>   // for std::getenv, std::atoi
+#include <iostream>
+
+#include <unistd.h>  // for pipe
+
+#include "BioCro.h"
+#include "child_process.h"
+#include "module_plugin.h"
+#include "module_registry.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+namespace {
+    BioCro::Simulation_result thermal_time_simulation(BioCro::Module_creator thermal_time)
+    {
+        return BioCro::Simulator {
+            { {"TTc", 0} },
+            { {"timestep", 1}, {"sowing_time", 0}, {"tbase", 5} },
+            { {"time", {0, 1, 2, 3, 4}}, {"temp", {5, 10, 15, 20, 25}} },
+            {},
+            { thermal_time },
+            "homemade_euler", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+}
+
+TEST(ModulePluginTest, PluginModulesAreFound) {
+    BioCro::Module_registry registry;
+    BioCro::Module_library& plugin {registry.load("testBML_plugin")};
+    EXPECT_TRUE(plugin.is_loaded());
+    EXPECT_EQ(plugin.get_all_modules(),
+              (BioCro::Module_names {"solar_position_michalsky", "thermal_time_linear"}));
+
+    BioCro::Module_creator thermal_time {registry.retrieve("testBML_plugin", "thermal_time_linear")};
+    EXPECT_EQ(thermal_time->get_name(), "thermal_time_linear");
+    EXPECT_EQ(thermal_time->get_outputs(), (BioCro::Variable_names {"TTc"}));
+
+    // testBML's thermal_time_linear uses days as its unit of time.
+    EXPECT_DOUBLE_EQ(thermal_time_simulation(thermal_time)["TTc"][4], 0 + 5 + 10 + 15);
+    EXPECT_DOUBLE_EQ(thermal_time_simulation(Module_factory::retrieve("thermal_time_linear"))["TTc"][4],
+                     (0 + 5 + 10 + 15) / 24.0);
+
+    // The same creators are found through testBML's creator map.
+    BioCro::Module_library test_library {"testBML"};
+    EXPECT_EQ(test_library.retrieve("thermal_time_linear"), thermal_time);
+    EXPECT_EQ(test_library.retrieve("solar_position_michalsky"),
+              plugin.retrieve("solar_position_michalsky"));
+}
+
+// Modules are looked for in the order their libraries were added.
+TEST(ModulePluginTest, RegistryOrder) {
+    BioCro::Module_registry registry;
+    registry.add("standardBML", standardBML::module_library::library_entries);
+    BioCro::Module_library& plugin {registry.add("testBML_plugin")};
+    EXPECT_EQ(registry.library_names(),
+              (std::vector<std::string> {"standardBML", "testBML_plugin"}));
+
+    // Found in the first library, so the plugin isn't opened.
+    EXPECT_EQ(registry.retrieve("thermal_time_linear"),
+              Module_factory::retrieve("thermal_time_linear"));
+    EXPECT_FALSE(plugin.is_loaded());
+
+    EXPECT_NE(registry.retrieve("testBML_plugin", "thermal_time_linear"),
+              registry.retrieve("thermal_time_linear"));
+    EXPECT_TRUE(plugin.is_loaded());
+
+    auto modules = registry.get_all_modules();
+    EXPECT_EQ(modules.size(), Module_factory::get_all_modules().size() + 2);
+    EXPECT_EQ(modules.back(), std::make_pair(std::string("testBML_plugin"),
+                                             std::string("thermal_time_linear")));
+
+    EXPECT_THROW(registry.retrieve("no_such_module"), std::out_of_range);
+    EXPECT_THROW(registry.retrieve("no_such_library", "thermal_time_linear"), std::out_of_range);
+    EXPECT_THROW(registry.add("testBML_plugin"), std::invalid_argument);
+
+    // A library that can't be loaded isn't added.
+    EXPECT_THROW(registry.load("no_such_library"), std::runtime_error);
+    EXPECT_EQ(registry.library_names().size(), 2u);
+}
+
+TEST(ModulePluginTest, MismatchedTablesAreRefused) {
+    creator_map creators {
+        {"harmonic_oscillator", Module_factory::retrieve("harmonic_oscillator")},
+        {"harmonic_energy", Module_factory::retrieve("harmonic_energy")}};
+    BioCro::Module_table_builder builder {creators};
+
+    // A table made here describes the creators it was made from.
+    EXPECT_EQ(BioCro::loading_detail::plugin_creators(builder.get(), "here"), creators);
+
+    biocro_module_table table {*builder.get()};
+    table.version = BIOCRO_MODULE_TABLE_VERSION + 1;
+    EXPECT_THROW(BioCro::loading_detail::plugin_creators(&table, "later"), std::runtime_error);
+
+    table = *builder.get();
+    table.cxx_library = "another C++ library";
+    try {
+        BioCro::loading_detail::plugin_creators(&table, "elsewhere");
+        ADD_FAILURE() << "Expected std::runtime_error";
+    }
+    catch (std::runtime_error const& e) {
+        EXPECT_EQ(std::string(e.what()),
+                  "The \"elsewhere\" plugin was loaded, but it was built with another "
+                  "C++ library rather than " BIOCRO_CXX_LIBRARY ".\n");
+    }
+
+    biocro_module_entry empty_entry {nullptr, nullptr};
+    table = {BIOCRO_MODULE_TABLE_VERSION, BIOCRO_CXX_LIBRARY, 1, &empty_entry};
+    EXPECT_THROW(BioCro::loading_detail::plugin_creators(&table, "empty"), std::runtime_error);
+    EXPECT_THROW(BioCro::loading_detail::plugin_creators(nullptr, "missing"), std::runtime_error);
+}
+
+// Run in a new process by LoadTime: loads testBML's modules in the way
+// that BIOCRO_LOAD_METHOD names and writes the time taken to the file
+// descriptor BIOCRO_RESULT_FD.
+TEST(ModulePluginTest, DISABLED_FirstLoad) {
+    using clock = std::chrono::steady_clock;
+    char const* method {std::getenv("BIOCRO_LOAD_METHOD")};
+    char const* result_fd {std::getenv("BIOCRO_RESULT_FD")};
+    ASSERT_NE(method, nullptr);
+    ASSERT_NE(result_fd, nullptr);
+
+    auto start = clock::now();
+    BioCro::Module_registry registry;
+    registry.load(std::string(method) == "plugin" ? "testBML_plugin" : "testBML");
+    registry.retrieve("thermal_time_linear");
+    long long elapsed {std::chrono::duration_cast<std::chrono::microseconds>(
+        clock::now() - start).count()};
+
+    ASSERT_EQ(write(std::atoi(result_fd), &elapsed, sizeof elapsed),
+              static_cast<ssize_t>(sizeof elapsed));
+}
+
+// Times loading testBML's modules in a new process, through the plugin
+// table and through the creator map, and then loading the plugin again
+// in a process that already has it.
+TEST(ModulePluginTest, LoadTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::nanoseconds;
+
+    // The time DISABLED_FirstLoad reports, as the least of five runs.
+    auto time_in_new_process = [](std::string const& method) {
+        long long least {-1};
+        for (int i {0}; i < 5; ++i) {
+            int fds[2];
+            EXPECT_EQ(pipe(fds), 0);
+            pid_t pid {child_process::start(
+                {"--gtest_filter=ModulePluginTest.DISABLED_FirstLoad",
+                 "--gtest_also_run_disabled_tests"},
+                {"BIOCRO_LOAD_METHOD=" + method, "BIOCRO_RESULT_FD=" + std::to_string(fds[1])},
+                !VERBOSE)};
+            close(fds[1]);
+            long long elapsed {-1};
+            EXPECT_EQ(read(fds[0], &elapsed, sizeof elapsed), static_cast<ssize_t>(sizeof elapsed));
+            close(fds[0]);
+            EXPECT_TRUE(child_process::succeeded(pid)) << method << " run failed";
+            if (least < 0 || elapsed < least) least = elapsed;
+        }
+        return least;
+    };
+
+    long long plugin_time {time_in_new_process("plugin")};
+    long long creator_map_time {time_in_new_process("creator_map")};
+
+    int const repeats {100};
+    auto start = clock::now();
+    for (int i {0}; i < repeats; ++i) {
+        BioCro::Module_registry registry;
+        registry.load("testBML_plugin");
+        registry.retrieve("thermal_time_linear");
+    }
+    auto resident_time = (clock::now() - start) / repeats;
+
+    EXPECT_GE(plugin_time, 0);
+    EXPECT_GE(creator_map_time, 0);
+    if (VERBOSE) {
+        cout << "first load through the plugin table: " << plugin_time << " us" << endl;
+        cout << "first load through the creator map: " << creator_map_time << " us" << endl;
+        cout << "load of a plugin already in the process: "
+             << duration_cast<nanoseconds>(resident_time).count() << " ns" << endl;
+    }
+}
@@ -0,0 +1,261 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the counter-based random streams of counter_rng.h
+// and the Monte Carlo driver of monte_carlo.h.  They check the Philox
+// generator against published known-answer values, show that a
+// stream's numbers depend only on its seed and stream number, and show
+// that the results of a Monte Carlo run are the same whatever the
+// number of threads or batch size, with any single run reproducible
+// from the seed and its index.  They also check that the seeded
+// generators of Random.h are reproducible.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max, std::min
+#include <chrono>
+#include <cmath>     // for std::log, std::sqrt
+#include <iostream>
+#include <thread>
+
+#include "BioCro_Extended.h"
+#include "counter_rng.h"
+#include "monte_carlo.h"
+#include "Random.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Known-answer values from the Random123 distribution (kat_vectors).
+TEST(CounterRngTest, PhiloxKnownAnswers) {
+    using Philox = BioCro::Philox4x32;
+
+    EXPECT_EQ(Philox::generate({{0, 0, 0, 0}}, {{0, 0}}),
+              (Philox::Counter {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}}));
+    EXPECT_EQ(Philox::generate({{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}},
+                               {{0xffffffff, 0xffffffff}}),
+              (Philox::Counter {{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}}));
+    EXPECT_EQ(Philox::generate({{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}},
+                               {{0xa4093822, 0x299f31d0}}),
+              (Philox::Counter {{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}));
+}
+
+// A stream's numbers depend only on the seed and the stream number,
+// not on what other streams have been used.
+TEST(CounterRngTest, StreamsAreReproducible) {
+    BioCro::Random_stream a {42, 7};
+    std::vector<double> first;
+    for (int i {0}; i < 10; ++i) first.push_back(a.uniform());
+
+    BioCro::Random_stream other {42, 8};
+    for (int i {0}; i < 100; ++i) other();
+
+    BioCro::Random_stream b {42, 7};
+    for (int i {0}; i < 10; ++i) EXPECT_EQ(b.uniform(), first[i]);
+
+    BioCro::Random_stream c {43, 7};
+    EXPECT_NE(c.uniform(), first[0]);
+    BioCro::Random_stream d {42, 8};
+    EXPECT_NE(d.uniform(), first[0]);
+}
+
+TEST(CounterRngTest, DeviatesHaveExpectedMoments) {
+    constexpr int n {100000};
+    BioCro::Random_stream stream {1, 0};
+
+    double sum {0}, sum_of_squares {0};
+    for (int i {0}; i < n; ++i) {
+        double u {stream.uniform()};
+        ASSERT_GE(u, 0);
+        ASSERT_LT(u, 1);
+        sum += u;
+    }
+    EXPECT_NEAR(sum / n, 0.5, 0.01);
+
+    sum = 0;
+    for (int i {0}; i < n; ++i) {
+        double x {stream.normal(3, 2)};
+        sum += x;
+        sum_of_squares += x * x;
+    }
+    double mean {sum / n};
+    EXPECT_NEAR(mean, 3, 0.05);
+    EXPECT_NEAR(std::sqrt(sum_of_squares / n - mean * mean), 2, 0.05);
+}
+
+// Generators of Random.h given the same seed give the same numbers.
+TEST(CounterRngTest, SeededRandGeneratorsAreReproducible) {
+    Rand_double a {-1, 1, 12345};
+    Rand_double b {-1, 1, 12345};
+    Rand_int c {0, 1000, 12345};
+    Rand_int d {0, 1000, 12345};
+    for (int i {0}; i < 10; ++i) {
+        EXPECT_EQ(a(), b());
+        EXPECT_EQ(c(), d());
+    }
+}
+
+class MonteCarloTest : public ::testing::Test {
+   protected:
+    MonteCarloTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) {
+            times.push_back(i * 0.1);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} },
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        {},
+        {}
+    };
+
+    BioCro::Parameter_distributions distributions {
+        {"mass", BioCro::Distribution::lognormal(1.5, 0.2)},
+        {"spring_constant", BioCro::Distribution::truncated_normal(7, 2, 1, 20)}};
+
+    BioCro::Reduction_set reductions {
+        { BioCro::Reduction::final_value("position"),
+          BioCro::Reduction::maximum("total_energy") },
+        "elapsed_time"};
+};
+
+// The samples and summaries are identical for any number of threads
+// and any batch size.
+TEST_F(MonteCarloTest, ResultsDoNotDependOnThreading) {
+    constexpr size_t n {300};
+
+    BioCro::Monte_carlo_options serial;
+    serial.number_of_threads = 1;
+    serial.batch_size = 300;
+    auto reference = BioCro::run_monte_carlo(spec, distributions, reductions, n, serial);
+    EXPECT_TRUE(reference.failed_runs().empty());
+
+    for (unsigned threads : {2, 4, 8}) {
+        for (size_t batch_size : {1, 7, 64}) {
+            BioCro::Monte_carlo_options options;
+            options.number_of_threads = threads;
+            options.batch_size = batch_size;
+            auto result = BioCro::run_monte_carlo(spec, distributions, reductions, n, options);
+            EXPECT_EQ(result.samples, reference.samples) << threads << " " << batch_size;
+            EXPECT_EQ(result.summaries, reference.summaries) << threads << " " << batch_size;
+        }
+    }
+
+    // A different seed gives different samples.
+    BioCro::Monte_carlo_options other_seed;
+    other_seed.seed = 2;
+    auto other = BioCro::run_monte_carlo(spec, distributions, reductions, n, other_seed);
+    EXPECT_NE(other.samples, reference.samples);
+}
+
+// Any single run can be repeated from the seed and its index.
+TEST_F(MonteCarloTest, AnyRunCanBeReproduced) {
+    BioCro::Monte_carlo_options options;
+    options.seed = 2024;
+    auto result = BioCro::run_monte_carlo(spec, distributions, reductions, 100, options);
+
+    size_t index {37};
+    std::vector<double> sample {BioCro::draw_sample(distributions, options.seed, index)};
+    EXPECT_EQ(sample, result.samples[index]);
+
+    BioCro::Parameter_set parameters {spec.parameters};
+    parameters["mass"] = sample[0];
+    parameters["spring_constant"] = sample[1];
+    BioCro::Idempotent_simulator sim {
+        spec.initial_state, parameters, spec.drivers,
+        spec.direct_modules, spec.differential_modules,
+        spec.ode_solver_name, spec.output_step_size,
+        spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+        spec.adaptive_max_steps};
+    EXPECT_EQ(sim.run_summary(reductions), result.summaries[index]);
+}
+
+TEST_F(MonteCarloTest, SamplesFollowTheirDistributions) {
+    auto result = BioCro::run_monte_carlo(spec, distributions, reductions, 2000);
+
+    double log_mass_sum {0};
+    for (auto const& sample : result.samples) {
+        log_mass_sum += std::log(sample[0]);
+        EXPECT_GE(sample[1], 1);
+        EXPECT_LE(sample[1], 20);
+    }
+    EXPECT_NEAR(log_mass_sum / result.samples.size(), 1.5, 0.02);
+
+    for (auto const& s : result.statistics) {
+        EXPECT_LE(s.minimum, s.mean);
+        EXPECT_LE(s.mean, s.maximum);
+        EXPECT_GT(s.standard_deviation, 0);
+    }
+}
+
+TEST_F(MonteCarloTest, UnknownParameterIsRejected) {
+    distributions.push_back({"bogus", BioCro::Distribution::constant(1)});
+    EXPECT_THROW(BioCro::run_monte_carlo(spec, distributions, reductions, 10),
+                 std::invalid_argument);
+    EXPECT_THROW(BioCro::Distribution::normal(0, -1), std::invalid_argument);
+}
+
+// Truncated normal values are drawn by inversion, so a window far out
+// in either tail is sampled as readily as any other, and a degenerate
+// distribution is refused rather than sampled forever.
+TEST(DistributionTest, TruncatedNormalInFarTails) {
+    constexpr size_t n {1000};
+    // The mean of a standard normal truncated to [8, 9] is about 8.1236.
+    for (double sign : {1.0, -1.0}) {
+        auto d = BioCro::Distribution::truncated_normal(
+            0, 1, sign > 0 ? 8 : -9, sign > 0 ? 9 : -8);
+        double sum {0};
+        for (std::uint64_t i {0}; i < n; ++i) {
+            BioCro::Random_stream stream {1, i};
+            double x {sign * d.sample(stream)};
+            ASSERT_GE(x, 8);
+            ASSERT_LE(x, 9);
+            sum += x;
+        }
+        EXPECT_NEAR(sum / n, 8.1236, 0.02);
+    }
+
+    EXPECT_THROW(BioCro::Distribution::truncated_normal(5, 0, 0, 1), std::invalid_argument);
+}
+
+// Times a Monte Carlo run on 1, 2, 4, ... threads, up to one per core.
+TEST_F(MonteCarloTest, ThroughputWithNumberOfThreads) {
+    using clock = std::chrono::steady_clock;
+    constexpr size_t n {2000};
+    unsigned cores {std::max(2u, std::thread::hardware_concurrency())};
+
+    for (unsigned threads {1};; threads = std::min(2 * threads, cores)) {
+        BioCro::Monte_carlo_options options;
+        options.number_of_threads = threads;
+
+        auto start = clock::now();
+        auto result = BioCro::run_monte_carlo(spec, distributions, reductions, n, options);
+        std::chrono::duration<double> elapsed {clock::now() - start};
+
+        EXPECT_TRUE(result.failed_runs().empty());
+        if (VERBOSE) {
+            cout << threads << " thread(s): " << n / elapsed.count() << " runs/s; "
+                 << "final position " << result.statistics[0].mean << " +/- "
+                 << result.statistics[0].standard_deviation << endl;
+        }
+        if (threads == cores) break;
+    }
+}
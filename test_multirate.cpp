@@ -0,0 +1,244 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover multirate.h, in which a Multirate_simulator takes
+// several steps of a fast group of differential modules for each step
+// of a slow group.  They use a stiff harmonic oscillator as the fast
+// group and the thermal time of test_repeat_runs.cpp as the slow one,
+// and check that with one substep the results are those of the
+// "homemade_euler" solver; that the fast group's results are those of
+// Euler steps as short as the substeps, while the slow group's stay
+// close to them; that partition_by_timescale puts the oscillator in the
+// fast group; and that badly formed systems are refused.  The last test
+// compares the time needed to run the mixed-timescale model with a
+// Simulator at the fast group's step and with a Multirate_simulator.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max
+#include <chrono>
+#include <cmath>     // for std::abs, std::sin
+#include <iostream>
+
+#include "BioCro_Extended.h"
+#include "driver_preparation.h"
+#include "multirate.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class MultirateTest : public ::testing::Test {
+   protected:
+    MultirateTest() { set_hours(48); }
+
+    // Hourly drivers, with time in days as solar_position_michalsky
+    // expects
+    void set_hours(size_t hours) {
+        drivers.clear();
+        for (size_t i {0}; i < hours; ++i) {
+            drivers["time"].push_back(100 + i / 24.0);
+            drivers["temp"].push_back(20 + 8 * std::sin(i * 0.26));
+        }
+    }
+
+    BioCro::Module_set all_differential_modules() const {
+        BioCro::Module_set modules {fast_modules};
+        modules.insert(modules.end(), slow_modules.begin(), slow_modules.end());
+        return modules;
+    }
+
+    BioCro::Simulation_result euler_result(BioCro::System_drivers const& d, BioCro::Parameter_set const& p) {
+        return BioCro::Simulator {initial_state, p, d, direct_modules, all_differential_modules(),
+                                  "homemade_euler", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+
+    void expect_same_results(BioCro::Simulation_result const& expected,
+                             BioCro::Simulation_result const& result) {
+        ASSERT_EQ(result.size(), expected.size());
+        for (auto const& column : expected) {
+            ASSERT_EQ(result.count(column.first), 1u) << column.first;
+            auto const& values = result.at(column.first);
+            ASSERT_EQ(values.size(), column.second.size()) << column.first;
+            for (size_t i {0}; i < values.size(); ++i) {
+                EXPECT_NEAR(values[i], column.second[i], 1e-12 * (1 + std::abs(column.second[i])))
+                    << column.first << " at row " << i;
+            }
+        }
+    }
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2}, {"TTc", 0} };
+    BioCro::Parameter_set parameters
+        { {"mass", 1}, {"spring_constant", 100}, {"timestep", 1},
+          {"sowing_time", 0}, {"tbase", 10} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set fast_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+    BioCro::Module_set slow_modules
+        { Module_factory::retrieve("thermal_time_linear") };
+};
+
+TEST_F(MultirateTest, OneSubstepIsEuler) {
+    parameters["spring_constant"] = 0.5;
+    BioCro::Simulation_result expected {euler_result(drivers, parameters)};
+
+    BioCro::Multirate_simulator simulator {initial_state, parameters, drivers, direct_modules,
+                                           {fast_modules, slow_modules}, 1};
+    expect_same_results(expected, simulator.run_simulation());
+
+    // Running again gives the same result.
+    expect_same_results(expected, simulator.run_simulation());
+
+    // The groups make no difference with one substep.
+    expect_same_results(expected, BioCro::Multirate_simulator {
+        initial_state, parameters, drivers, direct_modules,
+        {{}, all_differential_modules()}, 1}.run_simulation());
+}
+
+// With 100 substeps an hour, the oscillator's results are those of a
+// Simulator taking steps of 36 seconds, with the drivers interpolated
+// to each, and the thermal time differs from that Simulator's by the
+// error of taking hourly steps.
+TEST_F(MultirateTest, FastGroupTakesShortSteps) {
+    size_t const substeps {100};
+    BioCro::Prepared_drivers fine_drivers {BioCro::Driver_preparation {}
+        .resample(1.0 / (24 * substeps)).prepare(drivers)};
+    BioCro::Parameter_set fine_parameters {parameters};
+    fine_parameters["timestep"] = 1.0 / substeps;
+    BioCro::Simulation_result fine {euler_result(fine_drivers.drivers(), fine_parameters)};
+
+    BioCro::Multirate_simulator simulator {initial_state, parameters, drivers, direct_modules,
+                                           {fast_modules, slow_modules}, substeps};
+    BioCro::Simulation_result result {simulator.run_simulation()};
+    ASSERT_EQ(result["position"].size(), drivers["time"].size());
+
+    double largest_difference {0};
+    for (size_t row {0}; row < drivers["time"].size(); ++row) {
+        for (std::string name : {"position", "velocity", "total_energy"}) {
+            double const expected {fine[name][row * substeps]};
+            EXPECT_NEAR(result[name][row], expected, 1e-9 * (1 + std::abs(expected))) << name << " at row " << row;
+        }
+        EXPECT_DOUBLE_EQ(result["temp"][row], drivers["temp"][row]);
+
+        double const expected_ttc {fine["TTc"][row * substeps]};
+        largest_difference = std::max(largest_difference, std::abs(result["TTc"][row] - expected_ttc));
+    }
+    double const final_ttc {fine["TTc"][(drivers["time"].size() - 1) * substeps]};
+    if (VERBOSE) cout << "largest TTc difference: " << largest_difference << " of " << final_ttc << endl;
+    EXPECT_LT(largest_difference, 0.02 * final_ttc);
+}
+
+TEST_F(MultirateTest, PartitionByTimescale) {
+    BioCro::Module_set differential_modules {slow_modules[0], fast_modules[0]};
+    BioCro::Module_partition groups {BioCro::partition_by_timescale(
+        initial_state, parameters, drivers, direct_modules, differential_modules)};
+    EXPECT_EQ(groups.fast, fast_modules);
+    EXPECT_EQ(groups.slow, slow_modules);
+
+    // The oscillator's timescale is estimated as m / k = 0.01 hours,
+    // and that of the thermal time, which doesn't depend on the state,
+    // is unbounded.
+    groups = BioCro::partition_by_timescale(initial_state, parameters, drivers, direct_modules,
+                                            differential_modules, 0.005);
+    EXPECT_TRUE(groups.fast.empty());
+    EXPECT_EQ(groups.slow.size(), 2u);
+
+    groups = BioCro::partition_by_timescale(initial_state, parameters, drivers, direct_modules,
+                                            differential_modules, 1e9);
+    EXPECT_EQ(groups.fast, fast_modules);
+    EXPECT_EQ(groups.slow, slow_modules);
+}
+
+TEST_F(MultirateTest, BadSystemsAreRefused) {
+    BioCro::Module_partition groups {fast_modules, slow_modules};
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, parameters, drivers, direct_modules,
+                                               groups, 0}),
+                 std::invalid_argument);
+
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, parameters, {}, direct_modules,
+                                               groups, 10}),
+                 std::logic_error);
+
+    BioCro::System_drivers no_rows {drivers};
+    for (auto& item : no_rows) item.second.clear();
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, parameters, no_rows, direct_modules,
+                                               groups, 10}),
+                 std::logic_error);
+
+    BioCro::State no_ttc {initial_state};
+    no_ttc.erase("TTc");
+    EXPECT_THROW((BioCro::Multirate_simulator {no_ttc, parameters, drivers, direct_modules,
+                                               groups, 10}),
+                 std::logic_error);
+
+    BioCro::Parameter_set no_mass {parameters};
+    no_mass.erase("mass");
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, no_mass, drivers, {}, groups, 10}),
+                 std::logic_error);
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, no_mass, drivers, direct_modules,
+                                               groups, 10}),
+                 std::logic_error);
+
+    BioCro::Parameter_set duplicate {parameters};
+    duplicate["temp"] = 20;
+    EXPECT_THROW((BioCro::Multirate_simulator {initial_state, duplicate, drivers, direct_modules,
+                                               groups, 10}),
+                 std::logic_error);
+}
+
+// Times runs of 30 days of hourly drivers, with the cosine of the solar
+// zenith angle and the oscillator's energy as direct modules: with a
+// Simulator taking one-minute steps, and with a Multirate_simulator
+// taking one-minute steps of the oscillator only.
+TEST_F(MultirateTest, MixedTimescaleTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    set_hours(24 * 30);
+    size_t const substeps {60};
+    int const runs {5};
+    direct_modules.push_back(Module_factory::retrieve("solar_position_michalsky"));
+    // A period of about three hours
+    parameters["spring_constant"] = 4;
+    parameters["lat"] = 40;
+    parameters["longitude"] = -88;
+    parameters["time_zone_offset"] = -6;
+    parameters["year"] = 2005;
+
+    BioCro::Prepared_drivers fine_drivers {BioCro::Driver_preparation {}
+        .resample(1.0 / (24 * substeps)).prepare(drivers)};
+    BioCro::Parameter_set fine_parameters {parameters};
+    fine_parameters["timestep"] = 1.0 / substeps;
+
+    BioCro::Simulation_result fine;
+    auto start = clock::now();
+    for (int i {0}; i < runs; ++i) fine = euler_result(fine_drivers.drivers(), fine_parameters);
+    auto single_rate_time = clock::now() - start;
+
+    BioCro::Multirate_simulator simulator {initial_state, parameters, drivers, direct_modules,
+                                           BioCro::partition_by_timescale(
+                                               initial_state, parameters, drivers,
+                                               direct_modules, all_differential_modules()),
+                                           substeps};
+    BioCro::Output_columns output;
+    start = clock::now();
+    for (int i {0}; i < runs; ++i) simulator.run_simulation(output);
+    auto multirate_time = clock::now() - start;
+
+    size_t const last {output.rows() - 1};
+    double const expected {fine["position"][last * substeps]};
+    EXPECT_NEAR(output.column("position")[last], expected, 1e-9 * (1 + std::abs(expected)));
+    if (VERBOSE) {
+        cout << "single rate: " << duration_cast<microseconds>(single_rate_time).count() << " us" << endl;
+        cout << "multirate: " << duration_cast<microseconds>(multirate_time).count() << " us ("
+             << static_cast<double>(single_rate_time.count()) / multirate_time.count()
+             << " times as fast)" << endl;
+    }
+}
@@ -0,0 +1,230 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate recording only selected quantities, either
+// with integrate_selected (selective_simulation.h) or by giving an
+// Idempotent_simulator a list of quantities to record.  They check
+// that the recorded columns match the corresponding columns of a full
+// result for each solver and for output step sizes above, at, and
+// below 1, and, on a system with many quantities, compare the memory
+// used with and without selection (and, with -DVERBOSE=true, the time
+// taken).
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "safe_simulators.h"
+#include "selective_simulation.h"
+#include "BioCro_Extended.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Returns the number of doubles held in a result.
+size_t number_of_values(BioCro::Simulation_result const& result) {
+    size_t n {0};
+    for (auto& item : result) {
+        n += item.second.size();
+    }
+    return n;
+}
+
+class OutputSelectionTest : public ::testing::Test {
+   protected:
+    void set_number_of_timesteps(size_t n) {
+        vector<double> times;
+        for (size_t i {0}; i <= n; ++i) {
+            times.push_back(i * delta_t);
+        }
+        drivers = { {"elapsed_time", times} };
+    }
+
+    // Adds parameters that no module uses, making the system "wide"
+    // in the sense that most of its quantities are of no interest.
+    void add_unused_parameters(size_t n) {
+        for (size_t i {0}; i < n; ++i) {
+            parameters["unused_parameter_" + std::to_string(i)] = i;
+        }
+    }
+
+    BioCro::Idempotent_simulator get_simulator(std::string solver,
+                                               BioCro::Variable_names recorded = {}) {
+        return BioCro::Idempotent_simulator {
+            initial_state,
+            parameters,
+            drivers,
+            direct_modules,
+            differential_modules,
+            solver,
+            1,
+            0.0001,
+            0.0001,
+            200,
+            recorded
+        };
+    }
+
+    const double delta_t {0.01};
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", delta_t} };
+    BioCro::System_drivers drivers { {"elapsed_time", {0, 0.01}} };
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+
+    BioCro::Variable_names recorded { "position", "total_energy" };
+};
+
+// For every solver, the selected columns are identical to those of a
+// full result, and no other columns are returned.
+TEST_F(OutputSelectionTest, SelectedColumnsMatchFullResult) {
+    set_number_of_timesteps(200);
+
+    for (std::string solver : {"homemade_euler", "boost_euler", "boost_rk4",
+                               "boost_rkck54", "boost_rosenbrock"}) {
+        BioCro::Simulation_result full {get_simulator(solver).run_simulation()};
+        auto selective_sim = get_simulator(solver, recorded);
+        BioCro::Simulation_result selected {selective_sim.run_simulation()};
+
+        ASSERT_EQ(selected.size(), recorded.size()) << solver;
+        for (std::string& name : recorded) {
+            ASSERT_EQ(selected.at(name).size(), full.at(name).size()) << solver;
+            for (size_t i {0}; i < full.at(name).size(); ++i) {
+                EXPECT_DOUBLE_EQ(selected.at(name)[i], full.at(name)[i])
+                    << solver << ": " << name << " differs at row " << i;
+            }
+        }
+
+        // The Idempotent_simulator resets before each run, with or
+        // without a selection.
+        EXPECT_EQ(selective_sim.run_simulation(), selected) << solver;
+    }
+}
+
+// With an output step size larger than 1, integrate_selected skips
+// time points just as a Simulator does.
+TEST_F(OutputSelectionTest, StridedOutputMatchesSimulator) {
+    set_number_of_timesteps(200);
+    constexpr double output_step_size {4};
+
+    for (std::string solver : {"homemade_euler", "boost_euler", "boost_rk4",
+                               "boost_rkck54"}) {
+        BioCro::Simulator sim {initial_state, parameters, drivers,
+                               direct_modules, differential_modules,
+                               solver, output_step_size, 0.0001, 0.0001, 200};
+        BioCro::Simulation_result full {sim.run_simulation()};
+
+        auto sys = BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                                 direct_modules, differential_modules);
+        BioCro::Simulation_result selected {
+            BioCro::integrate_selected(sys, recorded, solver, output_step_size,
+                                       0.0001, 0.0001, 200)};
+
+        for (std::string& name : recorded) {
+            ASSERT_EQ(selected.at(name).size(), full.at(name).size()) << solver;
+            for (size_t i {0}; i < full.at(name).size(); ++i) {
+                EXPECT_DOUBLE_EQ(selected.at(name)[i], full.at(name)[i])
+                    << solver << ": " << name << " differs at row " << i;
+            }
+        }
+    }
+
+    auto sys = BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                             direct_modules, differential_modules);
+    EXPECT_THROW(BioCro::integrate_selected(sys, recorded, "boost_rk4", 2.5,
+                                            0.0001, 0.0001, 200),
+                 std::invalid_argument);
+}
+
+// With an output step size smaller than 1, integrate_selected records
+// rows between the time points just as a Simulator does, with the
+// drivers interpolated.
+TEST_F(OutputSelectionTest, FractionalOutputMatchesSimulator) {
+    set_number_of_timesteps(200);
+    constexpr double output_step_size {0.5};
+    BioCro::Variable_names with_time {recorded};
+    with_time.push_back("elapsed_time");
+
+    for (std::string solver : {"homemade_euler", "boost_euler", "boost_rk4",
+                               "boost_rkck54"}) {
+        BioCro::Simulator sim {initial_state, parameters, drivers,
+                               direct_modules, differential_modules,
+                               solver, output_step_size, 0.0001, 0.0001, 200};
+        BioCro::Simulation_result full {sim.run_simulation()};
+
+        auto sys = BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                                 direct_modules, differential_modules);
+        BioCro::Simulation_result selected {
+            BioCro::integrate_selected(sys, with_time, solver, output_step_size,
+                                       0.0001, 0.0001, 200)};
+
+        for (std::string& name : with_time) {
+            ASSERT_EQ(selected.at(name).size(), full.at(name).size()) << solver;
+            for (size_t i {0}; i < full.at(name).size(); ++i) {
+                EXPECT_DOUBLE_EQ(selected.at(name)[i], full.at(name)[i])
+                    << solver << ": " << name << " differs at row " << i;
+            }
+        }
+    }
+
+    auto sys = BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                             direct_modules, differential_modules);
+    EXPECT_THROW(BioCro::integrate_selected(sys, recorded, "boost_rk4", 0.3,
+                                            0.0001, 0.0001, 200),
+                 std::invalid_argument);
+}
+
+TEST_F(OutputSelectionTest, UnknownQuantityIsRejected) {
+    auto sim = get_simulator("boost_rk4", {"position", "bogus"});
+    EXPECT_THROW(sim.run_simulation(), std::out_of_range);
+
+    auto fallback_sim = get_simulator("boost_rosenbrock", {"bogus"});
+    EXPECT_THROW(fallback_sim.run_simulation(), std::out_of_range);
+}
+
+// On a system with a few hundred quantities of no interest, recording
+// only two quantities uses a small fraction of the memory.  It should
+// also take less time; the timings are shown with -DVERBOSE=true but
+// not checked, since wall-clock comparisons are unreliable on a
+// loaded machine.
+TEST_F(OutputSelectionTest, SelectionSavesMemory) {
+    using clock = std::chrono::steady_clock;
+
+    set_number_of_timesteps(5000);
+    add_unused_parameters(300);
+
+    auto full_sim = get_simulator("boost_rk4");
+    auto selective_sim = get_simulator("boost_rk4", recorded);
+
+    auto start = clock::now();
+    BioCro::Simulation_result full {full_sim.run_simulation()};
+    auto full_time = clock::now() - start;
+
+    start = clock::now();
+    BioCro::Simulation_result selected {selective_sim.run_simulation()};
+    auto selective_time = clock::now() - start;
+
+    if (VERBOSE) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+        cout << "full result: " << full.size() << " columns, "
+             << number_of_values(full) * sizeof(double) << " bytes, "
+             << duration_cast<microseconds>(full_time).count() << " us" << endl;
+        cout << "selected result: " << selected.size() << " columns, "
+             << number_of_values(selected) * sizeof(double) << " bytes, "
+             << duration_cast<microseconds>(selective_time).count() << " us" << endl;
+    }
+
+    EXPECT_EQ(number_of_values(selected) * full.size(),
+              number_of_values(full) * recorded.size());
+}
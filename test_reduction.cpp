@@ -0,0 +1,267 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate the reductions of reduction.h, which reduce
+// each run to a few numbers (a final value, a maximum, the time of the
+// maximum, an integral, and so on) computed as the run proceeds.  They
+// check each kind of reduction against the same quantity computed from
+// a full result, for every solver, and show a batch worker returning
+// reductions.  The last test compares the time and memory needed with
+// and without reduction for a long run.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::min_element, std::max_element
+#include <chrono>
+#include <cmath>     // for std::isnan, std::fmod
+#include <iostream>
+#include <iterator>  // for std::distance
+
+#include "BioCro_Extended.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+#include "sweep_coordinator.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class ReductionTest : public ::testing::Test {
+   protected:
+    ReductionTest() {
+        set_number_of_timesteps(1000);
+    }
+
+    void set_number_of_timesteps(size_t n) {
+        std::vector<double> times;
+        for (size_t i {0}; i <= n; ++i) {
+            times.push_back(i * delta_t);
+        }
+        drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Idempotent_simulator get_simulator(std::string solver) {
+        return BioCro::Idempotent_simulator {
+            initial_state,
+            parameters,
+            drivers,
+            direct_modules,
+            differential_modules,
+            solver,
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+
+    // The trapezoidal-rule integral of y with respect to t.
+    static double integral(std::vector<double> const& t, std::vector<double> const& y) {
+        double sum {0};
+        for (size_t i {1}; i < t.size(); ++i) {
+            sum += 0.5 * (y[i] + y[i - 1]) * (t[i] - t[i - 1]);
+        }
+        return sum;
+    }
+
+    const double delta_t {0.01};
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", delta_t} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+
+    BioCro::Reduction_set reductions {
+        { BioCro::Reduction::final_value("position"),
+          BioCro::Reduction::minimum("position"),
+          BioCro::Reduction::maximum("velocity"),
+          BioCro::Reduction::argmin("position"),
+          BioCro::Reduction::argmax("velocity").named("time_of_peak_velocity"),
+          BioCro::Reduction::integral("kinetic_energy"),
+          BioCro::Reduction::value_at("position", 1.0) },
+        "elapsed_time"};
+};
+
+// For every solver, each reduction has the value computed from the
+// full result.
+TEST_F(ReductionTest, ReductionsMatchFullResult) {
+    for (std::string solver : {"homemade_euler", "boost_euler", "boost_rk4",
+                               "boost_rkck54", "boost_rosenbrock"}) {
+        auto sim = get_simulator(solver);
+        BioCro::Simulation_result full {sim.run_simulation()};
+        BioCro::State summary {reductions.label(sim.run_summary(reductions))};
+
+        if (VERBOSE) {
+            cout << solver << ":" << endl;
+            for (auto& item : summary) cout << "    " << item.first << " = " << item.second << endl;
+        }
+
+        auto const& time = full.at("elapsed_time");
+        auto const& position = full.at("position");
+        auto const& velocity = full.at("velocity");
+        auto min_position = std::min_element(position.begin(), position.end());
+        auto max_velocity = std::max_element(velocity.begin(), velocity.end());
+
+        EXPECT_DOUBLE_EQ(summary.at("final_value(position)"), position.back()) << solver;
+        EXPECT_DOUBLE_EQ(summary.at("minimum(position)"), *min_position) << solver;
+        EXPECT_DOUBLE_EQ(summary.at("maximum(velocity)"), *max_velocity) << solver;
+        EXPECT_DOUBLE_EQ(summary.at("argmin(position)"),
+                         time[std::distance(position.begin(), min_position)]) << solver;
+        EXPECT_DOUBLE_EQ(summary.at("time_of_peak_velocity"),
+                         time[std::distance(velocity.begin(), max_velocity)]) << solver;
+        EXPECT_NEAR(summary.at("integral(kinetic_energy)"),
+                    integral(time, full.at("kinetic_energy")), 1e-12) << solver;
+
+        // Time 1.0 is (to within rounding) the time point at row 100.
+        EXPECT_NEAR(summary.at("value_at(position)@1.000000"), position[100], 1e-12) << solver;
+    }
+}
+
+// value_at interpolates between time points and gives NaN for a time
+// the run doesn't reach; without a time quantity, times are rows.
+TEST_F(ReductionTest, TimesAndInterpolation) {
+    BioCro::Reduction_set row_reductions {
+        { BioCro::Reduction::value_at("position", 10.5),
+          BioCro::Reduction::value_at("position", 5000),
+          BioCro::Reduction::argmin("position") } };
+
+    auto sim = get_simulator("boost_rk4");
+    BioCro::Simulation_result full {sim.run_simulation()};
+    BioCro::Run_summary summary {sim.run_summary(row_reductions)};
+
+    auto const& position = full.at("position");
+    EXPECT_DOUBLE_EQ(summary[0], 0.5 * (position[10] + position[11]));
+    EXPECT_TRUE(std::isnan(summary[1]));
+    EXPECT_EQ(summary[2], std::distance(position.begin(),
+                                        std::min_element(position.begin(), position.end())));
+}
+
+// Without a time quantity, reducing as the run proceeds and reducing
+// a full result give the same times, even when rows are spaced more
+// than one time point apart.
+TEST_F(ReductionTest, RowTimesAgreeBetweenPaths) {
+    constexpr double output_step_size {2};
+    BioCro::Reduction_set row_reductions {
+        { BioCro::Reduction::argmin("position"),
+          BioCro::Reduction::integral("kinetic_energy"),
+          BioCro::Reduction::value_at("position", 11) } };
+
+    BioCro::Simulator sim {initial_state, parameters, drivers,
+                           direct_modules, differential_modules,
+                           "boost_rk4", output_step_size, 0.0001, 0.0001, 200};
+    BioCro::Run_summary from_result {
+        BioCro::reduce_result(sim.run_simulation(), row_reductions, output_step_size)};
+
+    auto sys = BioCro::make_dynamical_system(initial_state, parameters, drivers,
+                                             direct_modules, differential_modules);
+    BioCro::Run_summary stepped {
+        BioCro::integrate_reduced(sys, row_reductions, "boost_rk4", output_step_size,
+                                  0.0001, 0.0001, 200)};
+
+    ASSERT_EQ(stepped.size(), from_result.size());
+    for (size_t i {0}; i < stepped.size(); ++i) {
+        EXPECT_DOUBLE_EQ(stepped[i], from_result[i]) << "reduction " << i;
+    }
+    EXPECT_EQ(std::fmod(stepped[0], output_step_size), 0);
+}
+
+// A custom reduction is given the values of its quantities at each
+// time point.
+TEST_F(ReductionTest, CustomReduction) {
+    BioCro::Reduction_set custom {
+        { BioCro::Reduction::custom(
+              "rows_moving_right", {"velocity"}, 0,
+              [](double count, double, std::vector<double> const& v) {
+                  return count + (v[0] > 0 ? 1 : 0);
+              }),
+          BioCro::Reduction::custom(
+              "largest_momentum", {"mass", "velocity"}, 0,
+              [](double largest, double, std::vector<double> const& v) {
+                  return std::max(largest, std::abs(v[0] * v[1]));
+              }) } };
+
+    auto sim = get_simulator("boost_rk4");
+    BioCro::Simulation_result full {sim.run_simulation()};
+    BioCro::Run_summary summary {sim.run_summary(custom)};
+
+    auto const& velocity = full.at("velocity");
+    double moving_right = std::count_if(velocity.begin(), velocity.end(),
+                                        [](double v) { return v > 0; });
+    double largest_speed {0};
+    for (double v : velocity) largest_speed = std::max(largest_speed, std::abs(v));
+
+    EXPECT_EQ(summary[0], moving_right);
+    EXPECT_DOUBLE_EQ(summary[1], parameters.at("mass") * largest_speed);
+}
+
+TEST_F(ReductionTest, UnknownQuantityIsRejected) {
+    BioCro::Reduction_set bogus { { BioCro::Reduction::maximum("bogus") } };
+
+    auto sim = get_simulator("boost_rk4");
+    EXPECT_THROW(sim.run_summary(bogus), std::out_of_range);
+
+    auto fallback_sim = get_simulator("boost_rosenbrock");
+    EXPECT_THROW(fallback_sim.run_summary(bogus), std::out_of_range);
+
+    EXPECT_THROW(BioCro::Reduction::custom("nothing", {}, 0, nullptr),
+                 std::invalid_argument);
+}
+
+// A batch worker can return reductions rather than applying a
+// function to each full result.
+TEST_F(ReductionTest, SweepWorkerReturnsReductions) {
+    BioCro::Sweep_specification spec {
+        initial_state, parameters, drivers, direct_modules, differential_modules,
+        "boost_rk4", 1, 0.0001, 0.0001, 200,
+        { "spring_constant" }, {}};
+    BioCro::Sweep_points points { {1}, {4}, {7}, {10} };
+
+    BioCro::Loopback_transport transport {2, [&](BioCro::Sweep_worker_endpoint& endpoint, size_t) {
+        BioCro::serve_sweep(endpoint, spec, reductions);
+    }};
+    auto result = BioCro::run_distributed_sweep(points, transport);
+
+    ASSERT_TRUE(result.failed_runs().empty());
+    for (size_t run {0}; run < points.size(); ++run) {
+        parameters["spring_constant"] = points[run][0];
+        EXPECT_EQ(result.values[run], get_simulator("boost_rk4").run_summary(reductions));
+    }
+}
+
+// The memory needed for a reduced run doesn't depend on its length.
+TEST_F(ReductionTest, LongRunTimeAndMemory) {
+    using clock = std::chrono::steady_clock;
+
+    set_number_of_timesteps(20000);
+    auto sim = get_simulator("boost_rk4");
+
+    auto start = clock::now();
+    BioCro::Simulation_result full {sim.run_simulation()};
+    auto full_time = clock::now() - start;
+
+    start = clock::now();
+    BioCro::Run_summary summary {sim.run_summary(reductions)};
+    auto reduced_time = clock::now() - start;
+
+    size_t full_size {0};
+    for (auto& item : full) full_size += item.second.size() * sizeof(double);
+
+    if (VERBOSE) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+        cout << "full result: " << full_size << " bytes, "
+             << duration_cast<microseconds>(full_time).count() << " us" << endl;
+        cout << "summary: " << summary.size() * sizeof(double) << " bytes, "
+             << duration_cast<microseconds>(reduced_time).count() << " us" << endl;
+    }
+
+    EXPECT_EQ(summary.size(), reductions.size());
+}
@@ -0,0 +1,248 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate the storage options provided by
+// result_storage.h: reduced-precision column types, elision of
+// constant columns, and run-length and delta encoding.  They check
+// that lossless storage really is lossless, that lossy storage stays
+// within the advertised precision, and that the encoded form is
+// substantially smaller than the Simulation_result it came from.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#include "BioCro.h"
+#include "result_storage.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class ResultStorageTest : public ::testing::Test {
+   protected:
+    ResultStorageTest() {
+        vector<double> times;
+        for (size_t i {0}; i <= number_of_timesteps; ++i) {
+            times.push_back(i * 0.01);
+        }
+        BioCro::Simulator sim {
+            { {"position", 3}, {"velocity", -2} },
+            { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.01} },
+            { {"elapsed_time", times} },
+            { Module_factory::retrieve("harmonic_energy") },
+            { Module_factory::retrieve("harmonic_oscillator") },
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        result = sim.run_simulation();
+    }
+
+    static constexpr size_t number_of_timesteps {1000};
+
+    BioCro::Simulation_result result;
+
+    void expect_results_to_match(BioCro::Simulation_result const& expected,
+                                 BioCro::Simulation_result const& actual) {
+        ASSERT_EQ(expected.size(), actual.size());
+        for (auto const& item : expected) {
+            ASSERT_EQ(item.second.size(), actual.at(item.first).size());
+            for (size_t i {0}; i < item.second.size(); ++i) {
+                // Lossless means bit-for-bit identical, so EXPECT_EQ
+                // rather than EXPECT_DOUBLE_EQ.
+                EXPECT_EQ(item.second[i], actual.at(item.first)[i])
+                    << item.first << " differs at row " << i;
+            }
+        }
+    }
+};
+
+constexpr size_t ResultStorageTest::number_of_timesteps;
+
+// With the default options, expanding a Stored_result gives back
+// exactly the result it was made from.
+TEST_F(ResultStorageTest, DefaultStorageIsLossless) {
+    BioCro::Stored_result stored {result};
+
+    EXPECT_EQ(stored.number_of_rows(), number_of_timesteps + 1);
+    expect_results_to_match(result, stored.expand());
+}
+
+// Lossless storage is lossless whichever layouts are enabled.
+TEST_F(ResultStorageTest, EveryLayoutIsLossless) {
+    for (int flags {0}; flags < 8; ++flags) {
+        BioCro::Storage_options options;
+        options.elide_constant_columns = flags & 1;
+        options.run_length_encoding = flags & 2;
+        options.delta_encoding = flags & 4;
+
+        expect_results_to_match(result, BioCro::Stored_result{result, options}.expand());
+    }
+}
+
+// Parameters such as "mass" and "timestep" are stored once, so most
+// of the space saved in this result comes from them; the rest comes
+// from delta encoding the time-varying columns.
+TEST_F(ResultStorageTest, StorageIsSmallerThanResult) {
+    BioCro::Stored_result stored {result};
+    size_t full_size {BioCro::Stored_result::full_size(result)};
+
+    if (VERBOSE) {
+        cout << "full size: " << full_size << " bytes" << endl
+             << "stored size: " << stored.stored_size() << " bytes" << endl;
+    }
+
+    // Three of the nine columns are constant.
+    EXPECT_LT(stored.stored_size(), full_size * 2 / 3);
+
+    BioCro::Stored_result uncompressed {result, {{}, {}, false, false, false}};
+    EXPECT_GT(uncompressed.stored_size(), full_size);
+}
+
+// Reduced precision trades accuracy for space, but only within the
+// limits of the chosen type.
+TEST_F(ResultStorageTest, ReducedPrecisionStaysWithinTolerance) {
+    constexpr double resolution {1e-4};
+
+    BioCro::Storage_options options;
+    options.default_format = {BioCro::Value_type::float32};
+    options.column_formats["position"] = {BioCro::Value_type::fixed_point, resolution};
+    options.column_formats["velocity"] = {BioCro::Value_type::fixed_point, resolution};
+
+    BioCro::Stored_result stored {result, options};
+    BioCro::Simulation_result expanded {stored.expand()};
+
+    for (auto const& item : result) {
+        for (size_t i {0}; i < item.second.size(); ++i) {
+            double expected {item.second[i]};
+            double actual {expanded.at(item.first)[i]};
+            if (item.first == "position" || item.first == "velocity") {
+                EXPECT_NEAR(actual, expected, resolution / 2);
+            } else {
+                EXPECT_NEAR(actual, expected, std::abs(expected) * 1e-7);
+            }
+        }
+    }
+
+    EXPECT_LT(stored.stored_size(), BioCro::Stored_result{result}.stored_size());
+
+    if (VERBOSE) {
+        cout << "reduced-precision stored size: " << stored.stored_size() << " bytes" << endl;
+    }
+}
+
+// A Stored_result survives a round trip through a stream.
+TEST_F(ResultStorageTest, WriteAndReadBack) {
+    BioCro::Stored_result stored {result};
+
+    std::stringstream stream;
+    stored.write(stream);
+    EXPECT_EQ(stream.str().size(), stored.stored_size());
+
+    BioCro::Stored_result read_back {BioCro::Stored_result::read(stream)};
+    expect_results_to_match(result, read_back.expand());
+}
+
+TEST_F(ResultStorageTest, BadInputIsRejected) {
+    BioCro::Storage_options options;
+    options.default_format = {BioCro::Value_type::fixed_point, 0};
+    EXPECT_THROW(BioCro::Stored_result(result, options), std::invalid_argument);
+
+    BioCro::Simulation_result ragged { {"a", {1, 2, 3}}, {"b", {1, 2}} };
+    EXPECT_THROW(BioCro::Stored_result{ragged}, std::invalid_argument);
+
+    std::stringstream garbage {"not a stored result at all"};
+    EXPECT_THROW(BioCro::Stored_result::read(garbage), std::runtime_error);
+}
+
+// Values that can't be quantized are rejected rather than stored as
+// garbage.
+TEST_F(ResultStorageTest, UnquantizableValuesAreRejected) {
+    BioCro::Storage_options options;
+    options.default_format = {BioCro::Value_type::fixed_point, 1e-3};
+
+    BioCro::Simulation_result with_nan { {"a", {1, std::nan(""), 3}} };
+    EXPECT_THROW(BioCro::Stored_result(with_nan, options), std::invalid_argument);
+
+    BioCro::Simulation_result too_large { {"a", {1, 1e300}} };
+    EXPECT_THROW(BioCro::Stored_result(too_large, options), std::invalid_argument);
+}
+
+// A stream with a corrupted column header is rejected rather than
+// decoded into nonsense.
+TEST_F(ResultStorageTest, CorruptHeadersAreRejected) {
+    BioCro::Simulation_result small { {"a", {1, 2, 4, 8}} };
+    std::stringstream stream;
+    BioCro::Stored_result{small}.write(stream);
+    std::string const good {stream.str()};
+
+    // The value type follows the 20-byte stream header, the 4-byte
+    // name length, and the one-character name.
+    std::string bad_type {good};
+    bad_type[25] = 7;
+    std::stringstream bad_type_stream {bad_type};
+    EXPECT_THROW(BioCro::Stored_result::read(bad_type_stream), std::runtime_error);
+
+    std::string bad_layout {good};
+    bad_layout[26] = 9;
+    std::stringstream bad_layout_stream {bad_layout};
+    EXPECT_THROW(BioCro::Stored_result::read(bad_layout_stream), std::runtime_error);
+
+    // A delta-encoded step whose header claims more zero bytes than
+    // the word has.
+    BioCro::Storage_options delta_only;
+    delta_only.elide_constant_columns = false;
+    delta_only.run_length_encoding = false;
+    BioCro::Stored_result delta {small, delta_only};
+    std::stringstream delta_stream;
+    delta.write(delta_stream);
+    std::string bad_delta {delta_stream.str()};
+    // The first step follows the 8-byte first value.
+    size_t const data_start {20 + 4 + 1 + 1 + 1 + 8 + 8};
+    bad_delta[data_start + 8] = static_cast<char>((5 << 4) | 5);
+    std::stringstream bad_delta_stream {bad_delta};
+    EXPECT_THROW(BioCro::Stored_result::read(bad_delta_stream).expand(),
+                 std::runtime_error);
+}
+
+// Lengths read from a corrupt stream are checked before anything is
+// allocated for them.
+TEST_F(ResultStorageTest, CorruptLengthsAreRejected) {
+    BioCro::Storage_options plain_only;
+    plain_only.elide_constant_columns = false;
+    plain_only.run_length_encoding = false;
+    plain_only.delta_encoding = false;
+    BioCro::Simulation_result small { {"a", {1, 2, 4, 8}} };
+    std::stringstream stream;
+    BioCro::Stored_result{small, plain_only}.write(stream);
+    std::string const good {stream.str()};
+
+    // Sets the `width` bytes at `offset` to 0xff.
+    auto corrupt = [&good](size_t offset, size_t width) {
+        std::string bad {good};
+        for (size_t i {0}; i < width; ++i) bad[offset + i] = static_cast<char>(0xff);
+        return bad;
+    };
+
+    // The row count, the name length, and the byte count.
+    for (auto const& field : std::vector<std::pair<size_t, size_t>> {
+             {4, 8}, {20, 4}, {20 + 4 + 1 + 1 + 1 + 8, 8}}) {
+        std::stringstream bad_stream {corrupt(field.first, field.second)};
+        EXPECT_THROW(BioCro::Stored_result::read(bad_stream), std::runtime_error);
+    }
+
+    // A plain column too short for the row count.
+    std::string more_rows {good};
+    more_rows[4] = 100;
+    std::stringstream more_rows_stream {more_rows};
+    EXPECT_THROW(BioCro::Stored_result::read(more_rows_stream), std::runtime_error);
+}
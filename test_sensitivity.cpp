@@ -0,0 +1,290 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the designs and Sobol sensitivity indices of
+// sensitivity.h.  They check that Latin hypercube and Sobol designs
+// are stratified as they should be, that the estimator recovers the
+// known indices of the Ishigami function, and that a sensitivity
+// analysis of the harmonic oscillator gives the same indices for any
+// number of threads and the same indices as a batch sweep of its
+// design.  The last test times the analysis with increasing numbers of
+// threads.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max, std::min
+#include <chrono>
+#include <cmath>     // for std::sin, std::pow
+#include <iostream>
+#include <set>
+#include <thread>
+
+#include "BioCro_Extended.h"
+#include "monte_carlo.h"
+#include "reduction.h"
+#include "sensitivity.h"
+#include "sweep_coordinator.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+namespace {
+    // Returns true if each of the intervals [k / n, (k + 1) / n) holds
+    // exactly one of the n values.
+    bool stratified(std::vector<double> const& values)
+    {
+        std::set<size_t> strata;
+        for (double x : values) strata.insert(static_cast<size_t>(x * values.size()));
+        return strata.size() == values.size() && *strata.rbegin() == values.size() - 1;
+    }
+
+    std::vector<double> coordinate(BioCro::Sweep_points const& points, size_t j)
+    {
+        std::vector<double> values;
+        for (auto const& p : points) values.push_back(p[j]);
+        return values;
+    }
+}
+
+TEST(SamplingTest, LatinHypercubeIsStratified) {
+    auto points = BioCro::latin_hypercube(5, 97, 11);
+    for (size_t j {0}; j < 5; ++j) {
+        EXPECT_TRUE(stratified(coordinate(points, j))) << j;
+    }
+    EXPECT_EQ(BioCro::latin_hypercube(5, 97, 11), points);
+    EXPECT_NE(BioCro::latin_hypercube(5, 97, 12), points);
+}
+
+TEST(SamplingTest, SobolSequenceIsStratified) {
+    BioCro::Sobol_sequence sequence {BioCro::Sobol_sequence::max_dimensions};
+
+    // The first points of the first two dimensions.
+    std::vector<std::vector<double>> expected {
+        {0, 0}, {0.5, 0.5}, {0.75, 0.25}, {0.25, 0.75}, {0.375, 0.375}};
+    for (size_t i {0}; i < expected.size(); ++i) {
+        auto x = sequence.point(i);
+        EXPECT_EQ(x[0], expected[i][0]) << i;
+        EXPECT_EQ(x[1], expected[i][1]) << i;
+    }
+
+    // Each block of 2^m points is stratified in every dimension.
+    for (size_t m : {4, 8, 10}) {
+        size_t n {size_t {1} << m};
+        auto points = BioCro::sobol_points(sequence.dimensions(), n, 3 * n);
+        for (size_t j {0}; j < sequence.dimensions(); ++j) {
+            EXPECT_TRUE(stratified(coordinate(points, j))) << m << " " << j;
+        }
+    }
+
+    // The first two dimensions form a (0, m, 2)-net: each box
+    // [i / 2^a, (i + 1) / 2^a) x [k / 2^(m - a), (k + 1) / 2^(m - a))
+    // holds exactly one of 2^m points.
+    constexpr size_t m {8};
+    auto points = BioCro::sobol_points(2, 1 << m, 0);
+    for (size_t a {0}; a <= m; ++a) {
+        std::set<std::pair<size_t, size_t>> boxes;
+        for (auto const& p : points) {
+            boxes.insert({static_cast<size_t>(p[0] * (1 << a)),
+                          static_cast<size_t>(p[1] * (1 << (m - a)))});
+        }
+        EXPECT_EQ(boxes.size(), points.size()) << a;
+    }
+
+    EXPECT_THROW(BioCro::Sobol_sequence {BioCro::Sobol_sequence::max_dimensions + 1},
+                 std::out_of_range);
+}
+
+TEST(SamplingTest, QuantilesInvertDistributions) {
+    using BioCro::Distribution;
+    for (double p : {1e-10, 0.001, 0.02425, 0.3, 0.5, 0.9, 0.999999}) {
+        double x {Distribution::standard_normal_quantile(p)};
+        EXPECT_NEAR(Distribution::standard_normal_cdf(x), p, 1e-14 + 1e-12 * p) << p;
+    }
+    EXPECT_DOUBLE_EQ(Distribution::uniform(2, 6).quantile(0.25), 3);
+    EXPECT_DOUBLE_EQ(Distribution::normal(3, 2).quantile(0.5), 3);
+    EXPECT_DOUBLE_EQ(Distribution::lognormal(1, 0.5).quantile(0.5), std::exp(1));
+
+    auto truncated = Distribution::truncated_normal(0, 1, -0.5, 2);
+    EXPECT_NEAR(truncated.quantile(1e-12), -0.5, 1e-9);
+    EXPECT_NEAR(truncated.quantile(1 - 1e-12), 2, 1e-9);
+}
+
+// The Ishigami function has known indices (Sobol' and Levitan, 1999).
+TEST(SobolIndexTest, IshigamiFunction) {
+    constexpr double pi {3.14159265358979323846};
+    constexpr double a {7}, b {0.1};
+    auto ishigami = [=](std::vector<double> const& x) {
+        return std::sin(x[0]) + a * std::pow(std::sin(x[1]), 2) +
+               b * std::pow(x[2], 4) * std::sin(x[0]);
+    };
+
+    double variance {a * a / 8 + b * std::pow(pi, 4) / 5 + b * b * std::pow(pi, 8) / 18 + 0.5};
+    double v1 {0.5 * std::pow(1 + b * std::pow(pi, 4) / 5, 2)};
+    double v2 {a * a / 8};
+    double v13 {b * b * std::pow(pi, 8) * (1.0 / 18 - 1.0 / 50)};
+    std::vector<double> first {v1 / variance, v2 / variance, 0};
+    std::vector<double> total {(v1 + v13) / variance, v2 / variance, v13 / variance};
+
+    BioCro::Parameter_distributions distributions {
+        {"x1", BioCro::Distribution::uniform(-pi, pi)},
+        {"x2", BioCro::Distribution::uniform(-pi, pi)},
+        {"x3", BioCro::Distribution::uniform(-pi, pi)}};
+
+    for (auto method : {BioCro::Sampling_method::sobol, BioCro::Sampling_method::latin_hypercube}) {
+        auto design = BioCro::saltelli_design(distributions, 1 << 14, method);
+        ASSERT_EQ(design.points.size(), (1 << 14) * 5);
+
+        std::vector<BioCro::Run_summary> summaries;
+        for (auto const& point : design.points) summaries.push_back({ishigami(point)});
+        auto indices = BioCro::sobol_indices(design, summaries, {"f"});
+
+        EXPECT_NEAR(indices.variance[0], variance, 0.02 * variance);
+        for (size_t i {0}; i < 3; ++i) {
+            if (VERBOSE) {
+                cout << "x" << i + 1 << ": S = " << indices.first_order[0][i]
+                     << " (" << first[i] << "), ST = " << indices.total_order[0][i]
+                     << " (" << total[i] << ")" << endl;
+            }
+            EXPECT_NEAR(indices.first_order[0][i], first[i], 0.02) << i;
+            EXPECT_NEAR(indices.total_order[0][i], total[i], 0.02) << i;
+        }
+    }
+}
+
+// An estimator with nothing in it refuses to give indices, and an
+// output that never changes has indices of 0 rather than NaN.
+TEST(SobolIndexTest, DegenerateCases) {
+    BioCro::Sobol_index_estimator estimator {{"x1", "x2"}, {"f", "g"}};
+    EXPECT_THROW(estimator.indices(), std::logic_error);
+
+    for (double x : {1.0, 2.0, 3.0}) {
+        estimator.add_group({{x, 5}, {x + 1, 5}, {x * x, 5}, {2 * x, 5}});
+    }
+    auto indices = estimator.indices();
+    EXPECT_EQ(indices.variance[1], 0);
+    EXPECT_EQ(indices.first_order[1], (std::vector<double> {0, 0}));
+    EXPECT_EQ(indices.total_order[1], (std::vector<double> {0, 0}));
+}
+
+class SensitivityTest : public ::testing::Test {
+   protected:
+    SensitivityTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) {
+            times.push_back(i * 0.1);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1}, {"unused", 0} },
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        {},
+        {}
+    };
+
+    BioCro::Parameter_distributions distributions {
+        {"mass", BioCro::Distribution::uniform(3, 7)},
+        {"spring_constant", BioCro::Distribution::lognormal(2, 0.3)},
+        {"unused", BioCro::Distribution::normal(0, 1)}};
+
+    BioCro::Reduction_set reductions {
+        { BioCro::Reduction::final_value("position"),
+          BioCro::Reduction::maximum("kinetic_energy") },
+        "elapsed_time"};
+};
+
+// The indices don't depend on the number of threads or the batch size,
+// and a parameter no module uses has indices of zero.
+TEST_F(SensitivityTest, IndicesDoNotDependOnThreading) {
+    BioCro::Sensitivity_options serial;
+    serial.number_of_threads = 1;
+    auto reference = BioCro::run_sensitivity_analysis(spec, distributions, reductions, 64, serial);
+
+    EXPECT_TRUE(reference.failed_groups.empty());
+    EXPECT_EQ(reference.indices.number_of_groups, 64u);
+    EXPECT_EQ(reference.indices.output_names, reductions.names());
+    for (size_t k {0}; k < reductions.size(); ++k) {
+        EXPECT_EQ(reference.indices.first_order[k][2], 0);
+        EXPECT_EQ(reference.indices.total_order[k][2], 0);
+    }
+
+    for (unsigned threads : {2, 4}) {
+        for (size_t batch_size : {1, 5}) {
+            BioCro::Sensitivity_options options;
+            options.number_of_threads = threads;
+            options.batch_size = batch_size;
+            auto result = BioCro::run_sensitivity_analysis(spec, distributions, reductions, 64, options);
+            EXPECT_EQ(result.indices.first_order, reference.indices.first_order);
+            EXPECT_EQ(result.indices.total_order, reference.indices.total_order);
+        }
+    }
+}
+
+// A design can also be run by a batch sweep, and the indices computed
+// from its results.
+TEST_F(SensitivityTest, DesignCanBeRunByASweep) {
+    auto design = BioCro::saltelli_design(distributions, 32);
+    spec.varied_parameters = design.parameter_names;
+
+    BioCro::Loopback_transport transport {2, [&](BioCro::Sweep_worker_endpoint& endpoint, size_t) {
+        BioCro::serve_sweep(endpoint, spec, reductions);
+    }};
+    auto sweep = BioCro::run_distributed_sweep(design.points, transport);
+    ASSERT_TRUE(sweep.failed_runs().empty());
+
+    auto from_sweep = BioCro::sobol_indices(design, sweep.values, reductions.names());
+    auto direct = BioCro::run_sensitivity_analysis(spec, distributions, reductions, 32);
+    EXPECT_EQ(from_sweep.first_order, direct.indices.first_order);
+    EXPECT_EQ(from_sweep.total_order, direct.indices.total_order);
+}
+
+TEST_F(SensitivityTest, BadInputsAreRejected) {
+    distributions.push_back({"bogus", BioCro::Distribution::constant(1)});
+    EXPECT_THROW(BioCro::run_sensitivity_analysis(spec, distributions, reductions, 8),
+                 std::invalid_argument);
+
+    BioCro::Parameter_distributions many;
+    for (int i {0}; i < 11; ++i) {
+        many.push_back({"p" + std::to_string(i), BioCro::Distribution::uniform(0, 1)});
+    }
+    EXPECT_THROW(BioCro::saltelli_design(many, 8), std::out_of_range);
+    EXPECT_NO_THROW(BioCro::saltelli_design(many, 8, BioCro::Sampling_method::latin_hypercube));
+}
+
+// Times an analysis on 1, 2, 4, ... threads, up to one per core.
+TEST_F(SensitivityTest, ThroughputWithNumberOfThreads) {
+    using clock = std::chrono::steady_clock;
+    constexpr size_t groups {256};
+    unsigned cores {std::max(2u, std::thread::hardware_concurrency())};
+
+    for (unsigned threads {1};; threads = std::min(2 * threads, cores)) {
+        BioCro::Sensitivity_options options;
+        options.number_of_threads = threads;
+
+        auto start = clock::now();
+        auto result = BioCro::run_sensitivity_analysis(spec, distributions, reductions, groups, options);
+        std::chrono::duration<double> elapsed {clock::now() - start};
+
+        EXPECT_TRUE(result.failed_groups.empty());
+        if (VERBOSE) {
+            cout << threads << " thread(s): " << groups * 5 / elapsed.count() << " runs/s; "
+                 << "S(mass) = " << result.indices.first_order[0][0]
+                 << ", ST(mass) = " << result.indices.total_order[0][0] << endl;
+        }
+        if (threads == cores) break;
+    }
+}
@@ -0,0 +1,341 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the result cache of simulation_cache.h.  They
+// check that cache keys are canonical (independent of the order of the
+// elements of a map) yet change with any input that affects a result,
+// that a cached result is the result the simulation would give, that
+// the least recently used results are dropped first, that results
+// written to disk are found by a new cache, and that a cache may be
+// shared by several threads.  The last test compares the time needed
+// for repeated evaluations with and without a cache.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>    // for std::remove
+#include <iostream>
+#include <thread>
+
+#include <dirent.h>    // for opendir, readdir
+#include <sys/stat.h>  // for mkdir
+#include <unistd.h>    // for rmdir
+
+#include "BioCro_Extended.h"
+#include "reduction.h"
+#include "safe_simulators.h"
+#include "simulation_cache.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class SimulationCacheTest : public ::testing::Test {
+   protected:
+    SimulationCacheTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) {
+            times.push_back(i * 0.1);
+        }
+        drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Memoized_simulator get_simulator(BioCro::Simulation_cache& cache) {
+        return BioCro::Memoized_simulator {
+            cache, initial_state, parameters, drivers,
+            direct_modules, differential_modules,
+            "boost_rk4", 1, 0.0001, 0.0001, 200};
+    }
+
+    BioCro::Simulation_result direct_result() {
+        return BioCro::Idempotent_simulator {
+            initial_state, parameters, drivers,
+            direct_modules, differential_modules,
+            "boost_rk4", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+
+    BioCro::Cache_key key() {
+        return BioCro::simulation_key(
+            initial_state, parameters, BioCro::fingerprint(drivers),
+            direct_modules, differential_modules,
+            solver, 1, 0.0001, 0.0001, 200);
+    }
+
+    std::string solver {"boost_rk4"};
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+};
+
+TEST_F(SimulationCacheTest, KeysAreCanonical) {
+    BioCro::Cache_key original {key()};
+
+    // The same parameters, arranged differently in the map
+    BioCro::Parameter_set rearranged;
+    rearranged.reserve(64);
+    rearranged["timestep"] = 0.1;
+    rearranged["spring_constant"] = 7;
+    rearranged["mass"] = 5;
+    std::swap(parameters, rearranged);
+    EXPECT_EQ(key(), original);
+
+    initial_state["velocity"] = -2.0000001;
+    EXPECT_NE(key(), original);
+    initial_state["velocity"] = -2;
+
+    parameters["extra"] = 0.0;
+    BioCro::Cache_key with_zero {key()};
+    parameters["extra"] = -0.0;
+    EXPECT_EQ(key(), with_zero);
+    parameters.erase("extra");
+    EXPECT_EQ(key(), original);
+
+    drivers["elapsed_time"][50] += 1e-12;
+    EXPECT_NE(key(), original);
+    drivers["elapsed_time"][50] -= 1e-12;
+    EXPECT_EQ(key(), original);
+
+    solver = "boost_euler";
+    EXPECT_NE(key(), original);
+    solver = "boost_rk4";
+
+    std::swap(direct_modules, differential_modules);
+    EXPECT_NE(key(), original);
+    std::swap(direct_modules, differential_modules);
+
+    // Another build of the modules
+    EXPECT_NE(BioCro::simulation_key(initial_state, parameters, BioCro::fingerprint(drivers),
+                                     direct_modules, differential_modules,
+                                     solver, 1, 0.0001, 0.0001, 200, {}, "rebuilt"),
+              original);
+
+    EXPECT_EQ(original.to_string().size(), 32u);
+}
+
+TEST_F(SimulationCacheTest, CachedResultsMatchSimulation) {
+    BioCro::Simulation_cache cache {1 << 20};
+    BioCro::Simulation_result expected {direct_result()};
+
+    EXPECT_EQ(get_simulator(cache).run_simulation(), expected);
+    EXPECT_EQ(get_simulator(cache).run_simulation(), expected);
+    EXPECT_EQ(get_simulator(cache).run_simulation(), expected);
+
+    parameters["mass"] = 6;
+    BioCro::Simulation_result other {direct_result()};
+    EXPECT_EQ(get_simulator(cache).run_simulation(), other);
+    EXPECT_NE(other, expected);
+
+    BioCro::Cache_statistics s {cache.statistics()};
+    EXPECT_EQ(s.memory_hits, 2u);
+    EXPECT_EQ(s.misses, 2u);
+    EXPECT_EQ(s.entries, 2u);
+    EXPECT_DOUBLE_EQ(s.hit_rate(), 0.5);
+    EXPECT_GE(s.bytes, 2 * BioCro::Stored_result::full_size(expected));
+
+    // Summaries are cached separately from full results.
+    BioCro::Reduction_set reductions {
+        { BioCro::Reduction::maximum("position"), BioCro::Reduction::final_value("velocity") },
+        "elapsed_time"};
+    BioCro::Run_summary summary {get_simulator(cache).run_summary(reductions)};
+    EXPECT_EQ(cache.statistics().misses, 3u);
+    EXPECT_EQ(get_simulator(cache).run_summary(reductions), summary);
+    EXPECT_EQ(cache.statistics().memory_hits, 3u);
+
+    BioCro::Reduction_set other_reductions {{ BioCro::Reduction::minimum("position") }};
+    get_simulator(cache).run_summary(other_reductions);
+    EXPECT_EQ(cache.statistics().misses, 4u);
+}
+
+// A reduction's key covers everything that determines its value,
+// not just its name.
+TEST(ReductionKeyTest, KeysCoverReductionDetails) {
+    auto key = [](BioCro::Reduction const& r) {
+        return BioCro::Key_builder{}.add(BioCro::Reduction_set {{r}}).key();
+    };
+
+    // Both of these are named "value_at(x)@0.000000".
+    EXPECT_NE(key(BioCro::Reduction::value_at("x", 0)),
+              key(BioCro::Reduction::value_at("x", 1e-7)));
+    EXPECT_EQ(key(BioCro::Reduction::maximum("x")),
+              key(BioCro::Reduction::maximum("x").named("peak")));
+    EXPECT_NE(key(BioCro::Reduction::maximum("x")), key(BioCro::Reduction::minimum("x")));
+
+    auto sum = [](double a, double, std::vector<double> const& v) { return a + v[0]; };
+    auto product = [](double a, double, std::vector<double> const& v) { return a * v[0]; };
+    auto total = BioCro::Reduction::custom("fold", {"x"}, 0, sum);
+    EXPECT_FALSE(BioCro::can_cache({{total}}));
+    EXPECT_THROW(key(total), std::invalid_argument);
+
+    // The same name, but different functions and so different versions
+    auto folded_sum = BioCro::Reduction::custom("fold", {"x"}, 0, sum).versioned("sum 1");
+    auto folded_product = BioCro::Reduction::custom("fold", {"x"}, 1, product).versioned("product 1");
+    EXPECT_TRUE(BioCro::can_cache({{folded_sum}}));
+    EXPECT_NE(key(folded_sum), key(folded_product));
+}
+
+// A summary including an unversioned custom reduction is not cached.
+TEST_F(SimulationCacheTest, UnversionedCustomReductionsAreNotCached) {
+    BioCro::Simulation_cache cache {1 << 20};
+    BioCro::Reduction_set reductions {{
+        BioCro::Reduction::custom("steps", {"position"}, 0,
+                                  [](double a, double, std::vector<double> const&) {
+                                      return a + 1;
+                                  })}};
+
+    BioCro::Run_summary summary {get_simulator(cache).run_summary(reductions)};
+    EXPECT_EQ(get_simulator(cache).run_summary(reductions), summary);
+    EXPECT_EQ(cache.statistics().lookups(), 0u);
+    EXPECT_EQ(cache.statistics().insertions, 0u);
+}
+
+// Once the byte limit is reached, the least recently used result is
+// dropped.
+TEST_F(SimulationCacheTest, LeastRecentlyUsedIsEvicted) {
+    size_t one_result {BioCro::Simulation_cache::size_of(direct_result())};
+    BioCro::Simulation_cache cache {2 * one_result + one_result / 2};
+
+    auto run = [&](double mass) {
+        parameters["mass"] = mass;
+        get_simulator(cache).run_simulation();
+    };
+
+    run(1);  // miss
+    run(2);  // miss
+    run(1);  // hit; 2 is now the least recently used
+    run(3);  // miss; evicts 2
+    run(1);  // hit
+    run(2);  // miss; evicts 3
+
+    BioCro::Cache_statistics s {cache.statistics()};
+    EXPECT_EQ(s.memory_hits, 2u);
+    EXPECT_EQ(s.misses, 4u);
+    EXPECT_EQ(s.evictions, 2u);
+    EXPECT_EQ(s.entries, 2u);
+    EXPECT_LE(s.bytes, s.byte_limit);
+
+    // A result larger than the limit isn't held at all.
+    BioCro::Simulation_cache tiny {one_result / 2};
+    get_simulator(tiny).run_simulation();
+    EXPECT_EQ(tiny.statistics().entries, 0u);
+    EXPECT_EQ(tiny.statistics().bytes, 0u);
+}
+
+// Results written to disk are found by another cache using the same
+// directory, unless it is for another version of the modules.
+TEST_F(SimulationCacheTest, DiskTierOutlivesTheCache) {
+    std::string directory {::testing::TempDir() + "test_simulation_cache_files"};
+    ::mkdir(directory.c_str(), 0700);
+
+    BioCro::Simulation_result expected {direct_result()};
+    {
+        BioCro::Simulation_cache first {1 << 20, directory};
+        get_simulator(first).run_simulation();
+        EXPECT_EQ(first.statistics().misses, 1u);
+    }
+
+    BioCro::Simulation_cache second {1 << 20, directory};
+    EXPECT_EQ(get_simulator(second).run_simulation(), expected);
+    EXPECT_EQ(get_simulator(second).run_simulation(), expected);
+
+    BioCro::Cache_statistics s {second.statistics()};
+    EXPECT_EQ(s.disk_hits, 1u);
+    EXPECT_EQ(s.memory_hits, 1u);
+    EXPECT_EQ(s.misses, 0u);
+
+    BioCro::Simulation_cache rebuilt {1 << 20, directory, "rebuilt"};
+    EXPECT_EQ(get_simulator(rebuilt).run_simulation(), expected);
+    EXPECT_EQ(rebuilt.statistics().disk_hits, 0u);
+    EXPECT_EQ(rebuilt.statistics().misses, 1u);
+
+    // Clean up.
+    if (DIR* d = ::opendir(directory.c_str())) {
+        while (dirent* entry = ::readdir(d)) {
+            std::string name {entry->d_name};
+            if (name != "." && name != "..") std::remove((directory + "/" + name).c_str());
+        }
+        ::closedir(d);
+    }
+    ::rmdir(directory.c_str());
+}
+
+// Threads sharing a cache get the results they would have computed.
+TEST_F(SimulationCacheTest, SharedByThreads) {
+    BioCro::Simulation_cache cache {1 << 22};
+    std::vector<BioCro::Simulation_result> expected;
+    for (int m {1}; m <= 5; ++m) {
+        parameters["mass"] = m;
+        expected.push_back(direct_result());
+    }
+    BioCro::Cache_key drivers_fingerprint {BioCro::fingerprint(drivers)};
+
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches {0};
+    for (int t {0}; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i {0}; i < 50; ++i) {
+                int m {1 + (i + t) % 5};
+                BioCro::Parameter_set p {parameters};
+                p["mass"] = m;
+                BioCro::Memoized_simulator sim {
+                    cache, initial_state, p, drivers, drivers_fingerprint,
+                    direct_modules, differential_modules,
+                    "boost_rk4", 1, 0.0001, 0.0001, 200};
+                if (sim.run_simulation() != expected[m - 1]) ++mismatches;
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    EXPECT_EQ(mismatches, 0);
+    BioCro::Cache_statistics s {cache.statistics()};
+    EXPECT_EQ(s.lookups(), 200u);
+    EXPECT_GE(s.misses, 5u);
+    EXPECT_EQ(s.entries, 5u);
+}
+
+// Times 500 evaluations of 25 distinct parameter values, with and
+// without a cache.
+TEST_F(SimulationCacheTest, RepeatedEvaluationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    BioCro::Simulation_cache cache {1 << 24};
+    BioCro::Cache_key drivers_fingerprint {BioCro::fingerprint(drivers)};
+
+    auto start = clock::now();
+    for (int i {0}; i < 500; ++i) {
+        parameters["mass"] = 1 + i % 25;
+        direct_result();
+    }
+    auto uncached_time = clock::now() - start;
+
+    start = clock::now();
+    for (int i {0}; i < 500; ++i) {
+        parameters["mass"] = 1 + i % 25;
+        BioCro::Memoized_simulator {
+            cache, initial_state, parameters, drivers, drivers_fingerprint,
+            direct_modules, differential_modules,
+            "boost_rk4", 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+    auto cached_time = clock::now() - start;
+
+    BioCro::Cache_statistics s {cache.statistics()};
+    EXPECT_DOUBLE_EQ(s.hit_rate(), 0.95);
+    if (VERBOSE) {
+        cout << "without cache: " << duration_cast<microseconds>(uncached_time).count() << " us" << endl;
+        cout << "with cache: " << duration_cast<microseconds>(cached_time).count() << " us ("
+             << 100 * s.hit_rate() << "% hits, " << s.entries << " entries, "
+             << s.bytes << " bytes)" << endl;
+    }
+}
@@ -0,0 +1,209 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the simulators of static_simulator.h, whose
+// modules are given as template arguments.  They check that a
+// Static_system calculates the same derivatives as a Dynamical_system
+// made from the same modules, that a Static_simulator gives the
+// results of a Simulator using the "homemade_euler" and "boost_rk4"
+// solvers, for the harmonic oscillator and for the thermal-time model
+// of test_repeat_runs.cpp, that drivers given as a temporary may be
+// used, and that badly formed systems are refused.  The last test
+// compares the time needed to run a simulation with the two.
+//
+// As in test_module_object.cpp, the module headers are included
+// directly, and must come before BioCro.h.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::find
+#include <chrono>
+#include <cmath>     // for std::abs
+#include <iostream>
+
+#include <module_library/harmonic_energy.h>     // for standardBML::harmonic_energy
+#include <module_library/harmonic_oscillator.h> // for standardBML::harmonic_oscillator
+#include <module_library/thermal_time_linear.h> // for standardBML::thermal_time_linear
+
+#include "BioCro_Extended.h"
+#include "static_simulator.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+using Oscillator_system = BioCro::Static_system<
+    BioCro::Direct_modules<standardBML::harmonic_energy>,
+    BioCro::Differential_modules<standardBML::harmonic_oscillator>>;
+
+using Oscillator_simulator = BioCro::Static_simulator<
+    BioCro::Direct_modules<standardBML::harmonic_energy>,
+    BioCro::Differential_modules<standardBML::harmonic_oscillator>>;
+
+using Thermal_time_simulator = BioCro::Static_simulator<
+    BioCro::Direct_modules<>,
+    BioCro::Differential_modules<standardBML::thermal_time_linear>>;
+
+class StaticSimulatorTest : public ::testing::Test {
+   protected:
+    StaticSimulatorTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 100; ++i) times.push_back(i * 0.1);
+        drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Simulation_result interpreted_result(std::string const& solver) {
+        return BioCro::Simulator {initial_state, parameters, drivers,
+                                  direct_modules, differential_modules,
+                                  solver, 1, 0.0001, 0.0001, 200}.run_simulation();
+    }
+
+    void expect_same_results(BioCro::Simulation_result const& expected,
+                             BioCro::Simulation_result const& result) {
+        ASSERT_EQ(result.size(), expected.size());
+        for (auto const& column : expected) {
+            ASSERT_EQ(result.count(column.first), 1u) << column.first;
+            auto const& values = result.at(column.first);
+            ASSERT_EQ(values.size(), column.second.size()) << column.first;
+            for (size_t i {0}; i < values.size(); ++i) {
+                EXPECT_NEAR(values[i], column.second[i], 1e-12 * (1 + std::abs(column.second[i])))
+                    << column.first << " at row " << i;
+            }
+        }
+    }
+
+    BioCro::State initial_state { {"position", 3}, {"velocity", -2} };
+    BioCro::Parameter_set parameters
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} };
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_modules
+        { Module_factory::retrieve("harmonic_energy") };
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+};
+
+TEST_F(StaticSimulatorTest, MatchesInterpretedDerivatives) {
+    BioCro::Dynamical_system interpreted {BioCro::make_dynamical_system(
+        initial_state, parameters, drivers, direct_modules, differential_modules)};
+    Oscillator_system system {initial_state, parameters, drivers};
+
+    auto interpreted_names = interpreted->get_differential_quantity_names();
+    auto names = system.get_differential_quantity_names();
+    ASSERT_EQ(names.size(), interpreted_names.size());
+
+    std::vector<double> x(2), system_x(2), dxdt(2), system_dxdt(2);
+    for (int trial {0}; trial < 20; ++trial) {
+        x = {0.37 * trial - 1, 0.5 - 0.2 * trial};
+        for (size_t i {0}; i < 2; ++i) {
+            auto position = std::find(interpreted_names.begin(), interpreted_names.end(), names[i]);
+            system_x[i] = x[position - interpreted_names.begin()];
+        }
+        size_t row {static_cast<size_t>(trial * 3) % system.get_ntimes()};
+        interpreted->calculate_derivative(x, dxdt, row);
+        system.calculate_derivative(system_x, system_dxdt, row);
+        for (size_t i {0}; i < 2; ++i) {
+            auto position = std::find(interpreted_names.begin(), interpreted_names.end(), names[i]);
+            EXPECT_DOUBLE_EQ(system_dxdt[i], dxdt[position - interpreted_names.begin()]) << names[i];
+        }
+    }
+}
+
+TEST_F(StaticSimulatorTest, MatchesInterpretedSimulations) {
+    expect_same_results(interpreted_result("homemade_euler"),
+                        Oscillator_simulator {initial_state, parameters, drivers,
+                                              BioCro::Static_method::euler}.run_simulation());
+
+    Oscillator_simulator simulator {initial_state, parameters, drivers};
+    BioCro::Simulation_result expected {interpreted_result("boost_rk4")};
+    expect_same_results(expected, simulator.run_simulation());
+
+    // Running again gives the same result.
+    expect_same_results(expected, simulator.run_simulation());
+
+    // The thermal-time model of test_repeat_runs.cpp
+    initial_state = { {"TTc", 0} };
+    parameters = { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} };
+    drivers = { {"time", {0, 1, 2, 3, 4, 5}}, {"temp", {3, 8, 11, 15, 4, 20}} };
+    direct_modules = {};
+    differential_modules = { Module_factory::retrieve("thermal_time_linear") };
+    for (auto method : {BioCro::Static_method::euler, BioCro::Static_method::rk4}) {
+        expect_same_results(
+            interpreted_result(method == BioCro::Static_method::euler ? "homemade_euler" : "boost_rk4"),
+            Thermal_time_simulator {initial_state, parameters, drivers, method}.run_simulation());
+    }
+}
+
+// A simulator keeps its own copy of the drivers, so they may be given
+// as a temporary.
+TEST_F(StaticSimulatorTest, TemporaryDriversMayBeGiven) {
+    Thermal_time_simulator simulator {
+        { {"TTc", 0} },
+        { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} },
+        { {"time", {0, 1, 2, 3, 4, 5}}, {"temp", {3, 8, 11, 15, 4, 20}} }};
+
+    initial_state = { {"TTc", 0} };
+    parameters = { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} };
+    drivers = { {"time", {0, 1, 2, 3, 4, 5}}, {"temp", {3, 8, 11, 15, 4, 20}} };
+    direct_modules = {};
+    differential_modules = { Module_factory::retrieve("thermal_time_linear") };
+    expect_same_results(interpreted_result("boost_rk4"), simulator.run_simulation());
+}
+
+TEST_F(StaticSimulatorTest, BadSystemsAreRefused) {
+    // Drivers with no rows
+    BioCro::System_drivers no_rows { {"elapsed_time", {}} };
+    EXPECT_THROW((Oscillator_system {initial_state, parameters, no_rows}), std::logic_error);
+
+    // A missing input (or one made only by a later direct module)
+    parameters.erase("mass");
+    EXPECT_THROW((Oscillator_system {initial_state, parameters, drivers}), std::logic_error);
+
+    // A quantity defined twice
+    parameters["mass"] = 5;
+    parameters["position"] = 1;
+    EXPECT_THROW((Oscillator_system {initial_state, parameters, drivers}), std::logic_error);
+
+    // A differential module's output with no initial value
+    parameters.erase("position");
+    initial_state.erase("velocity");
+    parameters["velocity"] = -2;
+    EXPECT_THROW((Oscillator_system {initial_state, parameters, drivers}), std::logic_error);
+}
+
+// Times 200 runs of a 1000-row simulation each way.
+TEST_F(StaticSimulatorTest, SimulationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    std::vector<double> times;
+    for (size_t i {0}; i < 1000; ++i) times.push_back(i * 0.1);
+    drivers = { {"elapsed_time", times} };
+
+    int const runs {200};
+    double sum {0};
+
+    auto start = clock::now();
+    for (int i {0}; i < runs; ++i) {
+        sum += interpreted_result("boost_rk4")["position"].back();
+    }
+    auto interpreted_time = clock::now() - start;
+
+    start = clock::now();
+    for (int i {0}; i < runs; ++i) {
+        sum -= Oscillator_simulator {initial_state, parameters, drivers}.run_simulation()["position"].back();
+    }
+    auto static_time = clock::now() - start;
+
+    EXPECT_NEAR(sum, 0, 1e-9);
+    if (VERBOSE) {
+        cout << "interpreted: " << duration_cast<microseconds>(interpreted_time).count() << " us" << endl;
+        cout << "static: " << duration_cast<microseconds>(static_time).count() << " us ("
+             << static_cast<double>(interpreted_time.count()) / static_time.count()
+             << " times as fast)" << endl;
+    }
+}
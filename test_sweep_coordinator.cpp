@@ -0,0 +1,279 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate run_distributed_sweep (sweep_coordinator.h),
+// which hands batches of sweep points to workers over a pluggable
+// transport and collects reduced results.  They use both the loopback
+// (thread) transport and the Unix-socket (process) transport, check
+// the reduced values against runs made on their own, and show that
+// work lost with a worker or held up by a slow one is redone
+// elsewhere.  The last test prints the throughput for increasing
+// numbers of workers.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max, std::max_element
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <sys/socket.h> // for socketpair, send
+#include <unistd.h>     // for close
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "sweep_coordinator.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class SweepCoordinatorTest : public ::testing::Test {
+   protected:
+    SweepCoordinatorTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i <= 200; ++i) {
+            times.push_back(i * 0.1);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+
+        for (size_t i {0}; i < 6; ++i) {
+            for (size_t j {0}; j < 6; ++j) {
+                points.push_back({1.0 + i, 0.5 + j});
+            }
+        }
+    }
+
+    // The final position and the largest energy.
+    static std::vector<double> reduce(BioCro::Simulation_result const& result) {
+        auto const& energy = result.at("total_energy");
+        return { result.at("position").back(),
+                 *std::max_element(energy.begin(), energy.end()) };
+    }
+
+    // The reduced values of the sweep point, run on its own.
+    std::vector<double> run_alone(std::vector<double> const& point) {
+        BioCro::Parameter_set parameters {spec.parameters};
+        for (size_t i {0}; i < point.size(); ++i) {
+            parameters[spec.varied_parameters[i]] = point[i];
+        }
+        BioCro::Idempotent_simulator sim {
+            spec.initial_state, parameters, spec.drivers,
+            spec.direct_modules, spec.differential_modules,
+            spec.ode_solver_name, spec.output_step_size,
+            spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+            spec.adaptive_max_steps, spec.recorded_quantities};
+        return reduce(sim.run_simulation());
+    }
+
+    BioCro::Sweep_worker_function worker() {
+        return [this](BioCro::Sweep_worker_endpoint& endpoint, size_t) {
+            BioCro::serve_sweep(endpoint, spec, reduce);
+        };
+    }
+
+    void expect_correct(BioCro::Distributed_sweep_result const& result) {
+        ASSERT_EQ(result.values.size(), points.size());
+        EXPECT_TRUE(result.failed_runs().empty());
+        for (size_t run {0}; run < points.size(); ++run) {
+            EXPECT_EQ(result.values[run], run_alone(points[run])) << "run " << run;
+        }
+    }
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} },
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        { "mass", "spring_constant" },
+        { "position", "total_energy" }
+    };
+
+    BioCro::Sweep_points points;
+    BioCro::Coordinator_options options {4, 3, std::chrono::milliseconds {50}};
+};
+
+TEST_F(SweepCoordinatorTest, LoopbackTransportGivesCorrectResults) {
+    BioCro::Loopback_transport transport {3, worker()};
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+
+    expect_correct(result);
+    EXPECT_EQ(result.workers_lost, 0);
+}
+
+TEST_F(SweepCoordinatorTest, UnixSocketTransportGivesCorrectResults) {
+    BioCro::Unix_socket_transport transport {3, worker()};
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+
+    expect_correct(result);
+    EXPECT_EQ(result.workers_lost, 0);
+}
+
+// A worker process that dies in the middle of a batch loses nothing:
+// its batch is redone by the other workers.
+TEST_F(SweepCoordinatorTest, WorkOfLostWorkerIsRetried) {
+    BioCro::Sweep_worker_function normal_worker {worker()};
+    BioCro::Unix_socket_transport transport {3, [&](BioCro::Sweep_worker_endpoint& endpoint, size_t w) {
+        if (w == 0) {
+            std::string message;
+            endpoint.receive(message);
+            ::_exit(1); // crash without replying
+        }
+        normal_worker(endpoint, w);
+    }};
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+
+    expect_correct(result);
+    EXPECT_EQ(result.workers_lost, 1);
+    EXPECT_EQ(result.runs_per_worker[0], 0);
+    EXPECT_GE(result.retried_runs, options.batch_size);
+}
+
+// A run that always fails is attempted max_attempts times and then
+// reported; the other runs are unaffected.  Here, a very stiff spring
+// makes the adaptive solver exceed its step limit.
+TEST_F(SweepCoordinatorTest, FailingRunsAreGivenUp) {
+    spec.ode_solver_name = "boost_rkck54";
+    spec.adaptive_max_steps = 50;
+    points = { {1, 1}, {1, 1e8}, {2, 3}, {1, 1e8}, {3, 2} };
+
+    BioCro::Loopback_transport transport {2, worker()};
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+
+    EXPECT_EQ(result.failed_runs(), (std::vector<size_t> {1, 3}));
+    EXPECT_EQ(result.retried_runs, 2 * (options.max_attempts - 1));
+    EXPECT_EQ(result.values[2], run_alone(points[2]));
+}
+
+// A batch held up by a slow worker is copied to an idle one, and the
+// sweep finishes without waiting for the slow worker.  Here the slow
+// worker is held up until the sweep is over, so the outcome doesn't
+// depend on how long anything takes.
+TEST_F(SweepCoordinatorTest, StragglersAreRebalanced) {
+    points.resize(2 * options.batch_size);
+    std::atomic<bool> sweep_is_over {false};
+
+    BioCro::Loopback_transport transport {2, [&](BioCro::Sweep_worker_endpoint& endpoint, size_t w) {
+        BioCro::serve_sweep(endpoint, spec, [&](BioCro::Simulation_result const& r) {
+            while (w == 0 && !sweep_is_over) {
+                std::this_thread::sleep_for(std::chrono::milliseconds {1});
+            }
+            return reduce(r);
+        });
+    }};
+
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+    sweep_is_over = true;
+
+    expect_correct(result);
+    EXPECT_GE(result.speculative_batches, 1);
+    EXPECT_EQ(result.runs_per_worker[0], 0);
+    EXPECT_EQ(result.runs_per_worker[1], points.size());
+}
+
+// A reply naming a run outside the sweep or outside the worker's
+// batch, like any reply that can't be parsed, costs the coordinator
+// only that worker.
+TEST_F(SweepCoordinatorTest, BadRepliesAreTreatedAsLostWorkers) {
+    BioCro::Sweep_worker_function normal_worker {worker()};
+    BioCro::Loopback_transport transport {4, [&](BioCro::Sweep_worker_endpoint& endpoint, size_t w) {
+        if (w < 3) {
+            std::string message;
+            if (!endpoint.receive(message)) return;
+            BioCro::coordinator_detail::Reader in {message};
+            in.get_uint(); // the tag
+            std::uint64_t batch_id {in.get_uint()};
+            std::uint64_t batch_size {in.get_uint()};
+            std::uint64_t first_run {in.get_uint()};
+
+            BioCro::coordinator_detail::Writer out;
+            out.put(std::uint64_t {BioCro::coordinator_detail::result_tag});
+            out.put(batch_id);
+            if (w < 2) {
+                out.put(std::uint64_t {1});
+                if (w == 0) {
+                    out.put(std::uint64_t {1000000}); // no such run
+                } else {
+                    out.put(first_run + batch_size);  // a run of another batch
+                }
+                out.put(std::uint64_t {1});
+                out.put(std::uint64_t {0});
+                endpoint.send(out.bytes());
+            } else {
+                out.put(std::uint64_t {1000}); // but no runs follow
+                endpoint.send(out.bytes());
+            }
+            while (endpoint.receive(message)) {}
+            return;
+        }
+        normal_worker(endpoint, w);
+    }};
+    auto result = BioCro::run_distributed_sweep(points, transport, options);
+
+    expect_correct(result);
+    EXPECT_EQ(result.workers_lost, 3);
+    EXPECT_EQ(result.runs_per_worker[3], points.size());
+}
+
+// A frame longer than the limit, or one that stops part way through,
+// is refused rather than allocated for or waited on forever.
+TEST_F(SweepCoordinatorTest, BadFramesAreRefused) {
+    int fds[2];
+    ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::string message;
+
+    std::uint64_t const huge {~std::uint64_t {0}};
+    ASSERT_EQ(::send(fds[0], &huge, sizeof huge, 0), static_cast<ssize_t>(sizeof huge));
+    EXPECT_FALSE(BioCro::coordinator_detail::read_frame(fds[1], message, 100));
+
+    std::uint64_t const length {100};
+    ASSERT_EQ(::send(fds[0], &length, sizeof length, 0), static_cast<ssize_t>(sizeof length));
+    ASSERT_EQ(::send(fds[0], "short", 5, 0), 5);
+    EXPECT_FALSE(BioCro::coordinator_detail::read_frame(fds[1], message, 100));
+
+    ASSERT_TRUE(BioCro::coordinator_detail::write_frame(fds[0], "whole"));
+    EXPECT_TRUE(BioCro::coordinator_detail::read_frame(fds[1], message, 100));
+    EXPECT_EQ(message, "whole");
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+// Prints the throughput of a sweep using 1, 2, 4, ... worker processes,
+// up to one per core.
+TEST_F(SweepCoordinatorTest, ThroughputWithNumberOfWorkers) {
+    using clock = std::chrono::steady_clock;
+
+    BioCro::Sweep_points many_points;
+    for (size_t i {0}; i < 16; ++i) {
+        many_points.insert(many_points.end(), points.begin(), points.end());
+    }
+    points = many_points;
+    unsigned cores {std::max(2u, std::thread::hardware_concurrency())};
+
+    for (unsigned workers {1};; workers = std::min(2 * workers, cores)) {
+        auto start = clock::now();
+        BioCro::Unix_socket_transport transport {workers, worker()};
+        auto result = BioCro::run_distributed_sweep(points, transport, options);
+        std::chrono::duration<double> elapsed {clock::now() - start};
+
+        EXPECT_TRUE(result.failed_runs().empty());
+        if (VERBOSE) {
+            cout << workers << " worker(s): " << points.size() / elapsed.count()
+                 << " runs/s (" << result.batches_sent << " batches sent, "
+                 << result.speculative_batches << " speculative)" << endl;
+        }
+        if (workers == cores) break;
+    }
+}
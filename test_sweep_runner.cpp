@@ -0,0 +1,207 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests demonstrate run_sweep (sweep_runner.h), which runs a
+// parameter sweep in forked worker processes sharing their drivers and
+// results through a memory mapping.  They check that every run matches
+// the same run made on its own, whatever the output step size, that a
+// result file can be reopened, and that failed runs are reported
+// without disturbing the others.
+// The last test times a sweep using from one worker up to one per
+// core.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max
+#include <chrono>
+#include <cstdio>    // for std::remove
+#include <iostream>
+#include <thread>    // for std::thread::hardware_concurrency
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "sweep_runner.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class SweepRunnerTest : public ::testing::Test {
+   protected:
+    SweepRunnerTest() {
+        set_number_of_timesteps(100);
+    }
+
+    void set_number_of_timesteps(size_t n) {
+        std::vector<double> times;
+        for (size_t i {0}; i <= n; ++i) {
+            times.push_back(i * 0.1);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+    }
+
+    // A grid of masses and spring constants.
+    static BioCro::Sweep_points grid(size_t n) {
+        BioCro::Sweep_points points;
+        for (size_t i {0}; i < n; ++i) {
+            for (size_t j {0}; j < n; ++j) {
+                points.push_back({1.0 + i, 0.5 + j});
+            }
+        }
+        return points;
+    }
+
+    // Runs the sweep point on its own, without the sweep runner.
+    BioCro::Simulation_result run_alone(std::vector<double> const& point) {
+        BioCro::Parameter_set parameters {spec.parameters};
+        for (size_t i {0}; i < point.size(); ++i) {
+            parameters[spec.varied_parameters[i]] = point[i];
+        }
+        BioCro::Idempotent_simulator sim {
+            spec.initial_state, parameters, spec.drivers,
+            spec.direct_modules, spec.differential_modules,
+            spec.ode_solver_name, spec.output_step_size,
+            spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+            spec.adaptive_max_steps, spec.recorded_quantities};
+        return sim.run_simulation();
+    }
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} },
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        { "mass", "spring_constant" },
+        { "position", "velocity", "total_energy" }
+    };
+};
+
+// Each run of a sweep gives exactly the result of the same run made
+// on its own.
+TEST_F(SweepRunnerTest, SweepMatchesSeparateRuns) {
+    BioCro::Sweep_points points {grid(5)};
+    BioCro::Sweep_result result {BioCro::run_sweep(spec, points, 3)};
+
+    ASSERT_EQ(result.number_of_runs(), points.size());
+    EXPECT_EQ(result.number_of_rows(), spec.drivers.at("elapsed_time").size());
+    EXPECT_EQ(result.recorded_quantities(), spec.recorded_quantities);
+    EXPECT_TRUE(result.failed_runs().empty());
+
+    for (size_t run {0}; run < points.size(); ++run) {
+        EXPECT_EQ(result.status(run), BioCro::Run_status::done);
+        EXPECT_EQ(result.point(run), points[run]);
+        EXPECT_EQ(result.result(run), run_alone(points[run])) << "run " << run;
+    }
+}
+
+// With an output step size other than 1, each run records fewer (or
+// more) rows than the drivers have, and the sweep stores them all.
+TEST_F(SweepRunnerTest, OutputStepSizeSetsRows) {
+    BioCro::Sweep_points points {grid(2)};
+
+    for (double output_step_size : {2.0, 0.5}) {
+        spec.output_step_size = output_step_size;
+        BioCro::Sweep_result result {BioCro::run_sweep(spec, points, 2)};
+
+        size_t const driver_rows {spec.drivers.at("elapsed_time").size()};
+        EXPECT_EQ(result.number_of_rows(),
+                  static_cast<size_t>((driver_rows - 1) / output_step_size) + 1);
+        EXPECT_EQ(result.drivers(), spec.drivers);
+        EXPECT_TRUE(result.failed_runs().empty()) << output_step_size;
+        for (size_t run {0}; run < points.size(); ++run) {
+            EXPECT_EQ(result.result(run), run_alone(points[run]))
+                << "output step size " << output_step_size << ", run " << run;
+        }
+    }
+}
+
+// A result file holds the points and drivers as well as the results,
+// and can be reopened after the sweep.
+TEST_F(SweepRunnerTest, ResultFileCanBeReopened) {
+    std::string path {::testing::TempDir() + "test_sweep_runner.sweep"};
+    BioCro::Sweep_points points {grid(3)};
+
+    BioCro::Simulation_result expected_last;
+    {
+        BioCro::Sweep_result result {BioCro::run_sweep(spec, points, 2, path)};
+        expected_last = result.result(points.size() - 1);
+    }
+
+    BioCro::Sweep_result reopened {BioCro::Sweep_result::open(path)};
+    EXPECT_EQ(reopened.number_of_runs(), points.size());
+    EXPECT_EQ(reopened.varied_parameters(), spec.varied_parameters);
+    EXPECT_EQ(reopened.drivers(), spec.drivers);
+    EXPECT_EQ(reopened.point(points.size() - 1), points.back());
+    EXPECT_EQ(reopened.result(points.size() - 1), expected_last);
+
+    EXPECT_THROW(reopened.column(0, "bogus"), std::out_of_range);
+    EXPECT_THROW(reopened.point(points.size()), std::out_of_range);
+
+    std::remove(path.c_str());
+}
+
+// With no quantities named, every quantity is recorded.
+TEST_F(SweepRunnerTest, AllQuantitiesRecordedByDefault) {
+    spec.recorded_quantities.clear();
+    BioCro::Sweep_result result {BioCro::run_sweep(spec, {{2, 3}}, 1)};
+
+    EXPECT_EQ(result.result(0), run_alone({2, 3}));
+}
+
+// Runs that throw are marked as failed; the others complete.  Here, a
+// very stiff spring makes the adaptive solver exceed its step limit.
+TEST_F(SweepRunnerTest, FailedRunsAreReported) {
+    spec.ode_solver_name = "boost_rkck54";
+    spec.adaptive_max_steps = 50;
+    BioCro::Sweep_points points { {1, 1}, {1, 1e8}, {2, 3}, {1, 1e8} };
+
+    BioCro::Sweep_result result {BioCro::run_sweep(spec, points, 2)};
+
+    EXPECT_EQ(result.failed_runs(), (std::vector<size_t> {1, 3}));
+    EXPECT_EQ(result.result(2), run_alone(points[2]));
+}
+
+TEST_F(SweepRunnerTest, InconsistentInputsAreRejected) {
+    EXPECT_THROW(BioCro::run_sweep(spec, {{1, 2, 3}}, 1), std::invalid_argument);
+    EXPECT_THROW(BioCro::run_sweep(spec, {{1, 2}}, 0), std::invalid_argument);
+
+    spec.varied_parameters = {"mass", "bogus"};
+    EXPECT_THROW(BioCro::run_sweep(spec, {{1, 2}}, 1), std::invalid_argument);
+}
+
+// Times a sweep of a few hundred runs with 1, 2, 4, ... workers, up to
+// one per core.
+TEST_F(SweepRunnerTest, ScalingWithNumberOfWorkers) {
+    using clock = std::chrono::steady_clock;
+
+    set_number_of_timesteps(2000);
+    BioCro::Sweep_points points {grid(16)};
+    unsigned cores {std::max(2u, std::thread::hardware_concurrency())};
+
+    double one_worker_time {0};
+    for (unsigned workers {1};; workers = std::min(2 * workers, cores)) {
+        auto start = clock::now();
+        BioCro::Sweep_result result {BioCro::run_sweep(spec, points, workers)};
+        std::chrono::duration<double> elapsed {clock::now() - start};
+
+        EXPECT_TRUE(result.failed_runs().empty());
+        if (workers == 1) one_worker_time = elapsed.count();
+
+        if (VERBOSE) {
+            cout << points.size() << " runs with " << workers << " worker(s): "
+                 << elapsed.count() << " s (speedup "
+                 << one_worker_time / elapsed.count() << ")" << endl;
+        }
+        if (workers == cores) break;
+    }
+}
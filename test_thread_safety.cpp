@@ -0,0 +1,346 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests exercise the thread-safety guarantees set out in
+// thread_safety.h: module factories for two libraries are queried, and
+// thousands of simulations mixing modules from both are run, from many
+// threads at once, and every answer is compared with one computed on a
+// single thread.  Other tests show that the simulators of
+// safe_simulators.h refuse to be run concurrently with themselves
+// (Idempotent_simulator, Single_use_simulator) or run correctly when
+// they are (Alternate_idempotent_simulator).
+//
+// To check for data races, build with ThreadSanitizer:
+//
+//     make clean; make run_test_thread_safety SANITIZE=thread
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm> // for std::max
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "thread_safety.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+using Module_factory_2 = BioCro::Test_BioCro_library_module_factory;
+
+// Runs `task(thread_number)` on each of `number_of_threads` threads
+// and waits for all of them to finish.  The threads are held at a
+// starting line until all have been created so that their work
+// overlaps as much as possible.
+template <typename Task>
+void run_concurrently(unsigned number_of_threads, Task task) {
+    std::atomic<unsigned> ready {0};
+    std::vector<std::thread> threads;
+    for (unsigned n {0}; n < number_of_threads; ++n) {
+        threads.emplace_back([&, n]() {
+            ++ready;
+            while (ready < number_of_threads) std::this_thread::yield();
+            task(n);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+class ThreadSafetyTest : public ::testing::Test {
+   protected:
+    // One simulation configuration: the modules to use and the result
+    // of running them on a single thread.
+    struct Configuration {
+        BioCro::State initial_state;
+        BioCro::Parameter_set parameters;
+        BioCro::System_drivers drivers;
+        BioCro::Module_set direct_modules;
+        BioCro::Module_set differential_modules;
+        std::string solver;
+        BioCro::Simulation_result expected_result;
+    };
+
+    ThreadSafetyTest() {
+        BioCro::System_drivers temperature_drivers
+            { {"time", { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }},
+              {"temp", { 5, 8, 10, 15, 20, 20, 25, 30, 32, 40 }} };
+
+        // The two libraries' thermal_time_linear modules have the
+        // same name and quantities but give different results.
+        configurations.push_back(Configuration {
+            { {"TTc", 0} },
+            { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} },
+            temperature_drivers,
+            {},
+            { Module_factory::retrieve("thermal_time_linear") },
+            "homemade_euler",
+            {}});
+        configurations.push_back(Configuration {
+            { {"TTc", 0} },
+            { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} },
+            temperature_drivers,
+            {},
+            { Module_factory_2::retrieve("thermal_time_linear") },
+            "homemade_euler",
+            {}});
+        configurations.push_back(Configuration {
+            { {"position", 3}, {"velocity", -2} },
+            { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.1} },
+            { {"elapsed_time", { 0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9 }} },
+            { Module_factory::retrieve("harmonic_energy") },
+            { Module_factory::retrieve("harmonic_oscillator") },
+            "boost_rk4",
+            {}});
+
+        for (auto& c : configurations) {
+            c.expected_result = run(c);
+        }
+    }
+
+    static BioCro::Simulation_result run(Configuration const& c) {
+        BioCro::Simulator sim {
+            c.initial_state,
+            c.parameters,
+            c.drivers,
+            c.direct_modules,
+            c.differential_modules,
+            c.solver,
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        return sim.run_simulation();
+    }
+
+    BioCro::Idempotent_simulator get_idempotent_simulator(Configuration const& c) {
+        return BioCro::Idempotent_simulator {
+            c.initial_state,
+            c.parameters,
+            c.drivers,
+            c.direct_modules,
+            c.differential_modules,
+            c.solver,
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+
+    const unsigned number_of_threads {std::max(8u, std::thread::hardware_concurrency())};
+
+    std::vector<Configuration> configurations;
+};
+
+// Every factory query made concurrently gives the same answer as it
+// does on a single thread.
+TEST_F(ThreadSafetyTest, FactoriesCanBeQueriedConcurrently) {
+    const auto modules = Module_factory::get_all_modules();
+    const auto modules_2 = Module_factory_2::get_all_modules();
+    const auto quantities = Module_factory::get_all_quantities();
+    const auto quantities_2 = Module_factory_2::get_all_quantities();
+
+    std::atomic<int> mismatches {0};
+    run_concurrently(number_of_threads, [&](unsigned n) {
+        for (int i {0}; i < 50; ++i) {
+            // Alternate the order in which the libraries are queried.
+            if ((n + i) % 2 == 0) {
+                if (Module_factory::get_all_modules() != modules) ++mismatches;
+                if (Module_factory_2::get_all_quantities() != quantities_2) ++mismatches;
+            } else {
+                if (Module_factory_2::get_all_modules() != modules_2) ++mismatches;
+                if (Module_factory::get_all_quantities() != quantities) ++mismatches;
+            }
+            for (std::string const& name : modules) {
+                BioCro::Module_creator w {Module_factory::retrieve(name)};
+                if (w->get_name() != name) ++mismatches;
+            }
+            for (std::string const& name : modules_2) {
+                BioCro::Module_creator w {Module_factory_2::retrieve(name)};
+                if (w->get_name() != name) ++mismatches;
+            }
+        }
+    });
+
+    EXPECT_EQ(mismatches, 0);
+}
+
+// A single Module_creator can create and run modules on many threads
+// at once, each thread using its own inputs and outputs.
+TEST_F(ThreadSafetyTest, ModuleCreatorsCanBeShared) {
+    BioCro::Module_creator w {Module_factory::retrieve("harmonic_energy")};
+
+    std::atomic<int> mismatches {0};
+    run_concurrently(number_of_threads, [&](unsigned n) {
+        BioCro::Variable_settings inputs;
+        for (std::string const& name : w->get_inputs()) inputs[name] = n + 1;
+        BioCro::Variable_settings outputs;
+        for (std::string const& name : w->get_outputs()) outputs[name] = 0;
+
+        BioCro::Variable_settings first_outputs;
+        for (int i {0}; i < 200; ++i) {
+            auto module = w->create_module(inputs, &outputs);
+            module->run();
+            if (i == 0) {
+                first_outputs = outputs;
+            } else if (outputs != first_outputs) {
+                ++mismatches;
+            }
+        }
+    });
+
+    EXPECT_EQ(mismatches, 0);
+}
+
+// Thousands of simulations, mixing modules from both libraries and
+// sharing Module_sets, each run by its own Simulator, give exactly
+// the results they give when run one at a time.
+TEST_F(ThreadSafetyTest, ConcurrentSimulationsMatchSerialResults) {
+    using clock = std::chrono::steady_clock;
+    constexpr int runs_per_thread {250};
+
+    std::atomic<int> mismatches {0};
+    auto start = clock::now();
+    run_concurrently(number_of_threads, [&](unsigned n) {
+        for (int i {0}; i < runs_per_thread; ++i) {
+            Configuration const& c {configurations[(n + i) % configurations.size()]};
+            if (run(c) != c.expected_result) ++mismatches;
+        }
+    });
+    auto elapsed = clock::now() - start;
+
+    if (VERBOSE) {
+        using std::chrono::microseconds;
+        using std::chrono::duration_cast;
+        cout << number_of_threads * runs_per_thread << " simulations on "
+             << number_of_threads << " threads: "
+             << duration_cast<microseconds>(elapsed).count() << " us" << endl;
+    }
+
+    EXPECT_EQ(mismatches, 0);
+}
+
+TEST_F(ThreadSafetyTest, ExclusiveUseFlagRejectsSecondUser) {
+    BioCro::Exclusive_use_flag flag;
+    {
+        BioCro::Exclusive_use_flag::Guard guard {flag, "The object"};
+        EXPECT_TRUE(flag.is_in_use());
+
+        bool refused {false};
+        std::thread other {[&]() {
+            try {
+                BioCro::Exclusive_use_flag::Guard guard {flag, "The object"};
+            } catch (std::logic_error const&) {
+                refused = true;
+            }
+        }};
+        other.join();
+        EXPECT_TRUE(refused);
+
+        // The refused guard doesn't release the flag.
+        EXPECT_TRUE(flag.is_in_use());
+    }
+    EXPECT_FALSE(flag.is_in_use());
+
+    std::thread other {[&]() {
+        EXPECT_NO_THROW(BioCro::Exclusive_use_flag::Guard(flag, "The object"));
+    }};
+    other.join();
+}
+
+// An Idempotent_simulator run by several threads at once either runs
+// correctly or refuses to run; it never returns a wrong result.
+TEST_F(ThreadSafetyTest, IdempotentSimulatorRefusesConcurrentUse) {
+    constexpr int runs_per_thread {100};
+    Configuration const& c {configurations.back()};
+    auto sim = get_idempotent_simulator(c);
+
+    std::atomic<int> successes {0};
+    std::atomic<int> refusals {0};
+    std::atomic<int> mismatches {0};
+    run_concurrently(number_of_threads, [&](unsigned) {
+        for (int i {0}; i < runs_per_thread; ++i) {
+            try {
+                if (sim.run_simulation() != c.expected_result) ++mismatches;
+                ++successes;
+            } catch (std::logic_error const&) {
+                ++refusals;
+            }
+        }
+    });
+
+    if (VERBOSE) {
+        cout << successes << " runs completed, " << refusals << " refused" << endl;
+    }
+
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_GT(successes, 0);
+    EXPECT_EQ(successes + refusals, number_of_threads * runs_per_thread);
+}
+
+// Of several threads racing to run a Single_use_simulator, exactly
+// one succeeds.
+TEST_F(ThreadSafetyTest, SingleUseSimulatorRunsOnce) {
+    Configuration const& c {configurations.front()};
+    BioCro::Single_use_simulator sim {
+        c.initial_state,
+        c.parameters,
+        c.drivers,
+        c.direct_modules,
+        c.differential_modules,
+        c.solver,
+        1,
+        0.0001,
+        0.0001,
+        200
+    };
+
+    std::atomic<int> successes {0};
+    std::atomic<int> refusals {0};
+    run_concurrently(number_of_threads, [&](unsigned) {
+        try {
+            if (sim.run_simulation() == c.expected_result) ++successes;
+        } catch (std::runtime_error const&) {
+            ++refusals;
+        }
+    });
+
+    EXPECT_EQ(successes, 1);
+    EXPECT_EQ(refusals, number_of_threads - 1);
+}
+
+// An Alternate_idempotent_simulator makes a new Simulator for each
+// run, so all of the concurrent runs succeed.
+TEST_F(ThreadSafetyTest, AlternateIdempotentSimulatorCanBeShared) {
+    Configuration const& c {configurations[1]};
+    BioCro::Alternate_idempotent_simulator sim {
+        c.initial_state,
+        c.parameters,
+        c.drivers,
+        c.direct_modules,
+        c.differential_modules,
+        c.solver,
+        1,
+        0.0001,
+        0.0001,
+        200
+    };
+
+    std::atomic<int> mismatches {0};
+    run_concurrently(number_of_threads, [&](unsigned) {
+        for (int i {0}; i < 100; ++i) {
+            if (sim.run_simulation() != c.expected_result) ++mismatches;
+        }
+    });
+
+    EXPECT_EQ(mismatches, 0);
+}
@@ -0,0 +1,171 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the Vector_evaluator of vector_evaluation.h, which
+// evaluates a module over columns of inputs with the AVX2 or AVX-512
+// version of the module's vector kernel.  For each instruction set the
+// processor supports, they check the built-in kernels for
+// harmonic_oscillator and harmonic_energy against the results of the
+// modules' own `run()`, as test_module_evaluation.cpp does for single
+// points.  They also check that a module without a kernel, such as
+// solar_position_michalsky, falls back to `run()`, and that kernels not
+// matching their module are refused.  The last test times each way of
+// evaluating harmonic_energy over a grid of inputs.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "BioCro.h"
+#include "module_evaluator.h"
+#include "vector_evaluation.h"
+
+#include "Random.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class VectorEvaluationTest : public ::testing::Test {
+   protected:
+    Rand_double double_gen { -100, 100 };
+    Rand_double pos_double_gen { 1e-5, 100 };
+
+    // The instruction sets to test, from widest to narrowest
+    std::vector<BioCro::Simd_level> levels() {
+        std::vector<BioCro::Simd_level> result;
+        for (auto level : {BioCro::Simd_level::avx512, BioCro::Simd_level::avx2}) {
+            if (level <= BioCro::detected_simd_level()) result.push_back(level);
+        }
+        return result;
+    }
+
+    // Checks that evaluating the module with each instruction set
+    // gives the results of its `run()`.  The number of points isn't a
+    // multiple of the vector widths, so the remainder loops are
+    // checked too.
+    void expect_scalar_results(std::string const& module_name) {
+        BioCro::Module_creator w = Module_factory::retrieve(module_name);
+        BioCro::Variable_names varying {"position", "velocity", "mass"};
+        BioCro::Variable_settings fixed { {"spring_constant", 7} };
+
+        size_t const rows {1003};
+        std::vector<std::vector<double>> inputs(3), expected, outputs;
+        for (size_t j {0}; j < rows; ++j) {
+            inputs[0].push_back(double_gen());
+            inputs[1].push_back(double_gen());
+            inputs[2].push_back(pos_double_gen());
+        }
+        BioCro::Module_evaluator {w, varying, fixed}.evaluate(inputs, expected);
+
+        for (auto level : levels()) {
+            BioCro::Vector_evaluator evaluator {w, varying, fixed, level};
+            EXPECT_EQ(evaluator.level(), level);
+            evaluator.evaluate(inputs, outputs);
+            ASSERT_EQ(outputs.size(), expected.size());
+            for (size_t i {0}; i < outputs.size(); ++i) {
+                for (size_t j {0}; j < rows; ++j) {
+                    EXPECT_DOUBLE_EQ(outputs[i][j], expected[i][j])
+                        << module_name << " " << evaluator.output_names()[i] << " at point " << j
+                        << " with " << BioCro::to_string(level);
+                }
+            }
+        }
+    }
+};
+
+TEST_F(VectorEvaluationTest, KernelsMatchScalarResults) {
+    expect_scalar_results("harmonic_oscillator");
+    expect_scalar_results("harmonic_energy");
+}
+
+TEST_F(VectorEvaluationTest, ModulesWithoutKernelsFallBack) {
+    BioCro::Module_creator w = Module_factory::retrieve("solar_position_michalsky");
+    BioCro::Variable_settings fixed {
+        {"lat", 40.0932},
+        {"longitude", -88.20175},
+        {"time_zone_offset", -5},
+        {"year", 2023}};
+    BioCro::Vector_evaluator evaluator {w, {"time"}, fixed};
+    EXPECT_EQ(evaluator.level(), BioCro::Simd_level::none);
+
+    std::vector<std::vector<double>> times {{200, 200.25, 200.5}}, outputs, expected;
+    evaluator.evaluate(times, outputs);
+    BioCro::Module_evaluator {w, {"time"}, fixed}.evaluate(times, expected);
+    EXPECT_EQ(outputs, expected);
+
+    // Asking for no vector instructions uses `run()` as well.
+    BioCro::Vector_evaluator scalar {Module_factory::retrieve("harmonic_energy"),
+                                     {"position", "velocity", "mass", "spring_constant"}, {},
+                                     BioCro::Simd_level::none};
+    EXPECT_EQ(scalar.level(), BioCro::Simd_level::none);
+}
+
+TEST_F(VectorEvaluationTest, MismatchedKernelsAreRefused) {
+    // A kernel with harmonic_energy's inputs and outputs, made here so
+    // that the test doesn't depend on the built-in kernels.  It is
+    // refused for harmonic_oscillator whatever this processor can run.
+    BioCro::Module_creator energy = Module_factory::retrieve("harmonic_energy");
+    BioCro::Vector_kernel kernel {energy->get_inputs(), energy->get_outputs(),
+                                  [](size_t, double const* const*, double* const*) {},
+                                  nullptr};
+    BioCro::Module_creator w = Module_factory::retrieve("harmonic_oscillator");
+    for (auto level : {BioCro::Simd_level::none, BioCro::Simd_level::avx2, BioCro::Simd_level::avx512}) {
+        EXPECT_THROW((BioCro::Vector_evaluator {w, kernel, {"position", "velocity"},
+                                                { {"mass", 5}, {"spring_constant", 7} }, level}),
+                     std::logic_error);
+    }
+
+    // A module may have only one kernel.
+    BioCro::add_vector_kernel("test_vector_evaluation_module", kernel);
+    EXPECT_THROW(BioCro::add_vector_kernel("test_vector_evaluation_module", kernel),
+                 std::invalid_argument);
+}
+
+// Times the evaluation of harmonic_energy at 1,000,000 points with the
+// module's `run()` and with each instruction set.
+TEST_F(VectorEvaluationTest, EvaluationTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    BioCro::Module_creator w = Module_factory::retrieve("harmonic_energy");
+    BioCro::Variable_names varying {"position", "velocity"};
+    BioCro::Variable_settings fixed { {"mass", 5}, {"spring_constant", 7} };
+
+    size_t const rows {1000000};
+    std::vector<std::vector<double>> inputs(2, std::vector<double>(rows)), expected, outputs;
+    for (size_t j {0}; j < rows; ++j) {
+        inputs[0][j] = j * 1e-6;
+        inputs[1][j] = 1 - j * 1e-6;
+    }
+
+    auto start = clock::now();
+    BioCro::Module_evaluator {w, varying, fixed}.evaluate(inputs, expected);
+    auto scalar_time = clock::now() - start;
+    if (VERBOSE) {
+        cout << "widest instruction set: " << BioCro::to_string(BioCro::detected_simd_level()) << endl;
+        cout << "run(): " << duration_cast<microseconds>(scalar_time).count() << " us" << endl;
+    }
+
+    for (auto level : levels()) {
+        BioCro::Vector_evaluator evaluator {w, varying, fixed, level};
+        evaluator.evaluate(inputs, outputs);  // sizes the columns
+        start = clock::now();
+        evaluator.evaluate(inputs, outputs);
+        auto vector_time = clock::now() - start;
+
+        EXPECT_EQ(outputs, expected);
+        if (VERBOSE) {
+            cout << BioCro::to_string(level) << ": "
+                 << duration_cast<microseconds>(vector_time).count() << " us ("
+                 << static_cast<double>(scalar_time.count()) / vector_time.count()
+                 << " times as fast)" << endl;
+        }
+    }
+}
@@ -0,0 +1,223 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+//
+// These tests cover the spin-up library of warm_start.h.  They check
+// that a run continued from a snapshot matches a full run, that the
+// latest usable snapshot is the one used, that snapshots are not used
+// for a different model or for drivers that differ before the
+// snapshot, and that snapshots written to a directory are found by a
+// new library.  The last test compares the time needed for a set of
+// runs sharing a spin-up period with and without warm starts.
+
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>       // for std::abs
+#include <cstdio>      // for std::remove
+#include <iostream>
+
+#include <dirent.h>    // for opendir, readdir
+#include <sys/stat.h>  // for mkdir
+#include <unistd.h>    // for rmdir
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "warm_start.h"
+
+using std::cout;
+using std::endl;
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class WarmStartTest : public ::testing::Test {
+   protected:
+    WarmStartTest() {
+        std::vector<double> times;
+        for (size_t i {0}; i < rows; ++i) {
+            times.push_back(i * 0.01);
+        }
+        spec.drivers = { {"elapsed_time", times} };
+    }
+
+    BioCro::Simulation_result full_run() {
+        return BioCro::Idempotent_simulator {
+            spec.initial_state, spec.parameters, spec.drivers,
+            spec.direct_modules, spec.differential_modules,
+            spec.ode_solver_name, spec.output_step_size,
+            spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+            spec.adaptive_max_steps}.run_simulation();
+    }
+
+    // Checks that `run` holds the rows of `full` from its first row on.
+    void expect_rows_match(BioCro::Warm_start_run const& run,
+                           BioCro::Simulation_result const& full) {
+        for (auto const& item : full) {
+            auto const& column = run.result.at(item.first);
+            ASSERT_EQ(column.size(), rows - run.first_row) << item.first;
+            for (size_t i {0}; i < column.size(); ++i) {
+                ASSERT_NEAR(column[i], item.second[run.first_row + i],
+                            1e-9 * (1 + std::abs(item.second[run.first_row + i])))
+                    << item.first << " " << run.first_row + i;
+            }
+        }
+    }
+
+    size_t const rows {1001};
+
+    BioCro::Sweep_specification spec {
+        { {"position", 3}, {"velocity", -2} },
+        { {"mass", 5}, {"spring_constant", 7}, {"timestep", 0.01} },
+        {},
+        { Module_factory::retrieve("harmonic_energy") },
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200,
+        {},
+        {}
+    };
+
+    BioCro::Spin_up_key key {"site_a", "weather_2020"};
+};
+
+TEST_F(WarmStartTest, ContinuedRunMatchesFullRun) {
+    BioCro::Simulation_result full {full_run()};
+    BioCro::Warm_start_library library;
+
+    // A cold run that saves snapshots as it goes
+    auto cold = BioCro::run_with_warm_start(library, key, spec, 0, {250, 400});
+    EXPECT_FALSE(cold.warm);
+    EXPECT_EQ(cold.rows_integrated, rows - 1);
+    EXPECT_EQ(library.size(), 2u);
+    expect_rows_match(cold, full);
+
+    // A run wanting rows from 500 on starts from row 400.
+    auto warm = BioCro::run_with_warm_start(library, key, spec, 500);
+    EXPECT_TRUE(warm.warm);
+    EXPECT_EQ(warm.start_row, 400u);
+    EXPECT_EQ(warm.rows_integrated, rows - 1 - 400);
+    expect_rows_match(warm, full);
+
+    // Starting exactly at a snapshot
+    auto exact = BioCro::run_with_warm_start(library, key, spec, 250);
+    EXPECT_EQ(exact.start_row, 250u);
+    expect_rows_match(exact, full);
+}
+
+TEST_F(WarmStartTest, LatestUsableSnapshotIsUsed) {
+    BioCro::Warm_start_library library;
+    BioCro::run_with_warm_start(library, key, spec, 0, {100, 300, 600});
+    EXPECT_EQ(library.size(), 3u);
+
+    EXPECT_EQ(BioCro::run_with_warm_start(library, key, spec, 450).start_row, 300u);
+    EXPECT_EQ(BioCro::run_with_warm_start(library, key, spec, 99).start_row, 0u);
+    EXPECT_EQ(BioCro::run_with_warm_start(library, key, spec, 999).start_row, 600u);
+
+    // A different site has no snapshots.
+    BioCro::Spin_up_key other_site {"site_b", "weather_2020"};
+    EXPECT_FALSE(BioCro::run_with_warm_start(library, other_site, spec, 450).warm);
+}
+
+// Snapshots are not used for another model, nor for drivers that
+// differ before the snapshot.
+TEST_F(WarmStartTest, MismatchedSnapshotsAreNotUsed) {
+    BioCro::Warm_start_library library;
+    BioCro::run_with_warm_start(library, key, spec, 0, {200, 700});
+
+    auto changed_model = spec;
+    changed_model.parameters["mass"] = 6;
+    EXPECT_FALSE(BioCro::run_with_warm_start(library, key, changed_model, 800).warm);
+
+    // Drivers that differ between rows 200 and 700 can use only the
+    // snapshot at row 200.
+    auto changed_weather = spec;
+    changed_weather.drivers["elapsed_time"][500] += 1e-9;
+    auto run = BioCro::run_with_warm_start(library, key, changed_weather, 800);
+    EXPECT_TRUE(run.warm);
+    EXPECT_EQ(run.start_row, 200u);
+
+    EXPECT_THROW(BioCro::run_with_warm_start(library, key, spec, rows), std::out_of_range);
+
+    // Rows of the result must be rows of the drivers.
+    auto strided = spec;
+    strided.output_step_size = 2;
+    EXPECT_THROW(BioCro::run_with_warm_start(library, key, strided, 800),
+                 std::invalid_argument);
+}
+
+// A snapshot can be saved at the last row, and a run wanting only that
+// row then integrates nothing.
+TEST_F(WarmStartTest, FinalStateCanBeSaved) {
+    BioCro::Warm_start_library library;
+    BioCro::run_with_warm_start(library, key, spec, 0, {500, rows - 1});
+    EXPECT_EQ(library.size(), 2u);
+
+    auto run = BioCro::run_with_warm_start(library, key, spec, rows - 1);
+    EXPECT_TRUE(run.warm);
+    EXPECT_EQ(run.start_row, rows - 1);
+    EXPECT_EQ(run.rows_integrated, 0u);
+    expect_rows_match(run, full_run());
+}
+
+// Snapshots written to a directory are loaded by a later library, and
+// used if it is for the same version of the modules.
+TEST_F(WarmStartTest, SnapshotsPersistInADirectory) {
+    std::string directory {::testing::TempDir() + "test_warm_start_files"};
+    ::mkdir(directory.c_str(), 0700);
+
+    {
+        BioCro::Warm_start_library library {directory};
+        BioCro::run_with_warm_start(library, key, spec, 0, {300});
+    }
+
+    BioCro::Warm_start_library reloaded {directory};
+    EXPECT_EQ(reloaded.size(), 1u);
+    auto run = BioCro::run_with_warm_start(reloaded, key, spec, 500);
+    EXPECT_TRUE(run.warm);
+    EXPECT_EQ(run.start_row, 300u);
+    expect_rows_match(run, full_run());
+
+    // Snapshots saved by another build of the modules aren't used.
+    BioCro::Warm_start_library rebuilt {directory, "rebuilt"};
+    EXPECT_FALSE(BioCro::run_with_warm_start(rebuilt, key, spec, 500).warm);
+
+    // Clean up.
+    if (DIR* d = ::opendir(directory.c_str())) {
+        while (dirent* entry = ::readdir(d)) {
+            std::string name {entry->d_name};
+            if (name != "." && name != "..") std::remove((directory + "/" + name).c_str());
+        }
+        ::closedir(d);
+    }
+    ::rmdir(directory.c_str());
+}
+
+// Times 20 runs that want only their last 100 rows, with and without
+// a snapshot at row 900.
+TEST_F(WarmStartTest, SharedSpinUpTime) {
+    using clock = std::chrono::steady_clock;
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto start = clock::now();
+    for (int i {0}; i < 20; ++i) full_run();
+    auto cold_time = clock::now() - start;
+
+    BioCro::Warm_start_library library;
+    start = clock::now();
+    for (int i {0}; i < 20; ++i) {
+        auto run = BioCro::run_with_warm_start(library, key, spec, 900, {900});
+        EXPECT_EQ(run.warm, i > 0);
+    }
+    auto warm_time = clock::now() - start;
+
+    if (VERBOSE) {
+        cout << "full runs: " << duration_cast<microseconds>(cold_time).count() << " us" << endl;
+        cout << "warm-started runs: " << duration_cast<microseconds>(warm_time).count() << " us" << endl;
+    }
+}
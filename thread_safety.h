@@ -0,0 +1,145 @@
+/**
+ *  Thread-safety guarantees for the BioCro interface, and a means of
+ *  enforcing them.
+ *
+ *  What may be shared between threads:
+ *
+ *  - The module factories.  `retrieve`, `get_all_modules`, and
+ *    `get_all_quantities` only read a library's table of module
+ *    creators, which is filled in during static initialization and
+ *    never changed afterward, so they may be called concurrently,
+ *    for any mix of libraries (for example,
+ *    Standard_BioCro_library_module_factory and
+ *    Test_BioCro_library_module_factory).
+ *
+ *  - Module_creator pointers, and Module_sets made of them.  Each
+ *    pointer refers to a single static creator object with no
+ *    mutable state; `get_inputs`, `get_outputs`, `get_name`, and
+ *    `create_module` may be called on it from any number of threads,
+ *    and any number of Simulators may be made from the same
+ *    Module_set.
+ *
+ *  - The input objects (State, Parameter_set, System_drivers,
+ *    Module_set) passed to a Simulator or dynamical-system
+ *    constructor, so long as no thread modifies them while they are
+ *    shared.  The constructors copy what they need.
+ *
+ *  What may not be shared:
+ *
+ *  - A Simulator, a Dynamical_system, a Solver, or a Module.  These
+ *    hold the current values of the system's quantities and change
+ *    them as they run, so each must be used by one thread at a time.
+ *    (A batch worker should make its own.)  Idempotent_simulator
+ *    (safe_simulators.h) enforces this, throwing std::logic_error
+ *    rather than running concurrently with itself; a
+ *    Single_use_simulator throws std::runtime_error if it is run a
+ *    second time, from any thread.  Alternate_idempotent_simulator
+ *    makes a new Simulator for each run and so may be run from
+ *    several threads at once.
+ *
+ *  - Arenas and the results and states allocated from them
+ *    (arena.h).
+ *
+ *  test_thread_safety.cpp exercises these guarantees; building it
+ *  with `make test_thread_safety SANITIZE=thread` checks them with
+ *  ThreadSanitizer.
+ */
+#ifndef THREAD_SAFETY_H
+#define THREAD_SAFETY_H
+
+#include <atomic>
+#include <exception>    // for std::exception_ptr
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace BioCro {
+
+    /**
+     * Marks an object that must not be used by two threads at once.
+     * A member function that must have the object to itself holds an
+     * Exclusive_use_flag::Guard for its duration; constructing the
+     * guard throws std::logic_error if another guard on the same flag
+     * is still alive.
+     *
+     * Copying or moving the object owning the flag gives the copy a
+     * flag of its own, which is not in use.
+     */
+    class Exclusive_use_flag
+    {
+       public:
+        Exclusive_use_flag() = default;
+        Exclusive_use_flag(Exclusive_use_flag const&) {}
+        Exclusive_use_flag& operator=(Exclusive_use_flag const&) { return *this; }
+
+        bool is_in_use() const { return in_use.load(std::memory_order_acquire); }
+
+        class Guard
+        {
+           public:
+            Guard(Exclusive_use_flag& flag, std::string const& object_description)
+                : flag{flag}
+            {
+                if (flag.in_use.exchange(true, std::memory_order_acquire)) {
+                    throw std::logic_error(
+                        object_description + " was used by two threads at once.  "
+                        "Each thread must have its own.");
+                }
+            }
+
+            Guard(Guard const&) = delete;
+            Guard& operator=(Guard const&) = delete;
+
+            ~Guard() { flag.in_use.store(false, std::memory_order_release); }
+
+           private:
+            Exclusive_use_flag& flag;
+        };
+
+       private:
+        std::atomic<bool> in_use {false};
+    };
+
+    /**
+     * Calls `work()` on `number_of_threads` threads, one of them the
+     * calling thread, and returns once every call has returned.
+     * `work` is expected to take its tasks from a shared queue, so if
+     * a thread can't be started the others simply do its share.  If
+     * any call throws, the remaining calls are still waited for and
+     * the first exception is then rethrown on the calling thread.
+     * (An exception escaping a std::thread, or a std::thread left
+     * unjoined, would otherwise terminate the program.)
+     */
+    template <typename Work>
+    void run_on_threads(unsigned number_of_threads, Work const& work)
+    {
+        std::mutex mutex;
+        std::exception_ptr first_error;
+        auto guarded_work = [&]() {
+            try {
+                work();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock {mutex};
+                if (!first_error) first_error = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        try {
+            for (unsigned t {1}; t < number_of_threads; ++t) {
+                threads.emplace_back(guarded_work);
+            }
+        } catch (std::system_error const&) {
+            // Carry on with the threads we have.
+        }
+        guarded_work();
+        for (auto& thread : threads) thread.join();
+
+        if (first_error) std::rethrow_exception(first_error);
+    }
+}
+
+#endif
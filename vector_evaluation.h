@@ -0,0 +1,425 @@
+/**
+ *  Evaluating modules over input grids with SIMD instructions.
+ *
+ *  A Module_evaluator (module_evaluator.h) runs its module once per
+ *  point.  For a module whose calculation is simple arithmetic, such
+ *  as harmonic_oscillator or harmonic_energy, the same calculation can
+ *  be done for four or eight points at once with AVX2 or AVX-512
+ *  instructions.  A Vector_kernel holds such versions of a module's
+ *  calculation, written by the module's author, and a Vector_evaluator
+ *  uses the widest one the processor supports, as found when the
+ *  program runs.  A module with no kernel, or a processor supporting
+ *  none of a kernel's versions, falls back to a Module_evaluator
+ *  running the module's own `run()`.
+ *
+ *  A kernel function has the form
+ *
+ *      void kernel(size_t rows, double const* const* inputs, double* const* outputs);
+ *
+ *  where `inputs[i][j]` is the value at point j of the kernel's i-th
+ *  input and `outputs[i][j]` receives that of its i-th output.  It
+ *  must give the results the module would (for a differential module,
+ *  starting from outputs set to zero).  Kernels are registered by
+ *  module name with `add_vector_kernel`, before any evaluator for the
+ *  module is made; kernels for harmonic_oscillator and harmonic_energy
+ *  are built in.
+ *
+ *  Kernels are compiled for their instruction sets with the `target`
+ *  attribute of GCC and Clang, so no special compiler flags are
+ *  needed, and are never run on a processor lacking them.  On other
+ *  compilers or processors, every module uses the fallback.
+ *
+ *  A Vector_evaluator must be used by one thread at a time; it throws
+ *  std::logic_error if it is used by two at once.  Kernels may be
+ *  registered from any thread.
+ */
+#ifndef VECTOR_EVALUATION_H
+#define VECTOR_EVALUATION_H
+
+#include <algorithm> // for std::find, std::is_permutation
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>   // for std::move
+#include <vector>
+
+#include "BioCro.h"
+#include "module_evaluator.h"
+#include "thread_safety.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define BIOCRO_VECTOR_KERNELS 1
+#include <immintrin.h>
+#else
+#define BIOCRO_VECTOR_KERNELS 0
+#endif
+
+namespace BioCro {
+
+    enum class Simd_level {none, avx2, avx512};
+
+    inline std::string to_string(Simd_level level)
+    {
+        switch (level) {
+            case Simd_level::avx2: return "AVX2";
+            case Simd_level::avx512: return "AVX-512";
+            default: return "none";
+        }
+    }
+
+    // The widest instruction set this processor supports.
+    inline Simd_level detected_simd_level()
+    {
+#if BIOCRO_VECTOR_KERNELS
+        static Simd_level const level {__builtin_cpu_supports("avx512f") ? Simd_level::avx512
+                                       : __builtin_cpu_supports("avx2")  ? Simd_level::avx2
+                                                                         : Simd_level::none};
+        return level;
+#else
+        return Simd_level::none;
+#endif
+    }
+
+    struct Vector_kernel {
+        using Function = void (*)(size_t rows, double const* const* inputs, double* const* outputs);
+
+        // The module's inputs and outputs, in the order of the
+        // kernel's columns
+        Variable_names inputs;
+        Variable_names outputs;
+
+        // Null where there is no version for that instruction set
+        Function avx2 {nullptr};
+        Function avx512 {nullptr};
+
+        Function for_level(Simd_level level) const
+        {
+            return level == Simd_level::avx512 ? avx512 : level == Simd_level::avx2 ? avx2 : nullptr;
+        }
+    };
+
+    namespace vector_detail {
+
+#if BIOCRO_VECTOR_KERNELS
+        // harmonic_oscillator: d(position)/dt = velocity,
+        // d(velocity)/dt = -spring_constant * position / mass
+
+        __attribute__((target("avx2")))
+        inline void harmonic_oscillator_avx2(size_t rows, double const* const* in, double* const* out)
+        {
+            size_t j {0};
+            __m256d const minus_one {_mm256_set1_pd(-1)};
+            for (; j + 4 <= rows; j += 4) {
+                __m256d x {_mm256_loadu_pd(in[0] + j)}, v {_mm256_loadu_pd(in[1] + j)};
+                __m256d m {_mm256_loadu_pd(in[2] + j)}, k {_mm256_loadu_pd(in[3] + j)};
+                _mm256_storeu_pd(out[0] + j, v);
+                _mm256_storeu_pd(out[1] + j, _mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(minus_one, k), x), m));
+            }
+            for (; j < rows; ++j) {
+                out[0][j] = in[1][j];
+                out[1][j] = -in[3][j] * in[0][j] / in[2][j];
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline void harmonic_oscillator_avx512(size_t rows, double const* const* in, double* const* out)
+        {
+            size_t j {0};
+            __m512d const minus_one {_mm512_set1_pd(-1)};
+            for (; j + 8 <= rows; j += 8) {
+                __m512d x {_mm512_loadu_pd(in[0] + j)}, v {_mm512_loadu_pd(in[1] + j)};
+                __m512d m {_mm512_loadu_pd(in[2] + j)}, k {_mm512_loadu_pd(in[3] + j)};
+                _mm512_storeu_pd(out[0] + j, v);
+                _mm512_storeu_pd(out[1] + j, _mm512_div_pd(_mm512_mul_pd(_mm512_mul_pd(minus_one, k), x), m));
+            }
+            for (; j < rows; ++j) {
+                out[0][j] = in[1][j];
+                out[1][j] = -in[3][j] * in[0][j] / in[2][j];
+            }
+        }
+
+        // harmonic_energy: kinetic_energy = mass * velocity^2 / 2,
+        // spring_energy = spring_constant * position^2 / 2, and their
+        // sum
+
+        __attribute__((target("avx2")))
+        inline void harmonic_energy_avx2(size_t rows, double const* const* in, double* const* out)
+        {
+            size_t j {0};
+            __m256d const half {_mm256_set1_pd(0.5)};
+            for (; j + 4 <= rows; j += 4) {
+                __m256d x {_mm256_loadu_pd(in[0] + j)}, v {_mm256_loadu_pd(in[1] + j)};
+                __m256d m {_mm256_loadu_pd(in[2] + j)}, k {_mm256_loadu_pd(in[3] + j)};
+                __m256d ke {_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(half, m), v), v)};
+                __m256d se {_mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(half, k), x), x)};
+                _mm256_storeu_pd(out[0] + j, ke);
+                _mm256_storeu_pd(out[1] + j, se);
+                _mm256_storeu_pd(out[2] + j, _mm256_add_pd(ke, se));
+            }
+            for (; j < rows; ++j) {
+                double ke {0.5 * in[2][j] * in[1][j] * in[1][j]};
+                double se {0.5 * in[3][j] * in[0][j] * in[0][j]};
+                out[0][j] = ke;
+                out[1][j] = se;
+                out[2][j] = ke + se;
+            }
+        }
+
+        __attribute__((target("avx512f")))
+        inline void harmonic_energy_avx512(size_t rows, double const* const* in, double* const* out)
+        {
+            size_t j {0};
+            __m512d const half {_mm512_set1_pd(0.5)};
+            for (; j + 8 <= rows; j += 8) {
+                __m512d x {_mm512_loadu_pd(in[0] + j)}, v {_mm512_loadu_pd(in[1] + j)};
+                __m512d m {_mm512_loadu_pd(in[2] + j)}, k {_mm512_loadu_pd(in[3] + j)};
+                __m512d ke {_mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(half, m), v), v)};
+                __m512d se {_mm512_mul_pd(_mm512_mul_pd(_mm512_mul_pd(half, k), x), x)};
+                _mm512_storeu_pd(out[0] + j, ke);
+                _mm512_storeu_pd(out[1] + j, se);
+                _mm512_storeu_pd(out[2] + j, _mm512_add_pd(ke, se));
+            }
+            for (; j < rows; ++j) {
+                double ke {0.5 * in[2][j] * in[1][j] * in[1][j]};
+                double se {0.5 * in[3][j] * in[0][j] * in[0][j]};
+                out[0][j] = ke;
+                out[1][j] = se;
+                out[2][j] = ke + se;
+            }
+        }
+#endif
+
+        inline std::map<std::string, Vector_kernel> built_in_kernels()
+        {
+#if BIOCRO_VECTOR_KERNELS
+            return {
+                {"harmonic_oscillator",
+                 {{"position", "velocity", "mass", "spring_constant"},
+                  {"position", "velocity"},
+                  harmonic_oscillator_avx2,
+                  harmonic_oscillator_avx512}},
+                {"harmonic_energy",
+                 {{"position", "velocity", "mass", "spring_constant"},
+                  {"kinetic_energy", "spring_energy", "total_energy"},
+                  harmonic_energy_avx2,
+                  harmonic_energy_avx512}}};
+#else
+            return {};
+#endif
+        }
+
+        struct Kernel_table {
+            std::mutex mutex;
+            std::map<std::string, Vector_kernel> kernels {built_in_kernels()};
+        };
+
+        inline Kernel_table& kernel_table()
+        {
+            static Kernel_table table;
+            return table;
+        }
+
+        inline bool same_names(Variable_names const& a, Variable_names const& b)
+        {
+            return a.size() == b.size() && std::is_permutation(a.begin(), a.end(), b.begin());
+        }
+    }
+
+    // Registers the kernel for the module of that name, throwing
+    // std::invalid_argument if there already is one.
+    inline void add_vector_kernel(std::string const& module_name, Vector_kernel kernel)
+    {
+        auto& table = vector_detail::kernel_table();
+        std::lock_guard<std::mutex> lock {table.mutex};
+        if (!table.kernels.emplace(module_name, std::move(kernel)).second) {
+            throw std::invalid_argument(
+                "\"" + module_name + "\" was given as a module name for a vector kernel, "
+                "but that module already has one.\n");
+        }
+    }
+
+    // Whether the module of that name has a kernel; if so, it is
+    // copied to `kernel`.
+    inline bool find_vector_kernel(std::string const& module_name, Vector_kernel& kernel)
+    {
+        auto& table = vector_detail::kernel_table();
+        std::lock_guard<std::mutex> lock {table.mutex};
+        auto found = table.kernels.find(module_name);
+        if (found == table.kernels.end()) return false;
+        kernel = found->second;
+        return true;
+    }
+
+    /**
+     * Evaluates a module over columns of inputs as a Module_evaluator
+     * does, using the module's vector kernel where possible.  The
+     * widest kernel version no wider than `max_level` that the
+     * processor supports is used.
+     */
+    class Vector_evaluator
+    {
+       public:
+        Vector_evaluator(Module_creator creator,
+                         Variable_names varying_inputs,
+                         Variable_settings const& fixed_inputs = {},
+                         Simd_level max_level = Simd_level::avx512)
+            : Vector_evaluator{creator, registered_kernel(creator),
+                               std::move(varying_inputs), fixed_inputs, max_level}
+        {
+        }
+
+        // Uses the given kernel rather than a registered one.
+        Vector_evaluator(Module_creator creator,
+                         Vector_kernel const& kernel,
+                         Variable_names varying_inputs,
+                         Variable_settings const& fixed_inputs = {},
+                         Simd_level max_level = Simd_level::avx512)
+            : scalar{creator, std::move(varying_inputs), fixed_inputs}
+        {
+            // A kernel is checked even if this processor can't run it.
+            bool const has_kernel {kernel.avx2 || kernel.avx512};
+            if (has_kernel && (!vector_detail::same_names(kernel.inputs, creator->get_inputs()) ||
+                               !vector_detail::same_names(kernel.outputs, creator->get_outputs())))
+            {
+                throw std::logic_error(
+                    "The vector kernel for the \"" + creator->get_name() + "\" module doesn't "
+                    "have the module's inputs and outputs.\n");
+            }
+
+            Simd_level const available {std::min(max_level, detected_simd_level())};
+            for (Simd_level level : {Simd_level::avx512, Simd_level::avx2}) {
+                if (level <= available && kernel.for_level(level)) {
+                    function = kernel.for_level(level);
+                    kernel_level = level;
+                    break;
+                }
+            }
+            if (!function) return;
+
+            // Each kernel input is either a varying input, given by the
+            // caller, or a fixed one, repeated in a column here.
+            Variable_names const& varying = scalar.input_names();
+            for (auto const& name : kernel.inputs) {
+                auto position = std::find(varying.begin(), varying.end(), name);
+                if (position != varying.end()) {
+                    input_sources.push_back(position - varying.begin());
+                }
+                else {
+                    input_sources.push_back(-1 - static_cast<long>(fixed_values.size()));
+                    fixed_values.push_back(fixed_inputs.at(name));
+                }
+            }
+            Variable_names const& outputs = scalar.output_names();
+            for (auto const& name : kernel.outputs) {
+                output_sources.push_back(std::find(outputs.begin(), outputs.end(), name) - outputs.begin());
+            }
+            fixed_columns.resize(fixed_values.size());
+            input_pointers.resize(kernel.inputs.size());
+            output_pointers.resize(kernel.outputs.size());
+        }
+
+        Vector_evaluator(Vector_evaluator const&) = delete;
+        Vector_evaluator& operator=(Vector_evaluator const&) = delete;
+
+        // The instruction set used, or Simd_level::none if the
+        // module's `run()` is used.
+        Simd_level level() const { return kernel_level; }
+
+        Variable_names const& input_names() const { return scalar.input_names(); }
+        Variable_names const& output_names() const { return scalar.output_names(); }
+
+        // As Module_evaluator::evaluate
+        void evaluate(size_t rows, double const* const* input_columns, double* const* output_columns)
+        {
+            if (!function) {
+                scalar.evaluate(rows, input_columns, output_columns);
+                return;
+            }
+            Exclusive_use_flag::Guard guard {in_use, "A Vector_evaluator"};
+            run_kernel(rows, input_columns, output_columns);
+        }
+
+        void evaluate(std::vector<std::vector<double>> const& input_columns,
+                      std::vector<std::vector<double>>& output_columns)
+        {
+            if (!function) {
+                scalar.evaluate(input_columns, output_columns);
+                return;
+            }
+            Exclusive_use_flag::Guard guard {in_use, "A Vector_evaluator"};
+            if (input_columns.size() != input_names().size()) {
+                throw std::invalid_argument(
+                    std::to_string(input_columns.size()) + " input columns were given, but " +
+                    std::to_string(input_names().size()) + " inputs are varied.\n");
+            }
+            size_t const rows {input_columns.empty() ? 0 : input_columns[0].size()};
+            caller_inputs.clear();
+            caller_outputs.clear();
+            for (size_t i {0}; i < input_columns.size(); ++i) {
+                if (input_columns[i].size() != rows) {
+                    throw std::invalid_argument(
+                        "The column for \"" + input_names()[i] + "\" has " +
+                        std::to_string(input_columns[i].size()) + " values, but the first has " +
+                        std::to_string(rows) + ".\n");
+                }
+                caller_inputs.push_back(input_columns[i].data());
+            }
+            output_columns.resize(output_names().size());
+            for (auto& column : output_columns) {
+                column.resize(rows);
+                caller_outputs.push_back(column.data());
+            }
+            run_kernel(rows, caller_inputs.data(), caller_outputs.data());
+        }
+
+       private:
+        Module_evaluator scalar;
+        Vector_kernel::Function function {nullptr};
+        Simd_level kernel_level {Simd_level::none};
+
+        // For each kernel input, the index of the caller's column
+        // (if at least 0) or -1 - the index of the fixed column
+        std::vector<long> input_sources;
+        std::vector<size_t> output_sources;
+        std::vector<double> fixed_values;
+        std::vector<std::vector<double>> fixed_columns;
+        size_t fixed_rows {0};
+
+        std::vector<double const*> input_pointers;
+        std::vector<double*> output_pointers;
+        std::vector<double const*> caller_inputs;
+        std::vector<double*> caller_outputs;
+        Exclusive_use_flag in_use;
+
+        void run_kernel(size_t rows, double const* const* input_columns, double* const* output_columns)
+        {
+            // Fixed-input columns only grow, so batches no larger than
+            // an earlier one need no allocation.
+            if (rows > fixed_rows) {
+                for (size_t i {0}; i < fixed_columns.size(); ++i) {
+                    fixed_columns[i].assign(rows, fixed_values[i]);
+                }
+                fixed_rows = rows;
+            }
+            for (size_t i {0}; i < input_sources.size(); ++i) {
+                long source {input_sources[i]};
+                input_pointers[i] = source >= 0 ? input_columns[source]
+                                                : fixed_columns[-1 - source].data();
+            }
+            for (size_t i {0}; i < output_sources.size(); ++i) {
+                output_pointers[i] = output_columns[output_sources[i]];
+            }
+            function(rows, input_pointers.data(), output_pointers.data());
+        }
+
+        static Vector_kernel registered_kernel(Module_creator creator)
+        {
+            Vector_kernel kernel;
+            find_vector_kernel(creator->get_name(), kernel);
+            return kernel;
+        }
+    };
+}
+
+#endif
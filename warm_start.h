@@ -0,0 +1,387 @@
+/**
+ *  A library of spin-up states, so that runs sharing the start of a
+ *  simulation (the same site, model, and weather up to some date) need
+ *  not each integrate it.
+ *
+ *  A Snapshot holds the values of the differential quantities at one
+ *  row of the drivers.  That is all that is needed to continue: a
+ *  system made with those values as its initial state and the drivers
+ *  from that row on takes up where the original left off (compare the
+ *  StartWhereWeLeftOff test of test_dynamical_system.cpp).
+ *
+ *  A Warm_start_library holds snapshots under a Spin_up_key, naming
+ *  the site and weather, together with a digest of everything else
+ *  that determines the state (initial state, parameters, modules, and
+ *  solver settings; see simulation_cache.h) and the library's model
+ *  version, which, as for a Simulation_cache, should name the build of
+ *  the module libraries; without one, the directory must be cleared
+ *  whenever they are rebuilt.  Each snapshot also
+ *  records a fingerprint of the drivers up to its row, and is used only
+ *  for runs whose drivers match it that far, so that a weather name
+ *  reused for different data does no harm.  If a directory is given,
+ *  each snapshot is also written there, and the snapshots found there
+ *  are loaded when the library is made.
+ *
+ *  `run_with_warm_start` starts from the latest usable snapshot not
+ *  beyond the first row wanted, integrates only the rest, and saves
+ *  snapshots at any requested rows it passes.  With a fixed-step
+ *  solver the result matches that of a full run to within rounding;
+ *  with an adaptive solver, to within the solver's tolerances, since
+ *  the steps taken may differ.
+ */
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include <algorithm> // for std::sort, std::unique, std::binary_search
+#include <atomic>
+#include <cstdint>
+#include <cstdio>    // for std::rename, std::remove
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dirent.h>  // for opendir, readdir
+#include <unistd.h>  // for getpid
+
+#include "BioCro_Extended.h"
+#include "safe_simulators.h"
+#include "simulation_cache.h"
+#include "sweep_runner.h"
+
+namespace BioCro {
+
+    struct Spin_up_key {
+        std::string site;
+        std::string weather;
+    };
+
+    struct Snapshot {
+        size_t driver_row;
+        Cache_key drivers_prefix;  // fingerprint of driver rows 0 to driver_row
+        State differential_quantities;
+    };
+
+    // The rows `first` through `last` of the drivers.
+    inline System_drivers driver_rows(System_drivers const& drivers, size_t first, size_t last)
+    {
+        System_drivers rows;
+        for (auto const& item : drivers) {
+            if (last >= item.second.size() || first > last) {
+                throw std::out_of_range(
+                    "Rows " + std::to_string(first) + " to " + std::to_string(last) +
+                    " were requested, but \"" + item.first + "\" has " +
+                    std::to_string(item.second.size()) + " rows.\n");
+            }
+            rows[item.first] = std::vector<double>(item.second.begin() + first,
+                                                   item.second.begin() + last + 1);
+        }
+        return rows;
+    }
+
+    // A digest of what, besides the drivers, determines the state of a
+    // run made by the given version of the module libraries.
+    inline Cache_key spin_up_model_key(Sweep_specification const& spec,
+                                       std::string const& model_version = "")
+    {
+        return Key_builder{}
+            .add(model_version)
+            .add(spec.initial_state)
+            .add(spec.parameters)
+            .add(spec.direct_modules)
+            .add(spec.differential_modules)
+            .add(spec.ode_solver_name)
+            .add(spec.output_step_size)
+            .add(spec.adaptive_rel_error_tol)
+            .add(spec.adaptive_abs_error_tol)
+            .add(static_cast<std::uint64_t>(spec.adaptive_max_steps))
+            .key();
+    }
+
+    class Warm_start_library
+    {
+       public:
+        /**
+         * Makes a library kept only in memory or, if `directory` isn't
+         * empty, also in files there.  The directory must already
+         * exist; the snapshots already in it are loaded, but only those
+         * saved with the same `model_version` are used.
+         */
+        explicit Warm_start_library(std::string directory = "",
+                                    std::string model_version = "")
+            : directory{directory}, version{model_version}
+        {
+            if (this->directory.empty()) return;
+            if (this->directory.back() != '/') this->directory += '/';
+
+            DIR* d {::opendir(this->directory.c_str())};
+            if (!d) {
+                throw std::runtime_error(
+                    "Warm_start_library: can't open directory \"" + this->directory + "\".");
+            }
+            while (dirent* entry = ::readdir(d)) {
+                std::string name {entry->d_name};
+                if (name.size() > 5 && name.compare(name.size() - 5, 5, ".bcws") == 0) {
+                    load(this->directory + name);
+                }
+            }
+            ::closedir(d);
+        }
+
+        Warm_start_library(Warm_start_library const&) = delete;
+        Warm_start_library& operator=(Warm_start_library const&) = delete;
+
+        std::string const& model_version() const { return version; }
+
+        void save(Spin_up_key const& key, Cache_key const& model, Snapshot const& snapshot)
+        {
+            if (!directory.empty()) write(key, model, snapshot);
+            std::lock_guard<std::mutex> lock {mutex};
+            snapshots[index(key, model)][snapshot.driver_row] = snapshot;
+        }
+
+        /**
+         * Finds the snapshot with the latest row not beyond `row` whose
+         * drivers match `drivers`.  Returns false if there is none.
+         */
+        bool find_nearest(Spin_up_key const& key, Cache_key const& model,
+                          System_drivers const& drivers, size_t row, Snapshot& found) const
+        {
+            std::vector<Snapshot> candidates;
+            {
+                std::lock_guard<std::mutex> lock {mutex};
+                auto it = snapshots.find(index(key, model));
+                if (it == snapshots.end()) return false;
+                for (auto s = it->second.upper_bound(row); s != it->second.begin();) {
+                    candidates.push_back((--s)->second);  // latest first
+                }
+            }
+            size_t const rows {drivers.empty() ? 0 : drivers.begin()->second.size()};
+            for (auto const& s : candidates) {
+                if (s.driver_row < rows &&
+                    fingerprint(driver_rows(drivers, 0, s.driver_row)) == s.drivers_prefix) {
+                    found = s;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // The number of snapshots held.
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            size_t n {0};
+            for (auto const& item : snapshots) n += item.second.size();
+            return n;
+        }
+
+       private:
+        static std::string magic() { return "BCWARM01"; }
+
+        static std::string index(Spin_up_key const& key, Cache_key const& model)
+        {
+            return std::to_string(key.site.size()) + ":" + key.site +
+                   std::to_string(key.weather.size()) + ":" + key.weather + model.to_string();
+        }
+
+        static void put(std::ofstream& out, std::uint64_t n)
+        {
+            out.write(reinterpret_cast<char const*>(&n), sizeof n);
+        }
+        static void put(std::ofstream& out, double x)
+        {
+            out.write(reinterpret_cast<char const*>(&x), sizeof x);
+        }
+        static void put(std::ofstream& out, std::string const& s)
+        {
+            put(out, std::uint64_t {s.size()});
+            out.write(s.data(), s.size());
+        }
+
+        template <typename T>
+        static T get(std::ifstream& in)
+        {
+            T value {};
+            in.read(reinterpret_cast<char*>(&value), sizeof value);
+            return value;
+        }
+        static std::string get_string(std::ifstream& in)
+        {
+            std::uint64_t size {get<std::uint64_t>(in)};
+            if (!in || size > (1 << 20)) return "";
+            std::string s(size, '\0');
+            in.read(&s[0], size);
+            return s;
+        }
+
+        // Written to a temporary file and renamed, like the files of a
+        // Simulation_cache.
+        void write(Spin_up_key const& key, Cache_key const& model, Snapshot const& snapshot) const
+        {
+            Cache_key const name {Key_builder{}
+                                      .add(index(key, model))
+                                      .add(std::uint64_t {snapshot.driver_row})
+                                      .key()};
+            std::string const final_path {directory + name.to_string() + ".bcws"};
+            static std::atomic<unsigned> serial {0};
+            std::string const temporary_path {
+                final_path + "." + std::to_string(::getpid()) + "." + std::to_string(serial++)};
+            {
+                std::ofstream out {temporary_path, std::ios::binary};
+                put(out, magic());
+                put(out, key.site);
+                put(out, key.weather);
+                put(out, model.high);
+                put(out, model.low);
+                put(out, std::uint64_t {snapshot.driver_row});
+                put(out, snapshot.drivers_prefix.high);
+                put(out, snapshot.drivers_prefix.low);
+                put(out, std::uint64_t {snapshot.differential_quantities.size()});
+                for (auto const& item : snapshot.differential_quantities) {
+                    put(out, item.first);
+                    put(out, item.second);
+                }
+                if (!out) {
+                    throw std::runtime_error(
+                        "Warm_start_library: can't write \"" + temporary_path + "\".");
+                }
+            }
+            if (std::rename(temporary_path.c_str(), final_path.c_str()) != 0) {
+                std::remove(temporary_path.c_str());
+                throw std::runtime_error(
+                    "Warm_start_library: can't rename \"" + temporary_path + "\".");
+            }
+        }
+
+        // A file that can't be read is skipped.
+        void load(std::string const& path)
+        {
+            std::ifstream in {path, std::ios::binary};
+            if (get_string(in) != magic()) return;
+
+            Spin_up_key key;
+            key.site = get_string(in);
+            key.weather = get_string(in);
+            Cache_key model;
+            model.high = get<std::uint64_t>(in);
+            model.low = get<std::uint64_t>(in);
+
+            Snapshot snapshot;
+            snapshot.driver_row = get<std::uint64_t>(in);
+            snapshot.drivers_prefix.high = get<std::uint64_t>(in);
+            snapshot.drivers_prefix.low = get<std::uint64_t>(in);
+            std::uint64_t n {get<std::uint64_t>(in)};
+            for (std::uint64_t i {0}; in && i < n; ++i) {
+                std::string name {get_string(in)};
+                snapshot.differential_quantities[name] = get<double>(in);
+            }
+            if (!in) return;
+            snapshots[index(key, model)][snapshot.driver_row] = snapshot;
+        }
+
+        std::string directory;
+        std::string const version;
+
+        mutable std::mutex mutex;  // guards snapshots
+        std::map<std::string, std::map<size_t, Snapshot>> snapshots;
+    };
+
+    struct Warm_start_run {
+        Simulation_result result;  // rows first_row onward
+        size_t first_row;
+        size_t start_row;          // the row integration started from
+        size_t rows_integrated;
+        bool warm;                 // whether a snapshot was used
+    };
+
+    /**
+     * Runs `spec`, returning the rows from `first_row` on.  Integration
+     * starts from the latest usable snapshot in `library` at or before
+     * `first_row` (or from the beginning if there is none), and a
+     * snapshot is saved at each row in `save_rows` that the run passes
+     * (including the last row).  Rows of the result correspond to rows
+     * of the drivers, so `spec.output_step_size` must be 1.
+     */
+    inline Warm_start_run run_with_warm_start(Warm_start_library& library,
+                                              Spin_up_key const& key,
+                                              Sweep_specification const& spec,
+                                              size_t first_row = 0,
+                                              std::vector<size_t> save_rows = {})
+    {
+        if (spec.drivers.empty()) {
+            throw std::invalid_argument("run_with_warm_start: there are no drivers.");
+        }
+        size_t const rows {spec.drivers.begin()->second.size()};
+        if (first_row >= rows) {
+            throw std::out_of_range(
+                "\"first_row\" was given as " + std::to_string(first_row) +
+                ", but the drivers have only " + std::to_string(rows) + " rows.\n");
+        }
+        if (spec.output_step_size != 1) {
+            throw std::invalid_argument(
+                "run_with_warm_start: \"output_step_size\" was given as " +
+                std::to_string(spec.output_step_size) + ", but it must be 1.\n");
+        }
+        Cache_key const model {spin_up_model_key(spec, library.model_version())};
+
+        Warm_start_run run {{}, first_row, 0, 0, false};
+        State state {spec.initial_state};
+        Snapshot snapshot;
+        if (library.find_nearest(key, model, spec.drivers, first_row, snapshot)) {
+            run.start_row = snapshot.driver_row;
+            run.warm = true;
+            for (auto const& item : snapshot.differential_quantities) state[item.first] = item.second;
+        }
+
+        // Integrate in segments ending at each row to be saved.
+        std::sort(save_rows.begin(), save_rows.end());
+        save_rows.erase(std::unique(save_rows.begin(), save_rows.end()), save_rows.end());
+        std::vector<size_t> ends;
+        for (size_t r : save_rows) {
+            if (r > run.start_row && r < rows - 1) ends.push_back(r);
+        }
+        ends.push_back(rows - 1);
+
+        size_t segment_start {run.start_row};
+        for (size_t segment_end : ends) {
+            Idempotent_simulator sim {
+                state, spec.parameters, driver_rows(spec.drivers, segment_start, segment_end),
+                spec.direct_modules, spec.differential_modules,
+                spec.ode_solver_name, spec.output_step_size,
+                spec.adaptive_rel_error_tol, spec.adaptive_abs_error_tol,
+                spec.adaptive_max_steps};
+            Simulation_result segment {sim.run_simulation()};
+            run.rows_integrated += segment_end - segment_start;
+
+            // Keep the rows wanted, leaving out each segment's first row
+            // (the last of the previous segment) after the first.
+            size_t const skip {segment_start == run.start_row ? 0 : size_t {1}};
+            for (auto& item : segment) {
+                auto& column = run.result[item.first];
+                for (size_t i {skip}; i < item.second.size(); ++i) {
+                    if (segment_start + i >= first_row) column.push_back(item.second[i]);
+                }
+            }
+
+            for (auto const& item : spec.initial_state) {
+                state[item.first] = segment.at(item.first).back();
+            }
+            bool const save_here {
+                segment_end != rows - 1 ||
+                std::binary_search(save_rows.begin(), save_rows.end(), segment_end)};
+            if (save_here && segment_end > run.start_row) {
+                library.save(key, model,
+                             Snapshot {segment_end,
+                                       fingerprint(driver_rows(spec.drivers, 0, segment_end)),
+                                       state});
+            }
+            segment_start = segment_end;
+        }
+        return run;
+    }
+}
+
+#endif